@@ -0,0 +1,96 @@
+// Times the dipolar field by FFT against the direct sum over pairs on
+// cubes of side L, with the largest difference between them, to show the
+// N log N against N^2 scaling. The direct sum is skipped on the largest
+// lattices.
+//
+// Usage: dipolar [repeats] [largest direct sites]
+#include "../include/all_hamils.hpp"
+#include "../include/dipolar.hpp"
+#include "../include/rng.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+
+    // The field of every spin from every other, pair by pair
+    void direct_field(const std::vector<double> &r,
+                      const std::valarray<double> &s,
+                      std::valarray<double> &h)
+    {
+        const int n = r.size() / 3;
+        h = 0;
+        for(int i = 0; i < n; i++)
+            for(int j = 0; j < n; j++)
+            {
+                if(i == j)
+                    continue;
+                double d[3], r2 = 0, sd = 0;
+                for(int a = 0; a < 3; a++)
+                {
+                    d[a] = r[3*i + a] - r[3*j + a];
+                    r2 += d[a]*d[a];
+                    sd += s[a*n + j]*d[a];
+                }
+                const double r3 = r2*std::sqrt(r2);
+                for(int a = 0; a < 3; a++)
+                    h[a*n + i] += (s[a*n + j] - 3*sd*d[a]/r2) / r3;
+            }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = (argc > 1) ? std::atoi(argv[1]) : 5;
+    int largest_direct = (argc > 2) ? std::atoi(argv[2]) : 8000;
+
+    std::cout << "L sites fft_ms direct_ms speedup max_diff" << std::endl;
+    hmc::UniformRNG rng(100000, 1);
+    for(int L : {4, 8, 16, 20, 32, 64})
+    {
+        const int sites = L*L*L;
+        std::valarray<double> angles(2*sites);
+        for(int i = 0; i < 2*sites; i++)
+            angles[i] = 2 * M_PI * rng.gen();
+        const std::valarray<double> spins = hmc::spin_vectors(angles);
+        hmc::HeisenbergSystem system(std::vector<int>(3, L));
+        const std::vector<double> r = system.positions();
+
+        hmc::DipolarField dipoles(r);
+        std::valarray<double> h(3*sites), h_direct(3*sites);
+        const int n = sites;
+        double t_fft = time_calls([&]() {
+            dipoles.field(&spins[0], &spins[n], &spins[2*n],
+                          &h[0], &h[n], &h[2*n]);
+        }, repeats);
+        std::cout << L << " " << sites << " " << 1e3 * t_fft;
+        if(sites <= largest_direct)
+        {
+            double t_direct = time_calls([&]() {
+                direct_field(r, spins, h_direct);
+            }, 1);
+            std::cout << " " << 1e3 * t_direct << " " << t_direct / t_fft
+                      << " " << std::abs(h - h_direct).max();
+        }
+        else
+        {
+            std::cout << " - - -";
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,97 @@
+// Compares the effective sample size per gradient call of the slice and
+// multinomial NUTS variants on a Gaussian with a spread of scales.
+//
+// Usage: nuts_variants [samples] [dimension] [eps]
+#include "../include/hmc.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <valarray>
+#include <vector>
+
+namespace
+{
+    // Effective sample size of one coordinate, summing the autocorrelation
+    // over pairs of lags until a pair is negative
+    double ess(const std::vector<double> &x)
+    {
+        const int n = x.size();
+        double mean = 0;
+        for(int i = 0; i < n; i++)
+            mean += x[i];
+        mean /= n;
+
+        auto autocov = [&](const int lag)
+        {
+            double c = 0;
+            for(int i = 0; i + lag < n; i++)
+                c += (x[i] - mean) * (x[i+lag] - mean);
+            return c / n;
+        };
+
+        double c0 = autocov(0);
+        double tau = -1;
+        for(int lag = 0; lag + 1 < n; lag += 2)
+        {
+            double pair = (autocov(lag) + autocov(lag+1)) / c0;
+            if(pair < 0)
+                break;
+            tau += 2 * pair;
+        }
+        return n / tau;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t samples = (argc > 1) ? std::atoi(argv[1]) : 20000;
+    int dim = (argc > 2) ? std::atoi(argv[2]) : 10;
+    double eps = (argc > 3) ? std::atof(argv[3]) : 0.2;
+
+    // Standard deviations from 1 up to dim
+    std::valarray<double> scale(dim);
+    for(int i = 0; i < dim; i++)
+        scale[i] = 1 + i;
+
+    long calls = 0;
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+        f = [&](std::valarray<double> &grad, const std::valarray<double> &x)
+        {
+            calls++;
+            grad = x / (scale*scale);
+            return 0.5 * (x*grad).sum();
+        };
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = [](const std::valarray<double> &x) { return x; };
+
+    std::cout << "variant grad_calls min_ess mean_ess min_ess_per_call"
+              << std::endl;
+    const char *names[] = {"slice", "multinomial"};
+    hmc::NutsVariant variants[] = {hmc::NutsVariant::slice,
+                                   hmc::NutsVariant::multinomial};
+    for(int v = 0; v < 2; v++)
+    {
+        hmc::NutsOptions options;
+        options.variant = variants[v];
+        hmc::ChainRNG rng(1, 0);
+        std::valarray<double> state(1.0, dim);
+        std::valarray<double> energy(samples);
+        calls = 0;
+        auto trace = hmc::nuts(energy, state, eps, samples, f, reduce, rng,
+                               hmc::Euclidean(), options);
+
+        double min_ess = samples, mean_ess = 0;
+        for(int i = 0; i < dim; i++)
+        {
+            std::vector<double> x(samples);
+            for(size_t s = 0; s < samples; s++)
+                x[s] = trace[s][i];
+            double e = ess(x);
+            min_ess = std::min(min_ess, e);
+            mean_ess += e / dim;
+        }
+        std::cout << names[v] << " " << calls << " " << min_ess << " "
+                  << mean_ess << " " << min_ess / calls << std::endl;
+    }
+}
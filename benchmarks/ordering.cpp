@@ -0,0 +1,88 @@
+// Times the exchange gradient of a 3D cubic lattice stored in the natural
+// order, with the first axis fastest, against the same lattice stored in
+// Morton and Hilbert order. The stencils are timed as the reference.
+//
+// Usage: ordering [max_side] [repeats]
+#include "../include/all_hamils.hpp"
+#include "../include/hamiltonian.hpp"
+#include "../include/lattice.hpp"
+#include "../include/rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+
+    // Nanoseconds per site of the energy and gradient of cartesian spins,
+    // given in the natural order
+    double time_gradient(const std::shared_ptr<hmc::HeisenbergSystem> &system,
+                         const std::valarray<double> &spins, const int repeats,
+                         double &energy)
+    {
+        hmc::CartesianHamiltonian<hmc::Exchange> exchange(system, hmc::Exchange(1));
+        const std::valarray<double> stored = system->from_built(spins);
+        std::valarray<double> grad(stored.size());
+        double t = time_calls([&]() {
+            energy = exchange(grad, stored);
+        }, repeats);
+        return 1e9 * t / system->spins();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int max_side = (argc > 1) ? std::atoi(argv[1]) : 128;
+    int repeats = (argc > 2) ? std::atoi(argv[2]) : 10;
+
+    std::cout << "L sites stencil_ns_per_site natural_ns_per_site"
+              << " morton_ns_per_site hilbert_ns_per_site max_diff" << std::endl;
+    hmc::UniformRNG rng(100000, 1);
+    for(int L = 16; L <= max_side; L *= 2)
+    {
+        const int sites = L*L*L;
+        std::valarray<double> angles(2*sites);
+        for(int i = 0; i < 2*sites; i++)
+            angles[i] = 2 * M_PI * rng.gen();
+        const std::valarray<double> spins = hmc::spin_vectors(angles);
+
+        const hmc::Lattice natural = hmc::rectangular_lattice({L, L, L});
+        std::shared_ptr<hmc::HeisenbergSystem> systems[4] = {
+            std::make_shared<hmc::HeisenbergSystem>(std::vector<int>{L, L, L}),
+            std::make_shared<hmc::HeisenbergSystem>(
+                std::make_shared<const hmc::Lattice>(natural)),
+            std::make_shared<hmc::HeisenbergSystem>(
+                std::make_shared<const hmc::Lattice>(
+                    natural.permuted(hmc::morton_order(natural)))),
+            std::make_shared<hmc::HeisenbergSystem>(
+                std::make_shared<const hmc::Lattice>(
+                    natural.permuted(hmc::hilbert_order(natural))))
+        };
+
+        std::cout << L << " " << sites;
+        double reference = 0, diff = 0;
+        for(int k = 0; k < 4; k++)
+        {
+            double energy;
+            std::cout << " " << time_gradient(systems[k], spins, repeats, energy);
+            if(k == 0)
+                reference = energy;
+            diff = std::max(diff, std::abs(energy - reference) / sites);
+        }
+        std::cout << " " << diff << std::endl;
+    }
+}
@@ -0,0 +1,76 @@
+// Strong scaling of one large lattice over a SlabPool: for each number of
+// threads, the time of a cartesian energy and gradient and of a whole
+// RATTLE step, with the speedup and parallel efficiency against the
+// calling thread alone.
+//
+// Usage: parallel [L] [max threads] [repeats] [pin]
+#include "../include/hamiltonian.hpp"
+#include "../include/hmc.hpp"
+#include "../include/rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int L = (argc > 1) ? std::atoi(argv[1]) : 128;
+    int max_threads = (argc > 2) ? std::atoi(argv[2])
+                                 : std::thread::hardware_concurrency();
+    int repeats = (argc > 3) ? std::atoi(argv[3]) : 20;
+    bool pin = (argc > 4) && std::atoi(argv[4]);
+
+    const int sites = L*L*L;
+    hmc::UniformRNG rng(100000, 1);
+    std::valarray<double> angles(2*sites);
+    for(int i = 0; i < 2*sites; i++)
+        angles[i] = 2 * M_PI * rng.gen();
+    const std::valarray<double> spins = hmc::spin_vectors(angles);
+
+    std::cout << "L sites threads grad_ms step_ms speedup efficiency"
+              << std::endl;
+    double serial = 0;
+    for(int threads = 1; threads <= std::max(max_threads, 1); threads *= 2)
+    {
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem(std::vector<int>(3, L)));
+        system->set_pool(std::make_shared<hmc::SlabPool>(threads, pin));
+        hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> hamiltonian(
+            system, hmc::Exchange(1), hmc::Zeeman(0.5));
+        const hmc::Sphere sphere(system->pool());
+
+        std::valarray<double> grad(3*sites), new_state(3*sites);
+        std::valarray<double> velocity(0.0, 3*sites), new_velocity(3*sites);
+        double t_grad = time_calls([&]() {
+            hamiltonian(grad, spins);
+        }, repeats);
+        double t_step = time_calls([&]() {
+            sphere.step(new_state, new_velocity, grad, spins, velocity,
+                        hamiltonian, 0.01);
+        }, repeats);
+        if(threads == 1)
+            serial = t_step;
+        std::cout << L << " " << sites << " " << threads
+                  << " " << 1e3 * t_grad << " " << 1e3 * t_step
+                  << " " << serial / t_step
+                  << " " << serial / t_step / threads << std::endl;
+    }
+}
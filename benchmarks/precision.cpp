@@ -0,0 +1,109 @@
+// Compares the double and mixed precision Hamiltonians on 1D, 2D and 3D
+// lattices: the time per site of an energy and gradient, the largest error
+// of the gradient and the relative error of the energy, for the angle and
+// cartesian forms. Then compares a short cartesian NUTS run of each.
+//
+// Usage: precision [repeats] [samples]
+#include "../include/hamiltonian.hpp"
+#include "../include/rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+
+    // Times both Hamiltonians on state and prints the times and errors
+    template <class Full, class Mixed>
+    void compare(const Full &full, const Mixed &mixed,
+                 const std::valarray<double> &state, const int sites,
+                 const int repeats)
+    {
+        std::valarray<double> g_full(state.size()), g_mixed(state.size());
+        double e_full = 0, e_mixed = 0;
+        double t_full = time_calls([&]() {
+            e_full = full(g_full, state);
+        }, repeats);
+        double t_mixed = time_calls([&]() {
+            e_mixed = mixed(g_mixed, state);
+        }, repeats);
+        std::cout << " " << 1e9 * t_full / sites
+                  << " " << 1e9 * t_mixed / sites
+                  << " " << t_full / t_mixed
+                  << " " << std::abs(g_full - g_mixed).max()
+                  << " " << std::abs((e_full - e_mixed) / e_full);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int repeats = (argc > 1) ? std::atoi(argv[1]) : 10;
+    int samples = (argc > 2) ? std::atoi(argv[2]) : 2000;
+
+    std::cout << "dim L sites"
+              << " angle_double_ns angle_mixed_ns angle_speedup"
+              << " angle_grad_err angle_energy_err"
+              << " cart_double_ns cart_mixed_ns cart_speedup"
+              << " cart_grad_err cart_energy_err" << std::endl;
+    hmc::UniformRNG rng(100000, 1);
+    const int sides[3][3] = {{64, 4096, 262144}, {8, 64, 512}, {3, 16, 64}};
+    for(int d = 1; d <= 3; d++)
+    {
+        for(int L : sides[d-1])
+        {
+            int sites = std::pow(L, d);
+            std::valarray<double> angles(2*sites);
+            for(int i = 0; i < 2*sites; i++)
+                angles[i] = 2 * M_PI * rng.gen();
+            std::valarray<double> spins = hmc::spin_vectors(angles);
+
+            std::shared_ptr<hmc::HeisenbergSystem> system(
+                new hmc::HeisenbergSystem(std::vector<int>(d, L)));
+            std::cout << d << " " << L << " " << sites;
+            compare(hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman>(
+                        system, hmc::Exchange(1), hmc::Zeeman(0.5)),
+                    hmc::MixedHamiltonian<hmc::Exchange, hmc::Zeeman>(
+                        system, hmc::Exchange(1), hmc::Zeeman(0.5)),
+                    angles, sites, repeats);
+            compare(hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman>(
+                        system, hmc::Exchange(1), hmc::Zeeman(0.5)),
+                    hmc::MixedCartesianHamiltonian<hmc::Exchange, hmc::Zeeman>(
+                        system, hmc::Exchange(1), hmc::Zeeman(0.5)),
+                    spins, sites, repeats);
+            std::cout << std::endl;
+        }
+    }
+
+    // The averages of a chain should agree within their errors
+    std::cout << std::endl << "precision energy energy_error"
+              << " magnetisation ess_per_second" << std::endl;
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    for(hmc::Precision p : {hmc::Precision::full, hmc::Precision::mixed})
+    {
+        std::valarray<double> none;
+        hmc::ModelResult res = hmc::heisenberg_model_cartesian(
+            none, none, {16, 16, 16}, options, 1.0, 0.1, samples, 3, 0,
+            hmc::CheckpointOptions(), p);
+        const hmc::Observables &obs = res.observables;
+        std::cout << (p == hmc::Precision::full ? "double" : "mixed")
+                  << " " << obs.energy << " " << obs.energy_error
+                  << " " << obs.abs_magnetisation
+                  << " " << obs.energy_ess / res.seconds << std::endl;
+    }
+}
@@ -0,0 +1,98 @@
+// Many replicas of one small lattice: the time per replica of an energy
+// and gradient found for all replicas at once by a ReplicaHamiltonian,
+// against the angle Hamiltonian of each replica called in turn, and the
+// same for whole HMC samples from replica_hmc and from separate chains.
+//
+// Usage: replicas [L] [max replicas] [repeats]
+#include "../include/replicas.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int L = (argc > 1) ? std::atoi(argv[1]) : 6;
+    int max_replicas = (argc > 2) ? std::atoi(argv[2]) : 64;
+    int repeats = (argc > 3) ? std::atoi(argv[3]) : 200;
+
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem(std::vector<int>(3, L)));
+    const int n = system->spins();
+    hmc::UniformRNG rng(100000, 1);
+    auto reduce = [system](const std::valarray<double> &state) {
+        std::valarray<double> res = { system->magnetisation(state) };
+        return res;
+    };
+
+    std::cout << "L replicas separate_grad_us batched_grad_us"
+              << " separate_sample_us batched_sample_us speedup" << std::endl;
+    for(int K = 1; K <= max_replicas; K *= 2)
+    {
+        std::vector<hmc::HamiltonianOptions> options(K);
+        std::vector<std::valarray<double> > states(K, std::valarray<double>(2*n));
+        for(int k = 0; k < K; k++)
+        {
+            options[k].J = 1 + 0.01*k;
+            options[k].H = 0.1;
+            for(int i = 0; i < 2*n; i++)
+                states[k][i] = 2 * M_PI * rng.gen();
+        }
+
+        // Each replica on its own, through the usual angle Hamiltonian
+        std::vector<std::function<double(std::valarray<double>&,
+                                         const std::valarray<double>&)> > single;
+        for(int k = 0; k < K; k++)
+            single.push_back(hmc::gen_total_energy_grad(options[k], system));
+        std::valarray<double> grad(2*n);
+        double t_separate = time_calls([&]() {
+            for(int k = 0; k < K; k++)
+                single[k](grad, states[k]);
+        }, repeats);
+
+        hmc::ReplicaHamiltonian hamiltonian(system, options);
+        const std::valarray<double> state = hamiltonian.pack(states);
+        std::valarray<double> lanes_grad(state.size()), energy(K);
+        double t_batched = time_calls([&]() {
+            hamiltonian(lanes_grad, state, &energy[0]);
+        }, repeats);
+
+        // Whole samples of ten leapfrog steps
+        const int samples = std::max(1, repeats / 20);
+        double t_chains = time_calls([&]() {
+            for(int k = 0; k < K; k++)
+            {
+                hmc::ChainRNG chain_rng(1, k);
+                std::valarray<double> e(samples), s(states[k]);
+                hmc::hmc(e, s, 0.05, 10, samples, single[k], reduce, chain_rng);
+            }
+        }, 3) / samples;
+        double t_replicas = time_calls([&]() {
+            hmc::replica_hmc(states, 0.05, 10, samples, hamiltonian, reduce, 1);
+        }, 3) / samples;
+
+        std::cout << L << " " << K
+                  << " " << 1e6 * t_separate / K << " " << 1e6 * t_batched / K
+                  << " " << 1e6 * t_chains / K << " " << 1e6 * t_replicas / K
+                  << " " << t_chains / t_replicas << std::endl;
+    }
+}
@@ -0,0 +1,170 @@
+// Times the exchange gradient of HeisenbergSystem against the std::gslice
+// neighbour sums it used to be built from, and against the neighbour table
+// of the same lattice.
+//
+// Usage: stencil [max_side] [repeats]
+#include "../include/all_hamils.hpp"
+#include "../include/lattice.hpp"
+#include "../include/rng.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // The previous exchange gradient, kept as the reference
+    class GsliceExchange
+    {
+    private:
+        int halfsize, dim;
+        std::vector<std::gslice> large_slice, small_slice;
+        std::vector<std::gslice> opp_large_slice, opp_small_slice;
+        std::slice tslice, pslice;
+        std::valarray<double> small_temp, cos_the, sin_the, cos_phi, sin_phi;
+
+        void neighbour_sum(const std::valarray<double> &comp)
+        {
+            small_temp = 0;
+            for(int i = 0; i < dim; i++)
+            {
+                small_temp[opp_large_slice[i]] += comp[large_slice[i]];
+                small_temp[opp_small_slice[i]] += comp[small_slice[i]];
+                small_temp[large_slice[i]] += comp[opp_large_slice[i]];
+                small_temp[small_slice[i]] += comp[opp_small_slice[i]];
+            }
+        }
+
+    public:
+        GsliceExchange(const int size, const int d) : dim(d)
+        {
+            halfsize = size / 2;
+            size_t hs = halfsize;
+            size_t s = std::round(std::pow(halfsize, 1./float(dim)));
+            size_t s2 = s*s;
+            tslice = std::slice(0, halfsize, 1);
+            pslice = std::slice(halfsize, halfsize, 1);
+            small_temp.resize(halfsize);
+            large_slice.resize(dim);
+            small_slice.resize(dim);
+            opp_large_slice.resize(dim);
+            opp_small_slice.resize(dim);
+            if(dim == 2)
+            {
+                large_slice[0] = std::gslice(0, {s, s-1}, {s, 1});
+                opp_large_slice[0] = std::gslice(1, {s, s-1}, {s, 1});
+                opp_small_slice[0] = std::gslice(0, {s}, {s});
+                small_slice[0] = std::gslice(s-1, {s}, {s});
+                large_slice[1] = std::gslice(0, {s2-s}, {1});
+                opp_large_slice[1] = std::gslice(s, {s2-s}, {1});
+                small_slice[1] = std::gslice(s2-s, {s}, {1});
+                opp_small_slice[1] = std::gslice(0, {s}, {1});
+            }
+            else
+            {
+                large_slice[0] = std::gslice(0, {s2, s-1}, {s, 1});
+                opp_large_slice[0] = std::gslice(1, {s2, s-1}, {s, 1});
+                opp_small_slice[0] = std::gslice(0, {s2}, {s});
+                small_slice[0] = std::gslice(s-1, {s2}, {s});
+                large_slice[1] = std::gslice(0, {s, s2-s}, {s2, 1});
+                opp_large_slice[1] = std::gslice(s, {s, s2-s}, {s2, 1});
+                opp_small_slice[1] = std::gslice(0, {s, s}, {s2, 1});
+                small_slice[1] = std::gslice(s2-s, {s, s}, {s2, 1});
+                large_slice[2] = std::gslice(0, {hs-s2}, {1});
+                opp_large_slice[2] = std::gslice(s2, {hs-s2}, {1});
+                small_slice[2] = std::gslice(hs-s2, {s2}, {1});
+                opp_small_slice[2] = std::gslice(0, {s2}, {1});
+            }
+        }
+
+        void calc_trig(const std::valarray<double> &data)
+        {
+            cos_the = cos(data[tslice]);
+            sin_the = sin(data[tslice]);
+            cos_phi = cos(data[pslice]);
+            sin_phi = sin(data[pslice]);
+        }
+
+        void grad(std::valarray<double> &grad_out, const double J)
+        {
+            grad_out = 0;
+
+            neighbour_sum(cos_phi*sin_the);
+            grad_out[pslice] -= J*sin_phi*sin_the*small_temp;
+            grad_out[tslice] += J*cos_phi*cos_the*small_temp;
+
+            neighbour_sum(sin_phi*sin_the);
+            grad_out[pslice] += J*cos_phi*sin_the*small_temp;
+            grad_out[tslice] += J*sin_phi*cos_the*small_temp;
+
+            neighbour_sum(cos_the);
+            grad_out[tslice] -= J*sin_the*small_temp;
+        }
+    };
+
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int max_side = (argc > 1) ? std::atoi(argv[1]) : 256;
+    int repeats = (argc > 2) ? std::atoi(argv[2]) : 10;
+
+    std::cout << "dim L sites gslice_ns_per_site stencil_ns_per_site speedup"
+              << " table_ns_per_site max_diff" << std::endl;
+    hmc::UniformRNG rng(100000, 1);
+    for(int d = 2; d <= 3; d++)
+    {
+        // A 256^3 lattice needs several GB of work arrays
+        int top = (d == 3) ? std::min(max_side, 128) : max_side;
+        for(int L = 16; L <= top; L *= 2)
+        {
+            int sites = std::pow(L, d);
+            std::valarray<double> state(2*sites);
+            for(int i = 0; i < 2*sites; i++)
+                state[i] = 2 * M_PI * rng.gen();
+
+            GsliceExchange reference(2*sites, d);
+            hmc::HeisenbergSystem system(2*sites, d);
+            hmc::HeisenbergSystem table(std::make_shared<const hmc::Lattice>(
+                hmc::rectangular_lattice(std::vector<int>(d, L))));
+            std::valarray<double> g_ref(2*sites), g_new(2*sites), g_table(2*sites);
+
+            // The trig functions are shared so only the stencils are timed
+            reference.calc_trig(state);
+            system.calc_trig(state);
+            table.calc_trig(state);
+            double t_ref = time_calls([&]() {
+                reference.grad(g_ref, 1.0);
+            }, repeats);
+            double t_new = time_calls([&]() {
+                g_new = 0;
+                system.exchange_grad(g_new, 1.0);
+            }, repeats);
+            double t_table = time_calls([&]() {
+                g_table = 0;
+                table.exchange_grad(g_table, 1.0);
+            }, repeats);
+
+            double diff = std::max(std::abs(g_ref - g_new).max(),
+                                   std::abs(g_ref - g_table).max());
+            std::cout << d << " " << L << " " << sites << " "
+                      << 1e9 * t_ref / sites << " "
+                      << 1e9 * t_new / sites << " "
+                      << t_ref / t_new << " "
+                      << 1e9 * t_table / sites << " " << diff << std::endl;
+        }
+    }
+}
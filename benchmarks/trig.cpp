@@ -0,0 +1,68 @@
+// Times HeisenbergSystem::calc_trig, which fills the four trig arrays in
+// one pass with sincos_array, against the four valarray expressions it
+// used to be, and prints the largest difference between them.
+//
+// Usage: trig [max_spins] [repeats]
+#include "../include/all_hamils.hpp"
+#include "../include/rng.hpp"
+#include "../include/trig.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    // Seconds per call of f, averaged over repeats
+    template <class F>
+    double time_calls(const F &f, const int repeats)
+    {
+        f();
+        auto start = std::chrono::steady_clock::now();
+        for(int r = 0; r < repeats; r++)
+            f();
+        std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+        return t.count() / repeats;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int max_spins = (argc > 1) ? std::atoi(argv[1]) : 1 << 22;
+    int repeats = (argc > 2) ? std::atoi(argv[2]) : 10;
+
+    std::cout << "isa " << hmc::sincos_isa() << std::endl;
+    std::cout << "spins valarray_ns_per_spin fused_ns_per_spin speedup max_diff"
+              << std::endl;
+    hmc::UniformRNG rng(100000, 1);
+    for(int n = 1 << 10; n <= max_spins; n *= 4)
+    {
+        std::valarray<double> state(2*n);
+        for(int i = 0; i < 2*n; i++)
+            state[i] = 2 * M_PI * rng.gen();
+        std::slice tslice(0, n, 1), pslice(n, n, 1);
+
+        const std::valarray<double> &data = state;
+        std::valarray<double> cos_the, sin_the, cos_phi, sin_phi;
+        double t_ref = time_calls([&]() {
+            cos_the = cos(data[tslice]);
+            sin_the = sin(data[tslice]);
+            cos_phi = cos(data[pslice]);
+            sin_phi = sin(data[pslice]);
+        }, repeats);
+
+        hmc::HeisenbergSystem system(std::vector<int>{n});
+        double t_new = time_calls([&]() {
+            system.calc_trig(state);
+        }, repeats);
+
+        double diff = std::max(
+            std::max(std::abs(cos_the - system.cos_thetas()).max(),
+                     std::abs(sin_the - system.sin_thetas()).max()),
+            std::max(std::abs(cos_phi - system.cos_phis()).max(),
+                     std::abs(sin_phi - system.sin_phis()).max()));
+        std::cout << n << " " << 1e9 * t_ref / n << " " << 1e9 * t_new / n
+                  << " " << t_ref / t_new << " " << diff << std::endl;
+    }
+}
@@ -0,0 +1,238 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+#include "./metric.hpp"
+#include <iosfwd>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Which metric the warmup estimates.
+    ///
+    /// diagonal estimates the variance of each coordinate. low_rank adds
+    /// the strongest correlations between the scaled coordinates. Both
+    /// need the Metric geometry.
+    ///////////////////////////////////////////////////////////////////////////
+    enum class MetricAdaptation { none, diagonal, low_rank };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Settings for adapting the step size during warmup.
+    ///
+    /// The step size defaults are those of Hoffman and Gelman (2014). If a
+    /// metric is adapted the warmup is split as in Stan: a first buffer
+    /// adapting only the step size, windows doubling in length from
+    /// base_window at the end of each of which the metric is estimated
+    /// from the window and the step size adaptation restarts, and a final
+    /// buffer adapting only the step size. Short warmups shrink the
+    /// buffers to 15% and 10% of the iterations.
+    ///////////////////////////////////////////////////////////////////////////
+    struct AdaptOptions {
+        /// Number of warmup iterations, none of which are kept
+        int warmup;
+        /// Mean acceptance statistic to aim for
+        double target_accept;
+        /// How strongly the step size is pulled towards ten times the
+        /// initial step
+        double gamma;
+        /// Offset of the iteration count, which damps the first iterations
+        double t0;
+        /// Power with which the weight of each iteration decays
+        double kappa;
+        /// The metric to estimate
+        MetricAdaptation metric;
+        /// Most correlated directions kept by the low_rank metric
+        int rank;
+        /// Iterations before the first window and after the last
+        int init_buffer, term_buffer;
+        /// Length of the first window
+        int base_window;
+
+        AdaptOptions()
+            : warmup( 1000 ), target_accept( 0.8 ), gamma( 0.05 ),
+              t0( 10 ), kappa( 0.75 ), metric( MetricAdaptation::none ),
+              rank( 4 ), init_buffer( 75 ), term_buffer( 50 ),
+              base_window( 25 ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The outcome of a warmup phase.
+    ///////////////////////////////////////////////////////////////////////////
+    struct WarmupResult {
+        /// Step size to sample with
+        double eps;
+        /// Acceptance statistic of each warmup iteration
+        std::valarray<double> acceptance;
+        /// Step size used by each warmup iteration
+        std::valarray<double> step_size;
+        /// The metric to sample with, the identity unless sampling with the
+        /// Metric geometry
+        Metric metric;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Nesterov dual averaging of the log step size.
+    ///
+    /// Each update moves the step size so that the running mean of the
+    /// acceptance statistic approaches the target. The weighted average of
+    /// the iterates, which is much less noisy, is the step size kept for
+    /// sampling.
+    ///////////////////////////////////////////////////////////////////////////
+    class DualAveraging
+    {
+    private:
+        AdaptOptions options;
+        double mu, log_eps, log_eps_bar, h_bar;
+        int t;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param eps The initial step size
+        /// \param options The target and rates of the adaptation
+        ////////////////////////////////////////////////////////////////////////
+        DualAveraging( const double eps, const AdaptOptions &options );
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Adds the acceptance statistic of an iteration.
+        ///
+        /// \param accept The acceptance statistic, treated as zero if it is
+        ///               not a number
+        /// \return The step size for the next iteration
+        ////////////////////////////////////////////////////////////////////////
+        double update( const double accept );
+
+        /// The averaged step size
+        double adapted() const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Starts the adaptation again from a new step size.
+        ///
+        /// Used when the metric changes, which changes the best step size.
+        ////////////////////////////////////////////////////////////////////////
+        void restart( const double eps );
+
+        /// Writes the state of the adaptation for a checkpoint
+        void save( std::ostream &out ) const;
+
+        /// Restores a state written by save
+        void load( std::istream &in );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Estimates a metric from the states of a warmup window.
+    ///
+    /// The variance of each coordinate is accumulated with Welford's
+    /// algorithm. For a low rank metric the states are also kept and the
+    /// leading eigenvectors of their correlation matrix are found by
+    /// subspace iteration, without forming the matrix.
+    ///////////////////////////////////////////////////////////////////////////
+    class MetricEstimator
+    {
+    private:
+        long n;
+        int rank;
+        std::valarray<double> mean, m2;
+        std::vector<std::valarray<double> > samples;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The size of the state
+        /// \param rank The number of correlated directions, zero for a
+        ///             diagonal metric
+        ////////////////////////////////////////////////////////////////////////
+        MetricEstimator( const size_t size, const int rank );
+
+        /// Adds a state of the chain
+        void add_sample( const std::valarray<double> &state );
+
+        /// Forgets every state
+        void restart();
+
+        /// Number of states since the last restart
+        long count() const {return n;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Sets metric from the states so far.
+        ///
+        /// The variances are shrunk towards a small value, as in Stan, so
+        /// short windows give a usable metric.
+        ////////////////////////////////////////////////////////////////////////
+        void estimate( Metric &metric ) const;
+
+        /// Writes the states so far for a checkpoint
+        void save( std::ostream &out ) const;
+
+        /// Restores the states written by save
+        void load( std::istream &in );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The whole of a warmup, one iteration at a time.
+    ///
+    /// Adapts the step size after every iteration and the metric at the end
+    /// of each window, as described for AdaptOptions. Keeping the schedule
+    /// in one object lets a warmup be checkpointed and resumed part way.
+    ///////////////////////////////////////////////////////////////////////////
+    class WindowedAdaptation
+    {
+    private:
+        AdaptOptions options;
+        bool adapt_metric;
+        int init, last, window, window_end, iteration;
+        double eps;
+        DualAveraging step_size;
+        MetricEstimator estimator;
+        WarmupResult res;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The size of the state
+        /// \param eps The initial step size
+        /// \param options The length and targets of the warmup
+        /// \param metric The metric to start from
+        ////////////////////////////////////////////////////////////////////////
+        WindowedAdaptation( const size_t size, const double eps,
+                            const AdaptOptions &options,
+                            const Metric &metric=Metric() );
+
+        /// The step size for the next iteration
+        double step() const {return eps;}
+
+        /// True once every warmup iteration has been added
+        bool done() const {return iteration >= options.warmup;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Adds an iteration taken with step().
+        ///
+        /// \param accept The acceptance statistic of the iteration
+        /// \param state The state of the chain after it
+        /// \return True if the metric has changed
+        ////////////////////////////////////////////////////////////////////////
+        bool update( const double accept, const std::valarray<double> &state );
+
+        /// The metric to take the next iteration with
+        const Metric& metric() const {return res.metric;}
+
+        /// The step size to sample with and the history so far
+        WarmupResult result() const;
+
+        /// Writes the progress of the warmup for a checkpoint
+        void save( std::ostream &out ) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Restores the progress written by save.
+        ///
+        /// Throws std::runtime_error if it was written for a warmup of a
+        /// different length.
+        ////////////////////////////////////////////////////////////////////////
+        void load( std::istream &in );
+    };
+}
+
+#endif
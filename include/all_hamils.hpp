@@ -2,90 +2,463 @@
 #define HAMIL_SHARE
 
 #include "hmc.hpp"
+#include "lattice.hpp"
+#include "parallel.hpp"
 #include <valarray>
 #include <vector>
+#include <memory>
 #include <functional>
 
 namespace hmc
 {
+    class DipolarField;
+
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Calculates the zeeman energy of a system.
+    /// \brief Lattice geometry and work arrays for a single Heisenberg system.
     ///
-    /// Calculates the standard zeeman energy \f$ H \sum_{i}
-    /// \mathbf{s}_i\f$ where \f$H =\f$ is actually the field strength
-    /// multiplied by the moment of an atom.
+    /// Holds the neighbour strides and the cached trigonometric functions of
+    /// the spin angles for one lattice. Each system is independent, so any
+    /// number of lattices (of different size or dimension) can be evaluated
+    /// in the same process. A single system is not safe to share between
+    /// threads; give each chain its own. A lattice too large for one core
+    /// can instead spread the work of its one system over a SlabPool.
     ///
-    /// \param H The field strength multiplied by the moment of an atom
+    /// Simple periodic lattices use stencils along each axis. Any other
+    /// lattice, such as a thin film with open surfaces or a bcc, fcc or
+    /// triangular lattice, is given by the neighbour table of a Lattice,
+    /// which systems can share.
     ///////////////////////////////////////////////////////////////////////////
-    double zeeman_energy(const double H);
+    class HeisenbergSystem
+    {
+    private:
+        int halfsize;
+        int dim;
+        /// Distance between neighbours along each axis
+        std::vector<int> stride;
+        /// Number of sites after which each axis wraps around
+        std::vector<int> period;
+        /// The neighbour table, if the stencils are not used
+        std::shared_ptr<const Lattice> lattice;
+        std::slice tslice, pslice;
+        std::valarray<double> small_temp, cos_the, sin_the, cos_phi, sin_phi;
+        std::valarray<double> spin_x, spin_y, spin_z;
+        std::valarray<double> field_x, field_y, field_z;
+        /// The threads sharing the sites, if any
+        std::shared_ptr<SlabPool> slabs;
+        /// The dipolar kernel and its field, made on first use
+        std::shared_ptr<DipolarField> dipoles;
+        std::valarray<double> dipole_x, dipole_y, dipole_z;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Sum of the neighbours of each site.
+        ///
+        /// Stores the sum of the neighbours of sites [begin, end) of comp
+        /// into out. If both is false only the previous neighbour along each
+        /// axis is included, which counts each bond once.
+        ////////////////////////////////////////////////////////////////////////
+        void neighbour_sum(const double *comp, double *out, const bool both,
+                           const int begin, const int end) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Neighbour field of the spins with the given components
+        ////////////////////////////////////////////////////////////////////////
+        void calc_field(const double *x, const double *y, const double *z);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Cartesian components of the spins from the last call to calc_trig
+        ////////////////////////////////////////////////////////////////////////
+        void calc_spins();
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Dipolar field of the spins with the given components
+        ////////////////////////////////////////////////////////////////////////
+        void calc_dipolar_field(const double *x, const double *y,
+                                const double *z);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Sizes the work arrays for a number of spins
+        ////////////////////////////////////////////////////////////////////////
+        void allocate(const int spins);
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The total size of the input array
+        /// \param dim The number of dimensions being worked in
+        ////////////////////////////////////////////////////////////////////////
+        HeisenbergSystem(const int size, const int dim);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor for a periodic rectangular lattice
+        ///
+        /// \param sides The number of sites along each axis, at least two
+        ////////////////////////////////////////////////////////////////////////
+        explicit HeisenbergSystem(const std::vector<int> &sides);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor for a lattice given by its neighbour table
+        ///
+        /// \param lattice The lattice, which may be shared with other systems
+        ////////////////////////////////////////////////////////////////////////
+        explicit HeisenbergSystem(const std::shared_ptr<const Lattice> &lattice);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Sets the strides used for multiplying by neighbours
+        ///
+        /// Sites are stored with the first axis fastest, so the neighbours
+        /// along axis d are a fixed stride apart and wrap within blocks of
+        /// the side length to the power d+1.
+        ///
+        /// \param size The total size of the input array
+        /// \param dim The number of dimensions being worked in
+        ////////////////////////////////////////////////////////////////////////
+        void set_slices(const int size, const int dim);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Sets the strides for a periodic rectangular lattice
+        ///
+        /// As set_slices but the sides need not be equal. Throws
+        /// std::invalid_argument if a side is shorter than two, which needs
+        /// a Lattice.
+        ///
+        /// \param sides The number of sites along each axis
+        ////////////////////////////////////////////////////////////////////////
+        void set_sides(const std::vector<int> &sides);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Shares the loops over the sites among threads.
+        ///
+        /// Every kernel of the system, and the Hamiltonians and geometries
+        /// built on it, then runs on the slabs of the pool. Sums are taken
+        /// in fixed blocks, so results do not depend on the number of
+        /// threads but differ in the last bits from those without a pool.
+        ///
+        /// \param pool The threads, or null to run on the calling thread
+        ////////////////////////////////////////////////////////////////////////
+        void set_pool(const std::shared_ptr<SlabPool> &pool);
+
+        /// The threads sharing the sites, or null
+        const std::shared_ptr<SlabPool>& pool() const {return slabs;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calls f(begin, end) over ranges covering every site.
+        ///
+        /// With a pool each thread takes its own slab, otherwise f is called
+        /// once for all of the sites.
+        ////////////////////////////////////////////////////////////////////////
+        template <class Function>
+        void for_sites(const Function &f) const
+        {
+            if(slabs)
+                slabs->run(halfsize, f);
+            else
+                f(0, halfsize);
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The sum of f(begin, end) over ranges covering every site.
+        ///
+        /// As for_sites, with the sums of the blocks added in order.
+        ////////////////////////////////////////////////////////////////////////
+        template <class Function>
+        double sum_sites(const Function &f) const
+        {
+            return slabs ? slabs->sum(halfsize, f) : f(0, halfsize);
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculate the cos and sin of the angles
+        ///
+        /// All four arrays are filled in one pass by sincos_array.
+        ///
+        /// \param data The valarray containing the angles
+        ////////////////////////////////////////////////////////////////////////
+        void calc_trig(const std::valarray<double> &data);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculates the zeeman energy of the system.
+        ///
+        /// Calculates the standard zeeman energy \f$ H \sum_{i}
+        /// \mathbf{s}_i\f$ where \f$H =\f$ is actually the field strength
+        /// multiplied by the moment of an atom. Uses the angles from the
+        /// last call to calc_trig.
+        ///
+        /// \param H The field strength multiplied by the moment of an atom
+        ////////////////////////////////////////////////////////////////////////
+        double zeeman_energy(const double H) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculates the gradient of the zeeman energy of the system.
+        ///
+        /// Calculates the gradient \f$\partial/\partial \theta\f$ and
+        /// \f$\partial/\partial \phi\f$ of the standard zeeman energy
+        /// \f$ H \sum_{i} \mathbf{s}_i\f$. Uses the angles from the last
+        /// call to calc_trig.
+        ///
+        /// \param grad_out Reference to the valarray where the output gradient
+        ///                 will be stored. The gradient is stored as the element
+        ///                 wise derivitive of data.
+        /// \param H The field strength multiplied by the moment of an atom
+        ////////////////////////////////////////////////////////////////////////
+        void zeeman_grad(std::valarray<double>& grad_out, const double H) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Zeeman energy and gradient in one call.
+        ///
+        /// Adds the gradient to grad_out and returns the energy.
+        ///
+        /// \param grad_out Reference to the valarray the gradient is added to
+        /// \param H The field strength multiplied by the moment of an atom
+        ////////////////////////////////////////////////////////////////////////
+        double zeeman_energy_grad(std::valarray<double>& grad_out,
+                                  const double H) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculates the exchange energy of the system.
+        ///
+        /// Calculates the standard Heisenberg exchange energy \f$\sum_{ij}
+        /// J_{ij} \mathbf{s}_i\cdot\mathbf{s}_j \f$ where \f$J_{ij} =\f$ -1
+        /// for neighbouring spins and 0 for other pairs. Uses the angles from
+        /// the last call to calc_trig.
+        ///
+        /// \param J Exchange constant
+        ////////////////////////////////////////////////////////////////////////
+        double exchange_energy(const double J);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculates the gradient of the exchange energy of the system.
+        ///
+        /// Calculates the gradient \f$\partial/\partial \theta\f$ and
+        /// \f$\partial/\partial \phi\f$ of the standard Heisenberg exchange
+        /// energy. Uses the angles from the last call to calc_trig.
+        ///
+        /// \param grad_out Reference to the valarray where the output gradient
+        ///                 will be stored. The gradient is stored as the element
+        ///                 wise derivitive of data.
+        /// \param J Exchange constant
+        ////////////////////////////////////////////////////////////////////////
+        void exchange_grad(std::valarray<double>& grad_out, const double J);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Exchange energy and gradient in one call.
+        ///
+        /// The gradient needs the full field of the neighbours of each spin,
+        /// \f$\mathbf{h}_i = \sum_j \mathbf{s}_j\f$, and the energy is
+        /// \f$-\frac{J}{2}\sum_i \mathbf{s}_i\cdot\mathbf{h}_i\f$, so it
+        /// comes at the cost of three sums. Adds the gradient to grad_out
+        /// and returns the energy.
+        ///
+        /// \param grad_out Reference to the valarray the gradient is added to
+        /// \param J Exchange constant
+        ////////////////////////////////////////////////////////////////////////
+        double exchange_energy_grad(std::valarray<double>& grad_out,
+                                    const double J);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculates the dipolar energy of the system.
+        ///
+        /// The energy \f$\frac{D}{2}\sum_{i\neq j} [\mathbf{s}_i\cdot
+        /// \mathbf{s}_j - 3(\mathbf{s}_i\cdot\hat{\mathbf{r}}_{ij})
+        /// (\mathbf{s}_j\cdot\hat{\mathbf{r}}_{ij})]/r_{ij}^3\f$ of every pair
+        /// of spins in the sample, by FFT; see DipolarField. The kernel is
+        /// built on the first call and kept for the rest. Uses the angles
+        /// from the last call to calc_trig.
+        ///
+        /// \param D Dipolar coupling
+        ////////////////////////////////////////////////////////////////////////
+        double dipolar_energy(const double D);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Dipolar energy and gradient in one call.
+        ///
+        /// Adds the gradient to grad_out and returns the energy.
+        ///
+        /// \param grad_out Reference to the valarray the gradient is added to
+        /// \param D Dipolar coupling
+        ////////////////////////////////////////////////////////////////////////
+        double dipolar_energy_grad(std::valarray<double>& grad_out,
+                                   const double D);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Dipolar energy and gradient of cartesian spins.
+        ///
+        /// As dipolar_energy_grad for spins stored as unit vectors, as
+        /// calc_field. Does not need calc_trig.
+        ///
+        /// \param grad_out Reference to the valarray the gradient is added to
+        /// \param spins The valarray containing the spin vectors
+        /// \param D Dipolar coupling
+        ////////////////////////////////////////////////////////////////////////
+        double vector_dipolar_energy_grad(std::valarray<double>& grad_out,
+                                          const std::valarray<double> &spins,
+                                          const double D);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculate the sum of the neighbouring spins of each site
+        ///
+        /// Stores the cartesian components of \f$\sum_j \mathbf{s}_j\f$ over
+        /// all neighbours j of each site. Uses the angles from the last call
+        /// to calc_trig.
+        ////////////////////////////////////////////////////////////////////////
+        void calc_field();
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calculate the neighbour field of cartesian spins
+        ///
+        /// As calc_field but for spins stored as unit vectors, every x
+        /// component first, then the y and z components. Does not need
+        /// calc_trig.
+        ///
+        /// \param spins The valarray containing the spin vectors
+        ////////////////////////////////////////////////////////////////////////
+        void calc_field(const std::valarray<double> &spins);
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Neighbour field of cartesian spins in any precision.
+        ///
+        /// As calc_field, but the spins are read from and the field written
+        /// to arrays of the caller, each of three blocks of spins() values,
+        /// so the sums can run in single precision at twice the vector
+        /// width. The work arrays of the system are not used. Instantiated
+        /// for float and double.
+        ///
+        /// \param spins Every x component, then every y and z component
+        /// \param field Where the field is stored, in the same layout
+        ////////////////////////////////////////////////////////////////////////
+        template <class Real>
+        void neighbour_field(const Real *spins, Real *field) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Sum of the neighbours of each site over several lanes.
+        ///
+        /// For values of the same lattice in several replicas, stored with
+        /// the replica fastest, so site i of lane k is at i*lanes + k. The
+        /// stencils then act on every lane at once with their strides
+        /// scaled by lanes, and the table rows run over contiguous lanes,
+        /// so the loops vectorise across the replicas.
+        ///
+        /// \param in One value per site and lane
+        /// \param out Where the sums are stored, in the same layout
+        /// \param lanes The number of replicas
+        ////////////////////////////////////////////////////////////////////////
+        void lane_neighbour_sum(const double *in, double *out,
+                                const int lanes) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Magnitude of the total magnetisation of a state.
+        ///
+        /// \param state The valarray containing the angles
+        ////////////////////////////////////////////////////////////////////////
+        double magnetisation(const std::valarray<double> &state);
+
+        /// Number of spins in the lattice
+        int spins() const {return halfsize;}
+
+        /// Dimension of the lattice
+        int dimension() const {return dim;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The position of each site, in the order they are stored.
+        ///
+        /// Three cartesian coordinates per site in units of the lattice
+        /// constant: the cell of each site for the stencils, or the
+        /// positions of the Lattice.
+        ////////////////////////////////////////////////////////////////////////
+        std::vector<double> positions() const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief A state moved into the order the sites are stored in.
+        ///
+        /// States outside the system keep the numbering the lattice was
+        /// built in, whatever order the sites are stored in; see
+        /// Lattice::from_built. Unchanged for the stencils.
+        ////////////////////////////////////////////////////////////////////////
+        std::valarray<double> from_built(const std::valarray<double> &state) const
+        {
+            return lattice ? lattice->from_built(state) : state;
+        }
+
+        /// A state moved back to the numbering the lattice was built in
+        std::valarray<double> to_built(const std::valarray<double> &state) const
+        {
+            return lattice ? lattice->to_built(state) : state;
+        }
+
+        /// Trigonometric functions from the last call to calc_trig
+        const std::valarray<double>& cos_thetas() const {return cos_the;}
+        const std::valarray<double>& sin_thetas() const {return sin_the;}
+        const std::valarray<double>& cos_phis() const {return cos_phi;}
+        const std::valarray<double>& sin_phis() const {return sin_phi;}
+
+        /// Neighbour field from the last call to calc_field
+        const std::valarray<double>& neighbour_x() const {return field_x;}
+        const std::valarray<double>& neighbour_y() const {return field_y;}
+        const std::valarray<double>& neighbour_z() const {return field_z;}
+    };
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Calculates the gradient of the zeeman energy of a system.
+    /// \brief Generates the total energy function for a system.
     ///
-    /// Calculates the gradient \f$\partial/\partial \theta\f$ and
-    /// \f$\partial/\partial \phi\f$ of the standard zeeman energy \f$ H \sum_{i}
-    /// \mathbf{s}_i\f$ where \f$H =\f$ is actually the field strength
-    /// multiplied by the moment of an atom.
+    /// Returns a std::function object of the form double
+    /// f(const std::valarray<double>&) which calculates and returns
+    /// the total energy of a system. A reference to the input data is
+    /// passed as the parameter. The returned function owns a reference to
+    /// the system and may share it with other generated functions.
     ///
-    /// \param grad_out Reference to the valarray where the output gradient
-    ///                 will be stored. The gradient is stored as the element
-    ///                 wise derivitive of data.
-    /// \param H The field strength multiplied by the moment of an atom
+    /// \param options A struct containing the Exchange constant and
+    ///                           the external field strength
+    /// \param system The lattice the energy is evaluated on
     ///////////////////////////////////////////////////////////////////////////
-    void zeeman_grad(
-        std::valarray<double>& grad_out,
-        const double H);
+    std::function<double(const std::valarray<double>&)>gen_total_energy(
+        const HamiltonianOptions options,
+        const std::shared_ptr<HeisenbergSystem> system);
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Calculates the exchange energy of a system.
+    /// \brief Generates the total energy function for a new system.
     ///
-    /// Calculates the standard Heisenberg exchange energy \f$\sum_{ij} J_{ij}
-    /// \mathbf{s}_i\cdot\mathbf{s}_j \f$ where \f$J_{ij} =\f$ -1 for
-    /// neighbouring spins and 0 for other pairs.
+    /// As above but creates a fresh HeisenbergSystem for the lattice.
     ///
-    /// \param J Exchange constant
-    /// \param d Dimension of the lattice
+    /// \param options A struct containing the Exchange constant and
+    ///                           the external field strength
+    /// \param d The dimension of the lattice
+    /// \param size The size of the total data array
     ///////////////////////////////////////////////////////////////////////////
-    double exchange_energy(
-        const double J,
-        const int d);
+    std::function<double(const std::valarray<double>&)>gen_total_energy(
+        const HamiltonianOptions options,
+        const int d,
+        const int size);
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Calculates the gradient of the exchange energy of a system.
+    /// \brief Generates the combined energy and gradient function for a system.
     ///
-    /// Calculates the gradient \f$\partial/\partial \theta\f$ and
-    /// \f$\partial/\partial \phi\f$ of the standard Heisenberg exchange energy
-    /// \f$\sum_{ij} J_{ij} \mathbf{s}_i\cdot\mathbf{s}_j \f$ where
-    /// \f$J_{ij} =\f$ -1 for neighbouring spins and 0 for other pairs.
+    /// Returns a std::function object of the form double
+    /// f(std::valarray<double>&, const std::valarray<double>&) which writes
+    /// the total gradient into the first parameter and returns the total
+    /// energy. The angles are only evaluated once per call.
     ///
-    /// \param grad_out Reference to the valarray where the output gradient
-    ///                 will be stored. The gradient is stored as the element
-    ///                 wise derivitive of data.
-    /// \param J Exchange constant
-    /// \param d Dimension of the lattice
+    /// \param options A struct containing the Exchange constant and
+    ///                           the external field strength
+    /// \param system The lattice the energy is evaluated on
     ///////////////////////////////////////////////////////////////////////////
-    void exchange_grad(
-        std::valarray<double>& grad_out,
-        const double J,
-        const int d);
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+    gen_total_energy_grad(
+        const HamiltonianOptions options,
+        const std::shared_ptr<HeisenbergSystem> system);
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Generates the total energy function for a system.
+    /// \brief Generates the combined energy and gradient function for a new
+    ///        system.
     ///
-    /// Returns a std::function object of the form double
-    /// f(const std::valarray<double>&) which calculates and returns
-    /// the total energy of a system. A reference to the input data is
-    /// passed as the parameter.
+    /// As above but creates a fresh HeisenbergSystem for the lattice.
     ///
     /// \param options A struct containing the Exchange constant and
     ///                           the external field strength
-    /// \param beta The relative temperature
     /// \param d The dimension of the lattice
     /// \param size The size of the total data array
     ///////////////////////////////////////////////////////////////////////////
-    std::function<double(const std::valarray<double>&)>gen_total_energy(
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+    gen_total_energy_grad(
         const HamiltonianOptions options,
-        const double beta,
         const int d,
         const int size);
 
@@ -100,29 +473,28 @@ namespace hmc
     ///
     /// \param options A struct containing the Exchange constant and
     ///                           the external field strength
-    /// \param d The dimension of the lattice
-    /// \param size The size of the total data array
+    /// \param system The lattice the gradient is evaluated on
     ///////////////////////////////////////////////////////////////////////////
     std::function<void(std::valarray<double>&, const std::valarray<double>&)>
     gen_total_grad(
         const HamiltonianOptions options,
-        const int d,
-        const int size);
+        const std::shared_ptr<HeisenbergSystem> system);
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Calculate the cos and sin of the angles
+    /// \brief Generates the total gradient function for a new system.
     ///
-    /// \param data The valarray containing the angles
-    ///////////////////////////////////////////////////////////////////////////
-    void calc_trig(const std::valarray<double> &data);
-
-    ///////////////////////////////////////////////////////////////////////////
-    /// \brief Sets the slices used for multiplying by neighbours
+    /// As above but creates a fresh HeisenbergSystem for the lattice.
     ///
-    /// \param size The total size of the input array
-    /// \param dim The number of dimensions being worked in
+    /// \param options A struct containing the Exchange constant and
+    ///                           the external field strength
+    /// \param d The dimension of the lattice
+    /// \param size The size of the total data array
     ///////////////////////////////////////////////////////////////////////////
-    void set_slices(int size, int dim);
+    std::function<void(std::valarray<double>&, const std::valarray<double>&)>
+    gen_total_grad(
+        const HamiltonianOptions options,
+        const int d,
+        const int size);
 }
 
 #endif
@@ -0,0 +1,121 @@
+#ifndef CHAINS_H
+#define CHAINS_H
+#include "./hmc.hpp"
+#include <functional>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The functions a single chain samples with.
+    ///
+    /// Each chain gets its own copy so that functions holding work arrays
+    /// (such as those from gen_total_energy) are never shared by threads.
+    /// If energy_and_grad is set it is used in place of energy and
+    /// energy_grad.
+    ///////////////////////////////////////////////////////////////////////////
+    struct ChainFunctions {
+        std::function<double(const std::valarray<double>&)> energy;
+        std::function<void(std::valarray<double>&, const std::valarray<double>&)> energy_grad;
+        std::function<double(std::valarray<double>&, const std::valarray<double>&)> energy_and_grad;
+        std::function<std::valarray<double>(const std::valarray<double>&)> reduce;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The output of a single chain.
+    ///////////////////////////////////////////////////////////////////////////
+    struct ChainResult {
+        /// Reduced state of every sample
+        std::vector<std::valarray<double> > trace;
+        /// Energy of every sample
+        std::valarray<double> energy;
+        /// State at the end of the chain
+        std::valarray<double> final_state;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs tasks 0..n_tasks-1 on a pool of threads.
+    ///
+    /// Each thread takes the next unstarted task until none are left. An
+    /// exception thrown by any task is rethrown once all threads have
+    /// finished.
+    ///
+    /// \param n_tasks The number of tasks
+    /// \param n_threads The number of threads. Zero uses one per core.
+    /// \param task The task to run, called with the task index
+    ///////////////////////////////////////////////////////////////////////////
+    void run_parallel(
+        const int n_tasks,
+        const int n_threads,
+        const std::function<void(const int)> &task );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs independent NUTS chains in parallel.
+    ///
+    /// Chain i starts from initial_states[i] and draws from ChainRNG(seed, i)
+    /// so the result does not depend on the number of threads.
+    ///
+    /// \param initial_states The starting state of each chain
+    /// \param leapfrog_eps Time step for the leapfrog integrator
+    /// \param samples The number of samples per chain
+    /// \param model Builds the functions for a chain. Called once per chain
+    ///              from the thread running it.
+    /// \param n_threads The number of threads. Zero uses one per core.
+    /// \param seed The seed shared by all chains
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<ChainResult> multi_chain_nuts(
+        const std::vector<std::valarray<double> > &initial_states,
+        const double leapfrog_eps,
+        const size_t samples,
+        const std::function<ChainFunctions(const int)> &model,
+        const int n_threads,
+        const int seed );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs independent HMC chains in parallel.
+    ///
+    /// As multi_chain_nuts but with a fixed number of leapfrog steps.
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<ChainResult> multi_chain_hmc(
+        const std::vector<std::valarray<double> > &initial_states,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t samples,
+        const std::function<ChainFunctions(const int)> &model,
+        const int n_threads,
+        const int seed );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Several Heisenberg chains at one parameter point.
+    ///
+    /// Every chain has its own lattice, random initial state and random
+    /// streams. As in heisenberg_model the terms are scaled by beta and
+    /// the energies returned are those of the lattice. Throws
+    /// std::out_of_range if nchains is more than ChainRNG::max_chains.
+    ///
+    /// \param sample_energy Output energies, one valarray per chain
+    /// \param sample_magnetisation Output magnetisations, one per chain
+    /// \param system_dimensions The side lengths of the lattice
+    /// \param options The exchange constant and field strength
+    /// \param beta The relative temperature
+    /// \param leapfrog_eps Time step for the leapfrog integrator
+    /// \param nsamples The number of samples per chain
+    /// \param nchains The number of chains
+    /// \param nthreads The number of threads. Zero uses one per core.
+    /// \param seed The seed shared by all chains
+    ///////////////////////////////////////////////////////////////////////////
+    void heisenberg_chains(
+        std::vector<std::valarray<double> > &sample_energy,
+        std::vector<std::valarray<double> > &sample_magnetisation,
+        const std::vector<int> system_dimensions,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int nchains,
+        const int nthreads,
+        const int seed );
+}
+
+#endif
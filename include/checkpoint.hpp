@@ -0,0 +1,76 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <valarray>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief When a resumable chain writes its checkpoint.
+    ///
+    /// With an empty path no checkpoint is read or written.
+    ///////////////////////////////////////////////////////////////////////////
+    struct CheckpointOptions {
+        /// The checkpoint file. The chain resumes from it if it exists.
+        std::string path;
+        /// Transitions between checkpoints, zero to write one only at the
+        /// end of the chain
+        size_t interval;
+
+        CheckpointOptions() : interval( 0 ) {}
+    };
+
+    /// Writes a plain value in native binary form
+    template <class T>
+    void write_value( std::ostream &out, const T &value )
+    {
+        out.write( reinterpret_cast<const char*>( &value ), sizeof( T ) );
+    }
+
+    /// Reads a value written by write_value, throwing std::runtime_error if
+    /// the input ends early
+    template <class T>
+    void read_value( std::istream &in, T &value )
+    {
+        in.read( reinterpret_cast<char*>( &value ), sizeof( T ) );
+        if( !in )
+            throw std::runtime_error( "checkpoint: input ended early" );
+    }
+
+    /// Writes the size and then the values of an array
+    void write_array( std::ostream &out, const std::valarray<double> &values );
+
+    /// Reads an array written by write_array, resizing values to fit
+    void read_array( std::istream &in, std::valarray<double> &values );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Writes a checkpoint file without ever leaving a partial one.
+    ///
+    /// The contents go to a temporary file beside path, which then replaces
+    /// path, so a job stopped while writing still has the last checkpoint.
+    /// Throws std::runtime_error if the file cannot be written.
+    ///
+    /// \param path The checkpoint file
+    /// \param write Writes the contents to the stream it is given
+    ///////////////////////////////////////////////////////////////////////////
+    void write_checkpoint(
+        const std::string &path,
+        const std::function<void(std::ostream&)> &write );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Reads a checkpoint file if there is one.
+    ///
+    /// \param path The checkpoint file
+    /// \param read Reads the contents from the stream it is given
+    /// \return False if there is no file at path
+    ///////////////////////////////////////////////////////////////////////////
+    bool read_checkpoint(
+        const std::string &path,
+        const std::function<void(std::istream&)> &read );
+}
+
+#endif
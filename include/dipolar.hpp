@@ -0,0 +1,73 @@
+#ifndef DIPOLAR_H
+#define DIPOLAR_H
+#include "fft.hpp"
+#include <complex>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The dipolar field of every spin of a lattice, by FFT.
+    ///
+    /// The field at site i is \f$\mathbf{h}_i = \sum_{j\neq i} N(\mathbf{r}_{ij})
+    /// \mathbf{s}_j\f$ with the dipole tensor \f$N_{ab}(\mathbf{r}) =
+    /// (\delta_{ab} r^2 - 3 r_a r_b) / r^5\f$, so the dipolar energy is
+    /// \f$\frac{D}{2}\sum_i \mathbf{s}_i\cdot\mathbf{h}_i\f$. The sites are
+    /// placed on a grid, which is padded to twice its size so the
+    /// convolution with N does not wrap, and the sum takes
+    /// \f$O(N\log N)\f$ rather than \f$O(N^2)\f$.
+    ///
+    /// The sum runs over the sample itself, open in every direction
+    /// whatever the boundaries of the exchange, which gives the
+    /// demagnetising field and shape anisotropy of a finite film or grain.
+    /// Positions are cartesian, in units of the lattice constant, and must
+    /// lie on a grid of whole or half units, as for the rectangular, bcc
+    /// and fcc lattices; cells of the grid without a site are left empty.
+    /// The triangular lattice gives its positions along its own lattice
+    /// vectors, so would be treated as square.
+    /// The spectra of the six parts of N and the plans of the grid are
+    /// found once, in the constructor.
+    ///////////////////////////////////////////////////////////////////////////
+    class DipolarField
+    {
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// Throws std::invalid_argument if a site is off the grid or two
+        /// sites share a cell.
+        ///
+        /// \param positions Three coordinates for each site
+        ////////////////////////////////////////////////////////////////////////
+        explicit DipolarField( const std::vector<double> &positions );
+
+        /// The number of sites
+        int sites() const {return cell.size();}
+
+        /// The number of points along each axis of the padded grid
+        const std::vector<int>& padded_sides() const {return grid.sides();}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Stores the dipolar field of every spin.
+        ///
+        /// \param x, y, z The components of the spins, one per site
+        /// \param hx, hy, hz Where the components of the field are stored
+        ////////////////////////////////////////////////////////////////////////
+        void field( const double *x, const double *y, const double *z,
+                    double *hx, double *hy, double *hz );
+
+    private:
+        FFTGrid grid;
+        /// The cell of the padded grid each site is in
+        std::vector<size_t> cell;
+        /// The index of -k for each point k of the grid
+        std::vector<size_t> negative;
+        /// The spectra of N_xx, N_yy, N_zz, N_xy, N_xz and N_yz, which are
+        /// real as N is even
+        std::vector<double> kernel[6];
+        /// Work arrays: x + i y and z in, then the fields out
+        std::vector<std::complex<double> > xy_work, z_work, field_work;
+    };
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FFT_H
+#define FFT_H
+#include <complex>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Plans for the complex FFT of a grid of up to three axes.
+    ///
+    /// A small radix-2 transform bundled so the library needs no FFT
+    /// package. The bit reversal and twiddle factors of each axis are found
+    /// once, so a grid can be transformed repeatedly, as in every leapfrog
+    /// step, at no further setup cost. The first axis is fastest in memory.
+    /// Not safe to use from two threads at once.
+    ///////////////////////////////////////////////////////////////////////////
+    class FFTGrid
+    {
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// Throws std::invalid_argument if a side is not a power of two.
+        ///
+        /// \param sides The number of points along each axis
+        ////////////////////////////////////////////////////////////////////////
+        explicit FFTGrid( const std::vector<int> &sides );
+
+        /// The number of points along each axis
+        const std::vector<int>& sides() const {return n_sides;}
+
+        /// The number of points in the grid
+        size_t size() const {return n_points;}
+
+        /// Transforms data in place with exp(-2 pi i k x / n)
+        void forward( std::complex<double> *data ) const;
+
+        /// The inverse of forward, including the division by size()
+        void inverse( std::complex<double> *data ) const;
+
+    private:
+        struct Axis {
+            /// exp(-2 pi i k / n) for k < n/2
+            std::vector<std::complex<double> > twiddle;
+            /// The bit reversed index of each point
+            std::vector<int> reversed;
+        };
+
+        std::vector<int> n_sides;
+        size_t n_points;
+        std::vector<Axis> axes;
+        /// One line of the grid, gathered so each transform is contiguous
+        mutable std::vector<std::complex<double> > line;
+
+        void transform( std::complex<double> *data, const bool inverse ) const;
+    };
+}
+
+#endif
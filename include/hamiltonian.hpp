@@ -0,0 +1,487 @@
+#ifndef HAMILTONIAN_H
+#define HAMILTONIAN_H
+
+#include "all_hamils.hpp"
+#include <cmath>
+#include <valarray>
+#include <memory>
+#include <type_traits>
+
+namespace hmc
+{
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The values a term needs at a single site.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SpinSite {
+        double cos_the, sin_the, cos_phi, sin_phi;
+        /// Cartesian sum of the neighbouring spins
+        double hx, hy, hz;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The values a term needs at a single cartesian spin.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SpinVector {
+        double sx, sy, sz;
+        /// Cartesian sum of the neighbouring spins
+        double hx, hy, hz;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Heisenberg exchange term for a Hamiltonian.
+    ///
+    /// Gives the same energy and gradient as
+    /// HeisenbergSystem::exchange_energy_grad.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Exchange {
+        /// Exchange constant
+        double J;
+        /// The term uses the neighbour field
+        static const bool needs_field = true;
+
+        explicit Exchange(const double J) : J(J) {}
+
+        /// Adds the gradient at one site and returns its share of the energy
+        double site(const SpinSite &s, double &d_the, double &d_phi) const
+        {
+            d_phi -= J*s.sin_the*(s.cos_phi*s.hy - s.sin_phi*s.hx);
+            d_the -= J*s.cos_the*(s.cos_phi*s.hx + s.sin_phi*s.hy)
+                   - J*s.sin_the*s.hz;
+            return -0.5*J*(s.sin_the*(s.cos_phi*s.hx + s.sin_phi*s.hy)
+                           + s.cos_the*s.hz);
+        }
+
+        /// Share of the energy at one site
+        double site_energy(const SpinSite &s) const
+        {
+            return -0.5*J*(s.sin_the*(s.cos_phi*s.hx + s.sin_phi*s.hy)
+                           + s.cos_the*s.hz);
+        }
+
+        /// Adds the cartesian gradient at one spin and returns its share
+        /// of the energy
+        double vector_site(const SpinVector &s,
+                           double &gx, double &gy, double &gz) const
+        {
+            gx -= J*s.hx;
+            gy -= J*s.hy;
+            gz -= J*s.hz;
+            return -0.5*J*(s.sx*s.hx + s.sy*s.hy + s.sz*s.hz);
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Zeeman term for a Hamiltonian.
+    ///
+    /// Gives the same energy and gradient as
+    /// HeisenbergSystem::zeeman_energy_grad.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Zeeman {
+        /// The field strength multiplied by the moment of an atom
+        double H;
+        /// The term only uses the spin at the site
+        static const bool needs_field = false;
+
+        explicit Zeeman(const double H) : H(H) {}
+
+        /// Adds the gradient at one site and returns its energy
+        double site(const SpinSite &s, double &d_the, double &) const
+        {
+            d_the += H*s.sin_the;
+            return -H*s.cos_the;
+        }
+
+        /// Energy at one site
+        double site_energy(const SpinSite &s) const
+        {
+            return -H*s.cos_the;
+        }
+
+        /// Adds the cartesian gradient at one spin and returns its energy
+        double vector_site(const SpinVector &s,
+                           double &, double &, double &gz) const
+        {
+            gz -= H;
+            return -H*s.sz;
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A list of terms evaluated together at each site.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class... Terms> struct TermList;
+
+    template <> struct TermList<>
+    {
+        static const bool needs_field = false;
+
+        double site(const SpinSite&, double&, double&) const {return 0;}
+        double site_energy(const SpinSite&) const {return 0;}
+        double vector_site(const SpinVector&, double&, double&, double&) const
+        {return 0;}
+    };
+
+    template <class Term, class... Rest> struct TermList<Term, Rest...>
+    {
+        static const bool needs_field = Term::needs_field
+                                        || TermList<Rest...>::needs_field;
+        Term head;
+        TermList<Rest...> tail;
+
+        TermList(const Term &head, const Rest&... rest)
+            : head(head), tail(rest...) {}
+
+        double site(const SpinSite &s, double &d_the, double &d_phi) const
+        {
+            return head.site(s, d_the, d_phi) + tail.site(s, d_the, d_phi);
+        }
+
+        double site_energy(const SpinSite &s) const
+        {
+            return head.site_energy(s) + tail.site_energy(s);
+        }
+
+        double vector_site(const SpinVector &s,
+                           double &gx, double &gy, double &gz) const
+        {
+            return head.vector_site(s, gx, gy, gz)
+                 + tail.vector_site(s, gx, gy, gz);
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Lattice work arrays in the precision of a Hamiltonian.
+    ///
+    /// Only made for a precision other than double; in double the work
+    /// arrays of the HeisenbergSystem are used as they always were.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class Real>
+    struct KernelWork {
+        /// cos and sin of theta, then of phi, one block each
+        std::valarray<Real> trig;
+        /// The spins and their neighbour field, three blocks each
+        std::valarray<Real> spins, field;
+
+        explicit KernelWork(const int n) : trig(4*n), spins(3*n), field(3*n) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A Hamiltonian made of terms chosen at compile time.
+    ///
+    /// Calling it has the form double f(std::valarray<double>&,
+    /// const std::valarray<double>&), as the function from
+    /// gen_total_energy_grad, so it can be passed straight to the samplers
+    /// and leapfrog integrator as a concrete type. All of the terms are
+    /// evaluated in a single loop over the lattice, so, for example,
+    /// Hamiltonian<Exchange, Zeeman> needs one pass after the neighbour
+    /// field instead of one per term and no indirect calls. Copies share
+    /// the lattice, which is not safe to share between threads.
+    ///
+    /// Real is the precision of the trig functions and neighbour field.
+    /// With float they take half the memory and twice the vector width,
+    /// while the state, the terms at each site and the sum of the energy
+    /// stay in double, as do the samplers, so the accept test and U-turn
+    /// criterion are unchanged. The energy is then accurate to about
+    /// 1e-7 of each site's share.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class Real, class... Terms>
+    class BasicHamiltonian
+    {
+    private:
+        static const bool native = std::is_same<Real, double>::value;
+        std::shared_ptr<HeisenbergSystem> system;
+        TermList<Terms...> terms;
+        std::shared_ptr<KernelWork<Real> > work;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Evaluates the trig functions and the field if a term needs it
+        ////////////////////////////////////////////////////////////////////////
+        void prepare(const std::valarray<double> &state) const
+        {
+            if(native)
+            {
+                system->calc_trig(state);
+                if(TermList<Terms...>::needs_field)
+                    system->calc_field();
+                return;
+            }
+
+            const size_t n = system->spins();
+            Real *trig = &work->trig[0];
+            Real *spins = &work->spins[0];
+            system->for_sites([&](const size_t begin, const size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    const Real the = state[i], phi = state[i+n];
+                    trig[i] = std::cos(the);
+                    trig[i+n] = std::sin(the);
+                    trig[i+2*n] = std::cos(phi);
+                    trig[i+3*n] = std::sin(phi);
+                    if(TermList<Terms...>::needs_field)
+                    {
+                        spins[i] = trig[i+n]*trig[i+2*n];
+                        spins[i+n] = trig[i+n]*trig[i+3*n];
+                        spins[i+2*n] = trig[i];
+                    }
+                }
+            });
+            if(TermList<Terms...>::needs_field)
+                system->neighbour_field(spins, &work->field[0]);
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// The values at site i from the last call to prepare
+        ////////////////////////////////////////////////////////////////////////
+        SpinSite site(const int i) const
+        {
+            SpinSite s;
+            if(native)
+            {
+                s.cos_the = system->cos_thetas()[i];
+                s.sin_the = system->sin_thetas()[i];
+                s.cos_phi = system->cos_phis()[i];
+                s.sin_phi = system->sin_phis()[i];
+                if(TermList<Terms...>::needs_field)
+                {
+                    s.hx = system->neighbour_x()[i];
+                    s.hy = system->neighbour_y()[i];
+                    s.hz = system->neighbour_z()[i];
+                }
+                else
+                {
+                    s.hx = s.hy = s.hz = 0;
+                }
+                return s;
+            }
+
+            const int n = system->spins();
+            const Real *trig = &work->trig[0];
+            s.cos_the = trig[i];
+            s.sin_the = trig[i+n];
+            s.cos_phi = trig[i+2*n];
+            s.sin_phi = trig[i+3*n];
+            if(TermList<Terms...>::needs_field)
+            {
+                const Real *field = &work->field[0];
+                s.hx = field[i];
+                s.hy = field[i+n];
+                s.hz = field[i+2*n];
+            }
+            else
+            {
+                s.hx = s.hy = s.hz = 0;
+            }
+            return s;
+        }
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param system The lattice the energy is evaluated on
+        /// \param terms The terms, in the order of the template arguments
+        ////////////////////////////////////////////////////////////////////////
+        BasicHamiltonian(const std::shared_ptr<HeisenbergSystem> &system,
+                         const Terms&... terms)
+            : system(system), terms(terms...),
+              work(native ? nullptr : new KernelWork<Real>(system->spins())) {}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Energy and gradient of a state.
+        ///
+        /// \param grad_out Reference to the valarray where the gradient will
+        ///                 be stored
+        /// \param state The valarray containing the angles
+        /// \return The total energy
+        ////////////////////////////////////////////////////////////////////////
+        double operator()(std::valarray<double> &grad_out,
+                          const std::valarray<double> &state) const
+        {
+            prepare(state);
+            const int n = system->spins();
+            return system->sum_sites([&](const size_t begin, const size_t end)
+            {
+                double energy = 0;
+                for(size_t i = begin; i < end; i++)
+                {
+                    double d_the = 0, d_phi = 0;
+                    energy += terms.site(site(i), d_the, d_phi);
+                    grad_out[i] = d_the;
+                    grad_out[i+n] = d_phi;
+                }
+                return energy;
+            });
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Energy of a state.
+        ///
+        /// \param state The valarray containing the angles
+        ////////////////////////////////////////////////////////////////////////
+        double energy(const std::valarray<double> &state) const
+        {
+            prepare(state);
+            return system->sum_sites([&](const size_t begin, const size_t end)
+            {
+                double energy = 0;
+                for(size_t i = begin; i < end; i++)
+                    energy += terms.site_energy(site(i));
+                return energy;
+            });
+        }
+    };
+
+    /// A Hamiltonian evaluated in double precision throughout
+    template <class... Terms>
+    using Hamiltonian = BasicHamiltonian<double, Terms...>;
+
+    /// A Hamiltonian with the lattice kernels in single precision
+    template <class... Terms>
+    using MixedHamiltonian = BasicHamiltonian<float, Terms...>;
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A Hamiltonian of spins stored as cartesian unit vectors.
+    ///
+    /// As Hamiltonian but the state holds every x component, then every y
+    /// and z component, and the gradient is with respect to those
+    /// components. No trigonometric functions are needed. Sample it with
+    /// the Sphere geometry, which keeps the spins at unit length. With Real
+    /// float the spins are rounded for the neighbour field alone.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class Real, class... Terms>
+    class BasicCartesianHamiltonian
+    {
+    private:
+        static const bool native = std::is_same<Real, double>::value;
+        std::shared_ptr<HeisenbergSystem> system;
+        TermList<Terms...> terms;
+        std::shared_ptr<KernelWork<Real> > work;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Evaluates the field if a term needs it
+        ////////////////////////////////////////////////////////////////////////
+        void prepare(const std::valarray<double> &state) const
+        {
+            if(!TermList<Terms...>::needs_field)
+                return;
+            if(native)
+            {
+                system->calc_field(state);
+                return;
+            }
+            const size_t n = system->spins();
+            Real *spins = &work->spins[0];
+            system->for_sites([&](const size_t begin, const size_t end)
+            {
+                for(size_t i = begin; i < end; i++)
+                {
+                    spins[i] = state[i];
+                    spins[i+n] = state[i+n];
+                    spins[i+2*n] = state[i+2*n];
+                }
+            });
+            system->neighbour_field(spins, &work->field[0]);
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// The values at spin i of state after the field is evaluated
+        ////////////////////////////////////////////////////////////////////////
+        SpinVector site(const std::valarray<double> &state, const int i,
+                        const int n) const
+        {
+            SpinVector s;
+            s.sx = state[i];
+            s.sy = state[i+n];
+            s.sz = state[i+2*n];
+            if(TermList<Terms...>::needs_field && native)
+            {
+                s.hx = system->neighbour_x()[i];
+                s.hy = system->neighbour_y()[i];
+                s.hz = system->neighbour_z()[i];
+            }
+            else if(TermList<Terms...>::needs_field)
+            {
+                const Real *field = &work->field[0];
+                s.hx = field[i];
+                s.hy = field[i+n];
+                s.hz = field[i+2*n];
+            }
+            else
+            {
+                s.hx = s.hy = s.hz = 0;
+            }
+            return s;
+        }
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param system The lattice, set up for the angle form of the same
+        ///               number of spins
+        /// \param terms The terms, in the order of the template arguments
+        ////////////////////////////////////////////////////////////////////////
+        BasicCartesianHamiltonian(const std::shared_ptr<HeisenbergSystem> &system,
+                                  const Terms&... terms)
+            : system(system), terms(terms...),
+              work(native ? nullptr : new KernelWork<Real>(system->spins())) {}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Energy and gradient of a state.
+        ///
+        /// \param grad_out Reference to the valarray where the gradient will
+        ///                 be stored
+        /// \param state The valarray containing the spin vectors
+        /// \return The total energy
+        ////////////////////////////////////////////////////////////////////////
+        double operator()(std::valarray<double> &grad_out,
+                          const std::valarray<double> &state) const
+        {
+            prepare(state);
+            const int n = system->spins();
+            return system->sum_sites([&](const size_t begin, const size_t end)
+            {
+                double energy = 0;
+                for(size_t i = begin; i < end; i++)
+                {
+                    double gx = 0, gy = 0, gz = 0;
+                    energy += terms.vector_site(site(state, i, n), gx, gy, gz);
+                    grad_out[i] = gx;
+                    grad_out[i+n] = gy;
+                    grad_out[i+2*n] = gz;
+                }
+                return energy;
+            });
+        }
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Energy of a state.
+        ///
+        /// \param state The valarray containing the spin vectors
+        ////////////////////////////////////////////////////////////////////////
+        double energy(const std::valarray<double> &state) const
+        {
+            prepare(state);
+            const int n = system->spins();
+            return system->sum_sites([&](const size_t begin, const size_t end)
+            {
+                double energy = 0;
+                double gx, gy, gz;
+                for(size_t i = begin; i < end; i++)
+                    energy += terms.vector_site(site(state, i, n), gx, gy, gz);
+                return energy;
+            });
+        }
+    };
+
+    /// A cartesian Hamiltonian evaluated in double precision throughout
+    template <class... Terms>
+    using CartesianHamiltonian = BasicCartesianHamiltonian<double, Terms...>;
+
+    /// A cartesian Hamiltonian with the neighbour field in single precision
+    template <class... Terms>
+    using MixedCartesianHamiltonian = BasicCartesianHamiltonian<float, Terms...>;
+}
+
+#endif
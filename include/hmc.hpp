@@ -1,18 +1,312 @@
 #ifndef HMC_H
 #define HMC_H
-#include "./mklrand.hpp"
+#include "./rng.hpp"
+#include "./leapfrog.hpp"
+#include "./adapt.hpp"
+#include "./sinks.hpp"
+#include "./checkpoint.hpp"
+#include "./observables.hpp"
+#include "./parallel.hpp"
 #include <functional>
+#include <memory>
 #include <valarray>
 #include <vector>
 #include <unordered_map>
 
 namespace hmc {
 
+    class HeisenbergSystem;
+
     struct HamiltonianOptions {
         double J;
         double H;
+        /// Dipolar coupling, the energy of two parallel moments one lattice
+        /// constant apart side by side. See DipolarField.
+        double D;
+
+        HamiltonianOptions() : J( 0 ), H( 0 ), D( 0 ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The terms of options at inverse temperature beta.
+    ///
+    /// Every sampler of the model draws from exp( -beta E ) by sampling
+    /// the energy of these terms.
+    ///////////////////////////////////////////////////////////////////////////
+    HamiltonianOptions scaled_options( const HamiltonianOptions &options,
+                                       const double beta );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The precision of the lattice kernels of a model.
+    ///
+    /// With mixed the trig functions and neighbour field are evaluated in
+    /// float, as MixedHamiltonian, and everything else in double.
+    ///////////////////////////////////////////////////////////////////////////
+    enum class Precision { full, mixed };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The random number streams used by a single chain.
+    ///
+    /// The default constructor gives the historical fixed seeds. Chains
+    /// built with the (seed, chain) constructor draw from distinct streams
+    /// of the backend of rng.hpp (members of the MT2203 family with MKL),
+    /// so no two chains share or overlap a stream.
+    ///////////////////////////////////////////////////////////////////////////
+    class ChainRNG
+    {
+    public:
+        /// Uniform integers in {0, 1}, used for the tree direction
+        IntRNG int_rng;
+        /// Uniform doubles in [0, 1)
+        UniformRNG uniform_rng;
+        /// Standard normal doubles, used for the momentum refresh
+        NormalRNG normal_rng;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// Constructor using the fixed seeds of a single chain.
+        ////////////////////////////////////////////////////////////////////////
+        ChainRNG();
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor for one of a family of independent chains.
+        ///
+        /// \param seed The seed shared by all chains of a run
+        /// \param chain The index of this chain. Must be less than
+        ///              max_chains.
+        ////////////////////////////////////////////////////////////////////////
+        ChainRNG(const int seed, const int chain);
+
+        /// Each chain uses three of the streams of the backend
+        static const int max_chains = rng_streams / 3;
+
+        /// Writes every stream with its buffer for a checkpoint
+        void save( std::ostream &out ) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Restores the streams written by save.
+        ///
+        /// The chain must have been constructed in the same way as the one
+        /// saved. The streams then continue exactly where they left off.
+        ////////////////////////////////////////////////////////////////////////
+        void load( std::istream &in );
+
+    private:
+        ChainRNG(const ChainRNG&);
+        ChainRNG& operator=(const ChainRNG&);
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A point in phase space with its energy and gradient.
+    ///
+    /// Carrying the gradient with the state lets the leapfrog integrator
+    /// start a step without evaluating it again.
+    ///////////////////////////////////////////////////////////////////////////
+    struct PhasePoint {
+        std::valarray<double> state;
+        std::valarray<double> velocity;
+        /// Energy gradient at state
+        std::valarray<double> grad;
+        /// Potential energy at state
+        double energy;
+
+        PhasePoint() : energy( 0 ) {}
+        explicit PhasePoint( const size_t n )
+            : state( n ), velocity( n ), grad( n ), energy( 0 ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Sampling in flat coordinates, such as the spin angles.
+    ///
+    /// Momenta are standard normal and steps use the leapfrog integrator.
+    /// Every geometry also gives the kinetic energy and U-turn check that
+    /// match its momenta; see Metric for one with a mass matrix. With a
+    /// pool the steps, kinetic energy and U-turn check are shared among
+    /// its threads; the momenta are still drawn on the calling thread.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Euclidean {
+        /// The threads sharing the loops over the state, or null
+        std::shared_ptr<SlabPool> pool;
+
+        Euclidean() {}
+        explicit Euclidean( const std::shared_ptr<SlabPool> &pool )
+            : pool( pool ) {}
+
+        /// Draws a new velocity for state
+        void refresh( std::valarray<double> &velocity,
+                      const std::valarray<double> &state,
+                      NormalRNG &rng ) const;
+
+        /// Half the squared velocity
+        double kinetic_energy( const std::valarray<double> &velocity ) const;
+
+        /// As hmc::u_turn_free
+        bool u_turn_free( const PhasePoint &back, const PhasePoint &front ) const;
+
+        /// One integrator step, as leapfrog::lfs_cached
+        template <class EnergyGrad>
+        double step( std::valarray<double> &new_state,
+                     std::valarray<double> &new_velocity,
+                     std::valarray<double> &energy_grads_work,
+                     const std::valarray<double> &state,
+                     const std::valarray<double> &velocity,
+                     const EnergyGrad &energy_grads,
+                     const double eps ) const
+        {
+            if( pool )
+                return leapfrog::lfs_cached( new_state, new_velocity,
+                                             energy_grads_work, state, velocity,
+                                             energy_grads, eps,
+                                             PoolSlabs{ pool.get() } );
+            return leapfrog::lfs_cached( new_state, new_velocity,
+                                         energy_grads_work, state, velocity,
+                                         energy_grads, eps );
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Sampling of spins stored as cartesian unit vectors.
+    ///
+    /// The state holds every x component, then every y and z component.
+    /// Momenta are standard normal in the tangent plane of each spin and
+    /// steps use leapfrog::rattle_sphere. A pool is used as by Euclidean.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Sphere {
+        /// The threads sharing the loops over the spins, or null
+        std::shared_ptr<SlabPool> pool;
+
+        Sphere() {}
+        explicit Sphere( const std::shared_ptr<SlabPool> &pool )
+            : pool( pool ) {}
+
+        /// Draws a new velocity tangent to each spin of state
+        void refresh( std::valarray<double> &velocity,
+                      const std::valarray<double> &state,
+                      NormalRNG &rng ) const;
+
+        /// Half the squared velocity
+        double kinetic_energy( const std::valarray<double> &velocity ) const;
+
+        /// As hmc::u_turn_free
+        bool u_turn_free( const PhasePoint &back, const PhasePoint &front ) const;
+
+        /// One integrator step, as leapfrog::rattle_sphere
+        template <class EnergyGrad>
+        double step( std::valarray<double> &new_state,
+                     std::valarray<double> &new_velocity,
+                     std::valarray<double> &energy_grads_work,
+                     const std::valarray<double> &state,
+                     const std::valarray<double> &velocity,
+                     const EnergyGrad &energy_grads,
+                     const double eps ) const
+        {
+            if( pool )
+                return leapfrog::rattle_sphere( new_state, new_velocity,
+                                                energy_grads_work, state,
+                                                velocity, energy_grads, eps,
+                                                PoolSlabs{ pool.get() } );
+            return leapfrog::rattle_sphere( new_state, new_velocity,
+                                            energy_grads_work, state, velocity,
+                                            energy_grads, eps );
+        }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief How NUTS picks a sample from the trajectory.
+    ///
+    /// slice draws a slice variable and picks uniformly among the points
+    /// inside it. multinomial picks each point with probability
+    /// proportional to exp(-H), with progressive sampling inside subtrees
+    /// and sampling biased towards each new subtree at the top level,
+    /// which moves further from the start for the same number of gradient
+    /// calls.
+    ///////////////////////////////////////////////////////////////////////////
+    enum class NutsVariant { slice, multinomial };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Settings for the NUTS sampler.
+    ///////////////////////////////////////////////////////////////////////////
+    struct NutsOptions {
+        /// The most times the trajectory is doubled for one sample
+        int max_depth;
+        /// The sampling scheme within the trajectory
+        NutsVariant variant;
+
+        NutsOptions() : max_depth( 10 ), variant( NutsVariant::slice ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Work space for building NUTS trees.
+    ///
+    /// Holds a candidate sample and the first point of the open subtree at
+    /// each level. Levels are allocated the first time a tree reaches
+    /// them, so the memory follows the depth actually used rather than the
+    /// maximum depth.
+    ///////////////////////////////////////////////////////////////////////////
+    struct NutsTree {
+        /// Size of the state
+        size_t size;
+        /// Scratch point for the next leaf
+        PhasePoint leaf;
+        /// First point of the open subtree at each level. Only the state
+        /// and velocity are kept.
+        std::vector<PhasePoint> checkpoint;
+        /// Sample from the completed first half of each level
+        std::vector<PhasePoint> candidate;
+        /// Weight behind each candidate, a count of acceptable points for
+        /// the slice variant and a log weight for the multinomial variant
+        std::vector<double> weight;
+        /// Total energy at the start of the trajectory
+        double start_energy;
+        /// Sum of min(1, exp(H0 - H)) over the leaves built for the
+        /// current sample, and the number of leaves
+        double accept_sum;
+        long accept_count;
+
+        explicit NutsTree( const size_t n )
+            : size( n ), leaf( n ), start_energy( 0 ), accept_sum( 0 ),
+              accept_count( 0 ) {}
+
+        /// Allocates the levels of a tree of the given height
+        void reserve( const int height );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The state of a NUTS chain between samples.
+    ///////////////////////////////////////////////////////////////////////////
+    struct NutsWorkspace {
+        /// The current sample with its energy and gradient
+        PhasePoint current;
+        PhasePoint temp, next;
+        /// The back and front of the trajectory
+        std::vector<PhasePoint> fb;
+        NutsTree tree;
+
+        explicit NutsWorkspace( const size_t n );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The state of an HMC chain between samples.
+    ///////////////////////////////////////////////////////////////////////////
+    struct HmcWorkspace {
+        /// The current sample with its energy and gradient
+        PhasePoint current;
+        std::valarray<double> temp_state, temp_velocity;
+        std::valarray<double> trial_state, trial_velocity;
+        /// Gradient carried along the trajectory
+        std::valarray<double> work;
+
+        explicit HmcWorkspace( const size_t n );
     };
 
+    /// Copies the state, gradient and energy but not the velocity
+    void copy_position( PhasePoint &to, const PhasePoint &from );
+
+    /// log( exp(a) + exp(b) ) without overflow
+    double log_add( const double a, const double b );
+
+    /// True if the ends of a trajectory are not yet moving towards each other
+    bool u_turn_free( const PhasePoint &back, const PhasePoint &front );
+
     template <typename T>
     void _swap_ptrs( T* &a, T* &b )
     {
@@ -24,10 +318,21 @@ namespace hmc {
     bool accept_trial(
         const double current_energy,
         const double trial_energy,
-        mklrand::mkl_drand &rng );
+        UniformRNG &rng );
 
     double kinetic_energy(
-        const std::valarray<double> velocity );
+        const std::valarray<double> &velocity );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Combines separate energy and gradient functions.
+    ///
+    /// Returns a function of the form double f(grad, state) which writes the
+    /// gradient and returns the energy, as used by the samplers.
+    ///////////////////////////////////////////////////////////////////////////
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+    fuse_energy_grad(
+        const std::function<double(const std::valarray<double>&)> &f_energy,
+        const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad );
 
     std::vector<std::valarray<double> > hmc(
         std::valarray<double> &sample_energy,
@@ -40,6 +345,112 @@ namespace hmc {
         const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce
     );
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs HMC from state using the random streams of rng.
+    ///
+    /// The chain continues from state and leaves its final position there,
+    /// so repeated calls with the same rng form one continuous chain.
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<std::valarray<double> > hmc(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t samples,
+        const std::function<double(const std::valarray<double>&)> &f_energy,
+        const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad,
+        const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+        ChainRNG &rng
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs HMC with a combined energy and gradient function.
+    ///
+    /// f_energy_grad writes the gradient into its first argument and returns
+    /// the energy. The gradient at the end of each leapfrog step is reused
+    /// at the start of the next, so each step costs one call. geometry
+    /// chooses the momentum and integrator, Euclidean for the spin angles
+    /// and Sphere for cartesian spins. Instantiated for std::function and
+    /// the Hamiltonian types of hamiltonian.hpp.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    std::vector<std::valarray<double> > hmc(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t samples,
+        const EnergyGrad &f_energy_grad,
+        const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+        ChainRNG &rng,
+        const Geometry &geometry=Geometry()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs HMC, writing the samples into a sink.
+    ///
+    /// As the hmc above, but each draw kept by sink is reduced into a
+    /// buffer of the sink's width and written, and the other draws are
+    /// never reduced. Nothing is allocated per sample.
+    ///
+    /// \param sink Receives the energy and reduced state of each kept draw
+    /// \param draws The number of transitions, kept or not
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    void hmc(
+        SampleSink &sink,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t draws,
+        const EnergyGrad &f_energy_grad,
+        const ReduceInto &reduce,
+        ChainRNG &rng,
+        const Geometry &geometry=Geometry()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief One HMC sample from the current point of w.
+    ///
+    /// \return The acceptance statistic min(1, exp(H0 - H))
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry>
+    double hmc_transition(
+        HmcWorkspace &w,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const EnergyGrad &f_energy_grad,
+        ChainRNG &rng,
+        const Geometry &geometry
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Adapts the HMC step size by dual averaging.
+    ///
+    /// Runs adapt.warmup samples from state, which are not kept, with the
+    /// step size moved towards the target acceptance after each one. The
+    /// chain continues from state afterwards, so it should be passed to
+    /// hmc with the returned step size.
+    ///
+    /// \param state The starting state, replaced by the final state
+    /// \param leapfrog_eps The initial step size
+    /// \param leapfrog_steps The number of leapfrog steps per sample
+    /// \param f_energy_grad The energy and gradient, as for hmc
+    /// \param rng The random streams of the chain
+    /// \param adapt The number of iterations and the target
+    /// \param geometry The momentum and integrator, as for hmc
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    WarmupResult hmc_warmup(
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const EnergyGrad &f_energy_grad,
+        ChainRNG &rng,
+        const AdaptOptions &adapt=AdaptOptions(),
+        const Geometry &geometry=Geometry()
+    );
+
     std::vector<std::valarray<double> > nuts(
         std::valarray<double> &sample_energy,
         const std::valarray<double> &initial_state,
@@ -50,49 +461,283 @@ namespace hmc {
         const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce
     );
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs NUTS from state using the random streams of rng.
+    ///
+    /// The chain continues from state and leaves its final position there,
+    /// so repeated calls with the same rng form one continuous chain.
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<std::valarray<double> > nuts(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t samples,
+        const std::function<double(const std::valarray<double>&)> &f_energy,
+        const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad,
+        const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+        ChainRNG &rng
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs NUTS with a combined energy and gradient function.
+    ///
+    /// f_energy_grad writes the gradient into its first argument and returns
+    /// the energy. Every point of the tree keeps its gradient and energy,
+    /// so each leapfrog step costs one call. geometry chooses the momentum
+    /// and integrator, as for hmc, and options bounds the depth of the
+    /// tree and picks the sampling variant. Instantiated for std::function and the
+    /// Hamiltonian types of hamiltonian.hpp.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    std::vector<std::valarray<double> > nuts(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t samples,
+        const EnergyGrad &f_energy_grad,
+        const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+        ChainRNG &rng,
+        const Geometry &geometry=Geometry(),
+        const NutsOptions &options=NutsOptions()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs NUTS, writing the samples into a sink.
+    ///
+    /// As the hmc that writes into a sink.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    void nuts(
+        SampleSink &sink,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t draws,
+        const EnergyGrad &f_energy_grad,
+        const ReduceInto &reduce,
+        ChainRNG &rng,
+        const Geometry &geometry=Geometry(),
+        const NutsOptions &options=NutsOptions()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief One NUTS sample from the current point of w.
+    ///
+    /// \return The acceptance statistic, the mean of min(1, exp(H0 - H))
+    ///         over every leaf built
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry>
+    double nuts_transition(
+        NutsWorkspace &w,
+        const double leapfrog_eps,
+        const EnergyGrad &f_energy_grad,
+        ChainRNG &rng,
+        const Geometry &geometry,
+        const NutsOptions &options
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Adapts the NUTS step size by dual averaging.
+    ///
+    /// As hmc_warmup. A step size that is too small makes every tree reach
+    /// a large depth, so warming up also bounds the cost of each sample.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    WarmupResult nuts_warmup(
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const EnergyGrad &f_energy_grad,
+        ChainRNG &rng,
+        const AdaptOptions &adapt=AdaptOptions(),
+        const Geometry &geometry=Geometry(),
+        const NutsOptions &options=NutsOptions()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Warms up and samples with NUTS, checkpointing the chain.
+    ///
+    /// Runs adapt.warmup iterations as nuts_warmup and then draws into
+    /// sink, as nuts. Every checkpoint.interval transitions, and at the
+    /// end, the position, random streams, adaptation and sink are written
+    /// to checkpoint.path. If that file exists when called the chain
+    /// carries on from it, and gives bit for bit the samples of a chain
+    /// that was never stopped. The sink, rng and options must be set up as
+    /// for the run that wrote the checkpoint.
+    ///
+    /// \param sink Receives the kept draws after the warmup
+    /// \param state The starting state, replaced by the final state
+    /// \param leapfrog_eps The initial step size, used throughout if there
+    ///                     is no warmup
+    /// \param draws The number of transitions after the warmup
+    /// \param f_energy_grad The energy and gradient, as for nuts
+    /// \param reduce Reduces the kept draws into the sink
+    /// \param rng The random streams of the chain
+    /// \param adapt The length and targets of the warmup
+    /// \param checkpoint Where and how often to checkpoint
+    /// \param geometry The momentum and integrator, as for nuts
+    /// \param options The tree depth and variant, as for nuts
+    /// \return The warmup result, whose step size was sampled with
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    WarmupResult nuts_chain(
+        SampleSink &sink,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t draws,
+        const EnergyGrad &f_energy_grad,
+        const ReduceInto &reduce,
+        ChainRNG &rng,
+        const AdaptOptions &adapt,
+        const CheckpointOptions &checkpoint,
+        const Geometry &geometry=Geometry(),
+        const NutsOptions &options=NutsOptions()
+    );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Warms up and samples with HMC, checkpointing the chain.
+    ///
+    /// As nuts_chain with a fixed number of leapfrog steps.
+    ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry=Euclidean>
+    WarmupResult hmc_chain(
+        SampleSink &sink,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t draws,
+        const EnergyGrad &f_energy_grad,
+        const ReduceInto &reduce,
+        ChainRNG &rng,
+        const AdaptOptions &adapt,
+        const CheckpointOptions &checkpoint,
+        const Geometry &geometry=Geometry()
+    );
+
     ///////////////////////////////////////////////////////////////////////////
     /// \brief Builds the sample tree for the NUTS.
     ///
-    /// \param back_state Input state
-    /// \param back_vel Input Velocity
-    /// \param back_state State at the back of the tree
-    /// \param back_vel Velocity at the back of the tree
-    /// \param for_state State at the front of the tree
-    /// \param for_vel Velocity at the front of the tree
-    /// \param slice Random number which decides the accepted energies
-    /// \param dir_choice The choice of direction
-    /// \param tree_height The current height of the energy tree
-    /// \param eps Time step for the leapfrog integrator
-    /// \param state_tree The constructed tree of states
-    /// \param vel_tree The constructed tree of velocities
-    /// \param tree_size The size of the constructed tree
+    /// Adds 2^tree_height leapfrog steps to one end of the trajectory.
+    /// The leaves are built in order without recursion, keeping only a
+    /// checkpoint and a candidate for each level, and points are moved by
+    /// swapping buffers. Draws the same random numbers as the recursive
+    /// form of the algorithm.
+    ///
+    /// \param edge The end of the trajectory being extended, updated to
+    ///             the new end
+    /// \param out The point sampled from the new subtree
+    /// \param tree Work space for the levels of the subtree
+    /// \param slice Random number which decides the accepted energies. For
+    ///              the multinomial variant, minus the starting energy.
+    /// \param tree_height The height of the new subtree
+    /// \param eps Time step for the leapfrog integrator, negative to go
+    ///            backwards
     /// \param break_check Check for the completion of the tree
+    /// \param n_check The number of acceptable points in the new subtree,
+    ///                or its log weight for the multinomial variant
     /// \param energy_grads A function which calculates the energy gradient
-    /// \param work Valarray to work in
+    ///                     and returns the energy
+    /// \param geometry The integrator for each step
+    /// \param rng Uniform generator for choosing the sample
+    /// \param variant The sampling scheme
     ///////////////////////////////////////////////////////////////////////////
+    template <class EnergyGrad, class Geometry>
     void build_tree(
-        std::valarray<double> &in_state,
-        std::valarray<double> &in_vel,
-        std::valarray<double> &back_state,
-        std::valarray<double> &back_vel,
-        std::valarray<double> &for_state,
-        std::valarray<double> &for_vel,
-        std::valarray<double> &out_state,
-        std::vector<std::valarray<double> > &dud_state_tree,
-        std::vector<std::valarray<double> > &dud_vel_tree,
-        std::vector<std::valarray<double> > &pos_state_tree,
+        PhasePoint &edge,
+        PhasePoint &out,
+        NutsTree &tree,
         const double slice,
         const int tree_height,
         const double eps,
         bool &break_check,
-        int &n_check,
-        const std::function<void(std::valarray<double>&,const std::valarray<double>&)> &energy_grads,
-        const std::function<double(const std::valarray<double>&, const std::valarray<double>&)> &energy,
-        std::valarray<double> &work,
-        mklrand::mkl_drand &rng
+        double &n_check,
+        const EnergyGrad &energy_grads,
+        const Geometry &geometry,
+        UniformRNG &rng,
+        const NutsVariant variant
     );
 
-    void heisenberg_model(
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The result of sampling one of the Heisenberg models.
+    ///
+    /// The warmup result with the thermodynamic averages of the samples.
+    ///////////////////////////////////////////////////////////////////////////
+    struct ModelResult : public WarmupResult {
+        Observables observables;
+        /// Wall time of the call in seconds, warmup included, for the
+        /// effective samples per second
+        double seconds;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Samples the Heisenberg model with NUTS.
+    ///
+    /// The terms of options are those of the lattice, and are scaled by
+    /// beta so the chain samples exp( -beta E ). The energies returned are
+    /// those of the lattice.
+    /// If warmup is positive the step size is first adapted from
+    /// leapfrog_eps over that many iterations, which are not returned.
+    /// If checkpoint has a path the chain is checkpointed there, and a run
+    /// with the same arguments resumes from it, as for nuts_chain.
+    /// If sample_energy and sample_magnetisation are empty the samples
+    /// are not kept, only their averages, so memory does not grow with
+    /// nsamples. Otherwise they must have nsamples elements. With precision
+    /// mixed the lattice kernels run in single precision.
+    ///
+    /// \return The step size sampled with, the warmup history and the
+    ///         thermodynamic averages
+    ///////////////////////////////////////////////////////////////////////////
+    ModelResult heisenberg_model(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &sample_magnetisation,
+        const std::vector<int> system_dimensions,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int initial_state_seed,
+        const int warmup=0,
+        const CheckpointOptions &checkpoint=CheckpointOptions(),
+        const Precision precision=Precision::full );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Samples the Heisenberg model on a given lattice.
+    ///
+    /// As above, on any lattice a HeisenbergSystem can describe, such as
+    /// one made from a Lattice. The initial state is drawn in the numbering
+    /// the lattice was built in, so a lattice renumbered for locality
+    /// starts from the same spins.
+    ///////////////////////////////////////////////////////////////////////////
+    ModelResult heisenberg_model(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &sample_magnetisation,
+        const std::shared_ptr<HeisenbergSystem> system,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int initial_state_seed,
+        const int warmup=0,
+        const CheckpointOptions &checkpoint=CheckpointOptions(),
+        const Precision precision=Precision::full );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Fills state with spins drawn uniformly from the sphere.
+    ///
+    /// \param state The valarray of angles, theta first then phi
+    /// \param rng The uniform generator to draw from
+    ///////////////////////////////////////////////////////////////////////////
+    void random_state(
+        std::valarray<double> &state,
+        UniformRNG &rng );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Heisenberg model sampled with cartesian spins.
+    ///
+    /// As heisenberg_model but the spins are kept as unit vectors and
+    /// sampled with the Sphere geometry. This avoids the trigonometric
+    /// functions of the angles and the stiffness at the poles, so larger
+    /// steps can be taken.
+    ///////////////////////////////////////////////////////////////////////////
+    ModelResult heisenberg_model_cartesian(
         std::valarray<double> &sample_energy,
         std::valarray<double> &sample_magnetisation,
         const std::vector<int> system_dimensions,
@@ -100,8 +745,50 @@ namespace hmc {
         const double beta,
         const double leapfrog_eps,
         const int nsamples,
-        const int initial_state_seed );
+        const int initial_state_seed,
+        const int warmup=0,
+        const CheckpointOptions &checkpoint=CheckpointOptions(),
+        const Precision precision=Precision::full );
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Heisenberg model with cartesian spins on a given lattice.
+    ///////////////////////////////////////////////////////////////////////////
+    ModelResult heisenberg_model_cartesian(
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &sample_magnetisation,
+        const std::shared_ptr<HeisenbergSystem> system,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int initial_state_seed,
+        const int warmup=0,
+        const CheckpointOptions &checkpoint=CheckpointOptions(),
+        const Precision precision=Precision::full );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Cartesian unit vectors of spins given by angles.
+    ///
+    /// \param angles Every theta then every phi
+    /// \return Every x component then every y and z component
+    ///////////////////////////////////////////////////////////////////////////
+    std::valarray<double> spin_vectors( const std::valarray<double> &angles );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Magnitude of the total magnetisation of cartesian spins.
+    ///
+    /// \param state Every x component then every y and z component
+    ///////////////////////////////////////////////////////////////////////////
+    double vector_magnetisation( const std::valarray<double> &state );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Magnitude of the total magnetisation of a state.
+    ///
+    /// Does not depend on any lattice set up so is safe to call from
+    /// several threads at once.
+    ///
+    /// \param state The valarray containing the angles
+    ///////////////////////////////////////////////////////////////////////////
     double magnetisation( const std::valarray<double>& state );
 }
 
@@ -0,0 +1,179 @@
+#ifndef LATTICE_H
+#define LATTICE_H
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A lattice given by a table of the neighbours of each site.
+    ///
+    /// The neighbours are stored compactly, row by row, with the row of
+    /// each site sorted so a sweep over the sites reads the spins in order
+    /// as far as it can. A neighbour joined through more than one periodic
+    /// image appears once for each, as for the stencils of
+    /// HeisenbergSystem, so a bond is always counted from both ends. Each
+    /// site also has a position, which orderings of the sites can use.
+    ///////////////////////////////////////////////////////////////////////////
+    class Lattice
+    {
+    private:
+        int n_dim;
+        /// Where the row of each site starts in the table, with the end
+        std::vector<int> row_start;
+        std::vector<int> table;
+        /// Three coordinates per site
+        std::vector<double> coords;
+        /// The number of neighbours of every site, or zero if it varies
+        int n_degree;
+        /// The number each site had when the lattice was built
+        std::vector<int> built;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// Throws std::invalid_argument if a neighbour is not a site or the
+        /// positions do not match the number of sites.
+        ///
+        /// \param dim The dimension of the lattice
+        /// \param neighbours The neighbours of each site
+        /// \param positions Three coordinates for each site
+        ////////////////////////////////////////////////////////////////////////
+        Lattice( const int dim,
+                 const std::vector<std::vector<int> > &neighbours,
+                 const std::vector<double> &positions );
+
+        /// The number of sites
+        int size() const {return row_start.size() - 1;}
+
+        /// The dimension of the lattice
+        int dimension() const {return n_dim;}
+
+        /// The number of neighbours of every site, or zero if it varies
+        int degree() const {return n_degree;}
+
+        /// The number of neighbours of site i
+        int degree( const int i ) const {return row_start[i+1] - row_start[i];}
+
+        /// The neighbours of site i, degree( i ) of them
+        const int* neighbours( const int i ) const {return &table[row_start[i]];}
+
+        /// Where the row of each site starts in the table, with the end
+        const std::vector<int>& offsets() const {return row_start;}
+
+        /// Every row of neighbours, one after the other
+        const std::vector<int>& neighbour_table() const {return table;}
+
+        /// The three coordinates of site i
+        const double* position( const int i ) const {return &coords[3*i];}
+
+        /// The number of bonds, each counted once
+        int bonds() const {return table.size() / 2;}
+
+        /// The number each site had when the lattice was built
+        const std::vector<int>& built_order() const {return built;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The same lattice with the sites renumbered.
+        ///
+        /// Renumbering can be repeated; built_order always refers back to
+        /// the lattice as first built. Throws std::invalid_argument if order
+        /// is not a permutation.
+        ///
+        /// \param order The old number of each new site
+        ////////////////////////////////////////////////////////////////////////
+        Lattice permuted( const std::vector<int> &order ) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Moves a state from the built numbering into this one.
+        ///
+        /// The state holds one block of size() values for each component,
+        /// as the angles or the cartesian spins, so the layout callers see
+        /// is kept however the sites are stored.
+        ///
+        /// \param state The state in the numbering the lattice was built in
+        ////////////////////////////////////////////////////////////////////////
+        std::valarray<double> from_built( const std::valarray<double> &state ) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Moves a state from this numbering back to the built one.
+        ///
+        /// \param state The state in the numbering of this lattice
+        ////////////////////////////////////////////////////////////////////////
+        std::valarray<double> to_built( const std::valarray<double> &state ) const;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A simple rectangular lattice of any side lengths.
+    ///
+    /// Sites are numbered with the first axis fastest, as for the stencils
+    /// of HeisenbergSystem. An axis which is not periodic has open ends,
+    /// as the surfaces of a thin film.
+    ///
+    /// \param sides The number of sites along each axis, one to three axes
+    /// \param periodic Whether each axis wraps. Empty for all periodic.
+    ///////////////////////////////////////////////////////////////////////////
+    Lattice rectangular_lattice(
+        const std::vector<int> &sides,
+        const std::vector<bool> &periodic=std::vector<bool>() );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A body centred cubic lattice with eight neighbours per site.
+    ///
+    /// \param cells The number of cubic cells along each axis, of two
+    ///              sites each
+    /// \param periodic Whether each axis wraps. Empty for all periodic.
+    ///////////////////////////////////////////////////////////////////////////
+    Lattice bcc_lattice(
+        const std::vector<int> &cells,
+        const std::vector<bool> &periodic=std::vector<bool>() );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A face centred cubic lattice with twelve neighbours per site.
+    ///
+    /// \param cells The number of cubic cells along each axis, of four
+    ///              sites each
+    /// \param periodic Whether each axis wraps. Empty for all periodic.
+    ///////////////////////////////////////////////////////////////////////////
+    Lattice fcc_lattice(
+        const std::vector<int> &cells,
+        const std::vector<bool> &periodic=std::vector<bool>() );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A triangular lattice with six neighbours per site.
+    ///
+    /// Positions are along the two lattice vectors, 60 degrees apart.
+    ///
+    /// \param sides The number of sites along each lattice vector
+    /// \param periodic Whether each axis wraps. Empty for all periodic.
+    ///////////////////////////////////////////////////////////////////////////
+    Lattice triangular_lattice(
+        const std::vector<int> &sides,
+        const std::vector<bool> &periodic=std::vector<bool>() );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The sites in Morton (Z curve) order.
+    ///
+    /// Sites are ordered by interleaving the bits of their positions, in
+    /// half units as all the builders give, so each block of 2^d sites, then
+    /// of 4^d and so on, is stored together. Neighbours along the last axis
+    /// are then mostly close in memory rather than a whole layer apart.
+    ///
+    /// \return The old number of each new site, for Lattice::permuted
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<int> morton_order( const Lattice &lattice );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The sites in Hilbert curve order.
+    ///
+    /// As morton_order, but consecutive sites are always neighbours on a
+    /// simple lattice of power of two sides, so there are no long jumps
+    /// between the blocks.
+    ///
+    /// \return The old number of each new site, for Lattice::permuted
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<int> hilbert_order( const Lattice &lattice );
+}
+
+#endif
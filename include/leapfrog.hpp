@@ -1,10 +1,27 @@
 #ifndef LEAPFROG_H
 #define LEAPFROG_H
+#include <atomic>
+#include <cmath>
 #include <functional>
+#include <limits>
 #include <valarray>
 
 namespace leapfrog {
 
+    /// \brief Runs the loops of an integrator on the calling thread.
+    ///
+    /// The integrators that take a Slabs argument call slabs( n, f ) for
+    /// each loop over n elements, and f( begin, end ) must be called over
+    /// ranges covering [0, n). Pass an hmc::PoolSlabs to share the loops
+    /// among threads.
+    struct SerialSlabs {
+        template <class Function>
+        void operator()( const size_t n, const Function &f ) const
+        {
+            f( 0, n );
+        }
+    };
+
     /// New velocity of the system states after half a step
     void half_step_velocity(
         std::valarray<double> &new_vels,
@@ -18,15 +35,257 @@ namespace leapfrog {
                      const std::valarray<double> &vels,
                      const double eps );
 
-    /// New state and velocity of the system after one leap frog step
+    /// \brief New state and velocity of the system after one leap frog step
+    ///
+    /// energy_grads may be a std::function or any functor called as
+    /// energy_grads(grad, state), such as a Hamiltonian.
+    template <class EnergyGrad>
     void lfs(
         std::valarray<double> &new_state,
         std::valarray<double> &new_velocity,
         std::valarray<double> &energy_grads_work,
         const std::valarray<double> &state,
         const std::valarray<double> &velocity,
-        const std::function<void(std::valarray<double>&,const std::valarray<double> &)> &energy_grads,
-        const double eps );
+        const EnergyGrad &energy_grads,
+        const double eps )
+    {
+        // Compute the gradient of the energy landscape
+        energy_grads( energy_grads_work, state );
+
+        // Compute the half-step velocity and next state
+        half_step_velocity( new_velocity, velocity, energy_grads_work, eps );
+        step_state( new_state, state, new_velocity, eps );
+
+        // Finish by computing the full-step velocity
+        energy_grads( energy_grads_work, new_state );
+        half_step_velocity( new_velocity, new_velocity, energy_grads_work, eps );
+    }
+
+    /// \brief New state and velocity after one leap frog step, reusing the
+    ///        gradient at the starting state.
+    ///
+    /// On entry energy_grads_work must hold the energy gradient at state.
+    /// On exit it holds the gradient at new_state, ready for the next step,
+    /// so each step needs a single call to energy_grads, which returns the
+    /// energy. Returns the energy at new_state.
+    template <class EnergyGrad>
+    double lfs_cached(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_velocity,
+        std::valarray<double> &energy_grads_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &velocity,
+        const EnergyGrad &energy_grads,
+        const double eps )
+    {
+        // Gradient at state is carried over from the previous step
+        half_step_velocity( new_velocity, velocity, energy_grads_work, eps );
+        step_state( new_state, state, new_velocity, eps );
+
+        // Finish by computing the full-step velocity
+        double energy = energy_grads( energy_grads_work, new_state );
+        half_step_velocity( new_velocity, new_velocity, energy_grads_work, eps );
+        return energy;
+    }
+
+    /// \brief As lfs_cached with the loops over the state run by slabs.
+    template <class EnergyGrad, class Slabs>
+    double lfs_cached(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_velocity,
+        std::valarray<double> &energy_grads_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &velocity,
+        const EnergyGrad &energy_grads,
+        const double eps,
+        const Slabs &slabs )
+    {
+        const double *g = &energy_grads_work[0];
+        const double *x = &state[0], *v = &velocity[0];
+        double *new_x = &new_state[0], *new_v = &new_velocity[0];
+        slabs( state.size(), [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+            {
+                new_v[i] = v[i] - eps / 2.0 * g[i];
+                new_x[i] = x[i] + eps * new_v[i];
+            }
+        } );
+
+        double energy = energy_grads( energy_grads_work, new_state );
+        slabs( state.size(), [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+                new_v[i] = new_v[i] - eps / 2.0 * g[i];
+        } );
+        return energy;
+    }
+
+    /// \brief One leap frog step with a mass matrix, reusing the gradient
+    ///        at the starting state.
+    ///
+    /// As lfs_cached but momentum takes the place of the velocity and the
+    /// state moves with the velocity inverse_metric(velocity_work, p),
+    /// which stores the product of the inverse mass matrix and p.
+    template <class EnergyGrad, class InverseMetric>
+    double lfs_metric(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_momentum,
+        std::valarray<double> &energy_grads_work,
+        std::valarray<double> &velocity_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &momentum,
+        const EnergyGrad &energy_grads,
+        const InverseMetric &inverse_metric,
+        const double eps )
+    {
+        half_step_velocity( new_momentum, momentum, energy_grads_work, eps );
+        inverse_metric( velocity_work, new_momentum );
+        step_state( new_state, state, velocity_work, eps );
+
+        double energy = energy_grads( energy_grads_work, new_state );
+        half_step_velocity( new_momentum, new_momentum, energy_grads_work, eps );
+        return energy;
+    }
+
+    /// \brief As lfs_metric with the loops over the state run by slabs.
+    ///
+    /// inverse_metric is called once for the whole state and may share
+    /// its own loops among the same threads.
+    template <class EnergyGrad, class InverseMetric, class Slabs>
+    double lfs_metric(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_momentum,
+        std::valarray<double> &energy_grads_work,
+        std::valarray<double> &velocity_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &momentum,
+        const EnergyGrad &energy_grads,
+        const InverseMetric &inverse_metric,
+        const double eps,
+        const Slabs &slabs )
+    {
+        const double *g = &energy_grads_work[0], *v = &velocity_work[0];
+        const double *x = &state[0], *p = &momentum[0];
+        double *new_x = &new_state[0], *new_p = &new_momentum[0];
+        slabs( state.size(), [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+                new_p[i] = p[i] - eps / 2.0 * g[i];
+        } );
+        inverse_metric( velocity_work, new_momentum );
+        slabs( state.size(), [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+                new_x[i] = x[i] + eps * v[i];
+        } );
+
+        double energy = energy_grads( energy_grads_work, new_state );
+        slabs( state.size(), [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+                new_p[i] = new_p[i] - eps / 2.0 * g[i];
+        } );
+        return energy;
+    }
+
+    /// \brief As rattle_sphere with the loops over the spins run by slabs.
+    ///
+    /// Every spin is stepped independently, so the result is the same
+    /// however the spins are split.
+    template <class EnergyGrad, class Slabs>
+    double rattle_sphere(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_velocity,
+        std::valarray<double> &energy_grads_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &velocity,
+        const EnergyGrad &energy_grads,
+        const double eps,
+        const Slabs &slabs )
+    {
+        const size_t n = state.size() / 3;
+        const double *g = &energy_grads_work[0];
+        const double *x = &state[0], *v = &velocity[0];
+        double *new_x = &new_state[0], *new_v = &new_velocity[0];
+
+        // Half step with the tangential force then move along the chord
+        std::atomic<bool> failed( false );
+        slabs( n, [=, &failed]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+            {
+                const size_t iy = i+n, iz = i+2*n;
+                double gs = g[i]*x[i] + g[iy]*x[iy] + g[iz]*x[iz];
+                double wx = v[i] - eps/2.0 * ( g[i] - gs*x[i] );
+                double wy = v[iy] - eps/2.0 * ( g[iy] - gs*x[iy] );
+                double wz = v[iz] - eps/2.0 * ( g[iz] - gs*x[iz] );
+                double disc = 1 - eps*eps * ( wx*wx + wy*wy + wz*wz );
+                if( disc < 0 )
+                {
+                    failed = true;
+                    return;
+                }
+                double a = std::sqrt( disc );
+                new_x[i] = a*x[i] + eps*wx;
+                new_x[iy] = a*x[iy] + eps*wy;
+                new_x[iz] = a*x[iz] + eps*wz;
+                new_v[i] = ( new_x[i] - x[i] ) / eps;
+                new_v[iy] = ( new_x[iy] - x[iy] ) / eps;
+                new_v[iz] = ( new_x[iz] - x[iz] ) / eps;
+            }
+        } );
+        if( failed )
+        {
+            new_state = state;
+            new_velocity = velocity;
+            return std::numeric_limits<double>::infinity();
+        }
+
+        // Finish with the force at the new state, kept tangent
+        double energy = energy_grads( energy_grads_work, new_state );
+        slabs( n, [=]( const size_t begin, const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+            {
+                const size_t iy = i+n, iz = i+2*n;
+                double ux = new_v[i] - eps/2.0 * g[i];
+                double uy = new_v[iy] - eps/2.0 * g[iy];
+                double uz = new_v[iz] - eps/2.0 * g[iz];
+                double us = ux*new_x[i] + uy*new_x[iy] + uz*new_x[iz];
+                new_v[i] = ux - us*new_x[i];
+                new_v[iy] = uy - us*new_x[iy];
+                new_v[iz] = uz - us*new_x[iz];
+            }
+        } );
+        return energy;
+    }
+
+    /// \brief One RATTLE step for spins held on the unit sphere.
+    ///
+    /// state holds the cartesian components of n unit vectors, every x
+    /// component first, then the y and z components. velocity must be
+    /// tangent to each sphere at state and stays so. Only the component
+    /// of the gradient along the sphere acts, and the position moves along
+    /// the chord that keeps each spin at unit length, so no trigonometric
+    /// functions are needed. As lfs_cached, energy_grads_work carries the
+    /// gradient in and out and the energy at new_state is returned. If a
+    /// spin would move more than the step allows the step fails, the state
+    /// is left as it was and the returned energy is infinite.
+    template <class EnergyGrad>
+    double rattle_sphere(
+        std::valarray<double> &new_state,
+        std::valarray<double> &new_velocity,
+        std::valarray<double> &energy_grads_work,
+        const std::valarray<double> &state,
+        const std::valarray<double> &velocity,
+        const EnergyGrad &energy_grads,
+        const double eps )
+    {
+        return rattle_sphere( new_state, new_velocity, energy_grads_work,
+                              state, velocity, energy_grads, eps,
+                              SerialSlabs() );
+    }
 
 } // end namespace
 
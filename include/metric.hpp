@@ -0,0 +1,107 @@
+#ifndef METRIC_H
+#define METRIC_H
+#include "./rng.hpp"
+#include "./leapfrog.hpp"
+#include "./parallel.hpp"
+#include <iosfwd>
+#include <memory>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    struct PhasePoint;
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Sampling in flat coordinates with a mass matrix.
+    ///
+    /// The inverse mass matrix is S R S, where S is diagonal and holds the
+    /// scale of each coordinate and R is the identity plus a low rank
+    /// correction along orthonormal directions. With no directions the
+    /// metric is diagonal, and with no scales it is the identity, as for
+    /// Euclidean. The velocity of each PhasePoint holds the momentum.
+    /// Usually set by the warmup, which estimates the scales and
+    /// directions from the chain. A single metric is not safe to share
+    /// between threads; give each chain its own. With a pool the steps,
+    /// kinetic energy and U-turn check are shared among its threads, as
+    /// for Euclidean.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Metric {
+        /// Standard deviation of each coordinate
+        std::valarray<double> scale;
+        /// Orthonormal directions of the scaled coordinates with a
+        /// correlation away from one
+        std::vector<std::valarray<double> > directions;
+        /// Variance of the scaled coordinates along each direction
+        std::valarray<double> values;
+        /// The threads sharing the loops over the state, or null. Not
+        /// written by save.
+        std::shared_ptr<SlabPool> pool;
+
+        /// The identity metric
+        Metric() {}
+
+        /// A diagonal metric of the given standard deviations
+        explicit Metric( const std::valarray<double> &scale )
+            : scale( scale ) {}
+
+        /// The identity metric, using the threads of pool
+        explicit Metric( const std::shared_ptr<SlabPool> &pool )
+            : pool( pool ) {}
+
+        /// Stores the velocity, the product of the inverse metric and p
+        void velocity( std::valarray<double> &v,
+                       const std::valarray<double> &p ) const;
+
+        /// Draws a new momentum from a normal of covariance the metric
+        void refresh( std::valarray<double> &momentum,
+                      const std::valarray<double> &state,
+                      NormalRNG &rng ) const;
+
+        /// One integrator step, as leapfrog::lfs_metric
+        template <class EnergyGrad>
+        double step( std::valarray<double> &new_state,
+                     std::valarray<double> &new_momentum,
+                     std::valarray<double> &energy_grads_work,
+                     const std::valarray<double> &state,
+                     const std::valarray<double> &momentum,
+                     const EnergyGrad &energy_grads,
+                     const double eps ) const
+        {
+            velocity_work.resize( state.size() );
+            const Metric &metric = *this;
+            auto inverse_metric = [&metric]( std::valarray<double> &v,
+                                             const std::valarray<double> &p )
+            { metric.velocity( v, p ); };
+            if( pool )
+                return leapfrog::lfs_metric(
+                    new_state, new_momentum, energy_grads_work, velocity_work,
+                    state, momentum, energy_grads, inverse_metric, eps,
+                    PoolSlabs{ pool.get() } );
+            return leapfrog::lfs_metric(
+                new_state, new_momentum, energy_grads_work, velocity_work,
+                state, momentum, energy_grads, inverse_metric, eps );
+        }
+
+        /// Kinetic energy of a momentum, half of p.M^-1.p
+        double kinetic_energy( const std::valarray<double> &momentum ) const;
+
+        /// True if the ends of a trajectory are not yet moving towards each
+        /// other, measured with the velocities rather than the momenta
+        bool u_turn_free( const PhasePoint &back, const PhasePoint &front ) const;
+
+        /// Writes the scales and directions for a checkpoint
+        void save( std::ostream &out ) const;
+
+        /// Restores a metric written by save
+        void load( std::istream &in );
+
+    private:
+        /// Multiplies z by R to the power a in place
+        void correlate( std::valarray<double> &z, const double a ) const;
+
+        mutable std::valarray<double> velocity_work, back_work, front_work;
+    };
+}
+
+#endif
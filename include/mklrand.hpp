@@ -2,6 +2,8 @@
 #define _MKLRAND
 
 #include "mkl.h"
+#include <cstddef>
+#include <iosfwd>
 
 namespace mklrand
 {
@@ -13,7 +15,16 @@ namespace mklrand
 	protected:
 		int arr_size;
 		int curr;
+		int brng;
 		VSLStreamStatePtr stream;
+		////////////////////////////////////////////////////////////////////////
+		/// The buffer of random numbers as raw bytes.
+		////////////////////////////////////////////////////////////////////////
+		virtual char* buffer_bytes() const {return 0;}
+		////////////////////////////////////////////////////////////////////////
+		/// The size in bytes of each number in the buffer.
+		////////////////////////////////////////////////////////////////////////
+		virtual int value_size() const {return 0;}
 	public:
 		////////////////////////////////////////////////////////////////////////
 		/// Default constructor.
@@ -45,6 +56,26 @@ namespace mklrand
 		/// \param name A string which defines the relative path of the input.
 		////////////////////////////////////////////////////////////////////////
 		void load(const char* name) {vslDeleteStream(&stream); vslLoadStreamF(&stream, name);}
+		////////////////////////////////////////////////////////////////////////
+		/// \brief Write the complete state of the generator.
+		///
+		/// Unlike save this includes the buffer and the position in it, so
+		/// a generator restored with read_state returns exactly the numbers
+		/// this one would have.
+		///
+		/// \param out A binary stream to write to.
+		////////////////////////////////////////////////////////////////////////
+		void write_state(std::ostream &out) const;
+		////////////////////////////////////////////////////////////////////////
+		/// \brief Restore a state written by write_state.
+		///
+		/// The generator must have been constructed with the same basic
+		/// generator and buffer size. Throws std::runtime_error otherwise or
+		/// if the input ends early.
+		///
+		/// \param in A binary stream to read from.
+		////////////////////////////////////////////////////////////////////////
+		void read_state(std::istream &in);
 	};
 
 	///////////////////////////////////////////////////////////////////////////
@@ -55,6 +86,9 @@ namespace mklrand
 	private:
 		double *randarr;
 
+		char* buffer_bytes() const {return (char*)randarr;}
+		int value_size() const {return sizeof(double);}
+
 	public:
 		////////////////////////////////////////////////////////////////////////
 		/// \brief Constructor
@@ -63,8 +97,11 @@ namespace mklrand
 		///             numbers.
 		/// \param seed The inital seed of the random number generator. Defaults
 		///             to 1.
+		/// \param gen The MKL basic generator to use. Defaults to
+		///            VSL_BRNG_SFMT19937. Use VSL_BRNG_MT2203 + i for the i-th
+		///            member of a family of independent streams.
 		////////////////////////////////////////////////////////////////////////
-		mkl_drand(int size, int seed=1);
+		mkl_drand(int size, int seed=1, int gen=VSL_BRNG_SFMT19937);
 		////////////////////////////////////////////////////////////////////////
 		/// Default destructor.
 		////////////////////////////////////////////////////////////////////////
@@ -72,12 +109,28 @@ namespace mklrand
 		////////////////////////////////////////////////////////////////////////
 		/// Return a single random number from the buffer.
 		////////////////////////////////////////////////////////////////////////
-		double gen();
+		double gen()
+		{
+			double out = randarr[curr];
+			if(++curr >= arr_size)
+				this->fill();
+			return out;
+		}
 		////////////////////////////////////////////////////////////////////////
 		/// Refill the buffer with fresh random numbers.
 		////////////////////////////////////////////////////////////////////////
 		void fill();
 		////////////////////////////////////////////////////////////////////////
+		/// \brief Write the next n random numbers to out.
+		///
+		/// The numbers are those n calls to gen would return. Whole buffers
+		/// are generated straight into out.
+		///
+		/// \param out Where the numbers are stored.
+		/// \param n The number of numbers.
+		////////////////////////////////////////////////////////////////////////
+		void fill(double *out, size_t n);
+		////////////////////////////////////////////////////////////////////////
 		/// \brief Change the current random seed.
 		///
 		/// \param seed The new seed.
@@ -93,6 +146,9 @@ namespace mklrand
 	private:
 		int *randarr;
 
+		char* buffer_bytes() const {return (char*)randarr;}
+		int value_size() const {return sizeof(int);}
+
 	public:
 		////////////////////////////////////////////////////////////////////////
 		/// \brief Constructor
@@ -101,8 +157,11 @@ namespace mklrand
 		///             numbers.
 		/// \param seed The inital seed of the random number generator. Defaults
 		///             to 1.
+		/// \param gen The MKL basic generator to use. Defaults to
+		///            VSL_BRNG_SFMT19937. Use VSL_BRNG_MT2203 + i for the i-th
+		///            member of a family of independent streams.
 		////////////////////////////////////////////////////////////////////////
-		mkl_irand(int size, int seed=1);
+		mkl_irand(int size, int seed=1, int gen=VSL_BRNG_SFMT19937);
 		////////////////////////////////////////////////////////////////////////
 		/// Default destructor.
 		////////////////////////////////////////////////////////////////////////
@@ -110,12 +169,28 @@ namespace mklrand
 		////////////////////////////////////////////////////////////////////////
 		/// Return a single random number from the buffer.
 		////////////////////////////////////////////////////////////////////////
-		int gen();
+		int gen()
+		{
+			int out = randarr[curr];
+			if(++curr >= arr_size)
+				this->fill();
+			return out;
+		}
 		////////////////////////////////////////////////////////////////////////
 		/// Refill the buffer with fresh random numbers.
 		////////////////////////////////////////////////////////////////////////
 		void fill();
 		////////////////////////////////////////////////////////////////////////
+		/// \brief Write the next n random numbers to out.
+		///
+		/// The numbers are those n calls to gen would return. Whole buffers
+		/// are generated straight into out.
+		///
+		/// \param out Where the numbers are stored.
+		/// \param n The number of numbers.
+		////////////////////////////////////////////////////////////////////////
+		void fill(int *out, size_t n);
+		////////////////////////////////////////////////////////////////////////
 		/// \brief Change the current random seed.
 		///
 		/// \param seed The new seed.
@@ -132,6 +207,9 @@ namespace mklrand
 		double *randarr;
 		double lmean, lsd;
 
+		char* buffer_bytes() const {return (char*)randarr;}
+		int value_size() const {return sizeof(double);}
+
 	public:
 		////////////////////////////////////////////////////////////////////////
 		/// \brief Constructor
@@ -143,8 +221,11 @@ namespace mklrand
 		///             numbers.
 		/// \param seed The inital seed of the random number generator. Defaults
 		///             to 1.
+		/// \param gen The MKL basic generator to use. Defaults to
+		///            VSL_BRNG_SFMT19937. Use VSL_BRNG_MT2203 + i for the i-th
+		///            member of a family of independent streams.
 		////////////////////////////////////////////////////////////////////////
-		mkl_lnrand(double m, double sd, int size, int seed=1);
+		mkl_lnrand(double m, double sd, int size, int seed=1, int gen=VSL_BRNG_SFMT19937);
 		////////////////////////////////////////////////////////////////////////
 		/// Default destructor.
 		////////////////////////////////////////////////////////////////////////
@@ -152,7 +233,13 @@ namespace mklrand
 		////////////////////////////////////////////////////////////////////////
 		/// Return a single random number from the buffer.
 		////////////////////////////////////////////////////////////////////////
-		double gen();
+		double gen()
+		{
+			double out = randarr[curr];
+			if(++curr >= arr_size)
+				this->fill();
+			return out;
+		}
 		////////////////////////////////////////////////////////////////////////
 		/// Refill the buffer with fresh random numbers.
 		////////////////////////////////////////////////////////////////////////
@@ -174,6 +261,9 @@ namespace mklrand
 		double *randarr;
 		double mean, sd;
 
+		char* buffer_bytes() const {return (char*)randarr;}
+		int value_size() const {return sizeof(double);}
+
 	public:
 		////////////////////////////////////////////////////////////////////////
 		/// \brief Constructor
@@ -184,8 +274,11 @@ namespace mklrand
 		///             numbers.
 		/// \param seed The inital seed of the random number generator. Defaults
 		///             to 1.
+		/// \param gen The MKL basic generator to use. Defaults to
+		///            VSL_BRNG_SFMT19937. Use VSL_BRNG_MT2203 + i for the i-th
+		///            member of a family of independent streams.
 		////////////////////////////////////////////////////////////////////////
-		mkl_nrand(double m, double sdin, int size, int seed=1);
+		mkl_nrand(double m, double sdin, int size, int seed=1, int gen=VSL_BRNG_SFMT19937);
 		////////////////////////////////////////////////////////////////////////
 		/// Default destructor.
 		////////////////////////////////////////////////////////////////////////
@@ -193,12 +286,28 @@ namespace mklrand
 		////////////////////////////////////////////////////////////////////////
 		/// Return a single random number from the buffer.
 		////////////////////////////////////////////////////////////////////////
-		double gen();
+		double gen()
+		{
+			double out = randarr[curr];
+			if(++curr >= arr_size)
+				this->fill();
+			return out;
+		}
 		////////////////////////////////////////////////////////////////////////
 		/// Refill the buffer with fresh random numbers.
 		////////////////////////////////////////////////////////////////////////
 		void fill();
 		////////////////////////////////////////////////////////////////////////
+		/// \brief Write the next n random numbers to out.
+		///
+		/// The numbers are those n calls to gen would return. Whole buffers
+		/// are generated straight into out.
+		///
+		/// \param out Where the numbers are stored.
+		/// \param n The number of numbers.
+		////////////////////////////////////////////////////////////////////////
+		void fill(double *out, size_t n);
+		////////////////////////////////////////////////////////////////////////
 		/// \brief Change the current random seed.
 		///
 		/// \param seed The new seed.
@@ -0,0 +1,260 @@
+#ifndef OBSERVABLES_H
+#define OBSERVABLES_H
+#include "./sinks.hpp"
+#include <iosfwd>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Running mean and variance by Welford's algorithm.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Welford {
+        long n;
+        double mean;
+        /// Sum of squared deviations from the mean
+        double m2;
+
+        Welford() : n( 0 ), mean( 0 ), m2( 0 ) {}
+
+        /// Adds a value
+        void add( const double x )
+        {
+            n++;
+            double delta = x - mean;
+            mean += delta / n;
+            m2 += delta * ( x - mean );
+        }
+
+        /// The unbiased variance, zero for fewer than two values
+        double variance() const {return ( n > 1 ) ? m2 / ( n-1 ) : 0;}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Binning analysis of a correlated series.
+    ///
+    /// Level l holds the running mean and variance of the averages of
+    /// consecutive blocks of 2^l values. For a correlated series the naive
+    /// error of level zero is too small, and grows with the level until
+    /// the blocks are longer than the correlation time. Memory is fixed
+    /// and each value costs on average two updates.
+    ///////////////////////////////////////////////////////////////////////////
+    class Binning
+    {
+    private:
+        std::vector<Welford> levels;
+        /// The first of a pair of blocks at each level, while it waits for
+        /// the second
+        std::valarray<double> pending;
+        std::vector<char> has_pending;
+
+    public:
+        /// Levels kept, enough for 2^40 values
+        static const int max_levels = 40;
+
+        Binning();
+
+        /// Adds a value of the series
+        void add( const double x );
+
+        /// The number of values added
+        long count() const {return levels[0].n;}
+
+        /// The mean of the series
+        double mean() const {return levels[0].mean;}
+
+        /// The variance of the values
+        double variance() const {return levels[0].variance();}
+
+        /// The number of complete blocks at a level
+        long blocks( const int level ) const {return levels[level].n;}
+
+        /// The error of the mean from the blocks of a level
+        double error( const int level ) const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The error of the mean allowing for correlation.
+        ///
+        /// Taken from the highest level with at least min_blocks blocks, so
+        /// the blocks are as long as possible while their variance is still
+        /// well estimated.
+        ////////////////////////////////////////////////////////////////////////
+        double binned_error( const long min_blocks=32 ) const;
+
+        /// Writes the levels for a checkpoint
+        void save( std::ostream &out ) const;
+
+        /// Restores the levels written by save
+        void load( std::istream &in );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Running estimate of the autocorrelation of a series.
+    ///
+    /// The sums of products of values up to max_lag apart are kept as the
+    /// series grows, so the autocorrelation function, the integrated
+    /// autocorrelation time and the effective sample size can be read at
+    /// any point of a run. Each value costs max_lag multiply-adds and the
+    /// memory is fixed.
+    ///
+    /// The time is summed over a window chosen as by Sokal, the first lag
+    /// at least window times the time summed so far. If the series is too
+    /// correlated for that within max_lag, the time is taken from batch
+    /// means instead, which has no such limit but is noisier.
+    ///////////////////////////////////////////////////////////////////////////
+    class Autocorrelation
+    {
+    private:
+        size_t max_lag;
+        long n;
+        /// The first value, which the others are taken from
+        double shift;
+        /// The sum of the shifted values
+        double total;
+        /// The first max_lag shifted values
+        std::valarray<double> head;
+        /// The last max_lag shifted values, as a ring
+        std::valarray<double> recent;
+        /// Sum of the products of the shifted values k apart, for each k
+        std::valarray<double> lagged;
+        Binning batches;
+
+    public:
+        /// The window is at least this many autocorrelation times
+        static constexpr double window = 5;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param max_lag The longest lag the autocorrelation is found for
+        ////////////////////////////////////////////////////////////////////////
+        explicit Autocorrelation( const size_t max_lag=256 );
+
+        /// Adds a value of the series
+        void add( const double x );
+
+        /// The number of values added
+        long count() const {return n;}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The normalised autocorrelation function.
+        ///
+        /// \return The autocorrelation at lags from zero up to the smaller
+        ///         of max_lag and the number of values
+        ////////////////////////////////////////////////////////////////////////
+        std::valarray<double> function() const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The integrated autocorrelation time.
+        ///
+        /// Defined as 1 + 2 sum_k rho_k, so one for independent values.
+        /// A constant series has time one.
+        ////////////////////////////////////////////////////////////////////////
+        double time() const;
+
+        /// The number of independent values the series is worth
+        double ess() const;
+
+        /// True if the time was found within max_lag rather than from
+        /// batch means
+        bool resolved() const;
+
+        /// Writes the sums for a checkpoint
+        void save( std::ostream &out ) const;
+
+        /// Restores the sums written by save
+        void load( std::istream &in );
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Thermodynamic averages of a spin model with error bars.
+    ///
+    /// Energies are totals over the lattice and M is the magnitude of the
+    /// total magnetisation. The response functions are per spin in units
+    /// where k_B = 1.
+    ///////////////////////////////////////////////////////////////////////////
+    struct Observables {
+        /// The number of samples averaged
+        long samples;
+        /// <E> and <E^2>
+        double energy, energy_error;
+        double energy2, energy2_error;
+        /// <|M|>, <M^2> and <M^4>
+        double abs_magnetisation, abs_magnetisation_error;
+        double magnetisation2, magnetisation2_error;
+        double magnetisation4, magnetisation4_error;
+        /// beta^2 ( <E^2> - <E>^2 ) / N
+        double specific_heat, specific_heat_error;
+        /// beta ( <M^2> - <|M|>^2 ) / N
+        double susceptibility, susceptibility_error;
+        /// 1 - <M^4> / ( 3 <M^2>^2 )
+        double binder, binder_error;
+        /// Integrated autocorrelation time and effective sample size of
+        /// the energy and of |M|
+        double energy_time, energy_ess;
+        double magnetisation_time, magnetisation_ess;
+
+        Observables();
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief A sink which accumulates the thermodynamic averages.
+    ///
+    /// Each sample is an energy, as sampled by heisenberg_model with the
+    /// terms scaled by beta, so beta times the energy of the lattice, and
+    /// one value, |M|. The moments
+    /// are accumulated with Welford's algorithm and binning analysis gives
+    /// the error of each. The derived quantities are averaged over a fixed
+    /// number of bins, between 32 and 64, whose length doubles as the chain
+    /// grows, and their errors come from a jackknife over the bins. Energies
+    /// are binned as differences from the first so the variance does not
+    /// cancel. The autocorrelation of E and |M| is tracked as well, for the
+    /// effective sample size of the run so far. Nothing is allocated per
+    /// sample.
+    ///////////////////////////////////////////////////////////////////////////
+    class ThermoAccumulator : public SampleSink
+    {
+    private:
+        double beta;
+        size_t spins;
+        /// Energy of the first sample, which the bins are taken from
+        double shift;
+        /// E, E^2, |M|, M^2 and M^4
+        Binning moments[5];
+        /// Mean of each moment, with the energies shifted, in each bin
+        std::valarray<double> bins;
+        /// Sum of each moment in the unfinished bin
+        std::valarray<double> partial;
+        long bin_length, n_bins, n_partial;
+        Autocorrelation energy_correlation, magnetisation_correlation;
+
+        /// Adds the shifted moments of one sample to the current bin
+        void add_to_bins( const double e, const double m );
+
+    public:
+        /// Complete bins kept before pairs are merged
+        static const int max_bins = 64;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param beta The inverse temperature
+        /// \param spins The number of spins, which the response functions
+        ///              are divided by
+        /// \param options The draws to keep
+        ////////////////////////////////////////////////////////////////////////
+        ThermoAccumulator( const double beta, const size_t spins,
+                           const SinkOptions &options=SinkOptions() );
+
+        void write( const double energy,
+                    const std::valarray<double> &values ) override;
+        void save( std::ostream &out ) override;
+        void load( std::istream &in ) override;
+
+        /// The averages of the samples so far
+        Observables result() const;
+    };
+}
+
+#endif
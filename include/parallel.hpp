@@ -0,0 +1,101 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Threads that work on slabs of one large array together.
+    ///
+    /// For a single lattice too large for one core. The elements are split
+    /// into blocks of block_size, and thread t always takes the same run of
+    /// consecutive blocks, so each core keeps touching the same memory from
+    /// one call to the next. With pin set each worker is bound to a core,
+    /// so memory stays near the core that first touches it, and on a NUMA
+    /// node with automatic balancing it migrates there. The calling thread
+    /// works on the first slab.
+    ///
+    /// Sums are made of a partial sum for each block, added in block order,
+    /// so they are the same whatever the number of threads, and a chain
+    /// gives the same samples on one core as on 32. Calls wake the workers,
+    /// which costs some microseconds, so a pool only pays for lattices of
+    /// some hundred thousand spins or more. A pool serves one caller at a
+    /// time.
+    ///////////////////////////////////////////////////////////////////////////
+    class SlabPool
+    {
+    public:
+        /// Elements in each block of a sum
+        static const size_t block_size = 2048;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param threads The number of threads, the caller included. Zero
+        ///                uses one per core.
+        /// \param pin Bind worker t to core t, where supported
+        ////////////////////////////////////////////////////////////////////////
+        explicit SlabPool( const int threads=0, const bool pin=false );
+        ~SlabPool();
+        SlabPool( const SlabPool& ) = delete;
+        SlabPool& operator=( const SlabPool& ) = delete;
+
+        /// The number of threads, the caller included
+        int threads() const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Calls f( begin, end ) on the slab of each thread.
+        ///
+        /// The slabs cover [0, n) and end on block boundaries. An exception
+        /// from any slab is rethrown once all have finished.
+        ////////////////////////////////////////////////////////////////////////
+        void run( const size_t n,
+                  const std::function<void(size_t, size_t)> &f );
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief The sum of f( begin, end ) over the blocks of [0, n).
+        ////////////////////////////////////////////////////////////////////////
+        double sum( const size_t n,
+                    const std::function<double(size_t, size_t)> &f );
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Several sums over the blocks of [0, n) in one pass.
+        ///
+        /// f( begin, end, partial ) stores the k sums of one block in
+        /// partial, and the totals are stored in out.
+        ////////////////////////////////////////////////////////////////////////
+        void sums( const size_t n, const size_t k,
+                   const std::function<void(size_t, size_t, double*)> &f,
+                   double *out );
+
+    private:
+        struct Workers;
+        std::unique_ptr<Workers> workers;
+
+        /// Calls job( t ) on every thread t and waits for them all
+        void dispatch( const std::function<void(int)> &job );
+
+        /// The blocks of thread t
+        void slab( const size_t blocks, const int t,
+                   size_t &first, size_t &last ) const;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs the loops of an integrator on the slabs of a SlabPool.
+    ///
+    /// See leapfrog::SerialSlabs.
+    ///////////////////////////////////////////////////////////////////////////
+    struct PoolSlabs {
+        SlabPool *pool;
+
+        template <class Function>
+        void operator()( const size_t n, const Function &f ) const
+        {
+            pool->run( n, f );
+        }
+    };
+}
+
+#endif
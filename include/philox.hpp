@@ -0,0 +1,274 @@
+#ifndef _PHILOX
+#define _PHILOX
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+namespace philox
+{
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief One block of the Philox4x32-10 counter based generator.
+    ///
+    /// Ten rounds of multiplication and xor turn a 128 bit counter into
+    /// four random 32 bit words, with a different bijection for each 64 bit
+    /// key (Salmon et al., SC11). No state is carried from one block to the
+    /// next, so any block of any stream can be found directly.
+    ///
+    /// \param counter The four words of the counter
+    /// \param key The two words of the key
+    /// \param out Where the four random words are stored
+    ///////////////////////////////////////////////////////////////////////////
+    void philox4x32(const uint32_t counter[4], const uint32_t key[2],
+                    uint32_t out[4]);
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Base class for the Philox generators.
+    ///
+    /// Each generator is keyed by its seed and stream, and number i of it
+    /// comes from block i / per_block of the counter. The buffer is filled
+    /// a block at a time in a loop with no branches, so it vectorises, and
+    /// any position in the stream can be reached with seek without drawing
+    /// the numbers before it. Unlike the MKL generators there is no limit
+    /// on the number of streams and nothing is shared between them.
+    ///////////////////////////////////////////////////////////////////////////
+    class philox_randbase
+    {
+    protected:
+        int arr_size;
+        int curr;
+        int per_block;
+        uint32_t key[2];
+        /// The block the buffer starts at
+        uint64_t start;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The size of the buffer, rounded up to whole blocks
+        /// \param seed The seed, the first word of the key
+        /// \param stream The stream, the second word of the key
+        /// \param values The number of values made from each block
+        ////////////////////////////////////////////////////////////////////////
+        philox_randbase(int size, int seed, int stream, int values);
+        ////////////////////////////////////////////////////////////////////////
+        /// Fill the buffer from the blocks at start.
+        ////////////////////////////////////////////////////////////////////////
+        virtual void generate() = 0;
+        ////////////////////////////////////////////////////////////////////////
+        /// Tells the kinds of generator apart in a saved state.
+        ////////////////////////////////////////////////////////////////////////
+        virtual int kind() const = 0;
+        ////////////////////////////////////////////////////////////////////////
+        /// Copy the next n numbers of randarr to out, refilling it as gen does.
+        ////////////////////////////////////////////////////////////////////////
+        template <class T>
+        void copy_out(const std::vector<T> &randarr, T *out, size_t n)
+        {
+            while(n > 0)
+            {
+                size_t count = std::min(n, (size_t)(arr_size - curr));
+                std::copy(randarr.begin() + curr,
+                          randarr.begin() + curr + count, out);
+                out += count;
+                n -= count;
+                curr += count;
+                if(curr >= arr_size)
+                    fill();
+            }
+        }
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// Default destructor.
+        ////////////////////////////////////////////////////////////////////////
+        virtual ~philox_randbase(){}
+        ////////////////////////////////////////////////////////////////////////
+        /// Refill the buffer with the next random numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill();
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Change the current random seed.
+        ///
+        /// The stream starts again from its first number.
+        ///
+        /// \param seed The new seed.
+        ////////////////////////////////////////////////////////////////////////
+        void change_seed(int seed);
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Move to any number of the stream.
+        ///
+        /// The next call to gen returns the number it would have returned
+        /// after index calls from the start of the stream.
+        ///
+        /// \param index The position in the stream.
+        ////////////////////////////////////////////////////////////////////////
+        void seek(uint64_t index);
+        ////////////////////////////////////////////////////////////////////////
+        /// The position in the stream of the next number.
+        ////////////////////////////////////////////////////////////////////////
+        uint64_t position() const {return start*per_block + curr;}
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the complete state of the generator.
+        ///
+        /// Only the key and position are written, the buffer is found again
+        /// from them.
+        ///
+        /// \param out A binary stream to write to.
+        ////////////////////////////////////////////////////////////////////////
+        void write_state(std::ostream &out) const;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Restore a state written by write_state.
+        ///
+        /// The generator must be of the same kind and buffer size. Throws
+        /// std::runtime_error otherwise or if the input ends early.
+        ///
+        /// \param in A binary stream to read from.
+        ////////////////////////////////////////////////////////////////////////
+        void read_state(std::istream &in);
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Generator for uniform numbers between 0 and 1
+    ///////////////////////////////////////////////////////////////////////////
+    class philox_drand: public philox_randbase
+    {
+    private:
+        std::vector<double> randarr;
+
+        void generate();
+        int kind() const {return 1;}
+
+    public:
+        using philox_randbase::fill;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The size of the buffer which is created to hold random
+        ///             numbers.
+        /// \param seed The inital seed of the random number generator. Defaults
+        ///             to 1.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        philox_drand(int size, int seed=1, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
+        /// Return a single random number from the buffer.
+        ////////////////////////////////////////////////////////////////////////
+        double gen()
+        {
+            double out = randarr[curr];
+            if(++curr >= arr_size)
+                fill();
+            return out;
+        }
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(double *out, size_t n) {copy_out(randarr, out, n);}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Generator for uniform numbers either 0 or 1
+    ///////////////////////////////////////////////////////////////////////////
+    class philox_irand: public philox_randbase
+    {
+    private:
+        std::vector<int> randarr;
+
+        void generate();
+        int kind() const {return 2;}
+
+    public:
+        using philox_randbase::fill;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size The size of the buffer which is created to hold random
+        ///             numbers.
+        /// \param seed The inital seed of the random number generator. Defaults
+        ///             to 1.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        philox_irand(int size, int seed=1, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
+        /// Return a single random number from the buffer.
+        ////////////////////////////////////////////////////////////////////////
+        int gen()
+        {
+            int out = randarr[curr];
+            if(++curr >= arr_size)
+                fill();
+            return out;
+        }
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(int *out, size_t n) {copy_out(randarr, out, n);}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Generator for random numbers on a normal distribution
+    ///
+    /// Each block gives a pair of numbers by the Box-Muller transform, with
+    /// the sines and cosines of a whole buffer found by hmc::sincos_array.
+    ///////////////////////////////////////////////////////////////////////////
+    class philox_nrand: public philox_randbase
+    {
+    private:
+        std::vector<double> randarr;
+        std::vector<double> radius, angle, sines, cosines;
+        double mean, sd;
+
+        void generate();
+        int kind() const {return 3;}
+
+    public:
+        using philox_randbase::fill;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param m The mean of the normal distribution.
+        /// \param sdin The standard deviation of the normal distribution.
+        /// \param size The size of the buffer which is created to hold random
+        ///             numbers.
+        /// \param seed The inital seed of the random number generator. Defaults
+        ///             to 1.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        philox_nrand(double m, double sdin, int size, int seed=1, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
+        /// Return a single random number from the buffer.
+        ////////////////////////////////////////////////////////////////////////
+        double gen()
+        {
+            double out = randarr[curr];
+            if(++curr >= arr_size)
+                fill();
+            return out;
+        }
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(double *out, size_t n) {copy_out(randarr, out, n);}
+    };
+}
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef REPLICAS_H
+#define REPLICAS_H
+#include "./hmc.hpp"
+#include "./chains.hpp"
+#include <functional>
+#include <memory>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The angle Hamiltonian of many replicas of one small lattice.
+    ///
+    /// For disorder averages over dozens of lattices of the same geometry,
+    /// too small for the kernels of a single lattice to pay for their calls.
+    /// The replicas are stored together with the replica innermost: angle a
+    /// of the usual layout of a single state (every theta, then every phi)
+    /// is at a*replicas() + k for replica k. Every kernel then runs over
+    /// all of the replicas at once, one replica per vector lane: the trig
+    /// functions in one sincos_array pass, the neighbour sums with the
+    /// strides scaled by the number of replicas, and the site terms with
+    /// an inner loop over the replicas. There are no std::function calls
+    /// or valarray temporaries.
+    ///
+    /// Each replica has its own exchange constant and field.
+    ///////////////////////////////////////////////////////////////////////////
+    class ReplicaHamiltonian
+    {
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param system The lattice shared by every replica
+        /// \param options The exchange constant and field of each replica
+        ////////////////////////////////////////////////////////////////////////
+        ReplicaHamiltonian( const std::shared_ptr<HeisenbergSystem> &system,
+                            const std::vector<HamiltonianOptions> &options );
+
+        /// The number of replicas
+        int replicas() const {return J.size();}
+
+        /// The number of spins of each replica
+        int spins() const;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Energy of each replica and the gradient of all of them.
+        ///
+        /// \param grad_out Where the gradient is stored, in the layout of
+        ///                 state
+        /// \param state The angles of every replica, interleaved
+        /// \param energy Where the energy of each replica is stored
+        ////////////////////////////////////////////////////////////////////////
+        void operator()( std::valarray<double> &grad_out,
+                         const std::valarray<double> &state,
+                         double *energy ) const;
+
+        /// Interleaves one state per replica into the stored layout
+        std::valarray<double> pack(
+            const std::vector<std::valarray<double> > &states ) const;
+
+        /// The state of replica k taken out of the stored layout
+        std::valarray<double> unpack( const std::valarray<double> &state,
+                                      const int k ) const;
+
+    private:
+        std::shared_ptr<HeisenbergSystem> system;
+        std::vector<double> J, H;
+
+        // Work arrays of n*replicas() values, and the sums of each replica
+        mutable std::valarray<double> cos_the, sin_the, cos_phi, sin_phi;
+        mutable std::valarray<double> spin_x, spin_y, spin_z;
+        mutable std::valarray<double> field_x, field_y, field_z;
+        mutable std::valarray<double> exchange_sum, zeeman_sum;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Runs HMC chains of many replicas in lock step.
+    ///
+    /// Every replica takes the same number of leapfrog steps, so the steps
+    /// run over all of them at once, but each draws its momenta from and
+    /// is accepted or rejected with its own ChainRNG(seed, k) and keeps its
+    /// own trace. A replica follows the same chain as hmc::hmc would with
+    /// that stream and the same Hamiltonian, up to the rounding of the
+    /// trig functions.
+    ///
+    /// \param initial_states The starting angles of each replica
+    /// \param leapfrog_eps Time step for the leapfrog integrator
+    /// \param leapfrog_steps The number of leapfrog steps per sample
+    /// \param samples The number of samples per replica
+    /// \param hamiltonian The replicas' Hamiltonian
+    /// \param reduce Reduces the state of one replica for its trace
+    /// \param seed The seed shared by all replicas
+    ///////////////////////////////////////////////////////////////////////////
+    std::vector<ChainResult> replica_hmc(
+        const std::vector<std::valarray<double> > &initial_states,
+        const double leapfrog_eps,
+        const size_t leapfrog_steps,
+        const size_t samples,
+        const ReplicaHamiltonian &hamiltonian,
+        const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+        const int seed );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Heisenberg chains of many replicas of one lattice.
+    ///
+    /// As heisenberg_chains but with a fixed number of leapfrog steps, one
+    /// set of options per replica, and the replicas run in lock step by
+    /// replica_hmc on the calling thread.
+    ///
+    /// \param sample_energy Output energies, one valarray per replica
+    /// \param sample_magnetisation Output magnetisations, one per replica
+    /// \param system_dimensions The side lengths of the lattice
+    /// \param options The exchange constant and field of each replica
+    /// \param beta The relative temperature
+    /// \param leapfrog_eps Time step for the leapfrog integrator
+    /// \param leapfrog_steps The number of leapfrog steps per sample
+    /// \param nsamples The number of samples per replica
+    /// \param seed The seed shared by all replicas
+    ///////////////////////////////////////////////////////////////////////////
+    void heisenberg_replicas(
+        std::vector<std::valarray<double> > &sample_energy,
+        std::vector<std::valarray<double> > &sample_magnetisation,
+        const std::vector<int> system_dimensions,
+        const std::vector<HamiltonianOptions> &options,
+        const double beta,
+        const double leapfrog_eps,
+        const int leapfrog_steps,
+        const int nsamples,
+        const int seed );
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef RNG_H
+#define RNG_H
+
+#if defined( USEMKL )
+#include "./mklrand.hpp"
+#elif defined( USESTDRAND )
+#include "./stdrand.hpp"
+#else
+#include "./philox.hpp"
+#endif
+#include <climits>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The random number generators the samplers draw from.
+    ///
+    /// Picked when the library is built: MKL with USEMKL defined, the C++
+    /// standard library with USESTDRAND, and the portable Philox generators
+    /// otherwise, so that the library builds without MKL. Every backend has
+    /// the same constructors, with a buffer size, a seed and a stream,
+    /// and gen, write_state and read_state. Chains draw from distinct
+    /// streams, numbered from zero by rng_stream.
+    ///////////////////////////////////////////////////////////////////////////
+#if defined( USEMKL )
+    /// Uniform integers in {0, 1}
+    typedef mklrand::mkl_irand IntRNG;
+    /// Uniform doubles in [0, 1)
+    typedef mklrand::mkl_drand UniformRNG;
+    /// Normal doubles
+    typedef mklrand::mkl_nrand NormalRNG;
+
+    /// The number of independent streams, those of MT2203
+    const int rng_streams = 6024;
+
+    /// The basic generator of stream i
+    inline int rng_stream( const int i ) { return VSL_BRNG_MT2203 + i; }
+
+    /// The name of the backend
+    inline const char* rng_backend() { return "mkl"; }
+#elif defined( USESTDRAND )
+    typedef stdrand::std_irand IntRNG;
+    typedef stdrand::std_d_unirand UniformRNG;
+    typedef stdrand::std_normrand NormalRNG;
+
+    /// Streams are told apart by seeding the engine with the stream index
+    const int rng_streams = INT_MAX;
+
+    inline int rng_stream( const int i ) { return i; }
+
+    inline const char* rng_backend() { return "std"; }
+#else
+    typedef philox::philox_irand IntRNG;
+    typedef philox::philox_drand UniformRNG;
+    typedef philox::philox_nrand NormalRNG;
+
+    /// The stream index is the second word of the Philox key
+    const int rng_streams = INT_MAX;
+
+    inline int rng_stream( const int i ) { return i; }
+
+    inline const char* rng_backend() { return "philox"; }
+#endif
+}
+
+#endif
@@ -0,0 +1,271 @@
+#ifndef SINKS_H
+#define SINKS_H
+#include <fstream>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Writes the reduced form of a state into its first argument.
+    ///
+    /// The output is already sized to the width of the sink, so assigning
+    /// into it does not allocate.
+    ///////////////////////////////////////////////////////////////////////////
+    typedef std::function<void(std::valarray<double>&, const std::valarray<double>&)>
+        ReduceInto;
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Which draws of a chain a sink keeps.
+    ///
+    /// The first burn_in draws are dropped, then every thin-th draw is
+    /// kept starting with the first after the burn in. The samplers only
+    /// reduce the draws that are kept.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SinkOptions {
+        /// Draws dropped from the start of the chain
+        size_t burn_in;
+        /// Keep one draw in every thin
+        size_t thin;
+
+        SinkOptions() : burn_in( 0 ), thin( 1 ) {}
+
+        /// True if the draw with this index is kept
+        bool keeps( const size_t draw ) const
+        {
+            return draw >= burn_in && ( draw - burn_in ) % thin == 0;
+        }
+
+        /// Number of draws kept out of the first draws
+        size_t kept( const size_t draws ) const;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Where a sampler writes the samples it keeps.
+    ///
+    /// Each kept sample is its energy and width reduced values. Sinks
+    /// allocate their storage up front, so sampling into one does no
+    /// allocation per sample.
+    ///////////////////////////////////////////////////////////////////////////
+    class SampleSink
+    {
+    protected:
+        size_t n_width;
+        SinkOptions sink_options;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param width The number of reduced values of each sample
+        /// \param options The draws to keep
+        ////////////////////////////////////////////////////////////////////////
+        SampleSink( const size_t width, const SinkOptions &options );
+        virtual ~SampleSink() {}
+
+        /// The number of reduced values of each sample
+        size_t width() const {return n_width;}
+
+        /// The draws to keep
+        const SinkOptions& options() const {return sink_options;}
+
+        /// True if the draw with this index is kept
+        bool keeps( const size_t draw ) const {return sink_options.keeps( draw );}
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Stores a kept sample.
+        ///
+        /// \param energy The energy of the sample
+        /// \param values The reduced state, of size width()
+        ////////////////////////////////////////////////////////////////////////
+        virtual void write( const double energy,
+                            const std::valarray<double> &values ) = 0;
+
+        /// Writes the samples kept so far for a checkpoint
+        virtual void save( std::ostream &out ) = 0;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Restores the samples written by save.
+        ///
+        /// The sink must have been constructed as the one saved. Throws
+        /// std::runtime_error if the samples do not fit.
+        ////////////////////////////////////////////////////////////////////////
+        virtual void load( std::istream &in ) = 0;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Keeps every sample in one contiguous matrix.
+    ///
+    /// The values are stored row by row, one row per sample. Writing more
+    /// rows than were allocated throws std::length_error.
+    ///////////////////////////////////////////////////////////////////////////
+    class TraceMatrix : public SampleSink
+    {
+    private:
+        std::valarray<double> trace;
+        std::valarray<double> energies;
+        size_t n_rows;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param rows The number of samples to allocate, options.kept(draws)
+        ///             for a run of draws
+        /// \param width The number of reduced values of each sample
+        /// \param options The draws to keep
+        ////////////////////////////////////////////////////////////////////////
+        TraceMatrix( const size_t rows, const size_t width,
+                     const SinkOptions &options=SinkOptions() );
+
+        void write( const double energy,
+                    const std::valarray<double> &values ) override;
+        void save( std::ostream &out ) override;
+        void load( std::istream &in ) override;
+
+        /// The number of samples written
+        size_t size() const {return n_rows;}
+
+        /// Value col of sample row
+        double operator()( const size_t row, const size_t col ) const
+        {
+            return trace[row*n_width + col];
+        }
+
+        /// Every value, row by row. Rows past size() are zero.
+        const std::valarray<double>& values() const {return trace;}
+
+        /// The energy of each sample. Entries past size() are zero.
+        const std::valarray<double>& energy() const {return energies;}
+
+        /// Value col of every sample written
+        std::valarray<double> column( const size_t col ) const;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Keeps the most recent samples.
+    ///
+    /// Once full each sample replaces the oldest, so a chain of any length
+    /// can be watched in fixed memory.
+    ///////////////////////////////////////////////////////////////////////////
+    class RingBuffer : public SampleSink
+    {
+    private:
+        std::valarray<double> trace;
+        std::valarray<double> energies;
+        size_t n_capacity, n_written;
+
+        /// Position in the storage of the i-th oldest sample held
+        size_t slot( const size_t i ) const;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param capacity The number of samples held
+        /// \param width The number of reduced values of each sample
+        /// \param options The draws to keep
+        ////////////////////////////////////////////////////////////////////////
+        RingBuffer( const size_t capacity, const size_t width,
+                    const SinkOptions &options=SinkOptions() );
+
+        void write( const double energy,
+                    const std::valarray<double> &values ) override;
+        void save( std::ostream &out ) override;
+        void load( std::istream &in ) override;
+
+        /// The number of samples held, at most the capacity
+        size_t size() const;
+
+        /// The number of samples written since construction
+        size_t written() const {return n_written;}
+
+        /// Value col of the i-th oldest sample held
+        double operator()( const size_t i, const size_t col ) const
+        {
+            return trace[slot( i )*n_width + col];
+        }
+
+        /// Energy of the i-th oldest sample held
+        double energy( const size_t i ) const {return energies[slot( i )];}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Streams samples to a binary file.
+    ///
+    /// Each sample is written as its energy followed by its values, as
+    /// native doubles with no header, so the file can be read back with
+    /// numpy.fromfile(path).reshape(-1, width+1). Samples are buffered and
+    /// written in blocks. The buffer is flushed when full, by flush() and
+    /// on destruction. The file is replaced when first written. A
+    /// checkpoint records how many samples are in the file, and loading it
+    /// instead continues the file from there.
+    ///////////////////////////////////////////////////////////////////////////
+    class BinaryFileSink : public SampleSink
+    {
+    private:
+        std::string path;
+        std::ofstream file;
+        std::vector<double> buffer;
+        size_t n_buffered, buffer_rows, n_samples;
+
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// Throws std::runtime_error if the file cannot be opened.
+        ///
+        /// \param path The file to write, replaced if it exists
+        /// \param width The number of reduced values of each sample
+        /// \param options The draws to keep
+        /// \param buffer_rows The number of samples held before writing
+        ////////////////////////////////////////////////////////////////////////
+        BinaryFileSink( const std::string &path, const size_t width,
+                        const SinkOptions &options=SinkOptions(),
+                        const size_t buffer_rows=4096 );
+        ~BinaryFileSink();
+
+        void write( const double energy,
+                    const std::valarray<double> &values ) override;
+
+        /// Flushes the file and records its length
+        void save( std::ostream &out ) override;
+
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Continues the file from the length recorded by save.
+        ///
+        /// Samples after that point are overwritten as the chain writes
+        /// them again.
+        ////////////////////////////////////////////////////////////////////////
+        void load( std::istream &in ) override;
+
+        /// Writes the buffered samples to the file
+        void flush();
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Writes every sample into two sinks.
+    ///
+    /// The draws kept are those of the options given here. The options of
+    /// the two sinks are not consulted.
+    ///////////////////////////////////////////////////////////////////////////
+    class TeeSink : public SampleSink
+    {
+    private:
+        SampleSink &first, &second;
+
+    public:
+        TeeSink( SampleSink &first, SampleSink &second,
+                 const SinkOptions &options=SinkOptions() );
+
+        void write( const double energy,
+                    const std::valarray<double> &values ) override;
+        void save( std::ostream &out ) override;
+        void load( std::istream &in ) override;
+    };
+}
+
+#endif
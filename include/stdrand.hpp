@@ -1,6 +1,8 @@
 #ifndef _STDRAND
 #define _STDRAND
 
+#include <cstddef>
+#include <iosfwd>
 #include <random>
 
 namespace stdrand
@@ -27,6 +29,14 @@ namespace stdrand
     	/// \param seed The new seed.
     	////////////////////////////////////////////////////////////////////////
     	void change_seed(int seed){generator.seed(seed);}
+    	////////////////////////////////////////////////////////////////////////
+    	/// \brief Change the seed and pick one of a family of streams.
+    	///
+    	/// \param seed The new seed.
+    	/// \param stream The stream. Streams with the same seed are
+    	///               independent.
+    	////////////////////////////////////////////////////////////////////////
+    	void change_seed(int seed, int stream);
     };
 
     ///////////////////////////////////////////////////////////////////////////
@@ -45,6 +55,15 @@ namespace stdrand
     	////////////////////////////////////////////////////////////////////////
         std_d_unirand(int seed=1);
         ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor with the arguments of the buffered generators
+        ///
+        /// \param size Unused, there is no buffer.
+        /// \param seed The inital seed of the random number generator.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        std_d_unirand(int size, int seed, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
     	/// Default destructor.
     	////////////////////////////////////////////////////////////////////////
     	~std_d_unirand(){}
@@ -52,6 +71,75 @@ namespace stdrand
     	/// Return a single random number.
     	////////////////////////////////////////////////////////////////////////
     	double gen(){return distribution(generator);}
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(double *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = distribution(generator);
+        }
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the complete state of the generator.
+        ///
+        /// \param out A binary stream to write to.
+        ////////////////////////////////////////////////////////////////////////
+        void write_state(std::ostream &out) const;
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Restore a state written by write_state.
+        ///
+        /// Throws std::runtime_error if the state is of a different kind of
+        /// generator or the input ends early.
+        ///
+        /// \param in A binary stream to read from.
+        ////////////////////////////////////////////////////////////////////////
+        void read_state(std::istream &in);
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Generator for uniform numbers either 0 or 1
+    ///////////////////////////////////////////////////////////////////////////
+    class std_irand : public std_randbase
+    {
+    private:
+        std::uniform_int_distribution<int> distribution;
+    public:
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor
+        ///
+        /// \param size Unused, there is no buffer.
+        /// \param seed The inital seed of the random number generator. Defaults
+        ///             to 1.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        std_irand(int size, int seed=1, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
+        /// Return a single random number.
+        ////////////////////////////////////////////////////////////////////////
+        int gen(){return distribution(generator);}
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(int *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = distribution(generator);
+        }
+        /// As std_d_unirand::write_state
+        void write_state(std::ostream &out) const;
+        /// As std_d_unirand::read_state
+        void read_state(std::istream &in);
     };
 
     ///////////////////////////////////////////////////////////////////////////
@@ -72,6 +160,17 @@ namespace stdrand
     	////////////////////////////////////////////////////////////////////////
         std_normrand(double m, double sdin, int seed=1);
         ////////////////////////////////////////////////////////////////////////
+        /// \brief Constructor with the arguments of the buffered generators
+        ///
+        /// \param m The mean of the normal distribution.
+        /// \param sdin The standard deviation of the normal distribution.
+        /// \param size Unused, there is no buffer.
+        /// \param seed The inital seed of the random number generator.
+        /// \param stream The stream of the generator. Streams with the same
+        ///               seed are independent. Defaults to one no chain uses.
+        ////////////////////////////////////////////////////////////////////////
+        std_normrand(double m, double sdin, int size, int seed, int stream=-1);
+        ////////////////////////////////////////////////////////////////////////
     	/// Default destructor.
     	////////////////////////////////////////////////////////////////////////
     	~std_normrand(){}
@@ -79,6 +178,23 @@ namespace stdrand
     	/// Return a single random number.
     	////////////////////////////////////////////////////////////////////////
     	double gen(){return distribution(generator);}
+        ////////////////////////////////////////////////////////////////////////
+        /// \brief Write the next n random numbers to out.
+        ///
+        /// The numbers are those n calls to gen would return.
+        ///
+        /// \param out Where the numbers are stored.
+        /// \param n The number of numbers.
+        ////////////////////////////////////////////////////////////////////////
+        void fill(double *out, size_t n)
+        {
+            for(size_t i = 0; i < n; i++)
+                out[i] = distribution(generator);
+        }
+        /// As std_d_unirand::write_state
+        void write_state(std::ostream &out) const;
+        /// As std_d_unirand::read_state
+        void read_state(std::istream &in);
     };
 }
 
@@ -0,0 +1,89 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include "./hmc.hpp"
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief One point of a sweep.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SweepPoint {
+        /// The inverse temperature
+        double beta;
+        /// The field strength
+        double H;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Settings for a sweep.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SweepOptions {
+        /// Adaptation iterations at each point, starting from the step size
+        /// and metric of the point before. Not returned.
+        int warmup;
+        /// Draws dropped at each point before the samples are taken
+        int burn_in;
+        /// Sample with cartesian spins, as heisenberg_model_cartesian
+        bool cartesian;
+        /// Walk back through the points after the last one
+        bool hysteresis;
+        /// Keep the energy and magnetisation of every sample, rather than
+        /// only their averages
+        bool traces;
+
+        SweepOptions() : warmup( 0 ), burn_in( 0 ), cartesian( false ),
+                         hysteresis( false ), traces( true ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The output of a sweep.
+    ///
+    /// Everything is indexed by the order the points were visited in, so
+    /// with hysteresis the second half is the return walk.
+    ///////////////////////////////////////////////////////////////////////////
+    struct SweepResult {
+        /// The points in the order visited
+        std::vector<SweepPoint> points;
+        /// The step size, warmup and averages at each point
+        std::vector<ModelResult> results;
+        /// Energy of every sample at each point, if traces are kept
+        std::vector<std::valarray<double> > sample_energy;
+        /// Magnetisation of every sample at each point, if traces are kept
+        std::vector<std::valarray<double> > sample_magnetisation;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Samples the Heisenberg model along a path of (beta, H).
+    ///
+    /// The lattice is set up once and each point starts from the final
+    /// state, step size and metric of the point before, so a chain near
+    /// equilibrium needs little burn in. \f$\exp(-\beta E)\f$ is sampled at
+    /// each point, with J and H scaled by beta as heisenberg_model scales
+    /// them, and energies are returned unscaled by beta. With
+    /// hysteresis the points are visited in order and then in reverse,
+    /// starting again from the last, so results[k] and
+    /// results[2n-1-k] are the two branches at the same point. The first
+    /// point starts from the random state heisenberg_model starts from.
+    ///
+    /// \param system_dimensions The side lengths of the lattice
+    /// \param J The exchange constant
+    /// \param points The inverse temperature and field of each point
+    /// \param leapfrog_eps Time step for the leapfrog integrator, the
+    ///                     starting step size if there is a warmup
+    /// \param nsamples The number of samples kept at each point
+    /// \param sweep The warmup, burn in and direction settings
+    /// \param initial_state_seed The seed for the initial state
+    ///////////////////////////////////////////////////////////////////////////
+    SweepResult heisenberg_sweep(
+        const std::vector<int> system_dimensions,
+        const double J,
+        const std::vector<SweepPoint> &points,
+        const double leapfrog_eps,
+        const int nsamples,
+        const SweepOptions sweep,
+        const int initial_state_seed );
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef TEMPERING_H
+#define TEMPERING_H
+#include "./hmc.hpp"
+#include <valarray>
+#include <vector>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Settings for replica exchange.
+    ///////////////////////////////////////////////////////////////////////////
+    struct TemperingOptions {
+        /// NUTS samples each replica takes between swap attempts, at
+        /// least one
+        int swap_interval;
+        /// Swap rounds used to adapt the ladder before sampling starts.
+        /// Samples from these rounds are discarded.
+        int adapt_rounds;
+        /// Step size of the ladder adaptation
+        double adapt_rate;
+
+        TemperingOptions() : swap_interval( 10 ), adapt_rounds( 0 ),
+                             adapt_rate( 0.5 ) {}
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The output of a replica exchange run.
+    ///
+    /// Traces are indexed by position on the ladder, not by replica.
+    ///////////////////////////////////////////////////////////////////////////
+    struct TemperingResult {
+        /// The ladder used for sampling, after any adaptation
+        std::valarray<double> betas;
+        /// Energy of every sample at each beta
+        std::vector<std::valarray<double> > sample_energy;
+        /// Magnetisation of every sample at each beta
+        std::vector<std::valarray<double> > sample_magnetisation;
+        /// Swaps attempted between beta i and i+1 while sampling
+        std::valarray<double> swap_attempts;
+        /// Swaps accepted between beta i and i+1 while sampling
+        std::valarray<double> swap_accepts;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Parallel tempering of the Heisenberg model.
+    ///
+    /// Runs one NUTS replica per beta, each on its own thread, sampling
+    /// \f$\exp(-\beta E)\f$. Every swap_interval samples neighbouring
+    /// replicas attempt to exchange states, alternating between even and
+    /// odd pairs. During the adaptation rounds the spacing of the ladder is
+    /// moved toward equal swap acceptance for every pair; its end points do
+    /// not move. Energies are returned unscaled by beta.
+    ///
+    /// \param system_dimensions The side lengths of the lattice
+    /// \param options The exchange constant and field strength
+    /// \param betas The inverse temperatures, positive and strictly
+    ///              monotonic
+    /// \param leapfrog_eps Time step for the leapfrog integrator
+    /// \param nsamples The number of recorded samples at each beta
+    /// \param temper The swap and adaptation settings
+    /// \param nthreads The number of threads. Zero uses one per core.
+    /// \param seed The seed for the initial states and random streams
+    ///////////////////////////////////////////////////////////////////////////
+    TemperingResult heisenberg_tempering(
+        const std::vector<int> system_dimensions,
+        const HamiltonianOptions options,
+        const std::vector<double> &betas,
+        const double leapfrog_eps,
+        const int nsamples,
+        const TemperingOptions temper,
+        const int nthreads,
+        const int seed );
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Moves a ladder toward equal swap acceptance.
+    ///
+    /// Each gap between neighbouring betas is scaled by
+    /// exp(rate * (acceptance - mean acceptance)) and the gaps are then
+    /// rescaled so that the first and last beta are unchanged.
+    ///
+    /// \param betas The ladder, updated in place
+    /// \param acceptance The swap acceptance of each neighbouring pair
+    /// \param rate The step size of the update
+    ///////////////////////////////////////////////////////////////////////////
+    void adapt_ladder(
+        std::valarray<double> &betas,
+        const std::valarray<double> &acceptance,
+        const double rate );
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TRIG_H
+#define TRIG_H
+#include <cstddef>
+
+namespace hmc {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The sine and cosine of every element of an array.
+    ///
+    /// Both are found together in a single pass with the same polynomial
+    /// kernels as fdlibm, to within an ulp or two of the C library. The loop
+    /// has no branches or library calls so it vectorises, and it is built
+    /// for SSE2, AVX2 and AVX-512 with the widest the processor supports
+    /// picked the first time it is called. It does not depend on MKL, so
+    /// GCC builds get the same speed up. Elements too large for the kernel
+    /// and non-finite ones go through std::sin and std::cos.
+    ///
+    /// \param x The angles
+    /// \param sin_out Where the sines are stored
+    /// \param cos_out Where the cosines are stored
+    /// \param n The number of angles
+    ///////////////////////////////////////////////////////////////////////////
+    void sincos_array( const double *x, double *sin_out, double *cos_out,
+                       const size_t n );
+
+    /// The instruction set sincos_array runs with: avx512, avx2 or sse2,
+    /// or generic off x86
+    const char* sincos_isa();
+}
+
+#endif
@@ -0,0 +1,295 @@
+#include "../include/adapt.hpp"
+#include "../include/checkpoint.hpp"
+#include <algorithm>
+#include <cmath>
+
+hmc::DualAveraging::DualAveraging(
+    const double eps,
+    const AdaptOptions &options )
+    : options( options ),
+      mu( std::log( 10 * eps ) ),
+      log_eps( std::log( eps ) ),
+      log_eps_bar( std::log( eps ) ),
+      h_bar( 0 ),
+      t( 0 )
+{}
+
+double hmc::DualAveraging::update( const double accept )
+{
+    // Divergent trajectories give no acceptance at all
+    double a = ( accept >= 0 ) ? std::fmin( accept, 1.0 ) : 0.0;
+
+    t++;
+    double eta = 1.0 / ( t + options.t0 );
+    h_bar = ( 1 - eta ) * h_bar + eta * ( options.target_accept - a );
+    log_eps = mu - std::sqrt( double( t ) ) / options.gamma * h_bar;
+
+    double w = std::pow( double( t ), -options.kappa );
+    log_eps_bar = w * log_eps + ( 1 - w ) * log_eps_bar;
+    return std::exp( log_eps );
+}
+
+double hmc::DualAveraging::adapted() const
+{
+    return std::exp( log_eps_bar );
+}
+
+void hmc::DualAveraging::restart( const double eps )
+{
+    mu = std::log( 10 * eps );
+    log_eps = std::log( eps );
+    log_eps_bar = std::log( eps );
+    h_bar = 0;
+    t = 0;
+}
+
+void hmc::DualAveraging::save( std::ostream &out ) const
+{
+    write_value( out, mu );
+    write_value( out, log_eps );
+    write_value( out, log_eps_bar );
+    write_value( out, h_bar );
+    write_value( out, t );
+}
+
+void hmc::DualAveraging::load( std::istream &in )
+{
+    read_value( in, mu );
+    read_value( in, log_eps );
+    read_value( in, log_eps_bar );
+    read_value( in, h_bar );
+    read_value( in, t );
+}
+
+namespace
+{
+    // Makes v orthonormal to the first k vectors of basis and returns
+    // false if nothing of it is left
+    bool orthonormalise(
+        std::valarray<double> &v,
+        const std::vector<std::valarray<double> > &basis,
+        const size_t k )
+    {
+        for( size_t j=0; j<k; j++ )
+            v -= ( v * basis[j] ).sum() * basis[j];
+        double norm = std::sqrt( ( v * v ).sum() );
+        if( !( norm > 1e-12 ) )
+            return false;
+        v /= norm;
+        return true;
+    }
+}
+
+hmc::MetricEstimator::MetricEstimator( const size_t size, const int rank )
+    : n( 0 ), rank( rank ), mean( 0.0, size ), m2( 0.0, size )
+{}
+
+void hmc::MetricEstimator::add_sample( const std::valarray<double> &state )
+{
+    n++;
+    for( size_t i=0; i<state.size(); i++ )
+    {
+        double delta = state[i] - mean[i];
+        mean[i] += delta / n;
+        m2[i] += delta * ( state[i] - mean[i] );
+    }
+    if( rank > 0 )
+        samples.push_back( state );
+}
+
+void hmc::MetricEstimator::restart()
+{
+    n = 0;
+    mean = 0;
+    m2 = 0;
+    samples.clear();
+}
+
+void hmc::MetricEstimator::estimate( Metric &metric ) const
+{
+    metric.directions.clear();
+    metric.values.resize( 0 );
+    if( n < 2 )
+        return;
+
+    // Shrink towards 1e-3 with the weight of five samples
+    const double w = n / ( n + 5.0 );
+    std::valarray<double> var = m2 / double( n-1 );
+    metric.scale = std::sqrt( w * var + 1e-3 * ( 1 - w ) );
+
+    const size_t size = mean.size();
+    const size_t k = std::min( std::min( size_t( rank ), size_t( n-1 ) ), size );
+    if( k == 0 )
+        return;
+
+    // Product with the correlation matrix of the scaled states
+    std::vector<std::valarray<double> > scaled( n );
+    for( long s=0; s<n; s++ )
+        scaled[s] = ( samples[s] - mean ) / metric.scale;
+    auto correlation = [&]( std::valarray<double> &out,
+                            const std::valarray<double> &v )
+    {
+        out = 0;
+        for( long s=0; s<n; s++ )
+            out += ( scaled[s] * v ).sum() * scaled[s];
+        out /= double( n-1 );
+    };
+
+    // Subspace iteration started from the states themselves
+    std::vector<std::valarray<double> > basis( k, std::valarray<double>( size ) );
+    for( size_t j=0; j<k; j++ )
+    {
+        basis[j] = scaled[j];
+        if( !orthonormalise( basis[j], basis, j ) )
+        {
+            basis[j] = 0;
+            basis[j][j] = 1;
+            orthonormalise( basis[j], basis, j );
+        }
+    }
+    std::valarray<double> product( size );
+    for( int iter=0; iter<20; iter++ )
+    {
+        for( size_t j=0; j<k; j++ )
+        {
+            correlation( product, basis[j] );
+            basis[j] = product;
+            if( !orthonormalise( basis[j], basis, j ) )
+                return;
+        }
+    }
+
+    // Keep the directions of strong correlation, shrunk as the variances
+    std::vector<double> values;
+    for( size_t j=0; j<k; j++ )
+    {
+        correlation( product, basis[j] );
+        double value = ( product * basis[j] ).sum();
+        if( value > 1 )
+        {
+            metric.directions.push_back( basis[j] );
+            values.push_back( 1 + w * ( value - 1 ) );
+        }
+    }
+    metric.values = std::valarray<double>( values.data(), values.size() );
+}
+
+void hmc::MetricEstimator::save( std::ostream &out ) const
+{
+    write_value( out, n );
+    write_array( out, mean );
+    write_array( out, m2 );
+    write_value( out, samples.size() );
+    for( auto &sample : samples )
+        write_array( out, sample );
+}
+
+void hmc::MetricEstimator::load( std::istream &in )
+{
+    read_value( in, n );
+    read_array( in, mean );
+    read_array( in, m2 );
+    size_t count;
+    read_value( in, count );
+    samples.resize( count );
+    for( auto &sample : samples )
+        read_array( in, sample );
+}
+
+hmc::WindowedAdaptation::WindowedAdaptation(
+    const size_t size,
+    const double eps,
+    const AdaptOptions &options,
+    const Metric &metric )
+    : options( options ),
+      adapt_metric( options.metric != MetricAdaptation::none ),
+      init( options.init_buffer ),
+      window( options.base_window ),
+      iteration( 0 ),
+      eps( eps ),
+      step_size( eps, options ),
+      estimator( size, ( options.metric == MetricAdaptation::low_rank ) ? options.rank : 0 )
+{
+    // Short warmups are split in proportion
+    int term = options.term_buffer;
+    if( init + window + term > options.warmup )
+    {
+        init = 0.15 * options.warmup;
+        term = 0.1 * options.warmup;
+        window = options.warmup - init - term;
+    }
+    last = options.warmup - term;
+    window_end = std::min( init + window, last );
+
+    res.acceptance.resize( options.warmup );
+    res.step_size.resize( options.warmup );
+    res.metric = metric;
+}
+
+bool hmc::WindowedAdaptation::update(
+    const double accept,
+    const std::valarray<double> &state )
+{
+    const int i = iteration++;
+    res.step_size[i] = eps;
+    res.acceptance[i] = accept;
+    eps = step_size.update( accept );
+
+    if( !adapt_metric || i < init || i >= last )
+        return false;
+    estimator.add_sample( state );
+    if( i+1 < window_end )
+        return false;
+
+    // End of a window, the step size starts again for the new metric
+    estimator.estimate( res.metric );
+    estimator.restart();
+    eps = step_size.adapted();
+    step_size.restart( eps );
+
+    // The next window is twice as long, and takes the rest if the one
+    // after would not fit
+    window *= 2;
+    window_end = i+1 + window;
+    if( window_end + 2*window >= last )
+        window_end = last;
+    return true;
+}
+
+hmc::WarmupResult hmc::WindowedAdaptation::result() const
+{
+    WarmupResult out( res );
+    out.eps = step_size.adapted();
+    return out;
+}
+
+void hmc::WindowedAdaptation::save( std::ostream &out ) const
+{
+    write_value( out, options.warmup );
+    write_value( out, window );
+    write_value( out, window_end );
+    write_value( out, iteration );
+    write_value( out, eps );
+    step_size.save( out );
+    estimator.save( out );
+    write_array( out, res.acceptance );
+    write_array( out, res.step_size );
+    res.metric.save( out );
+}
+
+void hmc::WindowedAdaptation::load( std::istream &in )
+{
+    int warmup;
+    read_value( in, warmup );
+    if( warmup != options.warmup )
+        throw std::runtime_error( "WindowedAdaptation: checkpoint is of a warmup of different length" );
+    read_value( in, window );
+    read_value( in, window_end );
+    read_value( in, iteration );
+    read_value( in, eps );
+    step_size.load( in );
+    estimator.load( in );
+    read_array( in, res.acceptance );
+    read_array( in, res.step_size );
+    res.metric.load( in );
+}
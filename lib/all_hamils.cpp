@@ -1,116 +1,464 @@
 #include "../include/all_hamils.hpp"
+#include "../include/dipolar.hpp"
+#include "../include/trig.hpp"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <stdexcept>
 
-namespace hmc
+namespace
 {
-    int halfsize;
-    std::vector<std::gslice> large_slice, small_slice, opp_large_slice;
-    std::vector<std::gslice> opp_small_slice;
-    std::slice tslice, pslice;
-    std::valarray<double> temp, small_temp, cos_the, sin_the, cos_phi, sin_phi;
+    // Adds the previous site along an axis to sites [begin, end) of out.
+    // The axis has neighbours s apart and wraps within blocks of p sites.
+    // The inner loops are contiguous so they vectorise.
+    template <class Real>
+    void add_previous(
+        const Real * __restrict in,
+        Real * __restrict out,
+        const int begin, const int end, const int s, const int p)
+    {
+        for(int b = begin - begin % p; b < end; b += p)
+        {
+            const Real *src = in + b;
+            Real *dst = out + b;
+            const int lo = std::max(begin - b, 0), hi = std::min(end - b, p);
+            for(int o = lo; o < std::min(hi, s); o++)
+                dst[o] += src[o + p - s];
+            for(int o = std::max(lo, s); o < hi; o++)
+                dst[o] += src[o - s];
+        }
+    }
+
+    // Stores the sum of the neighbours in the table of sites [begin, end).
+    // With the same number of neighbours at every site the rows are found
+    // without the offsets.
+    template <class Real>
+    void table_sum(
+        const hmc::Lattice &lattice,
+        const Real * __restrict in,
+        Real * __restrict out,
+        const int begin, const int end)
+    {
+        const int *table = lattice.neighbour_table().data();
+        const int degree = lattice.degree();
+        if(degree > 0)
+        {
+            for(int i = begin; i < end; i++)
+            {
+                const int *row = table + i*degree;
+                Real sum = 0;
+                for(int k = 0; k < degree; k++)
+                    sum += in[row[k]];
+                out[i] = sum;
+            }
+            return;
+        }
+
+        const int *start = lattice.offsets().data();
+        for(int i = begin; i < end; i++)
+        {
+            Real sum = 0;
+            for(int k = start[i]; k < start[i+1]; k++)
+                sum += in[table[k]];
+            out[i] = sum;
+        }
+    }
+
+    // Adds the previous and next sites along an axis to sites [begin, end)
+    // of out. Needs at least two sites along the axis.
+    template <class Real>
+    void add_both(
+        const Real * __restrict in,
+        Real * __restrict out,
+        const int begin, const int end, const int s, const int p)
+    {
+        for(int b = begin - begin % p; b < end; b += p)
+        {
+            const Real *src = in + b;
+            Real *dst = out + b;
+            const int lo = std::max(begin - b, 0), hi = std::min(end - b, p);
+            for(int o = lo; o < std::min(hi, s); o++)
+                dst[o] += src[o + p - s] + src[o + s];
+            for(int o = std::max(lo, s); o < std::min(hi, p - s); o++)
+                dst[o] += src[o - s] + src[o + s];
+            for(int o = std::max(lo, p - s); o < hi; o++)
+                dst[o] += src[o - s] + src[o + s - p];
+        }
+    }
+}
+
+hmc::HeisenbergSystem::HeisenbergSystem(const int size, const int dim)
+{
+    set_slices(size, dim);
+}
+
+hmc::HeisenbergSystem::HeisenbergSystem(const std::vector<int> &sides)
+{
+    set_sides(sides);
+}
+
+hmc::HeisenbergSystem::HeisenbergSystem(
+    const std::shared_ptr<const Lattice> &lattice)
+    : halfsize(lattice->size()), dim(lattice->dimension()), lattice(lattice)
+{
+    allocate(halfsize);
 }
 
-double hmc::zeeman_energy(
-    const double H)
+void hmc::HeisenbergSystem::set_pool(const std::shared_ptr<SlabPool> &pool)
 {
-    return -H * cos_the.sum();
+    slabs = pool;
 }
 
-void hmc::zeeman_grad(
+double hmc::HeisenbergSystem::zeeman_energy(
+    const double H) const
+{
+    const double *ct = &cos_the[0];
+    return -H * sum_sites([=](const size_t begin, const size_t end)
+    {
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+            sum += ct[i];
+        return sum;
+    });
+}
+
+void hmc::HeisenbergSystem::zeeman_grad(
     std::valarray<double>& grad_out,
-    const double H)
+    const double H) const
 {
-    grad_out[tslice] += H * sin_the;
+    const double *st = &sin_the[0];
+    double *g_the = &grad_out[0];
+    for_sites([=](const size_t begin, const size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+            g_the[i] += H * st[i];
+    });
 }
 
-double hmc::exchange_energy(
-    const double J,
-    const int d)
+double hmc::HeisenbergSystem::zeeman_energy_grad(
+    std::valarray<double>& grad_out,
+    const double H) const
 {
-    double temp_sum = 0;
+    const double *ct = &cos_the[0], *st = &sin_the[0];
+    double *g_the = &grad_out[0];
+    return -H * sum_sites([=](const size_t begin, const size_t end)
+    {
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+        {
+            g_the[i] += H * st[i];
+            sum += ct[i];
+        }
+        return sum;
+    });
+}
 
-    // mult xs
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+void hmc::HeisenbergSystem::neighbour_sum(
+    const double *in_p,
+    double *out_p,
+    const bool both,
+    const int begin,
+    const int end) const
+{
+    if(lattice)
     {
-        small_temp[opp_large_slice[i]] += cos_phi[large_slice[i]]*sin_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += cos_phi[small_slice[i]]*sin_the[small_slice[i]];
+        table_sum(*lattice, in_p, out_p, begin, end);
+        // The table holds every bond from both ends
+        if(!both)
+            for(int i = begin; i < end; i++)
+                out_p[i] *= 0.5;
+        return;
     }
-    temp_sum += (cos_phi*sin_the*small_temp).sum();
 
-    // mult ys
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+    std::fill(out_p + begin, out_p + end, 0.0);
+    for(int i = 0; i < dim; i++)
     {
-        small_temp[opp_large_slice[i]] += sin_phi[large_slice[i]]*sin_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += sin_phi[small_slice[i]]*sin_the[small_slice[i]];
+        if(both)
+            add_both(in_p, out_p, begin, end, stride[i], period[i]);
+        else
+            add_previous(in_p, out_p, begin, end, stride[i], period[i]);
     }
-    temp_sum += (sin_phi*sin_the*small_temp).sum();
+}
 
-    // mult zs
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+template <class Real>
+void hmc::HeisenbergSystem::neighbour_field(
+    const Real *spins,
+    Real *field) const
+{
+    for_sites([=](const size_t begin, const size_t end)
     {
-        small_temp[opp_large_slice[i]] += cos_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += cos_the[small_slice[i]];
+        for(int c = 0; c < 3; c++)
+        {
+            const Real *in_p = spins + c*halfsize;
+            Real *out_p = field + c*halfsize;
+            if(lattice)
+            {
+                table_sum(*lattice, in_p, out_p, begin, end);
+                continue;
+            }
+            std::fill(out_p + begin, out_p + end, Real(0));
+            for(int i = 0; i < dim; i++)
+                add_both(in_p, out_p, begin, end, stride[i], period[i]);
+        }
+    });
+}
+
+void hmc::HeisenbergSystem::lane_neighbour_sum(
+    const double *in,
+    double *out,
+    const int lanes) const
+{
+    const int n = halfsize * lanes;
+    if(lattice)
+    {
+        const int *table = lattice->neighbour_table().data();
+        const int *start = lattice->offsets().data();
+        for(int i = 0; i < halfsize; i++)
+        {
+            double *dst = out + i*lanes;
+            std::fill(dst, dst + lanes, 0.0);
+            for(int k = start[i]; k < start[i+1]; k++)
+            {
+                const double *src = in + table[k]*lanes;
+                for(int l = 0; l < lanes; l++)
+                    dst[l] += src[l];
+            }
+        }
+        return;
     }
-    temp_sum += (cos_the*small_temp).sum();
+
+    std::fill(out, out + n, 0.0);
+    for(int i = 0; i < dim; i++)
+        add_both(in, out, 0, n, stride[i]*lanes, period[i]*lanes);
+}
+
+template void hmc::HeisenbergSystem::neighbour_field<float>(
+    const float *spins, float *field) const;
+template void hmc::HeisenbergSystem::neighbour_field<double>(
+    const double *spins, double *field) const;
+
+void hmc::HeisenbergSystem::calc_spins()
+{
+    const double *ct = &cos_the[0], *st = &sin_the[0];
+    const double *cp = &cos_phi[0], *sp = &sin_phi[0];
+    double *sx = &spin_x[0], *sy = &spin_y[0], *sz = &spin_z[0];
+    for_sites([=](const size_t begin, const size_t end)
+    {
+        for(size_t i = begin; i < end; i++)
+        {
+            sx[i] = cp[i]*st[i];
+            sy[i] = sp[i]*st[i];
+            sz[i] = ct[i];
+        }
+    });
+}
+
+double hmc::HeisenbergSystem::exchange_energy(
+    const double J)
+{
+    calc_spins();
+    const double *comps[3] = { &spin_x[0], &spin_y[0], &spin_z[0] };
+    double *temp = &small_temp[0];
+
+    // Each component in turn, counting each bond once
+    double temp_sum = sum_sites([&](const size_t begin, const size_t end)
+    {
+        double sum = 0;
+        for(const double *comp : comps)
+        {
+            neighbour_sum(comp, temp, false, begin, end);
+            double dot = 0;
+            for(size_t i = begin; i < end; i++)
+                dot += comp[i]*temp[i];
+            sum += dot;
+        }
+        return sum;
+    });
 
     return -J * temp_sum;
 }
 
-void hmc::exchange_grad(
+void hmc::HeisenbergSystem::exchange_grad(
     std::valarray<double>& grad_out,
-    const double J,
-    const int d)
+    const double J)
 {
-    // mult xs
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+    exchange_energy_grad(grad_out, J);
+}
+
+double hmc::HeisenbergSystem::exchange_energy_grad(
+    std::valarray<double>& grad_out,
+    const double J)
+{
+    calc_field();
+
+    // Every bond appears twice in the full neighbour field
+    const int n = halfsize;
+    const double *ct = &cos_the[0], *st = &sin_the[0];
+    const double *cp = &cos_phi[0], *sp = &sin_phi[0];
+    const double *hx = &field_x[0], *hy = &field_y[0], *hz = &field_z[0];
+    double *g_the = &grad_out[0];
+    double *g_phi = &grad_out[n];
+    double temp_sum = sum_sites([=](const size_t begin, const size_t end)
     {
-        small_temp[opp_large_slice[i]] += cos_phi[large_slice[i]]*sin_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += cos_phi[small_slice[i]]*sin_the[small_slice[i]];
-        small_temp[large_slice[i]] += cos_phi[opp_large_slice[i]]*sin_the[opp_large_slice[i]];
-        small_temp[small_slice[i]] += cos_phi[opp_small_slice[i]]*sin_the[opp_small_slice[i]];
-    }
-    grad_out[pslice] -= J*sin_phi*sin_the*small_temp;
-    grad_out[tslice] += J*cos_phi*cos_the*small_temp;
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+        {
+            double h_plane = cp[i]*hx[i] + sp[i]*hy[i];
+            sum += st[i]*h_plane + ct[i]*hz[i];
+            g_phi[i] -= J*st[i]*(cp[i]*hy[i] - sp[i]*hx[i]);
+            g_the[i] -= J*(ct[i]*h_plane - st[i]*hz[i]);
+        }
+        return sum;
+    });
+
+    return -0.5 * J * temp_sum;
+}
+
+void hmc::HeisenbergSystem::calc_field()
+{
+    calc_spins();
+    calc_field(&spin_x[0], &spin_y[0], &spin_z[0]);
+}
 
-    // mult ys
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+void hmc::HeisenbergSystem::calc_field(const std::valarray<double> &spins)
+{
+    calc_field(&spins[0], &spins[halfsize], &spins[2*halfsize]);
+}
+
+void hmc::HeisenbergSystem::calc_field(
+    const double *x,
+    const double *y,
+    const double *z)
+{
+    double *hx = &field_x[0], *hy = &field_y[0], *hz = &field_z[0];
+    for_sites([=](const size_t begin, const size_t end)
     {
-        small_temp[opp_large_slice[i]] += sin_phi[large_slice[i]]*sin_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += sin_phi[small_slice[i]]*sin_the[small_slice[i]];
-        small_temp[large_slice[i]] += sin_phi[opp_large_slice[i]]*sin_the[opp_large_slice[i]];
-        small_temp[small_slice[i]] += sin_phi[opp_small_slice[i]]*sin_the[opp_small_slice[i]];
+        neighbour_sum(x, hx, true, begin, end);
+        neighbour_sum(y, hy, true, begin, end);
+        neighbour_sum(z, hz, true, begin, end);
+    });
+}
+
+void hmc::HeisenbergSystem::calc_dipolar_field(
+    const double *x,
+    const double *y,
+    const double *z)
+{
+    if(!dipoles)
+    {
+        dipoles = std::make_shared<DipolarField>(positions());
+        dipole_x.resize(halfsize);
+        dipole_y.resize(halfsize);
+        dipole_z.resize(halfsize);
     }
-    grad_out[pslice] += J*cos_phi*sin_the*small_temp;
-    grad_out[tslice] += J*sin_phi*cos_the*small_temp;
+    dipoles->field(x, y, z, &dipole_x[0], &dipole_y[0], &dipole_z[0]);
+}
+
+double hmc::HeisenbergSystem::dipolar_energy(
+    const double D)
+{
+    calc_spins();
+    calc_dipolar_field(&spin_x[0], &spin_y[0], &spin_z[0]);
+    const double *sx = &spin_x[0], *sy = &spin_y[0], *sz = &spin_z[0];
+    const double *hx = &dipole_x[0], *hy = &dipole_y[0], *hz = &dipole_z[0];
+    return 0.5 * D * sum_sites([=](const size_t begin, const size_t end)
+    {
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+            sum += sx[i]*hx[i] + sy[i]*hy[i] + sz[i]*hz[i];
+        return sum;
+    });
+}
+
+double hmc::HeisenbergSystem::dipolar_energy_grad(
+    std::valarray<double>& grad_out,
+    const double D)
+{
+    calc_spins();
+    calc_dipolar_field(&spin_x[0], &spin_y[0], &spin_z[0]);
 
-    // mult zs
-    small_temp = 0;
-    for(int i = 0; i < d; i++)
+    // The field is the gradient with respect to the spin vectors, taken
+    // through the derivatives of the spins with respect to the angles
+    const int n = halfsize;
+    const double *ct = &cos_the[0], *st = &sin_the[0];
+    const double *cp = &cos_phi[0], *sp = &sin_phi[0];
+    const double *hx = &dipole_x[0], *hy = &dipole_y[0], *hz = &dipole_z[0];
+    double *g_the = &grad_out[0];
+    double *g_phi = &grad_out[n];
+    return 0.5 * D * sum_sites([=](const size_t begin, const size_t end)
     {
-        small_temp[opp_large_slice[i]] += cos_the[large_slice[i]];
-        small_temp[opp_small_slice[i]] += cos_the[small_slice[i]];
-        small_temp[large_slice[i]] += cos_the[opp_large_slice[i]];
-        small_temp[small_slice[i]] += cos_the[opp_small_slice[i]];
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+        {
+            double h_plane = cp[i]*hx[i] + sp[i]*hy[i];
+            sum += st[i]*h_plane + ct[i]*hz[i];
+            g_the[i] += D*(ct[i]*h_plane - st[i]*hz[i]);
+            g_phi[i] += D*st[i]*(cp[i]*hy[i] - sp[i]*hx[i]);
+        }
+        return sum;
+    });
+}
+
+double hmc::HeisenbergSystem::vector_dipolar_energy_grad(
+    std::valarray<double>& grad_out,
+    const std::valarray<double> &spins,
+    const double D)
+{
+    const int n = halfsize;
+    const double *sx = &spins[0], *sy = &spins[n], *sz = &spins[2*n];
+    calc_dipolar_field(sx, sy, sz);
+    const double *hx = &dipole_x[0], *hy = &dipole_y[0], *hz = &dipole_z[0];
+    double *gx = &grad_out[0], *gy = &grad_out[n], *gz = &grad_out[2*n];
+    return 0.5 * D * sum_sites([=](const size_t begin, const size_t end)
+    {
+        double sum = 0;
+        for(size_t i = begin; i < end; i++)
+        {
+            sum += sx[i]*hx[i] + sy[i]*hy[i] + sz[i]*hz[i];
+            gx[i] += D*hx[i];
+            gy[i] += D*hy[i];
+            gz[i] += D*hz[i];
+        }
+        return sum;
+    });
+}
+
+std::vector<double> hmc::HeisenbergSystem::positions() const
+{
+    std::vector<double> res(3*halfsize, 0.0);
+    for(int i = 0; i < halfsize; i++)
+    {
+        if(lattice)
+        {
+            std::copy(lattice->position(i), lattice->position(i) + 3,
+                      &res[3*i]);
+            continue;
+        }
+        for(int d = 0; d < dim && d < 3; d++)
+            res[3*i + d] = (i % period[d]) / stride[d];
     }
-    grad_out[tslice] -= J*sin_the*small_temp;
+    return res;
+}
+
+double hmc::HeisenbergSystem::magnetisation(
+    const std::valarray<double> &state)
+{
+    calc_trig(state);
+    double x = (cos_phi*sin_the).sum();
+    double y = (sin_phi*sin_the).sum();
+    double z = cos_the.sum();
+    return std::sqrt( x*x + y*y + z*z );
 }
 
 std::function<double(const std::valarray<double>&)> hmc::gen_total_energy(
     const HamiltonianOptions options,
-    const double beta,
-    const int d,
-    const int size)
+    const std::shared_ptr<HeisenbergSystem> system)
 {
     // Init blank energy function
     std::function<double(const std::valarray<double>&)> init_f =
-        [options](const std::valarray<double> &data)
+        [system](const std::valarray<double> &data)
         {
-            calc_trig(data);
+            system->calc_trig(data);
             return 0;
         };
     std::function<double(const std::valarray<double>&)> new_f;
@@ -118,51 +466,137 @@ std::function<double(const std::valarray<double>&)> hmc::gen_total_energy(
     // Add exchange energy
     if ( options.J != 0)
     {
-        new_f =[init_f, options, d](const std::valarray<double> &data)
-            {return init_f(data) + exchange_energy(options.J, d);};
+        new_f =[init_f, options, system](const std::valarray<double> &data)
+            {return init_f(data) + system->exchange_energy(options.J);};
         init_f = new_f;
     }
 
     // Add zeeman energy
     if ( options.H != 0 )
     {
-        new_f = [init_f, options](const std::valarray<double> &data)
-            {return init_f(data) + zeeman_energy(options.H);};
+        new_f = [init_f, options, system](const std::valarray<double> &data)
+            {return init_f(data) + system->zeeman_energy(options.H);};
+        init_f = new_f;
+    }
+
+    // Add dipolar energy
+    if ( options.D != 0 )
+    {
+        new_f = [init_f, options, system](const std::valarray<double> &data)
+            {return init_f(data) + system->dipolar_energy(options.D);};
         init_f = new_f;
     }
 
+    return init_f;
+}
+
+std::function<double(const std::valarray<double>&)> hmc::gen_total_energy(
+    const HamiltonianOptions options,
+    const int d,
+    const int size)
+{
     // Set work arrs and slices
-    set_slices(size, d);
+    std::shared_ptr<HeisenbergSystem> system(new HeisenbergSystem(size, d));
+
+    return gen_total_energy(options, system);
+}
+
+std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+hmc::gen_total_energy_grad(
+    const HamiltonianOptions options,
+    const std::shared_ptr<HeisenbergSystem> system)
+{
+    // Init blank energy and grad function
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+        init_f, new_f;
+    init_f = [system](
+        std::valarray<double>& grad_out,
+        const std::valarray<double>& data)
+        {
+            grad_out = 0;
+            system->calc_trig(data);
+            return 0.0;
+        };
+
+    // Add Exchange energy and gradient
+    if( options.J != 0)
+    {
+        new_f = [init_f, options, system](
+            std::valarray<double>& grad_out,
+            const std::valarray<double>& data)
+        {
+            double E = init_f(grad_out, data);
+            return E + system->exchange_energy_grad(grad_out, options.J);
+        };
+        init_f = new_f;
+    }
+
+    // Add Zeeman energy and gradient
+    if( options.H != 0)
+    {
+        new_f = [init_f, options, system](
+            std::valarray<double>& grad_out,
+            const std::valarray<double>& data)
+        {
+            double E = init_f(grad_out, data);
+            return E + system->zeeman_energy_grad(grad_out, options.H);
+        };
+        init_f = new_f;
+    }
+
+    // Add dipolar energy and gradient
+    if( options.D != 0)
+    {
+        new_f = [init_f, options, system](
+            std::valarray<double>& grad_out,
+            const std::valarray<double>& data)
+        {
+            double E = init_f(grad_out, data);
+            return E + system->dipolar_energy_grad(grad_out, options.D);
+        };
+        init_f = new_f;
+    }
 
     return init_f;
 }
 
-std::function<void(std::valarray<double>&, const std::valarray<double>&)>
-hmc::gen_total_grad(
+std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+hmc::gen_total_energy_grad(
     const HamiltonianOptions options,
     const int d,
     const int size)
+{
+    // Set work arrs and slices
+    std::shared_ptr<HeisenbergSystem> system(new HeisenbergSystem(size, d));
+
+    return gen_total_energy_grad(options, system);
+}
+
+std::function<void(std::valarray<double>&, const std::valarray<double>&)>
+hmc::gen_total_grad(
+    const HamiltonianOptions options,
+    const std::shared_ptr<HeisenbergSystem> system)
 {
     // Init blank grad function
     std::function<void(std::valarray<double>&, const std::valarray<double>&)>
         init_f, new_f;
-    init_f = [options](
+    init_f = [system](
         std::valarray<double>& grad_out,
         const std::valarray<double>& data)
         {
             grad_out = 0;
-            calc_trig(data);
+            system->calc_trig(data);
         };
 
     // Add Exchange gradient
     if( options.J != 0)
     {
-        new_f = [init_f, options, d](
+        new_f = [init_f, options, system](
             std::valarray<double>& grad_out,
             const std::valarray<double>& data)
         {
             init_f(grad_out, data);
-            exchange_grad(grad_out, options.J, d);
+            system->exchange_grad(grad_out, options.J);
         };
         init_f = new_f;
     }
@@ -170,83 +604,116 @@ hmc::gen_total_grad(
     // Add Zeeman gradient
     if( options.H != 0)
     {
-        new_f = [init_f, options](
+        new_f = [init_f, options, system](
             std::valarray<double>& grad_out,
             const std::valarray<double>& data)
         {
             init_f(grad_out, data);
-            zeeman_grad(grad_out, options.H);
+            system->zeeman_grad(grad_out, options.H);
         };
         init_f = new_f;
     }
 
-    // Set work arrs and slices
-    set_slices(size, d);
+    // Add dipolar gradient
+    if( options.D != 0)
+    {
+        new_f = [init_f, options, system](
+            std::valarray<double>& grad_out,
+            const std::valarray<double>& data)
+        {
+            init_f(grad_out, data);
+            system->dipolar_energy_grad(grad_out, options.D);
+        };
+        init_f = new_f;
+    }
 
     return init_f;
 }
 
-void hmc::calc_trig(const std::valarray<double> &data)
+std::function<void(std::valarray<double>&, const std::valarray<double>&)>
+hmc::gen_total_grad(
+    const HamiltonianOptions options,
+    const int d,
+    const int size)
+{
+    // Set work arrs and slices
+    std::shared_ptr<HeisenbergSystem> system(new HeisenbergSystem(size, d));
+
+    return gen_total_grad(options, system);
+}
+
+void hmc::HeisenbergSystem::calc_trig(const std::valarray<double> &data)
 {
-    cos_the = cos(data[tslice]);
-    sin_the = sin(data[tslice]);
-    cos_phi = cos(data[pslice]);
-    sin_phi = sin(data[pslice]);
+    // One pass over the angles, without temporaries
+    const double *the = &data[0], *phi = &data[halfsize];
+    double *ct = &cos_the[0], *st = &sin_the[0];
+    double *cp = &cos_phi[0], *sp = &sin_phi[0];
+    for_sites([=](const size_t begin, const size_t end)
+    {
+        sincos_array(the + begin, st + begin, ct + begin, end - begin);
+        sincos_array(phi + begin, sp + begin, cp + begin, end - begin);
+    });
 }
 
-void hmc::set_slices(int size, int dim)
+void hmc::HeisenbergSystem::set_slices(const int size, const int d)
 {
     // Set arrays
-    large_slice.resize(dim);
-    small_slice.resize(dim);
-    opp_small_slice.resize(dim);
-    opp_large_slice.resize(dim);
-    temp.resize(size);
+    lattice.reset();
+    dipoles.reset();
+    dim = d;
+    stride.resize(dim);
+    period.resize(dim);
 
-    // Set slices
+    // Set strides
     halfsize = size / 2;
-    int sidesize = pow(halfsize, 1./float(dim));
-    int sidesize2 = sidesize*sidesize;
-    tslice = std::slice(0, halfsize, 1);
-    pslice = std::slice(halfsize, halfsize, 1);
-    small_temp.resize(halfsize);
-    cos_the.resize(halfsize);
-    sin_the.resize(halfsize);
-    cos_phi.resize(halfsize);
-    sin_phi.resize(halfsize);
-    switch(dim)
-    {
-        case 1:
-        large_slice[0] = std::gslice(0, {halfsize-1}, {1});
-        small_slice[0] = std::gslice(halfsize-1, {1}, {halfsize});
-        opp_large_slice[0] = std::gslice(1, {halfsize-1}, {1});
-        opp_small_slice[0] = std::gslice(0, {1}, {halfsize});
-        break;
-
-        case 2:
-        large_slice[0] = std::gslice(0, {sidesize, sidesize-1}, {sidesize, 1});
-        opp_large_slice[0] = std::gslice(1, {sidesize, sidesize-1}, {sidesize, 1});
-        opp_small_slice[0] = std::gslice(0, {sidesize}, {sidesize});
-        small_slice[0] = std::gslice(sidesize-1, {sidesize}, {sidesize});
-        large_slice[1] = std::gslice(0, {sidesize2-sidesize}, {1});
-        opp_large_slice[1] = std::gslice(sidesize, {sidesize2-sidesize}, {1});
-        small_slice[1] = std::gslice(sidesize2-sidesize, {sidesize}, {1});
-        opp_small_slice[1] = std::gslice(0, {sidesize}, {1});
-        break;
-
-        case 3:
-        large_slice[0] = std::gslice(0, {sidesize2, sidesize-1}, {sidesize, 1});
-        opp_large_slice[0] = std::gslice(1, {sidesize2, sidesize-1}, {sidesize, 1});
-        opp_small_slice[0] = std::gslice(0, {sidesize2}, {sidesize});
-        small_slice[0] = std::gslice(sidesize-1, {sidesize2}, {sidesize});
-        large_slice[1] = std::gslice(0, {sidesize, sidesize2-sidesize}, {sidesize2, 1});
-        opp_large_slice[1] = std::gslice(sidesize, {sidesize, sidesize2-sidesize}, {sidesize2, 1});
-        opp_small_slice[1] = std::gslice(0, {sidesize, sidesize}, {sidesize2, 1});
-        small_slice[1] = std::gslice(sidesize2-sidesize, {sidesize, sidesize}, {sidesize2, 1});
-        large_slice[2] = std::gslice(0, {halfsize-sidesize2}, {1});
-        opp_large_slice[2] = std::gslice(sidesize2, {halfsize-sidesize2}, {1});
-        small_slice[2] = std::gslice(halfsize-sidesize2, {sidesize2}, {1});
-        opp_small_slice[2] = std::gslice(0, {sidesize2}, {1});
-        break;
+    int sidesize = std::round(std::pow(halfsize, 1./float(dim)));
+    allocate(halfsize);
+
+    // The last axis wraps over the whole lattice
+    int s = 1;
+    for(int i = 0; i < dim; i++)
+    {
+        stride[i] = s;
+        s *= sidesize;
+        period[i] = (i == dim-1) ? halfsize : s;
     }
 }
+
+void hmc::HeisenbergSystem::set_sides(const std::vector<int> &sides)
+{
+    dim = sides.size();
+    stride.resize(dim);
+    period.resize(dim);
+    lattice.reset();
+    dipoles.reset();
+
+    int s = 1;
+    for(int i = 0; i < dim; i++)
+    {
+        if(sides[i] < 2)
+            throw std::invalid_argument(
+                "HeisenbergSystem: stencils need two sites along each axis");
+        stride[i] = s;
+        s *= sides[i];
+        period[i] = s;
+    }
+    halfsize = s;
+    allocate(halfsize);
+}
+
+void hmc::HeisenbergSystem::allocate(const int spins)
+{
+    tslice = std::slice(0, spins, 1);
+    pslice = std::slice(spins, spins, 1);
+    small_temp.resize(spins);
+    cos_the.resize(spins);
+    sin_the.resize(spins);
+    cos_phi.resize(spins);
+    sin_phi.resize(spins);
+    spin_x.resize(spins);
+    spin_y.resize(spins);
+    spin_z.resize(spins);
+    field_x.resize(spins);
+    field_y.resize(spins);
+    field_z.resize(spins);
+}
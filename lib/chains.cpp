@@ -0,0 +1,166 @@
+#include "../include/chains.hpp"
+#include "../include/all_hamils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+void hmc::run_parallel(
+    const int n_tasks,
+    const int n_threads,
+    const std::function<void(const int)> &task )
+{
+    int threads = n_threads;
+    if( threads <= 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = std::min( threads, n_tasks );
+
+    std::atomic<int> next( 0 );
+    std::exception_ptr error;
+    std::mutex error_lock;
+
+    // Each worker takes the next task until none are left
+    auto worker = [&]()
+    {
+        for( int i=next++; i<n_tasks; i=next++ )
+        {
+            try
+            {
+                task( i );
+            }
+            catch( ... )
+            {
+                std::lock_guard<std::mutex> lock( error_lock );
+                if( !error )
+                    error = std::current_exception();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for( int t=0; t<threads; t++ )
+        pool.push_back( std::thread( worker ) );
+    for( auto &t : pool )
+        t.join();
+
+    if( error )
+        std::rethrow_exception( error );
+}
+
+std::vector<hmc::ChainResult> hmc::multi_chain_nuts(
+    const std::vector<std::valarray<double> > &initial_states,
+    const double leapfrog_eps,
+    const size_t samples,
+    const std::function<ChainFunctions(const int)> &model,
+    const int n_threads,
+    const int seed )
+{
+    std::vector<ChainResult> results( initial_states.size() );
+
+    run_parallel( initial_states.size(), n_threads, [&]( const int chain )
+    {
+        ChainFunctions f = model( chain );
+        ChainRNG rng( seed, chain );
+        ChainResult &res = results[chain];
+        res.final_state = initial_states[chain];
+        res.energy.resize( samples );
+        if( !f.energy_and_grad )
+            f.energy_and_grad = fuse_energy_grad( f.energy, f.energy_grad );
+        res.trace = nuts( res.energy, res.final_state, leapfrog_eps, samples,
+                          f.energy_and_grad, f.reduce, rng );
+    });
+
+    return results;
+}
+
+std::vector<hmc::ChainResult> hmc::multi_chain_hmc(
+    const std::vector<std::valarray<double> > &initial_states,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t samples,
+    const std::function<ChainFunctions(const int)> &model,
+    const int n_threads,
+    const int seed )
+{
+    std::vector<ChainResult> results( initial_states.size() );
+
+    run_parallel( initial_states.size(), n_threads, [&]( const int chain )
+    {
+        ChainFunctions f = model( chain );
+        ChainRNG rng( seed, chain );
+        ChainResult &res = results[chain];
+        res.final_state = initial_states[chain];
+        res.energy.resize( samples );
+        if( !f.energy_and_grad )
+            f.energy_and_grad = fuse_energy_grad( f.energy, f.energy_grad );
+        res.trace = hmc::hmc( res.energy, res.final_state, leapfrog_eps,
+                              leapfrog_steps, samples, f.energy_and_grad,
+                              f.reduce, rng );
+    });
+
+    return results;
+}
+
+void hmc::heisenberg_chains(
+    std::vector<std::valarray<double> > &sample_energy,
+    std::vector<std::valarray<double> > &sample_magnetisation,
+    const std::vector<int> system_dimensions,
+    const HamiltonianOptions options,
+    const double beta,
+    const double leapfrog_eps,
+    const int nsamples,
+    const int nchains,
+    const int nthreads,
+    const int seed )
+{
+    // theta and phi for every element in system
+    const int state_size = 2 * std::accumulate(
+        system_dimensions.begin(),
+        system_dimensions.end(),
+        1, std::multiplies<int>() );
+
+    // Independent random initial state for each chain
+    std::vector<std::valarray<double> > initial_states(
+        nchains, std::valarray<double>( state_size ) );
+    for( int c=0; c<nchains; c++ )
+    {
+        ChainRNG rng( seed, c );
+        random_state( initial_states[c], rng.uniform_rng );
+    }
+
+    // The terms at beta, as heisenberg_model samples them
+    const HamiltonianOptions scaled = scaled_options( options, beta );
+
+    // Each chain gets its own lattice
+    std::function<ChainFunctions(const int)> model =
+        [scaled, system_dimensions]( const int )
+        {
+            std::shared_ptr<HeisenbergSystem> system(
+                new HeisenbergSystem( system_dimensions ) );
+            ChainFunctions f;
+            f.energy_and_grad = gen_total_energy_grad( scaled, system );
+            f.reduce = [system]( const std::valarray<double>& state )
+                {
+                    std::valarray<double> res = { system->magnetisation( state ) };
+                    return res;
+                };
+            return f;
+        };
+
+    auto results = multi_chain_nuts( initial_states, leapfrog_eps, nsamples,
+                                     model, nthreads, seed + 1 );
+
+    sample_energy.resize( nchains );
+    sample_magnetisation.resize( nchains );
+    for( int c=0; c<nchains; c++ )
+    {
+        // Energy is returned normalised so we turn it into real energy
+        sample_energy[c] = results[c].energy / beta;
+        sample_magnetisation[c].resize( nsamples );
+        for( int n=0; n<nsamples; n++ )
+            sample_magnetisation[c][n] = results[c].trace[n][0];
+    }
+}
@@ -0,0 +1,52 @@
+#include "../include/checkpoint.hpp"
+#include <cstdio>
+#include <fstream>
+
+void hmc::write_array( std::ostream &out, const std::valarray<double> &values )
+{
+    write_value( out, values.size() );
+    if( values.size() > 0 )
+        out.write( reinterpret_cast<const char*>( &values[0] ),
+                   values.size()*sizeof( double ) );
+}
+
+void hmc::read_array( std::istream &in, std::valarray<double> &values )
+{
+    size_t size;
+    read_value( in, size );
+    values.resize( size );
+    if( size == 0 )
+        return;
+    in.read( reinterpret_cast<char*>( &values[0] ), size*sizeof( double ) );
+    if( !in )
+        throw std::runtime_error( "checkpoint: input ended early" );
+}
+
+void hmc::write_checkpoint(
+    const std::string &path,
+    const std::function<void(std::ostream&)> &write )
+{
+    const std::string temp = path + ".tmp";
+    {
+        std::ofstream out( temp.c_str(), std::ios::binary | std::ios::trunc );
+        if( !out )
+            throw std::runtime_error( "checkpoint: cannot open " + temp );
+        write( out );
+        out.flush();
+        if( !out )
+            throw std::runtime_error( "checkpoint: cannot write " + temp );
+    }
+    if( std::rename( temp.c_str(), path.c_str() ) != 0 )
+        throw std::runtime_error( "checkpoint: cannot replace " + path );
+}
+
+bool hmc::read_checkpoint(
+    const std::string &path,
+    const std::function<void(std::istream&)> &read )
+{
+    std::ifstream in( path.c_str(), std::ios::binary );
+    if( !in )
+        return false;
+    read( in );
+    return true;
+}
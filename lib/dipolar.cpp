@@ -0,0 +1,170 @@
+#include "../include/dipolar.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    // Where the sites go on the grid: positions times scale, less low, are
+    // whole numbers below extent along each axis
+    struct Placement {
+        int scale;
+        double low[3];
+        int extent[3];
+        /// Twice the extent, less one, rounded up to a power of two
+        std::vector<int> padded;
+    };
+
+    // True if every position is a whole number of 1/scale units
+    bool on_grid( const std::vector<double> &positions, const int scale )
+    {
+        for( double x : positions )
+            if( std::abs( scale*x - std::round( scale*x ) ) > 1e-9 )
+                return false;
+        return true;
+    }
+
+    Placement place( const std::vector<double> &positions )
+    {
+        if( positions.size() % 3 != 0 )
+            throw std::invalid_argument( "DipolarField: three coordinates are needed for each site" );
+        Placement p;
+        p.scale = on_grid( positions, 1 ) ? 1 : 2;
+        if( !on_grid( positions, p.scale ) )
+            throw std::invalid_argument( "DipolarField: sites must lie on a grid of half units" );
+
+        for( int d=0; d<3; d++ )
+        {
+            double low = positions.empty() ? 0 : positions[d], high = low;
+            for( size_t i=d; i<positions.size(); i+=3 )
+            {
+                low = std::min( low, positions[i] );
+                high = std::max( high, positions[i] );
+            }
+            p.low[d] = low;
+            p.extent[d] = std::lround( p.scale*( high - low ) ) + 1;
+            int padded = 1;
+            while( padded < 2*p.extent[d] - 1 )
+                padded *= 2;
+            p.padded.push_back( padded );
+        }
+        return p;
+    }
+
+    // Index of a displacement of the grid, wrapped into the padded grid
+    size_t wrapped( const int dx, const int dy, const int dz,
+                    const std::vector<int> &sides )
+    {
+        const int x = ( dx + sides[0] ) % sides[0];
+        const int y = ( dy + sides[1] ) % sides[1];
+        const int z = ( dz + sides[2] ) % sides[2];
+        return ( size_t( z )*sides[1] + y )*sides[0] + x;
+    }
+}
+
+hmc::DipolarField::DipolarField( const std::vector<double> &positions )
+    : grid( place( positions ).padded )
+{
+    const Placement p = place( positions );
+    const std::vector<int> &sides = grid.sides();
+    const size_t points = grid.size();
+    const int n = positions.size() / 3;
+
+    std::vector<bool> taken( points, false );
+    cell.resize( n );
+    for( int i=0; i<n; i++ )
+    {
+        int g[3];
+        for( int d=0; d<3; d++ )
+            g[d] = std::lround( p.scale*( positions[3*i + d] - p.low[d] ) );
+        cell[i] = wrapped( g[0], g[1], g[2], sides );
+        if( taken[cell[i]] )
+            throw std::invalid_argument( "DipolarField: two sites share a position" );
+        taken[cell[i]] = true;
+    }
+
+    negative.resize( points );
+    for( int z=0; z<sides[2]; z++ )
+        for( int y=0; y<sides[1]; y++ )
+            for( int x=0; x<sides[0]; x++ )
+                negative[wrapped( x, y, z, sides )] = wrapped( -x, -y, -z, sides );
+
+    // The tensor at every displacement within the sample, one part at a
+    // time. Each part is even, so its spectrum is real.
+    const int pairs[6][2] = { {0, 0}, {1, 1}, {2, 2}, {0, 1}, {0, 2}, {1, 2} };
+    std::vector<std::complex<double> > work( points );
+    for( int c=0; c<6; c++ )
+    {
+        const int a = pairs[c][0], b = pairs[c][1];
+        std::fill( work.begin(), work.end(), 0.0 );
+        for( int dz=1-p.extent[2]; dz<p.extent[2]; dz++ )
+        for( int dy=1-p.extent[1]; dy<p.extent[1]; dy++ )
+        for( int dx=1-p.extent[0]; dx<p.extent[0]; dx++ )
+        {
+            if( dx == 0 && dy == 0 && dz == 0 )
+                continue;
+            const double r[3] = { double( dx ) / p.scale, double( dy ) / p.scale,
+                                  double( dz ) / p.scale };
+            const double r2 = r[0]*r[0] + r[1]*r[1] + r[2]*r[2];
+            const double r5 = r2*r2*std::sqrt( r2 );
+            work[wrapped( dx, dy, dz, sides )] =
+                ( ( a == b ? r2 : 0.0 ) - 3*r[a]*r[b] ) / r5;
+        }
+        grid.forward( &work[0] );
+        kernel[c].resize( points );
+        for( size_t k=0; k<points; k++ )
+            kernel[c][k] = work[k].real();
+    }
+
+    xy_work.resize( points );
+    z_work.resize( points );
+    field_work.resize( points );
+}
+
+void hmc::DipolarField::field(
+    const double *x,
+    const double *y,
+    const double *z,
+    double *hx,
+    double *hy,
+    double *hz )
+{
+    const size_t n = cell.size();
+    const size_t points = grid.size();
+    std::fill( xy_work.begin(), xy_work.end(), 0.0 );
+    std::fill( z_work.begin(), z_work.end(), 0.0 );
+    for( size_t i=0; i<n; i++ )
+    {
+        xy_work[cell[i]] = std::complex<double>( x[i], y[i] );
+        z_work[cell[i]] = z[i];
+    }
+    grid.forward( &xy_work[0] );
+    grid.forward( &z_work[0] );
+
+    // The x and y spectra are parted by the symmetry of real inputs, and
+    // the x and y fields packed back together for a single inverse
+    const std::complex<double> half_i( 0, 0.5 ), i1( 0, 1 );
+    const double *nxx = &kernel[0][0], *nyy = &kernel[1][0], *nzz = &kernel[2][0];
+    const double *nxy = &kernel[3][0], *nxz = &kernel[4][0], *nyz = &kernel[5][0];
+    for( size_t k=0; k<points; k++ )
+    {
+        const std::complex<double> a = xy_work[k];
+        const std::complex<double> b = std::conj( xy_work[negative[k]] );
+        const std::complex<double> fx = 0.5*( a + b );
+        const std::complex<double> fy = -half_i*( a - b );
+        const std::complex<double> fz = z_work[k];
+        const std::complex<double> fhx = nxx[k]*fx + nxy[k]*fy + nxz[k]*fz;
+        const std::complex<double> fhy = nxy[k]*fx + nyy[k]*fy + nyz[k]*fz;
+        field_work[k] = fhx + i1*fhy;
+        z_work[k] = nxz[k]*fx + nyz[k]*fy + nzz[k]*fz;
+    }
+    grid.inverse( &field_work[0] );
+    grid.inverse( &z_work[0] );
+
+    for( size_t i=0; i<n; i++ )
+    {
+        hx[i] = field_work[cell[i]].real();
+        hy[i] = field_work[cell[i]].imag();
+        hz[i] = z_work[cell[i]].real();
+    }
+}
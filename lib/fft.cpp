@@ -0,0 +1,109 @@
+#include "../include/fft.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    // In place transform of one contiguous line of n points, a power of
+    // two, in the iterative Cooley-Tukey form
+    void fft_line( std::complex<double> *a, const int n,
+                   const std::vector<std::complex<double> > &twiddle,
+                   const std::vector<int> &reversed, const bool inverse )
+    {
+        for( int i=0; i<n; i++ )
+            if( i < reversed[i] )
+                std::swap( a[i], a[reversed[i]] );
+
+        for( int len=2; len<=n; len<<=1 )
+        {
+            const int half = len/2, step = n/len;
+            for( int i=0; i<n; i+=len )
+            {
+                for( int j=0; j<half; j++ )
+                {
+                    std::complex<double> w = twiddle[j*step];
+                    if( inverse )
+                        w = std::conj( w );
+                    const std::complex<double> u = a[i+j];
+                    const std::complex<double> v = a[i+j+half] * w;
+                    a[i+j] = u + v;
+                    a[i+j+half] = u - v;
+                }
+            }
+        }
+    }
+}
+
+hmc::FFTGrid::FFTGrid( const std::vector<int> &sides )
+    : n_sides( sides ), n_points( 1 ), axes( sides.size() )
+{
+    int longest = 1;
+    for( size_t d=0; d<sides.size(); d++ )
+    {
+        const int n = sides[d];
+        if( n < 1 || ( n & ( n-1 ) ) )
+            throw std::invalid_argument( "FFTGrid: every side must be a power of two" );
+        n_points *= n;
+        longest = std::max( longest, n );
+
+        Axis &axis = axes[d];
+        axis.twiddle.resize( n/2 );
+        for( int k=0; k<n/2; k++ )
+            axis.twiddle[k] = std::polar( 1.0, -2*M_PI*k/n );
+        axis.reversed.resize( n );
+        int bits = 0;
+        while( ( 1 << bits ) < n )
+            bits++;
+        for( int i=0; i<n; i++ )
+        {
+            int r = 0;
+            for( int b=0; b<bits; b++ )
+                r |= ( ( i >> b ) & 1 ) << ( bits-1-b );
+            axis.reversed[i] = r;
+        }
+    }
+    line.resize( longest );
+}
+
+void hmc::FFTGrid::transform(
+    std::complex<double> *data,
+    const bool inverse ) const
+{
+    // Each axis in turn, one line at a time
+    size_t stride = 1;
+    for( size_t d=0; d<axes.size(); d++ )
+    {
+        const int n = n_sides[d];
+        if( n > 1 )
+        {
+            for( size_t outer=0; outer<n_points; outer+=n*stride )
+            {
+                for( size_t inner=0; inner<stride; inner++ )
+                {
+                    std::complex<double> *start = data + outer + inner;
+                    for( int j=0; j<n; j++ )
+                        line[j] = start[j*stride];
+                    fft_line( &line[0], n, axes[d].twiddle, axes[d].reversed,
+                              inverse );
+                    for( int j=0; j<n; j++ )
+                        start[j*stride] = line[j];
+                }
+            }
+        }
+        stride *= n;
+    }
+}
+
+void hmc::FFTGrid::forward( std::complex<double> *data ) const
+{
+    transform( data, false );
+}
+
+void hmc::FFTGrid::inverse( std::complex<double> *data ) const
+{
+    transform( data, true );
+    const double scale = 1.0 / n_points;
+    for( size_t i=0; i<n_points; i++ )
+        data[i] *= scale;
+}
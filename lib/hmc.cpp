@@ -1,24 +1,67 @@
 #include "../include/hmc.hpp"
+#include "../include/adapt.hpp"
 #include "../include/all_hamils.hpp"
+#include "../include/hamiltonian.hpp"
 #include "../include/leapfrog.hpp"
-#include "../include/mklrand.hpp"
+#include "../include/rng.hpp"
 #include "../include/constants.hpp"
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <memory>
+#include <numeric>
 #include <exception>
+#include <stdexcept>
 #include <iostream>
 #define _USE_MATH_DEFINES
 
-namespace hmc
+hmc::ChainRNG::ChainRNG()
+    : int_rng( 100000, 666 ),
+      uniform_rng( 100000, 1001 ),
+      normal_rng( 0, 1, 100000, 555555 )
+{}
+
+namespace
+{
+    // Stream for the k-th generator of a chain
+    int chain_stream( const int chain, const int k )
+    {
+        if( chain < 0 || chain >= hmc::ChainRNG::max_chains )
+            throw std::out_of_range( "ChainRNG: chain index out of range" );
+        return hmc::rng_stream( 3*chain + k );
+    }
+
+    // min(1, exp(log_ratio)), zero for a trajectory that failed
+    double accept_stat( const double log_ratio )
+    {
+        if( log_ratio >= 0 )
+            return 1;
+        return ( log_ratio < 0 ) ? std::exp( log_ratio ) : 0;
+    }
+}
+
+hmc::ChainRNG::ChainRNG( const int seed, const int chain )
+    : int_rng( 100000, seed, chain_stream( chain, 0 ) ),
+      uniform_rng( 100000, seed, chain_stream( chain, 1 ) ),
+      normal_rng( 0, 1, 100000, seed, chain_stream( chain, 2 ) )
+{}
+
+void hmc::ChainRNG::save( std::ostream &out ) const
 {
-    extern int halfsize;
-    extern std::vector<std::gslice> large_slice, small_slice, opp_large_slice;
-    extern std::vector<std::gslice> opp_small_slice;
-    extern std::slice tslice, pslice;
-    extern std::valarray<double> temp, small_temp, cos_the, sin_the, cos_phi, sin_phi;
+    int_rng.write_state( out );
+    uniform_rng.write_state( out );
+    normal_rng.write_state( out );
+}
+
+void hmc::ChainRNG::load( std::istream &in )
+{
+    int_rng.read_state( in );
+    uniform_rng.read_state( in );
+    normal_rng.read_state( in );
 }
 
 bool hmc::accept_trial( const double e, const double e_trial,
-                         mklrand::mkl_drand &rng )
+                         hmc::UniformRNG &rng )
 {
     double e_diff = e_trial - e;
     double acceptance_threshold = std::exp( -e_diff );
@@ -26,7 +69,7 @@ bool hmc::accept_trial( const double e, const double e_trial,
 }
 
 double hmc::kinetic_energy(
-    const std::valarray<double> velocity )
+    const std::valarray<double> &velocity )
 {
     double energy=0;
     for( auto &v : velocity )
@@ -34,6 +77,123 @@ double hmc::kinetic_energy(
     return energy/2.0;
 }
 
+void hmc::Euclidean::refresh(
+    std::valarray<double> &velocity,
+    const std::valarray<double> &,
+    hmc::NormalRNG &rng ) const
+{
+    rng.fill( &velocity[0], velocity.size() );
+}
+
+namespace
+{
+    // As hmc::kinetic_energy with the blocks summed by the pool
+    double pool_kinetic_energy( hmc::SlabPool &pool,
+                                const std::valarray<double> &velocity )
+    {
+        const double *v = &velocity[0];
+        return pool.sum( velocity.size(), [=]( const size_t begin,
+                                               const size_t end )
+        {
+            double energy = 0;
+            for( size_t i=begin; i<end; i++ )
+                energy += v[i] * v[i];
+            return energy;
+        } ) / 2.0;
+    }
+
+    // As hmc::u_turn_free with the blocks summed by the pool
+    bool pool_u_turn_free( hmc::SlabPool &pool,
+                           const hmc::PhasePoint &back,
+                           const hmc::PhasePoint &front )
+    {
+        const double *x0 = &back.state[0], *x1 = &front.state[0];
+        const double *v0 = &back.velocity[0], *v1 = &front.velocity[0];
+        double dots[2];
+        pool.sums( back.state.size(), 2, [=]( const size_t begin,
+                                              const size_t end,
+                                              double *partial )
+        {
+            double back_dot = 0, front_dot = 0;
+            for( size_t i=begin; i<end; i++ )
+            {
+                double diff = x1[i] - x0[i];
+                back_dot += diff * v0[i];
+                front_dot += diff * v1[i];
+            }
+            partial[0] = back_dot;
+            partial[1] = front_dot;
+        }, dots );
+        return ( dots[0] >= 0 ) && ( dots[1] >= 0 );
+    }
+}
+
+double hmc::Euclidean::kinetic_energy(
+    const std::valarray<double> &velocity ) const
+{
+    if( pool )
+        return pool_kinetic_energy( *pool, velocity );
+    return hmc::kinetic_energy( velocity );
+}
+
+bool hmc::Euclidean::u_turn_free(
+    const PhasePoint &back,
+    const PhasePoint &front ) const
+{
+    if( pool )
+        return pool_u_turn_free( *pool, back, front );
+    return hmc::u_turn_free( back, front );
+}
+
+double hmc::Sphere::kinetic_energy(
+    const std::valarray<double> &velocity ) const
+{
+    if( pool )
+        return pool_kinetic_energy( *pool, velocity );
+    return hmc::kinetic_energy( velocity );
+}
+
+bool hmc::Sphere::u_turn_free(
+    const PhasePoint &back,
+    const PhasePoint &front ) const
+{
+    if( pool )
+        return pool_u_turn_free( *pool, back, front );
+    return hmc::u_turn_free( back, front );
+}
+
+void hmc::Sphere::refresh(
+    std::valarray<double> &velocity,
+    const std::valarray<double> &state,
+    hmc::NormalRNG &rng ) const
+{
+    rng.fill( &velocity[0], velocity.size() );
+
+    // Remove the part along each spin
+    const size_t n = state.size() / 3;
+    for( size_t i=0; i<n; i++ )
+    {
+        double vs = velocity[i]*state[i] + velocity[i+n]*state[i+n]
+            + velocity[i+2*n]*state[i+2*n];
+        velocity[i] -= vs*state[i];
+        velocity[i+n] -= vs*state[i+n];
+        velocity[i+2*n] -= vs*state[i+2*n];
+    }
+}
+
+std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+hmc::fuse_energy_grad(
+    const std::function<double(const std::valarray<double>&)> &f_energy,
+    const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad )
+{
+    return [f_energy, f_energy_grad]( std::valarray<double>& grad,
+                                      const std::valarray<double>& state )
+    {
+        f_energy_grad( grad, state );
+        return f_energy( state );
+    };
+}
+
 std::vector<std::valarray<double> > hmc::hmc(
     std::valarray<double> &energy,
     const std::valarray<double> &initial_state,
@@ -44,74 +204,346 @@ std::vector<std::valarray<double> > hmc::hmc(
     const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad,
     const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce)
 {
-    // system size
-    size_t system_size = initial_state.size();
+    std::valarray<double> current_state( initial_state );
+    ChainRNG rng;
+    return hmc( energy, current_state, leapfrog_eps, leapfrog_steps, samples,
+                f_energy, f_energy_grad, reduce, rng );
+}
+
+std::vector<std::valarray<double> > hmc::hmc(
+    std::valarray<double> &energy,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t samples,
+    const std::function<double(const std::valarray<double>&)> &f_energy,
+    const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad,
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+    ChainRNG &rng)
+{
+    return hmc( energy, current_state, leapfrog_eps, leapfrog_steps, samples,
+                fuse_energy_grad( f_energy, f_energy_grad ), reduce, rng );
+}
+
+hmc::HmcWorkspace::HmcWorkspace( const size_t n )
+    : current( n ), temp_state( n ), temp_velocity( n ),
+      trial_state( n ), trial_velocity( n ), work( n )
+{}
+
+template <class EnergyGrad, class Geometry>
+double hmc::hmc_transition(
+    HmcWorkspace &w,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const EnergyGrad &f_energy_grad,
+    ChainRNG &rng,
+    const Geometry &geometry)
+{
+    PhasePoint &current = w.current;
 
+    // Get the initial state and a random choice of velocity
+    w.temp_state = current.state;
+    geometry.refresh( w.temp_velocity, w.temp_state, rng.normal_rng );
+    current.velocity = w.temp_velocity;
+    w.work = current.grad;
+    double trial_potential = current.energy;
+
+    // Run a number of leapfrog steps, work carries the gradient
+    for( unsigned int n=0; n<leapfrog_steps; n++ )
+    {
+        trial_potential = geometry.step(
+            w.trial_state, w.trial_velocity, w.work,
+            w.temp_state, w.temp_velocity,
+            f_energy_grad,
+            leapfrog_eps );
+
+        // Update arrays
+        std::swap( w.temp_state, w.trial_state );
+        std::swap( w.temp_velocity, w.trial_velocity );
+
+        // A failed step is always rejected
+        if( std::isinf( trial_potential ) )
+            break;
+    }
+
+    // Compute energies
+    double current_energy = current.energy + geometry.kinetic_energy( current.velocity );
+    double trial_energy = trial_potential + geometry.kinetic_energy( w.temp_velocity );
+
+    // check acceptance
+    bool accept = accept_trial( current_energy, trial_energy, rng.uniform_rng );
+    if( accept )
+    {
+        std::swap( current.state, w.temp_state );
+        std::swap( current.grad, w.work );
+        current.energy = trial_potential;
+    }
+
+    return accept_stat( current_energy - trial_energy );
+}
+
+template <class EnergyGrad, class Geometry>
+std::vector<std::valarray<double> > hmc::hmc(
+    std::valarray<double> &energy,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t samples,
+    const EnergyGrad &f_energy_grad,
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+    ChainRNG &rng,
+    const Geometry &geometry)
+{
     // initialise vector of results
     std::vector<std::valarray<double> > trace;
 
     // allocate memory for work
-    std::valarray<double> current_state( initial_state );
-    std::valarray<double> current_velocity( system_size );
-    std::valarray<double> temp_state( system_size );
-    std::valarray<double> temp_velocity( system_size );
-    std::valarray<double> trial_state( system_size );
-    std::valarray<double> trial_velocity( system_size );
-    std::valarray<double> work( system_size );
-
-    // Allocate RNGs
-    mklrand::mkl_drand uniform_rng( 100000, 1001 );
-    mklrand::mkl_nrand normal_rng( 0, 1, 100000, 555555 );
-
-    // Total energy
-    std::function<double(const std::valarray<double>&, const std::valarray<double>&)>
-        total_energy = [&f_energy](const std::valarray<double>& state, const std::valarray<double>& velocities)
-        { return f_energy( state ) + kinetic_energy( velocities ); };
+    HmcWorkspace w( current_state.size() );
+
+    // Energy and gradient of the starting state
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
 
     // Run a monte carlo step until we get specific number of samples
     for( unsigned int sample=0; sample<samples; sample++ )
     {
-        // Get the initial state and a random choice of velocity
-        temp_state = current_state;
-        for( unsigned int i=0; i<system_size; i++ )
-            temp_velocity[i] = normal_rng.gen();
-        current_velocity = temp_velocity;
+        hmc_transition( w, leapfrog_eps, leapfrog_steps, f_energy_grad,
+                        rng, geometry );
+
+        // Store the energy
+        energy[sample] = w.current.energy;
+
+        // Store the reduced parameters
+        trace.push_back( reduce( w.current.state ) );
+    }
+    current_state = w.current.state;
+
+    return trace;
+}
+
+template <class EnergyGrad, class Geometry>
+void hmc::hmc(
+    SampleSink &sink,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t draws,
+    const EnergyGrad &f_energy_grad,
+    const ReduceInto &reduce,
+    ChainRNG &rng,
+    const Geometry &geometry)
+{
+    HmcWorkspace w( current_state.size() );
+    std::valarray<double> reduced( sink.width() );
+
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    for( size_t draw=0; draw<draws; draw++ )
+    {
+        hmc_transition( w, leapfrog_eps, leapfrog_steps, f_energy_grad,
+                        rng, geometry );
+
+        // Dropped draws are never reduced
+        if( !sink.keeps( draw ) )
+            continue;
+        reduce( reduced, w.current.state );
+        sink.write( w.current.energy, reduced );
+    }
+    current_state = w.current.state;
+}
+
+namespace
+{
+    // Only the Metric geometry has a metric to adapt
+    template <class Geometry>
+    bool has_metric( const Geometry& ) { return false; }
+    bool has_metric( const hmc::Metric& ) { return true; }
 
+    // The identity for the other geometries, sharing their threads
+    template <class Geometry>
+    hmc::Metric metric_of( const Geometry &geometry )
+    {
+        return hmc::Metric( geometry.pool );
+    }
+    hmc::Metric metric_of( const hmc::Metric &metric ) { return metric; }
+
+    template <class Geometry>
+    void set_metric( Geometry&, const hmc::Metric& ) {}
+    void set_metric( hmc::Metric &to, const hmc::Metric &metric )
+    {
+        to = metric;
+    }
 
-        // Run a number of leapfrog steps
-        for( unsigned int n=0; n<leapfrog_steps; n++ )
+    template <class Geometry>
+    void check_adaptable( const hmc::AdaptOptions &adapt, const Geometry &geometry )
+    {
+        if( adapt.metric != hmc::MetricAdaptation::none && !has_metric( geometry ) )
+            throw std::invalid_argument( "warmup: only the Metric geometry has a metric to adapt" );
+    }
+
+    // Runs the warmup, adapting the step size after every transition and
+    // the metric at the end of each window. transition( geometry, eps )
+    // moves the chain, whose state is then in state, and returns the
+    // acceptance statistic.
+    template <class Geometry, class Transition>
+    hmc::WarmupResult windowed_warmup(
+        const std::valarray<double> &state,
+        const double leapfrog_eps,
+        const hmc::AdaptOptions &adapt,
+        const Geometry &geometry,
+        const Transition &transition )
+    {
+        check_adaptable( adapt, geometry );
+        hmc::WindowedAdaptation adaptation(
+            state.size(), leapfrog_eps, adapt, metric_of( geometry ) );
+        Geometry g( geometry );
+        while( !adaptation.done() )
         {
-            leapfrog::lfs( trial_state, trial_velocity, work,
-                           temp_state, temp_velocity,
-                           f_energy_grad,
-                           leapfrog_eps );
-
-            // Update arrays
-            temp_state = trial_state;
-            temp_velocity = trial_velocity;
+            double accept = transition( g, adaptation.step() );
+            if( adaptation.update( accept, state ) )
+                set_metric( g, adaptation.metric() );
         }
+        return adaptation.result();
+    }
+
+    // The geometry to sample with after warmup
+    template <class Geometry>
+    const Geometry& adapted( const Geometry &geometry, const hmc::WarmupResult& )
+    {
+        return geometry;
+    }
+    const hmc::Metric& adapted( const hmc::Metric&, const hmc::WarmupResult &res )
+    {
+        return res.metric;
+    }
+
+    // Marks the checkpoints of resumable chains, and their layout version
+    const char checkpoint_tag[8] = { 'h', 'y', 'M', 'C', 'c', 'h', 'n', '1' };
 
-        // Compute energies
-        double current_energy = total_energy( current_state, current_velocity );
-        double trial_energy = total_energy( trial_state, trial_velocity );
+    // Runs the warmup and then the draws of a chain whose current point is
+    // current, checkpointing as it goes and first resuming from the
+    // checkpoint if there is one. transition( geometry, eps ) moves the
+    // chain and returns the acceptance statistic.
+    template <class Geometry, class Transition>
+    hmc::WarmupResult resumable_chain(
+        hmc::SampleSink &sink,
+        hmc::PhasePoint &current,
+        const double leapfrog_eps,
+        const size_t draws,
+        const hmc::ReduceInto &reduce,
+        hmc::ChainRNG &rng,
+        const hmc::AdaptOptions &adapt,
+        const hmc::CheckpointOptions &checkpoint,
+        const Geometry &geometry,
+        const Transition &transition )
+    {
+        check_adaptable( adapt, geometry );
+        const size_t warmup = std::max( adapt.warmup, 0 );
+        hmc::WindowedAdaptation adaptation(
+            current.state.size(), leapfrog_eps, adapt, metric_of( geometry ) );
+        size_t iteration = 0;
 
-        // check acceptance
-        bool accept = accept_trial( current_energy, trial_energy, uniform_rng );
-        if( accept )
+        auto save = [&]( std::ostream &out )
+        {
+            out.write( checkpoint_tag, sizeof( checkpoint_tag ) );
+            hmc::write_value( out, iteration );
+            hmc::write_array( out, current.state );
+            hmc::write_array( out, current.grad );
+            hmc::write_value( out, current.energy );
+            rng.save( out );
+            adaptation.save( out );
+            sink.save( out );
+        };
+        auto load = [&]( std::istream &in )
         {
-            current_state = trial_state;
-            current_energy = trial_energy;
+            char tag[sizeof( checkpoint_tag )];
+            in.read( tag, sizeof( tag ) );
+            if( !in || !std::equal( tag, tag + sizeof( tag ), checkpoint_tag ) )
+                throw std::runtime_error( "checkpoint: not a chain checkpoint" );
+            hmc::read_value( in, iteration );
+            std::valarray<double> state;
+            hmc::read_array( in, state );
+            if( state.size() != current.state.size() )
+                throw std::runtime_error( "checkpoint: state of a different size" );
+            current.state = state;
+            hmc::read_array( in, current.grad );
+            hmc::read_value( in, current.energy );
+            rng.load( in );
+            adaptation.load( in );
+            sink.load( in );
+        };
+        auto checkpoint_due = [&]()
+        {
+            return !checkpoint.path.empty() && checkpoint.interval > 0
+                && iteration % checkpoint.interval == 0;
+        };
+        if( !checkpoint.path.empty() )
+            hmc::read_checkpoint( checkpoint.path, load );
+
+        Geometry g( geometry );
+        set_metric( g, adaptation.metric() );
+        while( iteration < warmup )
+        {
+            double accept = transition( g, adaptation.step() );
+            if( adaptation.update( accept, current.state ) )
+                set_metric( g, adaptation.metric() );
+            iteration++;
+            if( checkpoint_due() )
+                hmc::write_checkpoint( checkpoint.path, save );
         }
 
+        // Without a warmup the initial step size is kept as it is
+        hmc::WarmupResult res = adaptation.result();
+        if( warmup == 0 )
+            res.eps = leapfrog_eps;
+        const Geometry &sampler = adapted( geometry, res );
 
-        // Store the energy
-        energy[sample] = f_energy(current_state);
+        std::valarray<double> reduced( sink.width() );
+        while( iteration < warmup + draws )
+        {
+            transition( sampler, res.eps );
+            const size_t draw = iteration++ - warmup;
+            if( sink.keeps( draw ) )
+            {
+                reduce( reduced, current.state );
+                sink.write( current.energy, reduced );
+            }
+            if( checkpoint_due() )
+                hmc::write_checkpoint( checkpoint.path, save );
+        }
 
-        // Store the reduced parameters
-        trace.push_back( reduce( current_state ) );
+        // The final state, unless it was just written
+        if( !checkpoint.path.empty() && !checkpoint_due() )
+            hmc::write_checkpoint( checkpoint.path, save );
+        return res;
     }
+}
 
-    return trace;
+template <class EnergyGrad, class Geometry>
+hmc::WarmupResult hmc::hmc_warmup(
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const EnergyGrad &f_energy_grad,
+    ChainRNG &rng,
+    const AdaptOptions &adapt,
+    const Geometry &geometry)
+{
+    HmcWorkspace w( current_state.size() );
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    WarmupResult res = windowed_warmup(
+        w.current.state, leapfrog_eps, adapt, geometry,
+        [&]( const Geometry &g, const double eps )
+        {
+            return hmc_transition( w, eps, leapfrog_steps, f_energy_grad,
+                                   rng, g );
+        });
+    current_state = w.current.state;
+
+    return res;
 }
 
 std::vector<std::valarray<double> > hmc::nuts(
@@ -124,170 +556,587 @@ std::vector<std::valarray<double> > hmc::nuts(
     const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce
 )
 {
-    // system size
-    size_t system_size = initial_state.size();
+    std::valarray<double> current_state( initial_state );
+    ChainRNG rng;
+    return nuts( sample_energy, current_state, leapfrog_eps, samples,
+                 f_energy, f_energy_grad, reduce, rng );
+}
 
-    // max tree height
-    size_t max_tree_height = 30;
+std::vector<std::valarray<double> > hmc::nuts(
+    std::valarray<double> &sample_energy,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t samples,
+    const std::function<double(const std::valarray<double>&)> &f_energy,
+    const std::function<void(std::valarray<double>&, const std::valarray<double>&)> &f_energy_grad,
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+    ChainRNG &rng
+)
+{
+    return nuts( sample_energy, current_state, leapfrog_eps, samples,
+                 fuse_energy_grad( f_energy, f_energy_grad ), reduce, rng );
+}
 
-    // initialise vector of results
-    std::vector<std::valarray<double> > trace;
+hmc::NutsWorkspace::NutsWorkspace( const size_t n )
+    : current( n ), temp( n ), next( n ), fb( 2, PhasePoint( n ) ), tree( n )
+{}
 
-    // allocate memory for work
-    std::valarray<double> current_state( initial_state );
-    std::valarray<double> current_velocity( system_size );
-    std::valarray<double> work( system_size );
-    std::valarray<double> temp_state(system_size);
-    std::valarray<double> next_state(system_size);
-    std::vector<std::valarray<double> > fb_state(2, std::valarray<double>(system_size));
-    std::vector<std::valarray<double> > fb_velocity(2, std::valarray<double>(system_size));
-    std::vector<std::valarray<double> > dud_state_tree(max_tree_height, std::valarray<double>(system_size));
-    std::vector<std::valarray<double> > dud_vel_tree(max_tree_height, std::valarray<double>(system_size));
-    std::vector<std::valarray<double> > pos_state_tree(max_tree_height, std::valarray<double>(system_size));
-
-    // Allocate RNGs
-    mklrand::mkl_irand int_rng(100000, 666);
-    mklrand::mkl_drand uniform_rng( 100000, 1001 );
-    mklrand::mkl_nrand normal_rng( 0, 1, 100000, 555555 );
-
-    // Total energy
-    std::function<double(const std::valarray<double>&, const std::valarray<double>&)>
-        total_energy = [&f_energy](const std::valarray<double>& state, const std::valarray<double>& velocities)
-        { return f_energy( state ) + kinetic_energy( velocities ); };
+template <class EnergyGrad, class Geometry>
+double hmc::nuts_transition(
+    NutsWorkspace &w,
+    const double leapfrog_eps,
+    const EnergyGrad &f_energy_grad,
+    ChainRNG &rng,
+    const Geometry &geometry,
+    const NutsOptions &options
+)
+{
+    PhasePoint &current = w.current;
+    PhasePoint &next = w.next;
+    PhasePoint &temp = w.temp;
+    std::vector<PhasePoint> &fb = w.fb;
+    NutsTree &tree = w.tree;
+    const bool multinomial = ( options.variant == NutsVariant::multinomial );
 
-    // Run a monte carlo step until we get specific number of samples
-    for( unsigned int sample=0; sample<samples; sample++ )
+    // Random streams for this chain
+    hmc::IntRNG &int_rng = rng.int_rng;
+    hmc::UniformRNG &uniform_rng = rng.uniform_rng;
+
+    // Get the initial state and a random choice of velocity
+    geometry.refresh( current.velocity, current.state, rng.normal_rng );
+    fb[0] = current;
+    fb[1] = current;
+    copy_position( next, current );
+
+    // Init tree size
+    int n = 1;
+    int tree_height = 0;
+
+    // Find acceptance slice. The multinomial variant weights every
+    // point against the starting energy instead.
+    double current_energy = current.energy + geometry.kinetic_energy( current.velocity );
+    double lu = -current_energy;
+    double log_weight = 0;
+    if( !multinomial )
+        lu += std::log( uniform_rng.gen() );
+    tree.start_energy = current_energy;
+    tree.accept_sum = 0;
+    tree.accept_count = 0;
+
+    bool check1 = true;
+    // Begin building tree
+    while( check1 && tree_height < options.max_depth )
     {
-        // Get the initial state and a random choice of velocity
-        for( unsigned int i=0; i<system_size; i++ )
-            {current_velocity[i] = normal_rng.gen();}
-        fb_velocity[0] = current_velocity;
-        fb_velocity[1] = current_velocity;
-        fb_state[0] = current_state;
-        fb_state[1] = current_state;
-        next_state = current_state;
-
-        // Init tree size
-        int n = 1;
-        int tree_height = 0;
-
-        // Find acceptance slice
-        double current_energy = total_energy( current_state, current_velocity );
-        double r = uniform_rng.gen();
-        double lu = std::log(r) - current_energy;
-
-        bool check1 = true;
-        // Begin building tree
-        while(check1)
-        {
-            // Init n for this tree
-            int temp_n = 0;
+        // Init n for this tree
+        double temp_n = 0;
 
-            // Pick random direction
-            int dir_choice = int_rng.gen();
-            int dir = 2*dir_choice - 1;
-            double temp_eps = leapfrog_eps*dir;
+        // Pick random direction
+        int dir_choice = int_rng.gen();
+        int dir = 2*dir_choice - 1;
+        double temp_eps = leapfrog_eps*dir;
 
-            // Run leapfrog in that direction
-            if(temp_eps > 0)
-            {
-                build_tree(fb_state[1], fb_velocity[1], dud_state_tree[tree_height+1], dud_vel_tree[tree_height+1], fb_state[1], fb_velocity[1],
-                           temp_state, dud_state_tree, dud_vel_tree, pos_state_tree, lu, tree_height, temp_eps, check1, temp_n, f_energy_grad, total_energy, work, uniform_rng);
-            }
-            else
-            {
-                build_tree(fb_state[0], fb_velocity[0], fb_state[0], fb_velocity[0], dud_state_tree[tree_height+1], dud_vel_tree[tree_height+1],
-                           temp_state, dud_state_tree, dud_vel_tree, pos_state_tree, lu, tree_height, temp_eps, check1, temp_n, f_energy_grad, total_energy, work, uniform_rng);
-            }
+        // Run leapfrog in that direction from the matching end
+        build_tree( fb[dir_choice], temp, tree, lu, tree_height, temp_eps,
+                    check1, temp_n, f_energy_grad, geometry, uniform_rng,
+                    options.variant );
 
-            if (check1 && uniform_rng.gen() < temp_n/float(n)) {next_state = temp_state;}
+        if( multinomial )
+        {
+            // Biased towards the new subtree
+            if( check1 && uniform_rng.gen() < std::exp( temp_n - log_weight ) )
+                std::swap( next, temp );
+            log_weight = log_add( log_weight, temp_n );
+        }
+        else
+        {
+            if (check1 && uniform_rng.gen() < float(temp_n)/float(n)) {std::swap( next, temp );}
             n += temp_n;
-            check1 *= (((fb_state[1] - fb_state[0]) * fb_velocity[0]).sum() >= 0);
-            check1 *= (((fb_state[1] - fb_state[0]) * fb_velocity[1]).sum() >= 0);
-            tree_height++;
         }
+        check1 = check1 && geometry.u_turn_free( fb[0], fb[1] );
+        tree_height++;
+    }
 
-        // Set next state
-        current_state = next_state;
+    // Set next state
+    std::swap( current, next );
+
+    return tree.accept_sum / std::max( tree.accept_count, 1L );
+}
+
+template <class EnergyGrad, class Geometry>
+std::vector<std::valarray<double> > hmc::nuts(
+    std::valarray<double> &sample_energy,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t samples,
+    const EnergyGrad &f_energy_grad,
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+    ChainRNG &rng,
+    const Geometry &geometry,
+    const NutsOptions &options
+)
+{
+    // initialise vector of results
+    std::vector<std::valarray<double> > trace;
+
+    // allocate memory for work, the tree grows its levels as needed
+    NutsWorkspace w( current_state.size() );
+
+    // Energy and gradient of the starting state
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    // Run a monte carlo step until we get specific number of samples
+    for( unsigned int sample=0; sample<samples; sample++ )
+    {
+        nuts_transition( w, leapfrog_eps, f_energy_grad, rng, geometry,
+                         options );
 
         // Store the energy
-        sample_energy[sample] = f_energy(current_state);
+        sample_energy[sample] = w.current.energy;
 
         // Store the reduced parameters
-        trace.push_back( reduce( current_state ) );
+        trace.push_back( reduce( w.current.state ) );
     }
+    current_state = w.current.state;
     return trace;
 }
 
+template <class EnergyGrad, class Geometry>
+void hmc::nuts(
+    SampleSink &sink,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t draws,
+    const EnergyGrad &f_energy_grad,
+    const ReduceInto &reduce,
+    ChainRNG &rng,
+    const Geometry &geometry,
+    const NutsOptions &options
+)
+{
+    NutsWorkspace w( current_state.size() );
+    std::valarray<double> reduced( sink.width() );
+
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    for( size_t draw=0; draw<draws; draw++ )
+    {
+        nuts_transition( w, leapfrog_eps, f_energy_grad, rng, geometry,
+                         options );
+
+        // Dropped draws are never reduced
+        if( !sink.keeps( draw ) )
+            continue;
+        reduce( reduced, w.current.state );
+        sink.write( w.current.energy, reduced );
+    }
+    current_state = w.current.state;
+}
+
+template <class EnergyGrad, class Geometry>
+hmc::WarmupResult hmc::nuts_warmup(
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const EnergyGrad &f_energy_grad,
+    ChainRNG &rng,
+    const AdaptOptions &adapt,
+    const Geometry &geometry,
+    const NutsOptions &options
+)
+{
+    NutsWorkspace w( current_state.size() );
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    WarmupResult res = windowed_warmup(
+        w.current.state, leapfrog_eps, adapt, geometry,
+        [&]( const Geometry &g, const double eps )
+        {
+            return nuts_transition( w, eps, f_energy_grad, rng, g, options );
+        });
+    current_state = w.current.state;
+
+    return res;
+}
+
+template <class EnergyGrad, class Geometry>
+hmc::WarmupResult hmc::nuts_chain(
+    SampleSink &sink,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t draws,
+    const EnergyGrad &f_energy_grad,
+    const ReduceInto &reduce,
+    ChainRNG &rng,
+    const AdaptOptions &adapt,
+    const CheckpointOptions &checkpoint,
+    const Geometry &geometry,
+    const NutsOptions &options
+)
+{
+    NutsWorkspace w( current_state.size() );
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    WarmupResult res = resumable_chain(
+        sink, w.current, leapfrog_eps, draws, reduce, rng, adapt,
+        checkpoint, geometry,
+        [&]( const Geometry &g, const double eps )
+        {
+            return nuts_transition( w, eps, f_energy_grad, rng, g, options );
+        });
+    current_state = w.current.state;
+
+    return res;
+}
+
+template <class EnergyGrad, class Geometry>
+hmc::WarmupResult hmc::hmc_chain(
+    SampleSink &sink,
+    std::valarray<double> &current_state,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t draws,
+    const EnergyGrad &f_energy_grad,
+    const ReduceInto &reduce,
+    ChainRNG &rng,
+    const AdaptOptions &adapt,
+    const CheckpointOptions &checkpoint,
+    const Geometry &geometry
+)
+{
+    HmcWorkspace w( current_state.size() );
+    w.current.state = current_state;
+    w.current.energy = f_energy_grad( w.current.grad, w.current.state );
+
+    WarmupResult res = resumable_chain(
+        sink, w.current, leapfrog_eps, draws, reduce, rng, adapt,
+        checkpoint, geometry,
+        [&]( const Geometry &g, const double eps )
+        {
+            return hmc_transition( w, eps, leapfrog_steps, f_energy_grad,
+                                   rng, g );
+        });
+    current_state = w.current.state;
+
+    return res;
+}
+
+void hmc::NutsTree::reserve( const int height )
+{
+    // Each level keeps a candidate and the first point of its subtree
+    while( int( candidate.size() ) < height + 1 )
+    {
+        PhasePoint checkpoint_level;
+        checkpoint_level.state.resize( size );
+        checkpoint_level.velocity.resize( size );
+        checkpoint.push_back( checkpoint_level );
+        candidate.push_back( PhasePoint( size ) );
+        weight.push_back( 0 );
+    }
+}
+
+void hmc::copy_position( PhasePoint &to, const PhasePoint &from )
+{
+    to.state = from.state;
+    to.grad = from.grad;
+    to.energy = from.energy;
+}
+
+double hmc::log_add( const double a, const double b )
+{
+    double top = std::max( a, b );
+    return top + std::log1p( std::exp( -std::abs( a - b ) ) );
+}
+
+bool hmc::u_turn_free( const PhasePoint &back, const PhasePoint &front )
+{
+    double back_dot = 0, front_dot = 0;
+    for( size_t i=0; i<back.state.size(); i++ )
+    {
+        double diff = front.state[i] - back.state[i];
+        back_dot += diff * back.velocity[i];
+        front_dot += diff * front.velocity[i];
+    }
+    return ( back_dot >= 0 ) && ( front_dot >= 0 );
+}
+
+namespace
+{
+    // Level of the largest subtree, up to height, which starts at leaf k
+    int start_level( const long k, const int height )
+    {
+        int level = 0;
+        while( level < height && ( ( k >> level ) & 1 ) == 0 )
+            level++;
+        return level;
+    }
+}
+
+template <class EnergyGrad, class Geometry>
 void hmc::build_tree(
-    std::valarray<double> &in_state,
-    std::valarray<double> &in_vel,
-    std::valarray<double> &back_state,
-    std::valarray<double> &back_vel,
-    std::valarray<double> &for_state,
-    std::valarray<double> &for_vel,
-    std::valarray<double> &out_state,
-    std::vector<std::valarray<double> > &dud_state_tree,
-    std::vector<std::valarray<double> > &dud_vel_tree,
-    std::vector<std::valarray<double> > &pos_state_tree,
+    PhasePoint &edge,
+    PhasePoint &out,
+    NutsTree &tree,
     const double slice,
     const int tree_height,
     const double eps,
     bool &break_check,
-    int &n_check,
-    const std::function<void(std::valarray<double>&,const std::valarray<double>&)> &energy_grads,
-    const std::function<double(const std::valarray<double>&, const std::valarray<double>&)> &energy,
-    std::valarray<double> &work,
-    mklrand::mkl_drand &rng
+    double &n_check,
+    const EnergyGrad &energy_grads,
+    const Geometry &geometry,
+    hmc::UniformRNG &rng,
+    const NutsVariant variant
 )
 {
-    if(tree_height == 0)
+    const bool multinomial = ( variant == NutsVariant::multinomial );
+    tree.reserve( tree_height );
+    const long n_leaves = 1L << tree_height;
+
+    // Subtrees are completed in leaf order. A level-j subtree is the
+    // second half of its parent when bit j of its last leaf is set.
+    for( long k=0; k<n_leaves; k++ )
     {
-        leapfrog::lfs(dud_state_tree[tree_height], dud_vel_tree[tree_height], work, in_state, in_vel, energy_grads, eps);
+        // Step from the edge, the leaf then becomes the edge. The gradient
+        // at the edge starts the step.
+        PhasePoint &leaf = tree.leaf;
+        std::swap( leaf.grad, edge.grad );
+        leaf.energy = geometry.step( leaf.state, leaf.velocity, leaf.grad,
+                                     edge.state, edge.velocity, energy_grads, eps );
+        std::swap( leaf, edge );
 
-        back_state = dud_state_tree[tree_height];
-        back_vel = dud_vel_tree[tree_height];
-        for_state = dud_state_tree[tree_height];
-        for_vel = dud_vel_tree[tree_height];
-        out_state = dud_state_tree[tree_height];
+        double temp_E = -(edge.energy + geometry.kinetic_energy(edge.velocity));
+        double n_sub = multinomial ? temp_E - slice : (temp_E >= slice);
+        break_check = break_check && ( temp_E >= slice - 1000 );
+        tree.accept_sum += accept_stat( temp_E + tree.start_energy );
+        tree.accept_count++;
 
-        double temp_E = -energy(dud_state_tree[tree_height], dud_vel_tree[tree_height]);
-        n_check = (temp_E >= slice);
-        break_check *= (temp_E >= slice - 1000);
-        return;
-    }
-    else
-    {
-        n_check = 0;
-        build_tree(in_state, in_vel, back_state, back_vel, for_state, for_vel,
-                   out_state, dud_state_tree, dud_vel_tree, pos_state_tree, slice, tree_height-1, eps, break_check, n_check,
-                   energy_grads, energy, work, rng);
-        if(break_check)
+        // Keep the first point of the subtrees this leaf starts
+        int first = start_level( k, tree_height );
+        if( first > 0 )
+        {
+            tree.checkpoint[first].state = edge.state;
+            tree.checkpoint[first].velocity = edge.velocity;
+        }
+
+        // Merge each completed subtree into its parent. The candidate of
+        // the subtree is the leaf at level zero and tree.candidate[j-1]
+        // above it.
+        int j = 0;
+        for( ; break_check && j < tree_height; j++ )
         {
-            int temp_n = 0;
-            if(eps > 0)
+            if( ( ( k >> j ) & 1 ) == 0 )
             {
-                build_tree(for_state, for_vel, dud_state_tree[tree_height], dud_vel_tree[tree_height], for_state,
-                           for_vel, pos_state_tree[tree_height-1], dud_state_tree, dud_vel_tree, pos_state_tree, slice, tree_height-1, eps,
-                           break_check, temp_n, energy_grads, energy, work, rng);
+                // First half of the parent, keep it for later
+                if( j == 0 )
+                    copy_position( tree.candidate[0], edge );
+                else
+                    std::swap( tree.candidate[j], tree.candidate[j-1] );
+                tree.weight[j] = n_sub;
+                break;
             }
-            else
+
+            // Second half of the parent, choose between the halves in
+            // proportion to their weight
+            double total = multinomial ? log_add( n_sub, tree.weight[j] )
+                                       : n_sub + tree.weight[j];
+            double p_second = multinomial ? std::exp( n_sub - total )
+                                          : float(n_sub)/float(total);
+            if( rng.gen() < p_second )
             {
-                build_tree(back_state, back_vel, back_state, back_vel, dud_state_tree[tree_height],
-                           dud_vel_tree[tree_height], pos_state_tree[tree_height-1], dud_state_tree, dud_vel_tree, pos_state_tree, slice, tree_height-1, eps,
-                           break_check, temp_n, energy_grads, energy, work, rng);
+                if( j == 0 )
+                    copy_position( tree.candidate[0], edge );
+                else
+                    std::swap( tree.candidate[j], tree.candidate[j-1] );
             }
-            if(rng.gen() < temp_n/float(temp_n+n_check)) {out_state = pos_state_tree[tree_height-1];}
-            break_check *= (((for_state - back_state) * back_vel).sum() >= 0);
-            break_check *= (((for_state - back_state) * for_vel).sum() >= 0);
-            n_check += temp_n;
+            tree.weight[j] = total;
+            n_sub = total;
+
+            // Check the parent for a U-turn
+            const PhasePoint &start = tree.checkpoint[
+                start_level( k + 1 - ( 2L << j ), tree_height )];
+            break_check = break_check &&
+                ( ( eps > 0 ) ? geometry.u_turn_free( start, edge )
+                              : geometry.u_turn_free( edge, start ) );
+        }
+
+        if( !break_check )
+        {
+            // Parents whose second half was under way still draw, as in
+            // the recursive form, so the random stream is unchanged. The
+            // sample is not used once the tree has stopped.
+            for( ; j < tree_height; j++ )
+                if( ( k >> j ) & 1 )
+                    rng.gen();
+            n_check = 0;
+            return;
+        }
+
+        // The whole tree is complete after its last leaf
+        if( j == tree_height )
+        {
+            if( j == 0 )
+                copy_position( out, edge );
+            else
+                std::swap( out, tree.candidate[j-1] );
+            n_check = n_sub;
+        }
+    }
+}
+
+namespace
+{
+    // Adapts the step size, and the metric of the angles, if asked and
+    // then samples with NUTS into sink, checkpointing if asked
+    template <class EnergyGrad, class Geometry>
+    hmc::WarmupResult warm_and_sample(
+        hmc::SampleSink &sink,
+        std::valarray<double> &state,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int warmup,
+        const EnergyGrad &f_energy_grad,
+        const hmc::ReduceInto &reduce,
+        hmc::ChainRNG &rng,
+        const hmc::CheckpointOptions &checkpoint,
+        const Geometry &geometry )
+    {
+        hmc::AdaptOptions adapt;
+        adapt.warmup = std::max( warmup, 0 );
+        if( has_metric( geometry ) )
+            adapt.metric = hmc::MetricAdaptation::diagonal;
+        return hmc::nuts_chain( sink, state, leapfrog_eps, nsamples,
+                                f_energy_grad, reduce, rng, adapt,
+                                checkpoint, geometry );
+    }
+
+    // Runs warm_and_sample on one chain with whichever Hamiltonian the
+    // model picks
+    struct ModelSampler {
+        hmc::SampleSink &sink;
+        std::valarray<double> &state;
+        double leapfrog_eps;
+        int nsamples;
+        int warmup;
+        const hmc::ReduceInto &reduce;
+        hmc::ChainRNG &rng;
+        const hmc::CheckpointOptions &checkpoint;
+
+        template <class EnergyGrad, class Geometry>
+        hmc::WarmupResult operator()( const EnergyGrad &f_energy_grad,
+                                      const Geometry &geometry ) const
+        {
+            return warm_and_sample( sink, state, leapfrog_eps, nsamples,
+                                    warmup, f_energy_grad, reduce, rng,
+                                    checkpoint, geometry );
         }
-        return;
+    };
+
+    // Samples the angles with the terms fixed at compile time where
+    // possible, with the lattice kernels in precision Real
+    template <class Real>
+    hmc::WarmupResult sample_angles(
+        const ModelSampler &run,
+        const hmc::HamiltonianOptions &options,
+        const std::shared_ptr<hmc::HeisenbergSystem> &system )
+    {
+        using namespace hmc;
+        // The steps share the threads of the lattice, if it has any
+        const Metric metric( system->pool() );
+        // The dipolar term has its own field, so goes through the
+        // generated functions
+        if( options.D != 0 )
+            return run( gen_total_energy_grad( options, system ), metric );
+        if( options.J != 0 && options.H != 0 )
+            return run( BasicHamiltonian<Real, Exchange, Zeeman>(
+                            system, Exchange( options.J ), Zeeman( options.H ) ),
+                        metric );
+        if( options.J != 0 )
+            return run( BasicHamiltonian<Real, Exchange>(
+                            system, Exchange( options.J ) ), metric );
+        if( options.H != 0 )
+            return run( BasicHamiltonian<Real, Zeeman>(
+                            system, Zeeman( options.H ) ), metric );
+        return run( gen_total_energy_grad( options, system ), metric );
+    }
+
+    // Samples the spin vectors, with the neighbour field in precision Real
+    template <class Real>
+    hmc::WarmupResult sample_vectors(
+        const ModelSampler &run,
+        const hmc::HamiltonianOptions &options,
+        const std::shared_ptr<hmc::HeisenbergSystem> &system )
+    {
+        using namespace hmc;
+        // The steps share the threads of the lattice, if it has any
+        const Sphere sphere( system->pool() );
+        if( options.D != 0 )
+        {
+            // The local terms with the dipolar field added on
+            const BasicCartesianHamiltonian<Real, Exchange, Zeeman> local(
+                system, Exchange( options.J ), Zeeman( options.H ) );
+            const double D = options.D;
+            return run( [local, system, D]( std::valarray<double> &grad,
+                                            const std::valarray<double> &state )
+            {
+                return local( grad, state )
+                    + system->vector_dipolar_energy_grad( grad, state, D );
+            }, sphere );
+        }
+        if( options.J != 0 && options.H != 0 )
+            return run( BasicCartesianHamiltonian<Real, Exchange, Zeeman>(
+                            system, Exchange( options.J ), Zeeman( options.H ) ),
+                        sphere );
+        if( options.J != 0 )
+            return run( BasicCartesianHamiltonian<Real, Exchange>(
+                            system, Exchange( options.J ) ), sphere );
+        if( options.H != 0 )
+            return run( BasicCartesianHamiltonian<Real, Zeeman>(
+                            system, Zeeman( options.H ) ), sphere );
+        return run( CartesianHamiltonian<>( system ), sphere );
+    }
+
+    // Copies the samples kept in trace out, turning the normalised energy
+    // back into real energy, and adds the averages and the time since start
+    // to the warmup result
+    hmc::ModelResult model_result(
+        const std::chrono::steady_clock::time_point start,
+        const hmc::WarmupResult &warm,
+        const hmc::TraceMatrix &trace,
+        const hmc::ThermoAccumulator &observables,
+        const double beta,
+        std::valarray<double> &sample_energy,
+        std::valarray<double> &sample_magnetisation )
+    {
+        if( sample_energy.size() > 0 )
+        {
+            sample_energy = trace.energy() / beta;
+            for( size_t n=0; n<trace.size(); n++ )
+                sample_magnetisation[n] = trace( n, 0 );
+        }
+
+        hmc::ModelResult res;
+        static_cast<hmc::WarmupResult&>( res ) = warm;
+        res.observables = observables.result();
+        res.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start ).count();
+        return res;
     }
 }
 
+hmc::HamiltonianOptions hmc::scaled_options( const HamiltonianOptions &options,
+                                             const double beta )
+{
+    HamiltonianOptions scaled = options;
+    scaled.J *= beta;
+    scaled.H *= beta;
+    scaled.D *= beta;
+    return scaled;
+}
+
 /// Interface to Heisenberg hmc
-void hmc::heisenberg_model(
+hmc::ModelResult hmc::heisenberg_model(
     std::valarray<double> &sample_energy,
     std::valarray<double> &sample_magnetisation,
     const std::vector<int> system_dimensions,
@@ -295,55 +1144,316 @@ void hmc::heisenberg_model(
     const double beta,
     const double leapfrog_eps,
     const int nsamples,
-    const int initial_state_seed )
+    const int initial_state_seed,
+    const int warmup,
+    const CheckpointOptions &checkpoint,
+    const Precision precision )
+{
+    std::shared_ptr<HeisenbergSystem> system(
+        new HeisenbergSystem( system_dimensions ) );
+    return heisenberg_model( sample_energy, sample_magnetisation, system,
+                             options, beta, leapfrog_eps, nsamples,
+                             initial_state_seed, warmup, checkpoint,
+                             precision );
+}
+
+hmc::ModelResult hmc::heisenberg_model(
+    std::valarray<double> &sample_energy,
+    std::valarray<double> &sample_magnetisation,
+    const std::shared_ptr<HeisenbergSystem> system,
+    const HamiltonianOptions options,
+    const double beta,
+    const double leapfrog_eps,
+    const int nsamples,
+    const int initial_state_seed,
+    const int warmup,
+    const CheckpointOptions &checkpoint,
+    const Precision precision )
 {
-    // Compute the size of the state vector
+    const auto start = std::chrono::steady_clock::now();
+
     // theta and phi for every element in system
-    const double state_size = 2 * std::accumulate(
-        system_dimensions.begin(),
-        system_dimensions.end(),
-        1, std::multiplies<double>() );
+    const double state_size = 2 * system->spins();
 
-    // Random initial state is controlled with the initial_state_seed
+    // Random initial state is controlled with the initial_state_seed, in
+    // the numbering the lattice was built in
     std::valarray<double> initial_state( state_size );
-    mklrand::mkl_drand rng( initial_state_seed );
-    for( unsigned int i=0; i<state_size/2; i++ ){
-        double c_theta = rng.gen() * 2 - 1;
-        double phi = rng.gen() * 2 * M_PI;
-        initial_state[i] = acos(c_theta);
-        initial_state[i+state_size/2] = phi;
-    }
-
-    // Get the Hamiltonian and gradient functions
-    size_t ndim = system_dimensions.size();
-    auto energy_function = gen_total_energy( options, beta, ndim, state_size );
-    auto grad_function = gen_total_grad( options, ndim, state_size );
+    hmc::UniformRNG rng( initial_state_seed );
+    random_state( initial_state, rng );
+    initial_state = system->from_built( initial_state );
 
     // Reduction to compute the magnetisation
-    std::function<std::valarray<double>(const std::valarray<double>&)>
-        reduce = []( const std::valarray<double>& state )
-        {
-            std::valarray<double> res = { magnetisation( state ) };
-            return res;
-        };
+    ReduceInto reduce = [system]( std::valarray<double> &out,
+                                  const std::valarray<double>& state )
+    {
+        out[0] = system->magnetisation( state );
+    };
+
+    // EXECUTE HMC with the terms fixed at compile time where possible
+    // The samples are only kept if there is somewhere to return them
+    const bool keep_trace = sample_energy.size() > 0;
+    ChainRNG chain_rng;
+    TraceMatrix trace( keep_trace ? nsamples : 0, 1 );
+    ThermoAccumulator observables( beta, state_size/2 );
+    TeeSink both( trace, observables );
+    SampleSink &sink = keep_trace ? static_cast<SampleSink&>( both )
+                                  : observables;
+    const ModelSampler run = { sink, initial_state, leapfrog_eps, nsamples,
+                               warmup, reduce, chain_rng, checkpoint };
+    const HamiltonianOptions scaled = scaled_options( options, beta );
+    WarmupResult res = ( precision == Precision::mixed )
+        ? sample_angles<float>( run, scaled, system )
+        : sample_angles<double>( run, scaled, system );
+
+    return model_result( start, res, trace, observables, beta,
+                         sample_energy, sample_magnetisation );
+}
 
-    // EXECUTE HMC
-    auto trace = hmc::nuts( sample_energy, initial_state, leapfrog_eps, nsamples,
-                          energy_function, grad_function, reduce );
+hmc::ModelResult hmc::heisenberg_model_cartesian(
+    std::valarray<double> &sample_energy,
+    std::valarray<double> &sample_magnetisation,
+    const std::vector<int> system_dimensions,
+    const HamiltonianOptions options,
+    const double beta,
+    const double leapfrog_eps,
+    const int nsamples,
+    const int initial_state_seed,
+    const int warmup,
+    const CheckpointOptions &checkpoint,
+    const Precision precision )
+{
+    std::shared_ptr<HeisenbergSystem> system(
+        new HeisenbergSystem( system_dimensions ) );
+    return heisenberg_model_cartesian(
+        sample_energy, sample_magnetisation, system, options, beta,
+        leapfrog_eps, nsamples, initial_state_seed, warmup, checkpoint,
+        precision );
+}
 
-    // Energy is returned normalised so we turn it into real energy
-    sample_energy = sample_energy / beta;
+hmc::ModelResult hmc::heisenberg_model_cartesian(
+    std::valarray<double> &sample_energy,
+    std::valarray<double> &sample_magnetisation,
+    const std::shared_ptr<HeisenbergSystem> system,
+    const HamiltonianOptions options,
+    const double beta,
+    const double leapfrog_eps,
+    const int nsamples,
+    const int initial_state_seed,
+    const int warmup,
+    const CheckpointOptions &checkpoint,
+    const Precision precision )
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    // The same random initial state as heisenberg_model
+    const int nspins = system->spins();
+    std::valarray<double> initial_angles( 2*nspins );
+    hmc::UniformRNG rng( initial_state_seed );
+    random_state( initial_angles, rng );
+    std::valarray<double> initial_state =
+        system->from_built( spin_vectors( initial_angles ) );
 
-    // Magnetisation is stored in the trace
-    for( size_t n=0; n<nsamples; n++ )
-        sample_magnetisation[n] = trace[n][0];
+    ReduceInto reduce = []( std::valarray<double> &out,
+                            const std::valarray<double>& state )
+    {
+        out[0] = vector_magnetisation( state );
+    };
+
+    // The samples are only kept if there is somewhere to return them
+    const bool keep_trace = sample_energy.size() > 0;
+    ChainRNG chain_rng;
+    TraceMatrix trace( keep_trace ? nsamples : 0, 1 );
+    ThermoAccumulator observables( beta, nspins );
+    TeeSink both( trace, observables );
+    SampleSink &sink = keep_trace ? static_cast<SampleSink&>( both )
+                                  : observables;
+    const ModelSampler run = { sink, initial_state, leapfrog_eps, nsamples,
+                               warmup, reduce, chain_rng, checkpoint };
+    const HamiltonianOptions scaled = scaled_options( options, beta );
+    WarmupResult res = ( precision == Precision::mixed )
+        ? sample_vectors<float>( run, scaled, system )
+        : sample_vectors<double>( run, scaled, system );
+
+    return model_result( start, res, trace, observables, beta,
+                         sample_energy, sample_magnetisation );
+}
+
+std::valarray<double> hmc::spin_vectors( const std::valarray<double> &angles )
+{
+    size_t n = angles.size() / 2;
+    std::valarray<double> vectors( 3*n );
+    for( size_t i=0; i<n; i++ )
+    {
+        double sin_the = std::sin( angles[i] );
+        vectors[i] = std::cos( angles[n+i] ) * sin_the;
+        vectors[n+i] = std::sin( angles[n+i] ) * sin_the;
+        vectors[2*n+i] = std::cos( angles[i] );
+    }
+    return vectors;
+}
+
+double hmc::vector_magnetisation( const std::valarray<double>& state )
+{
+    size_t n = state.size() / 3;
+    double x = 0, y = 0, z = 0;
+    for( size_t i=0; i<n; i++ )
+    {
+        x += state[i];
+        y += state[n+i];
+        z += state[2*n+i];
+    }
+    return std::sqrt( x*x + y*y + z*z );
+}
+
+void hmc::random_state(
+    std::valarray<double> &state,
+    hmc::UniformRNG &rng )
+{
+    size_t halfsize = state.size() / 2;
+    for( unsigned int i=0; i<halfsize; i++ ){
+        double c_theta = rng.gen() * 2 - 1;
+        double phi = rng.gen() * 2 * M_PI;
+        state[i] = acos(c_theta);
+        state[i+halfsize] = phi;
+    }
 }
 
 double hmc::magnetisation( const std::valarray<double>& state )
 {
-    calc_trig(state);
-    double x = (cos_phi*sin_the).sum();
-    double y = (sin_phi*sin_the).sum();
-    double z = cos_the.sum();
+    size_t halfsize = state.size() / 2;
+    double x = 0, y = 0, z = 0;
+    for( size_t i=0; i<halfsize; i++ )
+    {
+        double sin_the = std::sin( state[i] );
+        x += std::cos( state[halfsize+i] ) * sin_the;
+        y += std::sin( state[halfsize+i] ) * sin_the;
+        z += std::cos( state[i] );
+    }
     return std::sqrt( x*x + y*y + z*z );
 }
+
+// Samplers are instantiated for the runtime and compile-time Hamiltonians.
+// The types are named first as macro arguments cannot contain commas.
+namespace
+{
+    typedef std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+        EnergyGradFunction;
+    typedef hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ExchangeZeeman;
+    typedef hmc::Hamiltonian<hmc::Exchange> ExchangeOnly;
+    typedef hmc::Hamiltonian<hmc::Zeeman> ZeemanOnly;
+    typedef hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> CartesianExchangeZeeman;
+    typedef hmc::CartesianHamiltonian<hmc::Exchange> CartesianExchange;
+    typedef hmc::CartesianHamiltonian<hmc::Zeeman> CartesianZeeman;
+    typedef hmc::CartesianHamiltonian<> CartesianFree;
+    typedef hmc::MixedHamiltonian<hmc::Exchange, hmc::Zeeman> MixedExchangeZeeman;
+    typedef hmc::MixedHamiltonian<hmc::Exchange> MixedExchange;
+    typedef hmc::MixedHamiltonian<hmc::Zeeman> MixedZeeman;
+    typedef hmc::MixedCartesianHamiltonian<hmc::Exchange, hmc::Zeeman>
+        MixedCartesianExchangeZeeman;
+    typedef hmc::MixedCartesianHamiltonian<hmc::Exchange> MixedCartesianExchange;
+    typedef hmc::MixedCartesianHamiltonian<hmc::Zeeman> MixedCartesianZeeman;
+}
+
+#define INSTANTIATE_SAMPLERS( EnergyGrad, Geometry ) \
+template std::vector<std::valarray<double> > hmc::hmc<EnergyGrad, Geometry>( \
+    std::valarray<double> &energy, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t leapfrog_steps, \
+    const size_t samples, \
+    const EnergyGrad &f_energy_grad, \
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce, \
+    ChainRNG &rng, \
+    const Geometry &geometry); \
+template hmc::WarmupResult hmc::hmc_warmup<EnergyGrad, Geometry>( \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t leapfrog_steps, \
+    const EnergyGrad &f_energy_grad, \
+    ChainRNG &rng, \
+    const AdaptOptions &adapt, \
+    const Geometry &geometry); \
+template std::vector<std::valarray<double> > hmc::nuts<EnergyGrad, Geometry>( \
+    std::valarray<double> &sample_energy, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t samples, \
+    const EnergyGrad &f_energy_grad, \
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce, \
+    ChainRNG &rng, \
+    const Geometry &geometry, \
+    const NutsOptions &options); \
+template void hmc::hmc<EnergyGrad, Geometry>( \
+    SampleSink &sink, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t leapfrog_steps, \
+    const size_t draws, \
+    const EnergyGrad &f_energy_grad, \
+    const ReduceInto &reduce, \
+    ChainRNG &rng, \
+    const Geometry &geometry); \
+template void hmc::nuts<EnergyGrad, Geometry>( \
+    SampleSink &sink, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t draws, \
+    const EnergyGrad &f_energy_grad, \
+    const ReduceInto &reduce, \
+    ChainRNG &rng, \
+    const Geometry &geometry, \
+    const NutsOptions &options); \
+template hmc::WarmupResult hmc::nuts_warmup<EnergyGrad, Geometry>( \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const EnergyGrad &f_energy_grad, \
+    ChainRNG &rng, \
+    const AdaptOptions &adapt, \
+    const Geometry &geometry, \
+    const NutsOptions &options); \
+template hmc::WarmupResult hmc::nuts_chain<EnergyGrad, Geometry>( \
+    SampleSink &sink, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t draws, \
+    const EnergyGrad &f_energy_grad, \
+    const ReduceInto &reduce, \
+    ChainRNG &rng, \
+    const AdaptOptions &adapt, \
+    const CheckpointOptions &checkpoint, \
+    const Geometry &geometry, \
+    const NutsOptions &options); \
+template hmc::WarmupResult hmc::hmc_chain<EnergyGrad, Geometry>( \
+    SampleSink &sink, \
+    std::valarray<double> &current_state, \
+    const double leapfrog_eps, \
+    const size_t leapfrog_steps, \
+    const size_t draws, \
+    const EnergyGrad &f_energy_grad, \
+    const ReduceInto &reduce, \
+    ChainRNG &rng, \
+    const AdaptOptions &adapt, \
+    const CheckpointOptions &checkpoint, \
+    const Geometry &geometry);
+
+INSTANTIATE_SAMPLERS( EnergyGradFunction, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( ExchangeZeeman, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( ExchangeOnly, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( ZeemanOnly, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( EnergyGradFunction, hmc::Metric )
+INSTANTIATE_SAMPLERS( ExchangeZeeman, hmc::Metric )
+INSTANTIATE_SAMPLERS( ExchangeOnly, hmc::Metric )
+INSTANTIATE_SAMPLERS( ZeemanOnly, hmc::Metric )
+INSTANTIATE_SAMPLERS( CartesianExchangeZeeman, hmc::Sphere )
+INSTANTIATE_SAMPLERS( CartesianExchange, hmc::Sphere )
+INSTANTIATE_SAMPLERS( CartesianZeeman, hmc::Sphere )
+INSTANTIATE_SAMPLERS( CartesianFree, hmc::Sphere )
+INSTANTIATE_SAMPLERS( MixedExchangeZeeman, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( MixedExchange, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( MixedZeeman, hmc::Euclidean )
+INSTANTIATE_SAMPLERS( MixedExchangeZeeman, hmc::Metric )
+INSTANTIATE_SAMPLERS( MixedExchange, hmc::Metric )
+INSTANTIATE_SAMPLERS( MixedZeeman, hmc::Metric )
+INSTANTIATE_SAMPLERS( MixedCartesianExchangeZeeman, hmc::Sphere )
+INSTANTIATE_SAMPLERS( MixedCartesianExchange, hmc::Sphere )
+INSTANTIATE_SAMPLERS( MixedCartesianZeeman, hmc::Sphere )
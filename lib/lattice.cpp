@@ -0,0 +1,345 @@
+#include "../include/lattice.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+
+hmc::Lattice::Lattice(
+    const int dim,
+    const std::vector<std::vector<int> > &neighbours,
+    const std::vector<double> &positions )
+    : n_dim( dim ), row_start( 1, 0 ), coords( positions ),
+      built( neighbours.size() )
+{
+    const int n = neighbours.size();
+    std::iota( built.begin(), built.end(), 0 );
+    if( positions.size() != size_t( 3*n ) )
+        throw std::invalid_argument( "Lattice: three coordinates are needed for each site" );
+
+    n_degree = ( n > 0 ) ? neighbours[0].size() : 0;
+    row_start.reserve( n+1 );
+    for( int i=0; i<n; i++ )
+    {
+        std::vector<int> row( neighbours[i] );
+        for( int j : row )
+            if( j < 0 || j >= n )
+                throw std::invalid_argument( "Lattice: a neighbour is not a site" );
+        std::sort( row.begin(), row.end() );
+        table.insert( table.end(), row.begin(), row.end() );
+        row_start.push_back( table.size() );
+        if( int( row.size() ) != n_degree )
+            n_degree = 0;
+    }
+}
+
+hmc::Lattice hmc::Lattice::permuted( const std::vector<int> &order ) const
+{
+    const int n = size();
+    std::vector<int> new_index( n, -1 );
+    if( order.size() != size_t( n ) )
+        throw std::invalid_argument( "Lattice: the order must have one entry per site" );
+    for( int i=0; i<n; i++ )
+    {
+        if( order[i] < 0 || order[i] >= n || new_index[order[i]] != -1 )
+            throw std::invalid_argument( "Lattice: the order is not a permutation" );
+        new_index[order[i]] = i;
+    }
+
+    std::vector<std::vector<int> > neighbours( n );
+    std::vector<double> positions( 3*n );
+    for( int i=0; i<n; i++ )
+    {
+        const int old = order[i];
+        const int *row = this->neighbours( old );
+        for( int k=0; k<degree( old ); k++ )
+            neighbours[i].push_back( new_index[row[k]] );
+        std::copy( position( old ), position( old )+3, &positions[3*i] );
+    }
+    Lattice res( n_dim, neighbours, positions );
+    for( int i=0; i<n; i++ )
+        res.built[i] = built[order[i]];
+    return res;
+}
+
+std::valarray<double> hmc::Lattice::from_built(
+    const std::valarray<double> &state ) const
+{
+    const size_t n = size();
+    std::valarray<double> res( state.size() );
+    for( size_t c=0; c<state.size(); c+=n )
+        for( size_t i=0; i<n; i++ )
+            res[c+i] = state[c+built[i]];
+    return res;
+}
+
+std::valarray<double> hmc::Lattice::to_built(
+    const std::valarray<double> &state ) const
+{
+    const size_t n = size();
+    std::valarray<double> res( state.size() );
+    for( size_t c=0; c<state.size(); c+=n )
+        for( size_t i=0; i<n; i++ )
+            res[c+built[i]] = state[c+i];
+    return res;
+}
+
+namespace
+{
+    typedef std::array<int, 3> Offset;
+
+    // Builds the lattice of the basis points of every cell, numbered with
+    // the basis fastest and then the first axis. Positions are integers in
+    // units of 1/scale of a cell. Each site is joined to the site at each
+    // of vectors from it, wrapping on periodic axes and dropped off the
+    // ends of open ones.
+    hmc::Lattice crystal(
+        const std::vector<int> &cells,
+        const std::vector<bool> &periodic,
+        const int scale,
+        const std::vector<Offset> &basis,
+        const std::vector<Offset> &vectors )
+    {
+        const int dim = cells.size();
+        if( dim < 1 || dim > 3 )
+            throw std::invalid_argument( "lattice: one to three axes are supported" );
+        if( !periodic.empty() && periodic.size() != cells.size() )
+            throw std::invalid_argument( "lattice: periodic must be empty or one per axis" );
+
+        int side[3] = { 1, 1, 1 };
+        bool wraps[3] = { true, true, true };
+        for( int d=0; d<dim; d++ )
+        {
+            if( cells[d] < 1 )
+                throw std::invalid_argument( "lattice: every axis needs a cell" );
+            side[d] = cells[d];
+            wraps[d] = periodic.empty() || periodic[d];
+        }
+
+        const int nbasis = basis.size();
+        const int nsites = side[0] * side[1] * side[2] * nbasis;
+        std::vector<std::vector<int> > neighbours( nsites );
+        std::vector<double> positions( 3*nsites );
+        int site = 0;
+        for( int z=0; z<side[2]; z++ )
+        for( int y=0; y<side[1]; y++ )
+        for( int x=0; x<side[0]; x++ )
+        for( int b=0; b<nbasis; b++, site++ )
+        {
+            const int p[3] = { scale*x + basis[b][0],
+                               scale*y + basis[b][1],
+                               scale*z + basis[b][2] };
+            for( int d=0; d<3; d++ )
+                positions[3*site + d] = double( p[d] ) / scale;
+
+            for( const Offset &v : vectors )
+            {
+                bool inside = true;
+                int cell[3], offset[3];
+                for( int d=0; d<3; d++ )
+                {
+                    const int extent = scale * side[d];
+                    int t = p[d] + v[d];
+                    if( t < 0 || t >= extent )
+                    {
+                        inside = inside && wraps[d];
+                        t = ( t % extent + extent ) % extent;
+                    }
+                    cell[d] = t / scale;
+                    offset[d] = t % scale;
+                }
+                if( !inside )
+                    continue;
+
+                const int b2 = std::find( basis.begin(), basis.end(),
+                                          Offset{{ offset[0], offset[1], offset[2] }} )
+                               - basis.begin();
+                neighbours[site].push_back(
+                    ( ( cell[2]*side[1] + cell[1] )*side[0] + cell[0] )*nbasis + b2 );
+            }
+        }
+        return hmc::Lattice( dim, neighbours, positions );
+    }
+
+    // Every arrangement of the signs of a vector
+    void add_signs( std::vector<Offset> &vectors, const Offset &v )
+    {
+        for( int sx : { -1, 1 } )
+        for( int sy : { -1, 1 } )
+        for( int sz : { -1, 1 } )
+        {
+            Offset w = {{ sx*v[0], sy*v[1], sz*v[2] }};
+            if( std::find( vectors.begin(), vectors.end(), w ) == vectors.end() )
+                vectors.push_back( w );
+        }
+    }
+
+    // Bits needed for the largest coordinate of any site
+    int coordinate_bits( const std::vector<std::array<uint32_t, 3> > &grid,
+                         const int dim )
+    {
+        uint32_t top = 0;
+        for( const auto &p : grid )
+            for( int d=0; d<dim; d++ )
+                top = std::max( top, p[d] );
+        int bits = 1;
+        while( bits < 21 && ( top >> bits ) )
+            bits++;
+        return bits;
+    }
+
+    // The positions of the sites on a grid of half units, shifted to start
+    // from zero
+    std::vector<std::array<uint32_t, 3> > site_grid( const hmc::Lattice &lattice )
+    {
+        const int n = lattice.size();
+        double low[3] = { 0, 0, 0 };
+        for( int i=0; i<n; i++ )
+            for( int d=0; d<3; d++ )
+                low[d] = std::min( low[d], lattice.position( i )[d] );
+
+        std::vector<std::array<uint32_t, 3> > grid( n );
+        for( int i=0; i<n; i++ )
+            for( int d=0; d<3; d++ )
+                grid[i][d] = std::lround( 2*( lattice.position( i )[d] - low[d] ) );
+        return grid;
+    }
+
+    // Interleaves the bits of the coordinates, the top bit of the first
+    // axis first
+    uint64_t interleave( const std::array<uint32_t, 3> &x, const int dim,
+                         const int bits )
+    {
+        uint64_t key = 0;
+        for( int b=bits-1; b>=0; b-- )
+            for( int d=0; d<dim; d++ )
+                key = ( key << 1 ) | ( ( x[d] >> b ) & 1 );
+        return key;
+    }
+
+    // Skilling's transform of coordinates into the transposed Hilbert
+    // index, whose interleaved bits are the distance along the curve
+    // (AIP Conf. Proc. 707, 381 (2004))
+    void hilbert_transpose( std::array<uint32_t, 3> &x, const int dim,
+                            const int bits )
+    {
+        const uint32_t top = uint32_t( 1 ) << ( bits-1 );
+        for( uint32_t q=top; q>1; q>>=1 )
+        {
+            const uint32_t p = q-1;
+            for( int d=0; d<dim; d++ )
+            {
+                if( x[d] & q )
+                    x[0] ^= p;
+                else
+                {
+                    const uint32_t t = ( x[0] ^ x[d] ) & p;
+                    x[0] ^= t;
+                    x[d] ^= t;
+                }
+            }
+        }
+        for( int d=1; d<dim; d++ )
+            x[d] ^= x[d-1];
+        uint32_t t = 0;
+        for( uint32_t q=top; q>1; q>>=1 )
+            if( x[dim-1] & q )
+                t ^= q-1;
+        for( int d=0; d<dim; d++ )
+            x[d] ^= t;
+    }
+
+    // The sites sorted by their keys
+    std::vector<int> sorted_by( const std::vector<uint64_t> &keys )
+    {
+        std::vector<int> order( keys.size() );
+        std::iota( order.begin(), order.end(), 0 );
+        std::stable_sort( order.begin(), order.end(),
+                          [&keys]( const int a, const int b )
+                          { return keys[a] < keys[b]; } );
+        return order;
+    }
+
+    void check_cubic( const std::vector<int> &cells )
+    {
+        if( cells.size() != 3 )
+            throw std::invalid_argument( "lattice: cubic lattices need three axes" );
+    }
+}
+
+hmc::Lattice hmc::rectangular_lattice(
+    const std::vector<int> &sides,
+    const std::vector<bool> &periodic )
+{
+    std::vector<Offset> vectors;
+    for( size_t d=0; d<sides.size() && d<3; d++ )
+    {
+        Offset v = {{ 0, 0, 0 }};
+        v[d] = 1;
+        add_signs( vectors, v );
+    }
+    return crystal( sides, periodic, 1, { {{ 0, 0, 0 }} }, vectors );
+}
+
+hmc::Lattice hmc::bcc_lattice(
+    const std::vector<int> &cells,
+    const std::vector<bool> &periodic )
+{
+    check_cubic( cells );
+    std::vector<Offset> vectors;
+    add_signs( vectors, {{ 1, 1, 1 }} );
+    return crystal( cells, periodic, 2,
+                    { {{ 0, 0, 0 }}, {{ 1, 1, 1 }} }, vectors );
+}
+
+hmc::Lattice hmc::fcc_lattice(
+    const std::vector<int> &cells,
+    const std::vector<bool> &periodic )
+{
+    check_cubic( cells );
+    std::vector<Offset> vectors;
+    add_signs( vectors, {{ 1, 1, 0 }} );
+    add_signs( vectors, {{ 1, 0, 1 }} );
+    add_signs( vectors, {{ 0, 1, 1 }} );
+    return crystal( cells, periodic, 2,
+                    { {{ 0, 0, 0 }}, {{ 0, 1, 1 }}, {{ 1, 0, 1 }}, {{ 1, 1, 0 }} },
+                    vectors );
+}
+
+hmc::Lattice hmc::triangular_lattice(
+    const std::vector<int> &sides,
+    const std::vector<bool> &periodic )
+{
+    if( sides.size() != 2 )
+        throw std::invalid_argument( "lattice: the triangular lattice needs two axes" );
+    std::vector<Offset> vectors = {
+        {{ 1, 0, 0 }}, {{ -1, 0, 0 }}, {{ 0, 1, 0 }}, {{ 0, -1, 0 }},
+        {{ 1, -1, 0 }}, {{ -1, 1, 0 }} };
+    return crystal( sides, periodic, 1, { {{ 0, 0, 0 }} }, vectors );
+}
+
+std::vector<int> hmc::morton_order( const Lattice &lattice )
+{
+    const int dim = lattice.dimension();
+    const std::vector<std::array<uint32_t, 3> > grid = site_grid( lattice );
+    const int bits = coordinate_bits( grid, dim );
+    std::vector<uint64_t> keys( grid.size() );
+    for( size_t i=0; i<grid.size(); i++ )
+        keys[i] = interleave( grid[i], dim, bits );
+    return sorted_by( keys );
+}
+
+std::vector<int> hmc::hilbert_order( const Lattice &lattice )
+{
+    const int dim = lattice.dimension();
+    std::vector<std::array<uint32_t, 3> > grid = site_grid( lattice );
+    const int bits = coordinate_bits( grid, dim );
+    std::vector<uint64_t> keys( grid.size() );
+    for( size_t i=0; i<grid.size(); i++ )
+    {
+        hilbert_transpose( grid[i], dim, bits );
+        keys[i] = interleave( grid[i], dim, bits );
+    }
+    return sorted_by( keys );
+}
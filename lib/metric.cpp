@@ -0,0 +1,163 @@
+#include "../include/metric.hpp"
+#include "../include/hmc.hpp"
+#include "../include/checkpoint.hpp"
+#include <cmath>
+
+namespace
+{
+    // Calls f over [0, n), on the slabs of pool if there is one
+    template <class Function>
+    void run_slabs( hmc::SlabPool *pool, const size_t n, const Function &f )
+    {
+        if( pool )
+            pool->run( n, f );
+        else
+            f( 0, n );
+    }
+
+    // The dot product of a and b, summed by the blocks of pool if there
+    // is one
+    double dot( hmc::SlabPool *pool,
+                const std::valarray<double> &a,
+                const std::valarray<double> &b )
+    {
+        const double *x = &a[0], *y = &b[0];
+        auto partial = [=]( const size_t begin, const size_t end )
+        {
+            double sum = 0;
+            for( size_t i=begin; i<end; i++ )
+                sum += x[i] * y[i];
+            return sum;
+        };
+        if( pool )
+            return pool->sum( a.size(), partial );
+        return partial( 0, a.size() );
+    }
+}
+
+void hmc::Metric::correlate( std::valarray<double> &z, const double a ) const
+{
+    // The directions are orthonormal so each acts on its own component
+    for( size_t k=0; k<directions.size(); k++ )
+    {
+        const double *u = &directions[k][0];
+        double *zp = &z[0];
+        const double along = dot( pool.get(), directions[k], z )
+            * ( std::pow( values[k], a ) - 1 );
+        run_slabs( pool.get(), z.size(), [=]( const size_t begin,
+                                              const size_t end )
+        {
+            for( size_t i=begin; i<end; i++ )
+                zp[i] += along * u[i];
+        } );
+    }
+}
+
+void hmc::Metric::velocity(
+    std::valarray<double> &v,
+    const std::valarray<double> &p ) const
+{
+    if( scale.size() == 0 )
+    {
+        v = p;
+        return;
+    }
+    if( v.size() != p.size() )
+        v.resize( p.size() );
+    const double *s = &scale[0], *pp = &p[0];
+    double *vp = &v[0];
+    run_slabs( pool.get(), p.size(), [=]( const size_t begin,
+                                          const size_t end )
+    {
+        for( size_t i=begin; i<end; i++ )
+            vp[i] = pp[i] * s[i];
+    } );
+    correlate( v, 1.0 );
+    run_slabs( pool.get(), p.size(), [=]( const size_t begin,
+                                          const size_t end )
+    {
+        for( size_t i=begin; i<end; i++ )
+            vp[i] *= s[i];
+    } );
+}
+
+void hmc::Metric::refresh(
+    std::valarray<double> &momentum,
+    const std::valarray<double> &,
+    hmc::NormalRNG &rng ) const
+{
+    rng.fill( &momentum[0], momentum.size() );
+    if( scale.size() == 0 )
+        return;
+
+    // S^-1 R^-1/2 has covariance (S R S)^-1
+    correlate( momentum, -0.5 );
+    momentum /= scale;
+}
+
+double hmc::Metric::kinetic_energy( const std::valarray<double> &momentum ) const
+{
+    if( scale.size() == 0 && !pool )
+        return hmc::kinetic_energy( momentum );
+    if( scale.size() == 0 )
+        return dot( pool.get(), momentum, momentum ) / 2.0;
+    velocity_work.resize( momentum.size() );
+    velocity( velocity_work, momentum );
+    return dot( pool.get(), momentum, velocity_work ) / 2.0;
+}
+
+bool hmc::Metric::u_turn_free( const PhasePoint &back, const PhasePoint &front ) const
+{
+    if( scale.size() == 0 && !pool )
+        return hmc::u_turn_free( back, front );
+    const double *v0 = &back.velocity[0], *v1 = &front.velocity[0];
+    if( scale.size() > 0 )
+    {
+        back_work.resize( back.state.size() );
+        front_work.resize( front.state.size() );
+        velocity( back_work, back.velocity );
+        velocity( front_work, front.velocity );
+        v0 = &back_work[0];
+        v1 = &front_work[0];
+    }
+
+    const double *x0 = &back.state[0], *x1 = &front.state[0];
+    auto partial = [=]( const size_t begin, const size_t end, double *dots )
+    {
+        double back_dot = 0, front_dot = 0;
+        for( size_t i=begin; i<end; i++ )
+        {
+            double diff = x1[i] - x0[i];
+            back_dot += diff * v0[i];
+            front_dot += diff * v1[i];
+        }
+        dots[0] = back_dot;
+        dots[1] = front_dot;
+    };
+    double dots[2];
+    if( pool )
+        pool->sums( back.state.size(), 2, partial, dots );
+    else
+        partial( 0, back.state.size(), dots );
+    return ( dots[0] >= 0 ) && ( dots[1] >= 0 );
+}
+
+void hmc::Metric::save( std::ostream &out ) const
+{
+    write_array( out, scale );
+    write_value( out, directions.size() );
+    for( auto &u : directions )
+        write_array( out, u );
+    write_array( out, values );
+}
+
+void hmc::Metric::load( std::istream &in )
+{
+    read_array( in, scale );
+    size_t n;
+    read_value( in, n );
+    directions.resize( n );
+    for( auto &u : directions )
+        read_array( in, u );
+    read_array( in, values );
+}
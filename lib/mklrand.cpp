@@ -1,11 +1,51 @@
 #include "../include/mklrand.hpp"
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
 
-mklrand::mkl_drand::mkl_drand(int size, int seed)
+void mklrand::mkl_randbase::write_state(std::ostream &out) const
+{
+	// Which generator and buffer the state belongs to
+	int header[4] = {brng, arr_size, curr, vslGetStreamSize(stream)};
+	out.write((const char*)header, sizeof(header));
+
+	std::vector<char> memory(header[3]);
+	vslSaveStreamM(stream, memory.data());
+	out.write(memory.data(), memory.size());
+	out.write(buffer_bytes(), (size_t)arr_size*value_size());
+}
+
+void mklrand::mkl_randbase::read_state(std::istream &in)
+{
+	int header[4];
+	in.read((char*)header, sizeof(header));
+	if(!in)
+		throw std::runtime_error("mkl_randbase: random state ended early");
+	if(header[0] != brng || header[1] != arr_size)
+		throw std::runtime_error("mkl_randbase: random state is of a different generator");
+
+	std::vector<char> memory(header[3]);
+	in.read(memory.data(), memory.size());
+	std::vector<char> buffer((size_t)arr_size*value_size());
+	in.read(buffer.data(), buffer.size());
+	if(!in)
+		throw std::runtime_error("mkl_randbase: random state ended early");
+
+	vslDeleteStream(&stream);
+	vslLoadStreamM(&stream, memory.data());
+	std::copy(buffer.begin(), buffer.end(), buffer_bytes());
+	curr = header[2];
+}
+
+mklrand::mkl_drand::mkl_drand(int size, int seed, int gen)
 {
 	arr_size = size;
 	curr = 0;
+	brng = gen;
 	randarr = (double*)malloc(arr_size*sizeof(double));
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this -> fill();
 }
 
@@ -14,37 +54,46 @@ mklrand::mkl_drand::~mkl_drand()
 	free(randarr);
 }
 
-double mklrand::mkl_drand::gen()
-{
-	double out = randarr[curr];
-	curr++;
-	if(curr >= arr_size)
-	{
-		this->fill();
-	}
-	return out;
-}
-
 void mklrand::mkl_drand::fill()
 {
 	curr = 0;
 	vdRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, arr_size, randarr, 0, 1);
 }
 
+void mklrand::mkl_drand::fill(double *out, size_t n)
+{
+	while(n > 0)
+	{
+		size_t count = std::min(n, (size_t)(arr_size - curr));
+		std::copy(randarr + curr, randarr + curr + count, out);
+		out += count;
+		n -= count;
+		curr += count;
+		if(curr >= arr_size)
+		{
+			// As many buffers as fill would have made, in the same calls
+			for(; n >= (size_t)arr_size; out += arr_size, n -= arr_size)
+				vdRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, arr_size, out, 0, 1);
+			this->fill();
+		}
+	}
+}
+
 void mklrand::mkl_drand::change_seed(int seed)
 {
 	vslDeleteStream(&stream);
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this->fill();
 }
 
-mklrand::mkl_irand::mkl_irand(int size, int seed)
+mklrand::mkl_irand::mkl_irand(int size, int seed, int gen)
 {
 	arr_size = size;
 	curr = 0;
+	brng = gen;
 	randarr = (int*)malloc(arr_size*sizeof(int));
 
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this -> fill();
 }
 
@@ -53,38 +102,47 @@ mklrand::mkl_irand::~mkl_irand()
 	free(randarr);
 }
 
-int mklrand::mkl_irand::gen()
-{
-	int out = randarr[curr];
-	curr++;
-	if(curr >= arr_size)
-	{
-		this->fill();
-	}
-	return out;
-}
-
 void mklrand::mkl_irand::fill()
 {
 	curr = 0;
 	viRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, arr_size, randarr, 0, 2);
 }
 
+void mklrand::mkl_irand::fill(int *out, size_t n)
+{
+	while(n > 0)
+	{
+		size_t count = std::min(n, (size_t)(arr_size - curr));
+		std::copy(randarr + curr, randarr + curr + count, out);
+		out += count;
+		n -= count;
+		curr += count;
+		if(curr >= arr_size)
+		{
+			// As many buffers as fill would have made, in the same calls
+			for(; n >= (size_t)arr_size; out += arr_size, n -= arr_size)
+				viRngUniform(VSL_RNG_METHOD_UNIFORM_STD, stream, arr_size, out, 0, 2);
+			this->fill();
+		}
+	}
+}
+
 void mklrand::mkl_irand::change_seed(int seed)
 {
 	vslDeleteStream(&stream);
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this->fill();
 }
 
-mklrand::mkl_lnrand::mkl_lnrand(double m, double sd, int size, int seed)
+mklrand::mkl_lnrand::mkl_lnrand(double m, double sd, int size, int seed, int gen)
 {
 	lmean = m;
 	lsd = sd;
 	arr_size = size;
 	curr = 0;
+	brng = gen;
 	randarr = (double*)malloc(arr_size*sizeof(double));
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this -> fill();
 }
 
@@ -93,17 +151,6 @@ mklrand::mkl_lnrand::~mkl_lnrand()
 	free(randarr);
 }
 
-double mklrand::mkl_lnrand::gen()
-{
-	double out = randarr[curr];
-	curr++;
-	if(curr >= arr_size)
-	{
-		this->fill();
-	}
-	return out;
-}
-
 void mklrand::mkl_lnrand::fill()
 {
 	curr = 0;
@@ -113,18 +160,19 @@ void mklrand::mkl_lnrand::fill()
 void mklrand::mkl_lnrand::change_seed(int seed)
 {
 	vslDeleteStream(&stream);
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this->fill();
 }
 
-mklrand::mkl_nrand::mkl_nrand(double m, double sdin, int size, int seed)
+mklrand::mkl_nrand::mkl_nrand(double m, double sdin, int size, int seed, int gen)
 {
 	mean = m;
 	sd = sdin;
 	arr_size = size;
 	curr = 0;
+	brng = gen;
 	randarr = (double*)malloc(arr_size*sizeof(double));
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this -> fill();
 }
 
@@ -133,26 +181,34 @@ mklrand::mkl_nrand::~mkl_nrand()
 	free(randarr);
 }
 
-double mklrand::mkl_nrand::gen()
-{
-	double out = randarr[curr];
-	curr++;
-	if(curr >= arr_size)
-	{
-		this->fill();
-	}
-	return out;
-}
-
 void mklrand::mkl_nrand::fill()
 {
 	curr = 0;
 	vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2, stream, arr_size, randarr, mean, sd);
 }
 
+void mklrand::mkl_nrand::fill(double *out, size_t n)
+{
+	while(n > 0)
+	{
+		size_t count = std::min(n, (size_t)(arr_size - curr));
+		std::copy(randarr + curr, randarr + curr + count, out);
+		out += count;
+		n -= count;
+		curr += count;
+		if(curr >= arr_size)
+		{
+			// As many buffers as fill would have made, in the same calls
+			for(; n >= (size_t)arr_size; out += arr_size, n -= arr_size)
+				vdRngGaussian(VSL_RNG_METHOD_GAUSSIAN_BOXMULLER2, stream, arr_size, out, mean, sd);
+			this->fill();
+		}
+	}
+}
+
 void mklrand::mkl_nrand::change_seed(int seed)
 {
 	vslDeleteStream(&stream);
-	vslNewStream(&stream, VSL_BRNG_SFMT19937, seed);
+	vslNewStream(&stream, brng, seed);
 	this->fill();
 }
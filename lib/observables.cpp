@@ -0,0 +1,387 @@
+#include "../include/observables.hpp"
+#include "../include/checkpoint.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+hmc::Binning::Binning()
+    : levels( max_levels ), pending( 0.0, max_levels ),
+      has_pending( max_levels, 0 )
+{}
+
+void hmc::Binning::add( const double x )
+{
+    // Each finished block is paired with the one before it at the next
+    // level up
+    double block = x;
+    for( int l=0; l<max_levels; l++ )
+    {
+        levels[l].add( block );
+        if( !has_pending[l] )
+        {
+            pending[l] = block;
+            has_pending[l] = 1;
+            return;
+        }
+        block = ( pending[l] + block ) / 2;
+        has_pending[l] = 0;
+    }
+}
+
+double hmc::Binning::error( const int level ) const
+{
+    const Welford &w = levels[level];
+    return ( w.n > 1 ) ? std::sqrt( w.variance() / w.n ) : 0;
+}
+
+double hmc::Binning::binned_error( const long min_blocks ) const
+{
+    int level = 0;
+    while( level+1 < max_levels && levels[level+1].n >= min_blocks )
+        level++;
+    return error( level );
+}
+
+void hmc::Binning::save( std::ostream &out ) const
+{
+    for( int l=0; l<max_levels; l++ )
+    {
+        write_value( out, levels[l].n );
+        write_value( out, levels[l].mean );
+        write_value( out, levels[l].m2 );
+        write_value( out, has_pending[l] );
+    }
+    write_array( out, pending );
+}
+
+void hmc::Binning::load( std::istream &in )
+{
+    for( int l=0; l<max_levels; l++ )
+    {
+        read_value( in, levels[l].n );
+        read_value( in, levels[l].mean );
+        read_value( in, levels[l].m2 );
+        read_value( in, has_pending[l] );
+    }
+    read_array( in, pending );
+    if( pending.size() != size_t( max_levels ) )
+        throw std::runtime_error( "Binning: checkpoint does not fit" );
+}
+
+constexpr double hmc::Autocorrelation::window;
+
+hmc::Autocorrelation::Autocorrelation( const size_t max_lag )
+    : max_lag( max_lag ), n( 0 ), shift( 0 ), total( 0 ),
+      head( 0.0, max_lag ), recent( 0.0, max_lag ), lagged( 0.0, max_lag )
+{
+    if( max_lag == 0 )
+        throw std::invalid_argument( "Autocorrelation: max_lag must be positive" );
+}
+
+void hmc::Autocorrelation::add( const double x )
+{
+    if( n == 0 )
+        shift = x;
+    const double y = x - shift;
+    batches.add( x );
+
+    const size_t slot = n % max_lag;
+    recent[slot] = y;
+    if( size_t( n ) < max_lag )
+        head[n] = y;
+    total += y;
+    n++;
+
+    // Products with this value and each of the last max_lag, newest first
+    const size_t lags = std::min( size_t( n ), max_lag );
+    size_t i = slot;
+    for( size_t k=0; k<lags; k++ )
+    {
+        lagged[k] += y * recent[i];
+        i = ( i == 0 ) ? max_lag-1 : i-1;
+    }
+}
+
+std::valarray<double> hmc::Autocorrelation::function() const
+{
+    const size_t lags = std::min( size_t( n ), max_lag );
+    std::valarray<double> rho( 0.0, lags );
+    if( lags == 0 )
+        return rho;
+
+    // Covariances about the mean of the whole series, from the sums of
+    // the products and of the values at either end
+    const double mean = total / n;
+    double first = 0, last = 0;
+    size_t i = ( n-1 ) % max_lag;
+    std::valarray<double> cov( lags );
+    for( size_t k=0; k<lags; k++ )
+    {
+        cov[k] = ( lagged[k] - mean * ( 2*total - first - last )
+                   + ( n-k ) * mean*mean ) / n;
+        first += head[k];
+        last += recent[i];
+        i = ( i == 0 ) ? max_lag-1 : i-1;
+    }
+    if( cov[0] <= 0 )
+    {
+        rho[0] = 1;
+        return rho;
+    }
+    return cov / cov[0];
+}
+
+namespace
+{
+    // Sums the autocorrelation up to the first lag at least window times
+    // the time so far, and reports whether that lag was reached
+    double windowed_time( const std::valarray<double> &rho, bool &resolved )
+    {
+        double tau = 1;
+        for( size_t m=1; m<rho.size(); m++ )
+        {
+            tau += 2 * rho[m];
+            if( m >= hmc::Autocorrelation::window * tau )
+            {
+                resolved = true;
+                return tau;
+            }
+        }
+        resolved = false;
+        return tau;
+    }
+}
+
+double hmc::Autocorrelation::time() const
+{
+    bool found;
+    const double tau = windowed_time( function(), found );
+    if( found || n < 2 )
+        return tau;
+
+    // The ratio of the variances of the batch means to that of the values
+    const double naive = batches.error( 0 );
+    if( naive == 0 )
+        return 1;
+    const double ratio = batches.binned_error() / naive;
+    return std::max( tau, ratio*ratio );
+}
+
+double hmc::Autocorrelation::ess() const
+{
+    return ( n > 0 ) ? n / time() : 0;
+}
+
+bool hmc::Autocorrelation::resolved() const
+{
+    bool found;
+    windowed_time( function(), found );
+    return found;
+}
+
+void hmc::Autocorrelation::save( std::ostream &out ) const
+{
+    write_value( out, max_lag );
+    write_value( out, n );
+    write_value( out, shift );
+    write_value( out, total );
+    write_array( out, head );
+    write_array( out, recent );
+    write_array( out, lagged );
+    batches.save( out );
+}
+
+void hmc::Autocorrelation::load( std::istream &in )
+{
+    size_t saved_lag;
+    read_value( in, saved_lag );
+    if( saved_lag != max_lag )
+        throw std::runtime_error( "Autocorrelation: checkpoint does not fit" );
+    read_value( in, n );
+    read_value( in, shift );
+    read_value( in, total );
+    read_array( in, head );
+    read_array( in, recent );
+    read_array( in, lagged );
+    batches.load( in );
+}
+
+hmc::Observables::Observables()
+    : samples( 0 ),
+      energy( 0 ), energy_error( 0 ), energy2( 0 ), energy2_error( 0 ),
+      abs_magnetisation( 0 ), abs_magnetisation_error( 0 ),
+      magnetisation2( 0 ), magnetisation2_error( 0 ),
+      magnetisation4( 0 ), magnetisation4_error( 0 ),
+      specific_heat( 0 ), specific_heat_error( 0 ),
+      susceptibility( 0 ), susceptibility_error( 0 ),
+      binder( 0 ), binder_error( 0 ),
+      energy_time( 0 ), energy_ess( 0 ),
+      magnetisation_time( 0 ), magnetisation_ess( 0 )
+{}
+
+hmc::ThermoAccumulator::ThermoAccumulator(
+    const double beta,
+    const size_t spins,
+    const SinkOptions &options )
+    : SampleSink( 1, options ),
+      beta( beta ),
+      spins( spins ),
+      shift( 0 ),
+      bins( 0.0, 5*max_bins ),
+      partial( 0.0, 5 ),
+      bin_length( 1 ),
+      n_bins( 0 ),
+      n_partial( 0 )
+{}
+
+void hmc::ThermoAccumulator::add_to_bins( const double e, const double m )
+{
+    partial[0] += e;
+    partial[1] += e*e;
+    partial[2] += m;
+    partial[3] += m*m;
+    partial[4] += m*m*m*m;
+    if( ++n_partial < bin_length )
+        return;
+
+    for( int k=0; k<5; k++ )
+        bins[5*n_bins + k] = partial[k] / bin_length;
+    partial = 0;
+    n_partial = 0;
+    if( ++n_bins < max_bins )
+        return;
+
+    // Merge pairs of bins so there is room for as many again
+    for( int b=0; b<max_bins/2; b++ )
+        for( int k=0; k<5; k++ )
+            bins[5*b + k] = ( bins[10*b + k] + bins[10*b + 5 + k] ) / 2;
+    n_bins = max_bins / 2;
+    bin_length *= 2;
+}
+
+void hmc::ThermoAccumulator::write(
+    const double energy,
+    const std::valarray<double> &values )
+{
+    const double e = energy / beta;
+    const double m = values[0];
+    if( moments[0].count() == 0 )
+        shift = e;
+
+    moments[0].add( e );
+    moments[1].add( e*e );
+    moments[2].add( m );
+    moments[3].add( m*m );
+    moments[4].add( m*m*m*m );
+    add_to_bins( e - shift, m );
+    energy_correlation.add( e );
+    magnetisation_correlation.add( m );
+}
+
+namespace
+{
+    // Specific heat, susceptibility and Binder cumulant from the means of
+    // the shifted E, E^2, |M|, M^2 and M^4
+    void derived( const double *mean, const double beta, const double spins,
+                  double *out )
+    {
+        out[0] = beta*beta * ( mean[1] - mean[0]*mean[0] ) / spins;
+        out[1] = beta * ( mean[3] - mean[2]*mean[2] ) / spins;
+        out[2] = 1 - mean[4] / ( 3 * mean[3]*mean[3] );
+    }
+}
+
+hmc::Observables hmc::ThermoAccumulator::result() const
+{
+    Observables res;
+    const long n = moments[0].count();
+    res.samples = n;
+    if( n == 0 )
+        return res;
+
+    res.energy = moments[0].mean();
+    res.energy_error = moments[0].binned_error();
+    res.energy2 = moments[1].mean();
+    res.energy2_error = moments[1].binned_error();
+    res.abs_magnetisation = moments[2].mean();
+    res.abs_magnetisation_error = moments[2].binned_error();
+    res.magnetisation2 = moments[3].mean();
+    res.magnetisation2_error = moments[3].binned_error();
+    res.magnetisation4 = moments[4].mean();
+    res.magnetisation4_error = moments[4].binned_error();
+
+    // The variances from Welford's algorithm, over n rather than n-1
+    const double scale = double( n-1 ) / n;
+    res.specific_heat = beta*beta * moments[0].variance() * scale / spins;
+    res.susceptibility = beta * moments[2].variance() * scale / spins;
+    res.binder = 1 - res.magnetisation4
+        / ( 3 * res.magnetisation2*res.magnetisation2 );
+
+    res.energy_time = energy_correlation.time();
+    res.energy_ess = n / res.energy_time;
+    res.magnetisation_time = magnetisation_correlation.time();
+    res.magnetisation_ess = n / res.magnetisation_time;
+
+    // Jackknife over the complete bins
+    if( n_bins < 2 )
+        return res;
+    double total[5] = { 0, 0, 0, 0, 0 };
+    for( long b=0; b<n_bins; b++ )
+        for( int k=0; k<5; k++ )
+            total[k] += bins[5*b + k];
+    double sum[3] = { 0, 0, 0 }, sum2[3] = { 0, 0, 0 };
+    for( long b=0; b<n_bins; b++ )
+    {
+        double mean[5], f[3];
+        for( int k=0; k<5; k++ )
+            mean[k] = ( total[k] - bins[5*b + k] ) / ( n_bins-1 );
+        derived( mean, beta, spins, f );
+        for( int j=0; j<3; j++ )
+        {
+            sum[j] += f[j];
+            sum2[j] += f[j]*f[j];
+        }
+    }
+    double error[3];
+    for( int j=0; j<3; j++ )
+    {
+        double mean = sum[j] / n_bins;
+        double var = sum2[j] / n_bins - mean*mean;
+        error[j] = std::sqrt( std::max( var, 0.0 ) * ( n_bins-1 ) );
+    }
+    res.specific_heat_error = error[0];
+    res.susceptibility_error = error[1];
+    res.binder_error = error[2];
+
+    return res;
+}
+
+void hmc::ThermoAccumulator::save( std::ostream &out )
+{
+    write_value( out, shift );
+    for( auto &m : moments )
+        m.save( out );
+    write_array( out, bins );
+    write_array( out, partial );
+    write_value( out, bin_length );
+    write_value( out, n_bins );
+    write_value( out, n_partial );
+    energy_correlation.save( out );
+    magnetisation_correlation.save( out );
+}
+
+void hmc::ThermoAccumulator::load( std::istream &in )
+{
+    read_value( in, shift );
+    for( auto &m : moments )
+        m.load( in );
+    read_array( in, bins );
+    read_array( in, partial );
+    if( bins.size() != size_t( 5*max_bins ) || partial.size() != 5 )
+        throw std::runtime_error( "ThermoAccumulator: checkpoint does not fit" );
+    read_value( in, bin_length );
+    read_value( in, n_bins );
+    read_value( in, n_partial );
+    energy_correlation.load( in );
+    magnetisation_correlation.load( in );
+}
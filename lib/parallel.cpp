@@ -0,0 +1,191 @@
+#include "../include/parallel.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct hmc::SlabPool::Workers {
+    int n_threads;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable start, done;
+    /// The job of the current call and how many workers are still on it
+    const std::function<void(int)> *job;
+    unsigned long generation;
+    int pending;
+    bool stop;
+    std::exception_ptr error;
+    /// The partial sum of each block
+    std::vector<double> partials;
+
+    Workers() : n_threads( 1 ), job( nullptr ), generation( 0 ),
+                pending( 0 ), stop( false ) {}
+
+    // Runs job( t ), keeping the first exception of any thread
+    void attempt( const int t )
+    {
+        try
+        {
+            (*job)( t );
+        }
+        catch( ... )
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            if( !error )
+                error = std::current_exception();
+        }
+    }
+
+    void work( const int t )
+    {
+        unsigned long seen = 0;
+        for( ;; )
+        {
+            {
+                std::unique_lock<std::mutex> guard( lock );
+                start.wait( guard, [&]() { return stop || generation != seen; } );
+                if( stop )
+                    return;
+                seen = generation;
+            }
+            attempt( t );
+            std::lock_guard<std::mutex> guard( lock );
+            if( --pending == 0 )
+                done.notify_one();
+        }
+    }
+};
+
+hmc::SlabPool::SlabPool( const int threads, const bool pin )
+    : workers( new Workers() )
+{
+    int n = threads;
+    if( n <= 0 )
+        n = std::max( 1u, std::thread::hardware_concurrency() );
+    workers->n_threads = n;
+    for( int t=1; t<n; t++ )
+    {
+        workers->threads.push_back( std::thread( &Workers::work, workers.get(), t ) );
+#ifdef __linux__
+        if( pin )
+        {
+            cpu_set_t cpus;
+            CPU_ZERO( &cpus );
+            CPU_SET( t % CPU_SETSIZE, &cpus );
+            pthread_setaffinity_np( workers->threads.back().native_handle(),
+                                    sizeof( cpus ), &cpus );
+        }
+#else
+        (void) pin;
+#endif
+    }
+}
+
+hmc::SlabPool::~SlabPool()
+{
+    {
+        std::lock_guard<std::mutex> guard( workers->lock );
+        workers->stop = true;
+    }
+    workers->start.notify_all();
+    for( auto &t : workers->threads )
+        t.join();
+}
+
+int hmc::SlabPool::threads() const
+{
+    return workers->n_threads;
+}
+
+void hmc::SlabPool::dispatch( const std::function<void(int)> &job )
+{
+    Workers &w = *workers;
+    {
+        std::lock_guard<std::mutex> guard( w.lock );
+        w.job = &job;
+        w.error = nullptr;
+        w.pending = w.n_threads - 1;
+        w.generation++;
+    }
+    w.start.notify_all();
+    w.attempt( 0 );
+
+    std::unique_lock<std::mutex> guard( w.lock );
+    w.done.wait( guard, [&]() { return w.pending == 0; } );
+    if( w.error )
+        std::rethrow_exception( w.error );
+}
+
+void hmc::SlabPool::slab( const size_t blocks, const int t,
+                          size_t &first, size_t &last ) const
+{
+    const size_t n_threads = workers->n_threads;
+    first = blocks * t / n_threads;
+    last = blocks * ( t+1 ) / n_threads;
+}
+
+void hmc::SlabPool::run(
+    const size_t n,
+    const std::function<void(size_t, size_t)> &f )
+{
+    const size_t blocks = ( n + block_size - 1 ) / block_size;
+    if( workers->n_threads == 1 )
+    {
+        f( 0, n );
+        return;
+    }
+    dispatch( [&]( const int t )
+    {
+        size_t first, last;
+        slab( blocks, t, first, last );
+        if( first < last )
+            f( first*block_size, std::min( last*block_size, n ) );
+    } );
+}
+
+void hmc::SlabPool::sums(
+    const size_t n,
+    const size_t k,
+    const std::function<void(size_t, size_t, double*)> &f,
+    double *out )
+{
+    const size_t blocks = ( n + block_size - 1 ) / block_size;
+    std::vector<double> &partials = workers->partials;
+    partials.assign( blocks*k, 0.0 );
+    auto blocks_of = [&]( const int t )
+    {
+        size_t first, last;
+        slab( blocks, t, first, last );
+        for( size_t b=first; b<last; b++ )
+            f( b*block_size, std::min( ( b+1 )*block_size, n ), &partials[b*k] );
+    };
+    if( workers->n_threads == 1 )
+        blocks_of( 0 );
+    else
+        dispatch( blocks_of );
+
+    for( size_t j=0; j<k; j++ )
+    {
+        out[j] = 0;
+        for( size_t b=0; b<blocks; b++ )
+            out[j] += partials[b*k + j];
+    }
+}
+
+double hmc::SlabPool::sum(
+    const size_t n,
+    const std::function<double(size_t, size_t)> &f )
+{
+    double total;
+    sums( n, 1, [&]( const size_t begin, const size_t end, double *partial )
+    {
+        partial[0] = f( begin, end );
+    }, &total );
+    return total;
+}
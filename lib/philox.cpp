@@ -0,0 +1,240 @@
+#include "../include/philox.hpp"
+#include "../include/trig.hpp"
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+
+// At -O2 GCC's cost model leaves the rounds over a chunk of blocks scalar
+#if defined( __GNUC__ ) && !defined( __clang__ ) && !defined( __INTEL_COMPILER )
+#pragma GCC optimize ( "O3" )
+#endif
+
+namespace
+{
+    // Ten Philox rounds on the counter words c, keyed by k0 and k1
+    inline void philox_rounds(uint32_t &c0, uint32_t &c1, uint32_t &c2,
+                              uint32_t &c3, uint32_t k0, uint32_t k1)
+    {
+        for(int round = 0; round < 10; round++)
+        {
+            const uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+            const uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+            const uint32_t x0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+            const uint32_t x2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+            c1 = (uint32_t)p1;
+            c3 = (uint32_t)p0;
+            c0 = x0;
+            c2 = x2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+    // Blocks are made this many at a time, so their words stay in cache
+    const int chunk = 256;
+
+    // The words of blocks first to first+count of the stream keyed by key.
+    // Each round runs over all the blocks, so the loops vectorise.
+    void block_words(const uint64_t first, const int count,
+                     const uint32_t key[2], uint32_t *w0, uint32_t *w1,
+                     uint32_t *w2, uint32_t *w3)
+    {
+        for(int b = 0; b < count; b++)
+        {
+            w0[b] = (uint32_t)(first + b);
+            w1[b] = (uint32_t)((first + b) >> 32);
+            w2[b] = 0;
+            w3[b] = 0;
+        }
+        uint32_t k0 = key[0], k1 = key[1];
+        for(int round = 0; round < 10; round++)
+        {
+            for(int b = 0; b < count; b++)
+            {
+                const uint64_t p0 = (uint64_t)0xD2511F53u * w0[b];
+                const uint64_t p1 = (uint64_t)0xCD9E8D57u * w2[b];
+                w0[b] = (uint32_t)(p1 >> 32) ^ w1[b] ^ k0;
+                w2[b] = (uint32_t)(p0 >> 32) ^ w3[b] ^ k1;
+                w1[b] = (uint32_t)p1;
+                w3[b] = (uint32_t)p0;
+            }
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+    // 53 random bits from two words as a double in [0, 1)
+    inline double to_unit(const uint32_t hi, const uint32_t lo)
+    {
+        const uint64_t bits = ((uint64_t)hi << 21) ^ (lo >> 11);
+        return bits * (1.0 / 9007199254740992.0);
+    }
+}
+
+void philox::philox4x32(const uint32_t counter[4], const uint32_t key[2],
+                        uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    philox_rounds(c0, c1, c2, c3, key[0], key[1]);
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+philox::philox_randbase::philox_randbase(int size, int seed, int stream,
+                                         int values)
+{
+    per_block = values;
+    arr_size = std::max(1, (size + values - 1) / values) * values;
+    curr = 0;
+    key[0] = (uint32_t)seed;
+    key[1] = (uint32_t)stream;
+    start = 0;
+}
+
+void philox::philox_randbase::fill()
+{
+    start += arr_size / per_block;
+    curr = 0;
+    generate();
+}
+
+void philox::philox_randbase::change_seed(int seed)
+{
+    key[0] = (uint32_t)seed;
+    start = 0;
+    curr = 0;
+    generate();
+}
+
+void philox::philox_randbase::seek(uint64_t index)
+{
+    start = index / per_block;
+    curr = index % per_block;
+    generate();
+}
+
+void philox::philox_randbase::write_state(std::ostream &out) const
+{
+    // Which generator and buffer the state belongs to
+    int header[3] = {kind(), arr_size, curr};
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)key, sizeof(key));
+    out.write((const char*)&start, sizeof(start));
+}
+
+void philox::philox_randbase::read_state(std::istream &in)
+{
+    int header[3];
+    uint32_t new_key[2];
+    uint64_t new_start;
+    in.read((char*)header, sizeof(header));
+    in.read((char*)new_key, sizeof(new_key));
+    in.read((char*)&new_start, sizeof(new_start));
+    if(!in)
+        throw std::runtime_error("philox_randbase: random state ended early");
+    if(header[0] != kind() || header[1] != arr_size)
+        throw std::runtime_error("philox_randbase: random state is of a different generator");
+
+    key[0] = new_key[0];
+    key[1] = new_key[1];
+    start = new_start;
+    generate();
+    curr = header[2];
+}
+
+philox::philox_drand::philox_drand(int size, int seed, int stream)
+    : philox_randbase(size, seed, stream, 2)
+{
+    randarr.resize(arr_size);
+    generate();
+}
+
+void philox::philox_drand::generate()
+{
+    const int blocks = arr_size / 2;
+    uint32_t w[4][chunk];
+    for(int first = 0; first < blocks; first += chunk)
+    {
+        const int count = std::min(chunk, blocks - first);
+        block_words(start + first, count, key, w[0], w[1], w[2], w[3]);
+        double *out = randarr.data() + 2*first;
+        for(int b = 0; b < count; b++)
+        {
+            out[2*b] = to_unit(w[0][b], w[1][b]);
+            out[2*b + 1] = to_unit(w[2][b], w[3][b]);
+        }
+    }
+}
+
+philox::philox_irand::philox_irand(int size, int seed, int stream)
+    : philox_randbase(size, seed, stream, 4)
+{
+    randarr.resize(arr_size);
+    generate();
+}
+
+void philox::philox_irand::generate()
+{
+    const int blocks = arr_size / 4;
+    uint32_t w[4][chunk];
+    for(int first = 0; first < blocks; first += chunk)
+    {
+        const int count = std::min(chunk, blocks - first);
+        block_words(start + first, count, key, w[0], w[1], w[2], w[3]);
+        int *out = randarr.data() + 4*first;
+        for(int b = 0; b < count; b++)
+        {
+            out[4*b] = w[0][b] >> 31;
+            out[4*b + 1] = w[1][b] >> 31;
+            out[4*b + 2] = w[2][b] >> 31;
+            out[4*b + 3] = w[3][b] >> 31;
+        }
+    }
+}
+
+philox::philox_nrand::philox_nrand(double m, double sdin, int size, int seed,
+                                   int stream)
+    : philox_randbase(size, seed, stream, 2)
+{
+    mean = m;
+    sd = sdin;
+    randarr.resize(arr_size);
+    radius.resize(arr_size / 2);
+    angle.resize(arr_size / 2);
+    sines.resize(arr_size / 2);
+    cosines.resize(arr_size / 2);
+    generate();
+}
+
+void philox::philox_nrand::generate()
+{
+    const int blocks = arr_size / 2;
+    double *r = radius.data(), *theta = angle.data();
+    uint32_t w[4][chunk];
+    for(int first = 0; first < blocks; first += chunk)
+    {
+        const int count = std::min(chunk, blocks - first);
+        block_words(start + first, count, key, w[0], w[1], w[2], w[3]);
+        for(int b = 0; b < count; b++)
+        {
+            // In (0, 1] so the logarithm is finite
+            r[first + b] = 1.0 - to_unit(w[0][b], w[1][b]);
+            theta[first + b] = 2 * M_PI * to_unit(w[2][b], w[3][b]);
+        }
+    }
+    for(int b = 0; b < blocks; b++)
+        r[b] = sd * std::sqrt(-2.0 * std::log(r[b]));
+    hmc::sincos_array(theta, sines.data(), cosines.data(), blocks);
+
+    double *out = randarr.data();
+    const double *s = sines.data(), *c = cosines.data();
+    for(int b = 0; b < blocks; b++)
+    {
+        out[2*b] = mean + r[b] * c[b];
+        out[2*b + 1] = mean + r[b] * s[b];
+    }
+}
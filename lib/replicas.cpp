@@ -0,0 +1,269 @@
+#include "../include/replicas.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/leapfrog.hpp"
+#include "../include/trig.hpp"
+#include <algorithm>
+#include <deque>
+#include <numeric>
+#include <stdexcept>
+
+hmc::ReplicaHamiltonian::ReplicaHamiltonian(
+    const std::shared_ptr<HeisenbergSystem> &system,
+    const std::vector<HamiltonianOptions> &options )
+    : system( system )
+{
+    if( options.empty() )
+        throw std::invalid_argument( "ReplicaHamiltonian: no replicas" );
+    for( const HamiltonianOptions &o : options )
+    {
+        if( o.D != 0 )
+            throw std::invalid_argument(
+                "ReplicaHamiltonian: the dipolar term is not supported" );
+        J.push_back( o.J );
+        H.push_back( o.H );
+    }
+
+    const size_t m = system->spins() * options.size();
+    for( std::valarray<double> *a : { &cos_the, &sin_the, &cos_phi, &sin_phi,
+                                      &spin_x, &spin_y, &spin_z,
+                                      &field_x, &field_y, &field_z } )
+        a->resize( m );
+    exchange_sum.resize( options.size() );
+    zeeman_sum.resize( options.size() );
+}
+
+void hmc::ReplicaHamiltonian::operator()(
+    std::valarray<double> &grad_out,
+    const std::valarray<double> &state,
+    double *energy ) const
+{
+    const int lanes = replicas();
+    const int n = spins();
+    const size_t m = n * lanes;
+    if( state.size() != 2*m )
+        throw std::invalid_argument( "ReplicaHamiltonian: state of the wrong size" );
+
+    double *ct = &cos_the[0], *st = &sin_the[0];
+    double *cp = &cos_phi[0], *sp = &sin_phi[0];
+    sincos_array( &state[0], st, ct, m );
+    sincos_array( &state[m], sp, cp, m );
+
+    double *sx = &spin_x[0], *sy = &spin_y[0], *sz = &spin_z[0];
+    for( size_t i=0; i<m; i++ )
+    {
+        sx[i] = st[i]*cp[i];
+        sy[i] = st[i]*sp[i];
+        sz[i] = ct[i];
+    }
+    double *hx = &field_x[0], *hy = &field_y[0], *hz = &field_z[0];
+    system->lane_neighbour_sum( sx, hx, lanes );
+    system->lane_neighbour_sum( sy, hy, lanes );
+    system->lane_neighbour_sum( sz, hz, lanes );
+
+    // Each replica sums over the sites in order, every bond twice
+    const double *j = &J[0], *h = &H[0];
+    double *g_the = &grad_out[0], *g_phi = &grad_out[m];
+    double *e_sum = &exchange_sum[0], *z_sum = &zeeman_sum[0];
+    std::fill( e_sum, e_sum + lanes, 0.0 );
+    std::fill( z_sum, z_sum + lanes, 0.0 );
+    for( int i=0; i<n; i++ )
+    {
+        const size_t row = i * lanes;
+        for( int k=0; k<lanes; k++ )
+        {
+            const size_t a = row + k;
+            double h_plane = cp[a]*hx[a] + sp[a]*hy[a];
+            e_sum[k] += st[a]*h_plane + ct[a]*hz[a];
+            z_sum[k] += ct[a];
+            g_the[a] = -j[k]*( ct[a]*h_plane - st[a]*hz[a] ) + h[k]*st[a];
+            g_phi[a] = -j[k]*st[a]*( cp[a]*hy[a] - sp[a]*hx[a] );
+        }
+    }
+    for( int k=0; k<lanes; k++ )
+        energy[k] = -0.5 * j[k] * e_sum[k] - h[k] * z_sum[k];
+}
+
+int hmc::ReplicaHamiltonian::spins() const
+{
+    return system->spins();
+}
+
+std::valarray<double> hmc::ReplicaHamiltonian::pack(
+    const std::vector<std::valarray<double> > &states ) const
+{
+    const int lanes = replicas();
+    const size_t size = 2 * spins();
+    if( states.size() != static_cast<size_t>( lanes ) )
+        throw std::invalid_argument( "ReplicaHamiltonian: one state per replica" );
+
+    std::valarray<double> packed( size * lanes );
+    for( int k=0; k<lanes; k++ )
+    {
+        if( states[k].size() != size )
+            throw std::invalid_argument( "ReplicaHamiltonian: state of the wrong size" );
+        for( size_t a=0; a<size; a++ )
+            packed[a*lanes + k] = states[k][a];
+    }
+    return packed;
+}
+
+std::valarray<double> hmc::ReplicaHamiltonian::unpack(
+    const std::valarray<double> &state,
+    const int k ) const
+{
+    const int lanes = replicas();
+    return state[std::slice( k, 2*spins(), lanes )];
+}
+
+std::vector<hmc::ChainResult> hmc::replica_hmc(
+    const std::vector<std::valarray<double> > &initial_states,
+    const double leapfrog_eps,
+    const size_t leapfrog_steps,
+    const size_t samples,
+    const ReplicaHamiltonian &hamiltonian,
+    const std::function<std::valarray<double>(const std::valarray<double>&)> &reduce,
+    const int seed )
+{
+    const int lanes = hamiltonian.replicas();
+    std::valarray<double> state = hamiltonian.pack( initial_states );
+    const size_t m = state.size();
+    const size_t size = m / lanes;
+
+    // Generators are built in place as they cannot be copied
+    std::deque<ChainRNG> rngs;
+    for( int k=0; k<lanes; k++ )
+        rngs.emplace_back( seed, k );
+
+    std::vector<ChainResult> results( lanes );
+    for( ChainResult &res : results )
+        res.energy.resize( samples );
+
+    std::valarray<double> grad( m ), energy( lanes );
+    hamiltonian( grad, state, &energy[0] );
+
+    std::valarray<double> velocity( m ), work( m ), lane_velocity( size );
+    std::valarray<double> temp_state( m ), temp_velocity( m );
+    std::valarray<double> trial_state( m ), trial_velocity( m );
+    std::valarray<double> trial_potential( lanes );
+    std::valarray<double> current_kinetic( lanes ), trial_kinetic( lanes );
+
+    // Every lane's energy is kept, the leapfrog step only needs the gradient
+    auto energy_grad = [&]( std::valarray<double> &g, const std::valarray<double> &x )
+    {
+        hamiltonian( g, x, &trial_potential[0] );
+        return 0.0;
+    };
+
+    // As hmc::kinetic_energy for each lane, summed in the same order
+    auto kinetic = [&]( std::valarray<double> &out, const std::valarray<double> &v )
+    {
+        out = 0;
+        for( size_t a=0; a<size; a++ )
+            for( int k=0; k<lanes; k++ )
+                out[k] += v[a*lanes + k] * v[a*lanes + k];
+        out /= 2.0;
+    };
+
+    for( size_t sample=0; sample<samples; sample++ )
+    {
+        // Each lane draws its velocity from its own stream in the order of
+        // a single chain
+        for( int k=0; k<lanes; k++ )
+        {
+            rngs[k].normal_rng.fill( &lane_velocity[0], size );
+            velocity[std::slice( k, size, lanes )] = lane_velocity;
+        }
+
+        temp_state = state;
+        temp_velocity = velocity;
+        work = grad;
+        trial_potential = energy;
+        for( size_t n=0; n<leapfrog_steps; n++ )
+        {
+            leapfrog::lfs_cached( trial_state, trial_velocity, work,
+                                  temp_state, temp_velocity, energy_grad,
+                                  leapfrog_eps );
+            std::swap( temp_state, trial_state );
+            std::swap( temp_velocity, trial_velocity );
+        }
+
+        kinetic( current_kinetic, velocity );
+        kinetic( trial_kinetic, temp_velocity );
+        for( int k=0; k<lanes; k++ )
+        {
+            bool accept = accept_trial( energy[k] + current_kinetic[k],
+                                        trial_potential[k] + trial_kinetic[k],
+                                        rngs[k].uniform_rng );
+            if( accept )
+            {
+                std::slice lane( k, size, lanes );
+                state[lane] = temp_state[lane];
+                grad[lane] = work[lane];
+                energy[k] = trial_potential[k];
+            }
+
+            results[k].energy[sample] = energy[k];
+            results[k].trace.push_back( reduce( hamiltonian.unpack( state, k ) ) );
+        }
+    }
+
+    for( int k=0; k<lanes; k++ )
+        results[k].final_state = hamiltonian.unpack( state, k );
+    return results;
+}
+
+void hmc::heisenberg_replicas(
+    std::vector<std::valarray<double> > &sample_energy,
+    std::vector<std::valarray<double> > &sample_magnetisation,
+    const std::vector<int> system_dimensions,
+    const std::vector<HamiltonianOptions> &options,
+    const double beta,
+    const double leapfrog_eps,
+    const int leapfrog_steps,
+    const int nsamples,
+    const int seed )
+{
+    const int nreplicas = options.size();
+
+    // theta and phi for every element in system
+    const int state_size = 2 * std::accumulate(
+        system_dimensions.begin(),
+        system_dimensions.end(),
+        1, std::multiplies<int>() );
+
+    // Independent random initial state for each replica
+    std::vector<std::valarray<double> > initial_states(
+        nreplicas, std::valarray<double>( state_size ) );
+    for( int k=0; k<nreplicas; k++ )
+    {
+        ChainRNG rng( seed, k );
+        random_state( initial_states[k], rng.uniform_rng );
+    }
+
+    // The chains sample exp(-beta E)
+    std::vector<HamiltonianOptions> scaled;
+    for( const HamiltonianOptions &o : options )
+        scaled.push_back( scaled_options( o, beta ) );
+    std::shared_ptr<HeisenbergSystem> system(
+        new HeisenbergSystem( system_dimensions ) );
+    ReplicaHamiltonian hamiltonian( system, scaled );
+    auto reduce = [system]( const std::valarray<double>& state )
+        {
+            std::valarray<double> res = { system->magnetisation( state ) };
+            return res;
+        };
+
+    auto results = replica_hmc( initial_states, leapfrog_eps, leapfrog_steps,
+                                nsamples, hamiltonian, reduce, seed + 1 );
+
+    sample_energy.resize( nreplicas );
+    sample_magnetisation.resize( nreplicas );
+    for( int k=0; k<nreplicas; k++ )
+    {
+        // Energy is returned normalised so we turn it into real energy
+        sample_energy[k] = results[k].energy / beta;
+        sample_magnetisation[k].resize( nsamples );
+        for( int n=0; n<nsamples; n++ )
+            sample_magnetisation[k][n] = results[k].trace[n][0];
+    }
+}
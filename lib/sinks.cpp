@@ -0,0 +1,247 @@
+#include "../include/sinks.hpp"
+#include "../include/checkpoint.hpp"
+#include <stdexcept>
+
+size_t hmc::SinkOptions::kept( const size_t draws ) const
+{
+    if( draws <= burn_in )
+        return 0;
+    return ( draws - burn_in + thin - 1 ) / thin;
+}
+
+hmc::SampleSink::SampleSink( const size_t width, const SinkOptions &options )
+    : n_width( width ), sink_options( options )
+{
+    if( options.thin == 0 )
+        throw std::invalid_argument( "SampleSink: thin must be at least one" );
+}
+
+hmc::TraceMatrix::TraceMatrix(
+    const size_t rows,
+    const size_t width,
+    const SinkOptions &options )
+    : SampleSink( width, options ),
+      trace( 0.0, rows*width ),
+      energies( 0.0, rows ),
+      n_rows( 0 )
+{}
+
+void hmc::TraceMatrix::write(
+    const double energy,
+    const std::valarray<double> &values )
+{
+    if( n_rows == energies.size() )
+        throw std::length_error( "TraceMatrix: more samples than rows" );
+    energies[n_rows] = energy;
+    for( size_t i=0; i<n_width; i++ )
+        trace[n_rows*n_width + i] = values[i];
+    n_rows++;
+}
+
+void hmc::TraceMatrix::save( std::ostream &out )
+{
+    // Only the rows written so far
+    write_value( out, n_width );
+    write_value( out, n_rows );
+    if( n_rows == 0 )
+        return;
+    out.write( reinterpret_cast<const char*>( &energies[0] ),
+               n_rows*sizeof( double ) );
+    if( n_width > 0 )
+        out.write( reinterpret_cast<const char*>( &trace[0] ),
+                   n_rows*n_width*sizeof( double ) );
+}
+
+void hmc::TraceMatrix::load( std::istream &in )
+{
+    size_t width, rows;
+    read_value( in, width );
+    read_value( in, rows );
+    if( width != n_width || rows > energies.size() )
+        throw std::runtime_error( "TraceMatrix: checkpoint does not fit" );
+    energies = 0;
+    trace = 0;
+    if( rows > 0 )
+        in.read( reinterpret_cast<char*>( &energies[0] ), rows*sizeof( double ) );
+    if( rows > 0 && width > 0 )
+        in.read( reinterpret_cast<char*>( &trace[0] ),
+                 rows*width*sizeof( double ) );
+    if( !in )
+        throw std::runtime_error( "checkpoint: input ended early" );
+    n_rows = rows;
+}
+
+std::valarray<double> hmc::TraceMatrix::column( const size_t col ) const
+{
+    return trace[std::slice( col, n_rows, n_width )];
+}
+
+hmc::RingBuffer::RingBuffer(
+    const size_t capacity,
+    const size_t width,
+    const SinkOptions &options )
+    : SampleSink( width, options ),
+      trace( 0.0, capacity*width ),
+      energies( 0.0, capacity ),
+      n_capacity( capacity ),
+      n_written( 0 )
+{
+    if( capacity == 0 )
+        throw std::invalid_argument( "RingBuffer: capacity must be at least one" );
+}
+
+size_t hmc::RingBuffer::slot( const size_t i ) const
+{
+    // Before the buffer is full the oldest sample is at the start
+    size_t oldest = ( n_written < n_capacity ) ? 0 : n_written % n_capacity;
+    return ( oldest + i ) % n_capacity;
+}
+
+size_t hmc::RingBuffer::size() const
+{
+    return ( n_written < n_capacity ) ? n_written : n_capacity;
+}
+
+void hmc::RingBuffer::write(
+    const double energy,
+    const std::valarray<double> &values )
+{
+    size_t s = n_written % n_capacity;
+    energies[s] = energy;
+    for( size_t i=0; i<n_width; i++ )
+        trace[s*n_width + i] = values[i];
+    n_written++;
+}
+
+void hmc::RingBuffer::save( std::ostream &out )
+{
+    write_value( out, n_written );
+    write_array( out, energies );
+    write_array( out, trace );
+}
+
+void hmc::RingBuffer::load( std::istream &in )
+{
+    size_t written;
+    read_value( in, written );
+    std::valarray<double> e, t;
+    read_array( in, e );
+    read_array( in, t );
+    if( e.size() != energies.size() || t.size() != trace.size() )
+        throw std::runtime_error( "RingBuffer: checkpoint does not fit" );
+    n_written = written;
+    energies = e;
+    trace = t;
+}
+
+hmc::BinaryFileSink::BinaryFileSink(
+    const std::string &path,
+    const size_t width,
+    const SinkOptions &options,
+    const size_t buffer_rows )
+    : SampleSink( width, options ),
+      path( path ),
+      buffer( ( buffer_rows > 0 ? buffer_rows : 1 ) * ( width+1 ) ),
+      n_buffered( 0 ),
+      buffer_rows( buffer_rows > 0 ? buffer_rows : 1 ),
+      n_samples( 0 )
+{
+    // The file is replaced on the first write, unless a checkpoint is
+    // loaded first, so only check it can be written for now
+    std::ofstream probe( path.c_str(), std::ios::binary | std::ios::app );
+    if( !probe )
+        throw std::runtime_error( "BinaryFileSink: cannot open " + path );
+}
+
+hmc::BinaryFileSink::~BinaryFileSink()
+{
+    // Destructors must not throw, a failed final write is lost
+    try { flush(); }
+    catch( ... ) {}
+}
+
+void hmc::BinaryFileSink::write(
+    const double energy,
+    const std::valarray<double> &values )
+{
+    double *row = &buffer[n_buffered*( n_width+1 )];
+    row[0] = energy;
+    for( size_t i=0; i<n_width; i++ )
+        row[i+1] = values[i];
+    n_samples++;
+    if( ++n_buffered == buffer_rows )
+        flush();
+}
+
+void hmc::BinaryFileSink::save( std::ostream &out )
+{
+    flush();
+    write_value( out, n_width );
+    write_value( out, n_samples );
+}
+
+void hmc::BinaryFileSink::load( std::istream &in )
+{
+    size_t width, samples;
+    read_value( in, width );
+    read_value( in, samples );
+    if( width != n_width )
+        throw std::runtime_error( "BinaryFileSink: checkpoint does not fit" );
+
+    // Reopen without truncating and continue after the saved samples
+    n_buffered = 0;
+    file.close();
+    file.open( path.c_str(), std::ios::binary | std::ios::in | std::ios::out );
+    file.seekp( samples*( n_width+1 )*sizeof( double ) );
+    if( !file )
+        throw std::runtime_error( "BinaryFileSink: cannot continue " + path );
+    n_samples = samples;
+}
+
+void hmc::BinaryFileSink::flush()
+{
+    if( !file.is_open() )
+    {
+        file.open( path.c_str(), std::ios::binary | std::ios::trunc );
+        if( !file )
+            throw std::runtime_error( "BinaryFileSink: cannot open " + path );
+    }
+    if( n_buffered == 0 )
+        return;
+    file.write( reinterpret_cast<const char*>( buffer.data() ),
+                n_buffered*( n_width+1 )*sizeof( double ) );
+    file.flush();
+    n_buffered = 0;
+    if( !file )
+        throw std::runtime_error( "BinaryFileSink: write failed" );
+}
+
+hmc::TeeSink::TeeSink(
+    SampleSink &first,
+    SampleSink &second,
+    const SinkOptions &options )
+    : SampleSink( first.width(), options ), first( first ), second( second )
+{
+    if( first.width() != second.width() )
+        throw std::invalid_argument( "TeeSink: the sinks differ in width" );
+}
+
+void hmc::TeeSink::write(
+    const double energy,
+    const std::valarray<double> &values )
+{
+    first.write( energy, values );
+    second.write( energy, values );
+}
+
+void hmc::TeeSink::save( std::ostream &out )
+{
+    first.save( out );
+    second.save( out );
+}
+
+void hmc::TeeSink::load( std::istream &in )
+{
+    first.load( in );
+    second.load( in );
+}
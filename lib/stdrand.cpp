@@ -1,4 +1,52 @@
 #include "../include/stdrand.hpp"
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+    // The engine and distribution as text, after the kind of generator and
+    // the length of the text
+    template <class Distribution>
+    void write_text(std::ostream &out, const int kind,
+                    const std::mt19937_64 &generator,
+                    const Distribution &distribution)
+    {
+        std::ostringstream text;
+        text << generator << ' ' << distribution;
+        const std::string s = text.str();
+        int header[2] = {kind, (int)s.size()};
+        out.write((const char*)header, sizeof(header));
+        out.write(s.data(), s.size());
+    }
+
+    template <class Distribution>
+    void read_text(std::istream &in, const int kind,
+                   std::mt19937_64 &generator,
+                   Distribution &distribution)
+    {
+        int header[2];
+        in.read((char*)header, sizeof(header));
+        if(!in)
+            throw std::runtime_error("std_randbase: random state ended early");
+        if(header[0] != kind)
+            throw std::runtime_error("std_randbase: random state is of a different generator");
+        std::string s(header[1], ' ');
+        in.read(&s[0], s.size());
+        std::istringstream text(s);
+        text >> generator >> distribution;
+        if(!in || !text)
+            throw std::runtime_error("std_randbase: random state ended early");
+    }
+}
+
+void stdrand::std_randbase::change_seed(int seed, int stream)
+{
+    std::seed_seq sequence = {seed, stream};
+    generator.seed(sequence);
+}
 
 stdrand::std_d_unirand::std_d_unirand(int seed)
 {
@@ -6,12 +54,57 @@ stdrand::std_d_unirand::std_d_unirand(int seed)
     this->change_seed(seed);
 }
 
+stdrand::std_d_unirand::std_d_unirand(int, int seed, int stream)
+{
+    distribution = std::uniform_real_distribution<double>(0.0, 1.0);
+    this->change_seed(seed, stream);
+}
+
+void stdrand::std_d_unirand::write_state(std::ostream &out) const
+{
+    write_text(out, 1, generator, distribution);
+}
+
+void stdrand::std_d_unirand::read_state(std::istream &in)
+{
+    read_text(in, 1, generator, distribution);
+}
+
+stdrand::std_irand::std_irand(int, int seed, int stream)
+{
+    distribution = std::uniform_int_distribution<int>(0, 1);
+    this->change_seed(seed, stream);
+}
+
+void stdrand::std_irand::write_state(std::ostream &out) const
+{
+    write_text(out, 2, generator, distribution);
+}
+
+void stdrand::std_irand::read_state(std::istream &in)
+{
+    read_text(in, 2, generator, distribution);
+}
+
 stdrand::std_normrand::std_normrand(double m, double sdin, int seed)
 {
     distribution = std::normal_distribution<double>(m, sdin);
     this->change_seed(seed);
 }
 
-///////////////////////////////////////////////////////
-// Random Number Tests
-///////////////////////////////////////////////////////
+stdrand::std_normrand::std_normrand(double m, double sdin, int, int seed,
+                                    int stream)
+{
+    distribution = std::normal_distribution<double>(m, sdin);
+    this->change_seed(seed, stream);
+}
+
+void stdrand::std_normrand::write_state(std::ostream &out) const
+{
+    write_text(out, 3, generator, distribution);
+}
+
+void stdrand::std_normrand::read_state(std::istream &in)
+{
+    read_text(in, 3, generator, distribution);
+}
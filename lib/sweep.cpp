@@ -0,0 +1,166 @@
+#include "../include/sweep.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/hamiltonian.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <numeric>
+
+namespace
+{
+    // Runs the chain of one point from wherever the last point left it
+    struct PointSampler {
+        hmc::SampleSink &sink;
+        std::valarray<double> &state;
+        double eps;
+        size_t draws;
+        const hmc::ReduceInto &reduce;
+        hmc::ChainRNG &rng;
+        const hmc::AdaptOptions &adapt;
+
+        template <class EnergyGrad, class Geometry>
+        hmc::WarmupResult operator()( const EnergyGrad &f_energy_grad,
+                                      const Geometry &geometry ) const
+        {
+            return hmc::nuts_chain( sink, state, eps, draws, f_energy_grad,
+                                    reduce, rng, adapt,
+                                    hmc::CheckpointOptions(), geometry );
+        }
+    };
+
+    // Samples the angles with the terms fixed at compile time where
+    // possible, as heisenberg_model. J and H are already scaled by beta.
+    hmc::WarmupResult sample_angles(
+        const PointSampler &run,
+        const double J,
+        const double H,
+        const std::shared_ptr<hmc::HeisenbergSystem> &system,
+        const hmc::Metric &metric )
+    {
+        using namespace hmc;
+        if( J != 0 && H != 0 )
+            return run( Hamiltonian<Exchange, Zeeman>(
+                            system, Exchange( J ), Zeeman( H ) ), metric );
+        if( J != 0 )
+            return run( Hamiltonian<Exchange>( system, Exchange( J ) ), metric );
+        if( H != 0 )
+            return run( Hamiltonian<Zeeman>( system, Zeeman( H ) ), metric );
+        HamiltonianOptions free;
+        free.J = 0;
+        free.H = 0;
+        return run( gen_total_energy_grad( free, system ), metric );
+    }
+
+    // Samples the spin vectors, as heisenberg_model_cartesian
+    hmc::WarmupResult sample_vectors(
+        const PointSampler &run,
+        const double J,
+        const double H,
+        const std::shared_ptr<hmc::HeisenbergSystem> &system )
+    {
+        using namespace hmc;
+        if( J != 0 && H != 0 )
+            return run( CartesianHamiltonian<Exchange, Zeeman>(
+                            system, Exchange( J ), Zeeman( H ) ), Sphere() );
+        if( J != 0 )
+            return run( CartesianHamiltonian<Exchange>( system, Exchange( J ) ),
+                        Sphere() );
+        if( H != 0 )
+            return run( CartesianHamiltonian<Zeeman>( system, Zeeman( H ) ),
+                        Sphere() );
+        return run( CartesianHamiltonian<>( system ), Sphere() );
+    }
+}
+
+hmc::SweepResult hmc::heisenberg_sweep(
+    const std::vector<int> system_dimensions,
+    const double J,
+    const std::vector<SweepPoint> &points,
+    const double leapfrog_eps,
+    const int nsamples,
+    const SweepOptions sweep,
+    const int initial_state_seed )
+{
+    const int nspins = std::accumulate(
+        system_dimensions.begin(),
+        system_dimensions.end(),
+        1, std::multiplies<int>() );
+
+    // The same random initial state as heisenberg_model
+    std::valarray<double> state( 2*nspins );
+    hmc::UniformRNG state_rng( initial_state_seed );
+    random_state( state, state_rng );
+    if( sweep.cartesian )
+        state = spin_vectors( state );
+
+    // One lattice for every point
+    std::shared_ptr<HeisenbergSystem> system(
+        new HeisenbergSystem( system_dimensions ) );
+    ReduceInto reduce;
+    if( sweep.cartesian )
+        reduce = []( std::valarray<double> &out,
+                     const std::valarray<double> &state )
+        {
+            out[0] = vector_magnetisation( state );
+        };
+    else
+        reduce = [system]( std::valarray<double> &out,
+                           const std::valarray<double> &state )
+        {
+            out[0] = system->magnetisation( state );
+        };
+
+    SweepResult res;
+    res.points = points;
+    if( sweep.hysteresis )
+        res.points.insert( res.points.end(), points.rbegin(), points.rend() );
+
+    AdaptOptions adapt;
+    adapt.warmup = std::max( sweep.warmup, 0 );
+    if( !sweep.cartesian )
+        adapt.metric = MetricAdaptation::diagonal;
+    SinkOptions keep;
+    keep.burn_in = std::max( sweep.burn_in, 0 );
+    const size_t draws = nsamples + keep.burn_in;
+    const size_t rows = sweep.traces ? nsamples : 0;
+
+    // The step size and metric are carried from point to point along with
+    // the state
+    ChainRNG chain_rng;
+    double eps = leapfrog_eps;
+    Metric metric( system->pool() );
+    for( const SweepPoint &point : res.points )
+    {
+        const auto start = std::chrono::steady_clock::now();
+        TraceMatrix trace( rows, 1, keep );
+        ThermoAccumulator observables( point.beta, nspins, keep );
+        TeeSink both( trace, observables, keep );
+        SampleSink &sink = sweep.traces ? static_cast<SampleSink&>( both )
+                                        : observables;
+
+        const PointSampler run = { sink, state, eps, draws, reduce,
+                                   chain_rng, adapt };
+        const double scaled_J = point.beta * J;
+        const double scaled_H = point.beta * point.H;
+        WarmupResult warm = sweep.cartesian
+            ? sample_vectors( run, scaled_J, scaled_H, system )
+            : sample_angles( run, scaled_J, scaled_H, system, metric );
+        eps = warm.eps;
+        if( !sweep.cartesian )
+            metric = warm.metric;
+
+        ModelResult model;
+        static_cast<WarmupResult&>( model ) = warm;
+        model.observables = observables.result();
+        model.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start ).count();
+        res.results.push_back( model );
+        if( sweep.traces )
+        {
+            res.sample_energy.push_back( trace.energy() / point.beta );
+            res.sample_magnetisation.push_back( trace.column( 0 ) );
+        }
+    }
+
+    return res;
+}
@@ -0,0 +1,174 @@
+#include "../include/tempering.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/chains.hpp"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+
+namespace
+{
+    // The lattice and random streams stay at one position on the ladder
+    // while the states move between positions when swaps are accepted.
+    struct Replica {
+        std::shared_ptr<hmc::HeisenbergSystem> system;
+        std::shared_ptr<hmc::ChainRNG> rng;
+        std::valarray<double> state;
+        double energy;
+    };
+}
+
+void hmc::adapt_ladder(
+    std::valarray<double> &betas,
+    const std::valarray<double> &acceptance,
+    const double rate )
+{
+    size_t n = betas.size();
+    if( n < 3 )
+        return;
+
+    double mean_acc = acceptance.sum() / acceptance.size();
+    std::valarray<double> gaps( n-1 );
+    for( size_t i=0; i<n-1; i++ )
+        gaps[i] = ( betas[i+1] - betas[i] )
+            * std::exp( rate * ( acceptance[i] - mean_acc ) );
+
+    // Keep the end points fixed
+    gaps *= ( betas[n-1] - betas[0] ) / gaps.sum();
+    for( size_t i=1; i<n-1; i++ )
+        betas[i] = betas[i-1] + gaps[i-1];
+}
+
+hmc::TemperingResult hmc::heisenberg_tempering(
+    const std::vector<int> system_dimensions,
+    const HamiltonianOptions options,
+    const std::vector<double> &betas,
+    const double leapfrog_eps,
+    const int nsamples,
+    const TemperingOptions temper,
+    const int nthreads,
+    const int seed )
+{
+    const int nbeta = betas.size();
+    for( int k=1; k<nbeta; k++ )
+        if( ( betas[k] - betas[k-1] ) * ( betas[1] - betas[0] ) <= 0 )
+            throw std::invalid_argument( "tempering: betas must be strictly monotonic" );
+    for( int k=0; k<nbeta; k++ )
+        if( !( betas[k] > 0 ) )
+            throw std::invalid_argument( "tempering: betas must be positive" );
+    if( temper.swap_interval < 1 )
+        throw std::invalid_argument( "tempering: swap_interval must be at least one" );
+
+    // theta and phi for every element in system
+    const int state_size = 2 * std::accumulate(
+        system_dimensions.begin(),
+        system_dimensions.end(),
+        1, std::multiplies<int>() );
+
+    TemperingResult res;
+    res.betas = std::valarray<double>( betas.data(), nbeta );
+    res.sample_energy.assign( nbeta, std::valarray<double>( nsamples ) );
+    res.sample_magnetisation.assign( nbeta, std::valarray<double>( nsamples ) );
+    res.swap_attempts.resize( std::max( nbeta-1, 0 ), 0.0 );
+    res.swap_accepts.resize( std::max( nbeta-1, 0 ), 0.0 );
+
+    // One replica per beta with its own lattice and streams
+    std::vector<Replica> replicas( nbeta );
+    for( int k=0; k<nbeta; k++ )
+    {
+        replicas[k].system.reset( new HeisenbergSystem( system_dimensions ) );
+        replicas[k].rng.reset( new ChainRNG( seed, k ) );
+        replicas[k].state.resize( state_size );
+        random_state( replicas[k].state, replicas[k].rng->uniform_rng );
+    }
+    ChainRNG swap_rng( seed, nbeta );
+
+    // Smoothed swap acceptance of each pair, used by the adaptation
+    std::valarray<double> acceptance( 0.0, std::max( nbeta-1, 0 ) );
+    std::valarray<double> acc_count( 0.0, std::max( nbeta-1, 0 ) );
+
+    // Run n samples on every replica, recording from offset if asked
+    auto run_round = [&]( const int n, const bool record, const int offset )
+    {
+        run_parallel( nbeta, nthreads, [&]( const int k )
+        {
+            Replica &rep = replicas[k];
+            const double beta = res.betas[k];
+            auto energy_grad = gen_total_energy_grad(
+                scaled_options( options, beta ), rep.system );
+            std::shared_ptr<HeisenbergSystem> system = rep.system;
+            std::function<std::valarray<double>(const std::valarray<double>&)>
+                reduce = [system]( const std::valarray<double>& state )
+                {
+                    std::valarray<double> m = { system->magnetisation( state ) };
+                    return m;
+                };
+
+            std::valarray<double> e( n );
+            auto trace = nuts( e, rep.state, leapfrog_eps, n,
+                               energy_grad, reduce, *rep.rng );
+            rep.energy = e[n-1] / beta;
+            if( record )
+            {
+                for( int i=0; i<n; i++ )
+                {
+                    res.sample_energy[k][offset+i] = e[i] / beta;
+                    res.sample_magnetisation[k][offset+i] = trace[i][0];
+                }
+            }
+        });
+    };
+
+    // Attempt swaps between alternate neighbouring pairs
+    auto swap_round = [&]( const int round, const bool record )
+    {
+        for( int k=round%2; k+1<nbeta; k+=2 )
+        {
+            double delta = ( res.betas[k] - res.betas[k+1] )
+                * ( replicas[k].energy - replicas[k+1].energy );
+            double prob = std::min( 1.0, std::exp( delta ) );
+            bool accept = swap_rng.uniform_rng.gen() < prob;
+            if( accept )
+            {
+                std::swap( replicas[k].state, replicas[k+1].state );
+                std::swap( replicas[k].energy, replicas[k+1].energy );
+            }
+            if( record )
+            {
+                res.swap_attempts[k] += 1;
+                res.swap_accepts[k] += accept;
+            }
+            else
+            {
+                // Running mean which becomes an exponential average
+                acc_count[k] += 1;
+                double w = std::max( 1.0/acc_count[k], 0.1 );
+                acceptance[k] += w * ( prob - acceptance[k] );
+            }
+        }
+    };
+
+    // Warm up and adapt the ladder
+    int round = 0;
+    for( ; round<temper.adapt_rounds; round++ )
+    {
+        run_round( temper.swap_interval, false, 0 );
+        swap_round( round, false );
+        // A single beta has no pairs to adapt from
+        if( nbeta > 1 && acc_count.min() > 0 )
+            adapt_ladder( res.betas, acceptance, temper.adapt_rate );
+    }
+
+    // Sample with the ladder fixed
+    for( int recorded=0; recorded<nsamples; round++ )
+    {
+        int n = std::min( temper.swap_interval, nsamples-recorded );
+        run_round( n, true, recorded );
+        recorded += n;
+        if( recorded < nsamples )
+            swap_round( round, true );
+    }
+
+    return res;
+}
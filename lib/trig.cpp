@@ -0,0 +1,160 @@
+#include "../include/trig.hpp"
+#include <cmath>
+
+// The kernel only vectorises if GCC may evaluate both sides of a select,
+// which -ftrapping-math forbids, and at -O2 its cost model rejects a loop
+// of unknown length
+#if defined( __GNUC__ ) && !defined( __clang__ ) && !defined( __INTEL_COMPILER )
+#pragma GCC optimize ( "O3", "no-trapping-math" )
+#endif
+
+namespace
+{
+    // Largest angle the reduction is exact for. The quotient by pi/2 fits
+    // in 17 bits, so its products with the 33 bit parts of pi/2 are exact.
+    const double reduce_limit = 1e5;
+
+    const double two_over_pi = 6.36619772367581382433e-01;
+    const double pio2_1 = 1.57079632673412561417e+00;
+    const double pio2_2 = 6.07710050630396597660e-11;
+    const double pio2_3 = 2.02226624871116645580e-21;
+
+    // fdlibm __kernel_sin and __kernel_cos on [-pi/4, pi/4]
+    const double S1 = -1.66666666666666324348e-01;
+    const double S2 = 8.33333333332248946124e-03;
+    const double S3 = -1.98412698298579493134e-04;
+    const double S4 = 2.75573137070700676789e-06;
+    const double S5 = -2.50507602534068634195e-08;
+    const double S6 = 1.58969099521155010221e-10;
+    const double C1 = 4.16666666666666019037e-02;
+    const double C2 = -1.38888888888741095749e-03;
+    const double C3 = 2.48015872894767294178e-05;
+    const double C4 = -2.75573143513906633035e-07;
+    const double C5 = 2.08757232129817482790e-09;
+    const double C6 = -1.13596475577881948265e-11;
+
+    // The body shared by every instruction set. Reduces each angle to r in
+    // [-pi/4, pi/4] and the quadrant q, evaluates both polynomials and
+    // picks and signs them by the quadrant with selects rather than
+    // branches.
+    inline __attribute__((always_inline)) void sincos_loop(
+        const double * __restrict x,
+        double * __restrict sin_out,
+        double * __restrict cos_out,
+        const size_t n )
+    {
+        for( size_t i=0; i<n; i++ )
+        {
+            // Out of range angles are patched afterwards. No library calls,
+            // not even std::abs, as they are not inlined under the pragma
+            const double xi = ( x[i] <= reduce_limit && x[i] >= -reduce_limit )
+                              ? x[i] : 0.0;
+            const double t = xi * two_over_pi;
+            const int q = int( t + ( ( t >= 0 ) ? 0.5 : -0.5 ) );
+            const double qd = q;
+            const double r = ( ( xi - qd*pio2_1 ) - qd*pio2_2 ) - qd*pio2_3;
+            const double z = r*r;
+
+            const double ps = r + r*z*( S1 + z*( S2 + z*( S3 + z*( S4
+                                  + z*( S5 + z*S6 ) ) ) ) );
+            const double hz = 0.5*z;
+            const double w = 1.0 - hz;
+            const double pc = w + ( ( ( 1.0 - w ) - hz )
+                                    + z*z*( C1 + z*( C2 + z*( C3 + z*( C4
+                                      + z*( C5 + z*C6 ) ) ) ) ) );
+
+            const bool odd = q & 1;
+            const double s = odd ? pc : ps;
+            const double c = odd ? ps : pc;
+            sin_out[i] = s * double( 1 - ( q & 2 ) );
+            cos_out[i] = c * double( 1 - ( ( q + 1 ) & 2 ) );
+        }
+    }
+
+    typedef void (*SincosKernel)( const double*, double*, double*, size_t );
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    __attribute__((target( "avx512f" )))
+    void sincos_avx512( const double *x, double *s, double *c, size_t n )
+    {
+        sincos_loop( x, s, c, n );
+    }
+
+    __attribute__((target( "avx2,fma" )))
+    void sincos_avx2( const double *x, double *s, double *c, size_t n )
+    {
+        sincos_loop( x, s, c, n );
+    }
+
+    void sincos_sse2( const double *x, double *s, double *c, size_t n )
+    {
+        sincos_loop( x, s, c, n );
+    }
+
+    struct Dispatch {
+        SincosKernel kernel;
+        const char *isa;
+
+        Dispatch()
+        {
+            __builtin_cpu_init();
+            if( __builtin_cpu_supports( "avx512f" ) )
+            {
+                kernel = sincos_avx512;
+                isa = "avx512";
+            }
+            else if( __builtin_cpu_supports( "avx2" )
+                     && __builtin_cpu_supports( "fma" ) )
+            {
+                kernel = sincos_avx2;
+                isa = "avx2";
+            }
+            else
+            {
+                kernel = sincos_sse2;
+                isa = "sse2";
+            }
+        }
+    };
+#else
+    void sincos_generic( const double *x, double *s, double *c, size_t n )
+    {
+        sincos_loop( x, s, c, n );
+    }
+
+    struct Dispatch {
+        SincosKernel kernel;
+        const char *isa;
+
+        Dispatch() : kernel( sincos_generic ), isa( "generic" ) {}
+    };
+#endif
+
+    // Chosen once, on first use
+    const Dispatch& dispatch()
+    {
+        static const Dispatch d;
+        return d;
+    }
+}
+
+void hmc::sincos_array( const double *x, double *sin_out, double *cos_out,
+                        const size_t n )
+{
+    dispatch().kernel( x, sin_out, cos_out, n );
+
+    // Rarely any, so a second pass costs less than a branch in the kernel
+    for( size_t i=0; i<n; i++ )
+    {
+        if( !( x[i] <= reduce_limit && x[i] >= -reduce_limit ) )
+        {
+            sin_out[i] = std::sin( x[i] );
+            cos_out[i] = std::cos( x[i] );
+        }
+    }
+}
+
+const char* hmc::sincos_isa()
+{
+    return dispatch().isa;
+}
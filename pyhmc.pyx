@@ -3,6 +3,7 @@ import cython
 import numpy as np
 cimport numpy as np
 
+from libcpp.string cimport string
 from libcpp.vector cimport vector
 
 # valarray
@@ -11,6 +12,7 @@ cdef extern from "<valarray>" namespace "std" nogil:
         dvarray() except+
         dvarray( size_t ) except+
         double& operator[](size_t)
+        size_t size()
 
 # Options struct
 cdef extern from "hmc.hpp" namespace "hmc":
@@ -18,9 +20,56 @@ cdef extern from "hmc.hpp" namespace "hmc":
         double J
         double H
 
+# Step size adaptation
+cdef extern from "adapt.hpp" namespace "hmc":
+    cdef cppclass WarmupResult:
+        double eps
+        dvarray acceptance
+        dvarray step_size
+
+# Checkpointing of a chain
+cdef extern from "checkpoint.hpp" namespace "hmc":
+    cdef cppclass CheckpointOptions:
+        string path
+        size_t interval
+
+# Averages accumulated while sampling
+cdef extern from "observables.hpp" namespace "hmc":
+    cdef cppclass Observables:
+        long samples
+        double energy, energy_error
+        double energy2, energy2_error
+        double abs_magnetisation, abs_magnetisation_error
+        double magnetisation2, magnetisation2_error
+        double magnetisation4, magnetisation4_error
+        double specific_heat, specific_heat_error
+        double susceptibility, susceptibility_error
+        double binder, binder_error
+        double energy_time, energy_ess
+        double magnetisation_time, magnetisation_ess
+
 # declare the Heisenberg model function
 cdef extern from "hmc.hpp" namespace "hmc":
-    vector[dvarray] heisenberg_model(
+    cdef cppclass ModelResult:
+        double eps
+        dvarray acceptance
+        dvarray step_size
+        Observables observables
+        double seconds
+
+    ModelResult heisenberg_model(
+        dvarray &energy,
+        dvarray &magnetisation,
+        const vector[int] dims,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int initial_state_seed,
+        const int warmup,
+        const CheckpointOptions &checkpoint ) except +
+
+    ModelResult heisenberg_model_cartesian(
         dvarray &energy,
         dvarray &magnetisation,
         const vector[int] dims,
@@ -28,16 +77,110 @@ cdef extern from "hmc.hpp" namespace "hmc":
         const double beta,
         const double leapfrog_eps,
         const int nsamples,
-        const int initial_state_seed )
+        const int initial_state_seed,
+        const int warmup,
+        const CheckpointOptions &checkpoint ) except +
+
+# declare the sweep over temperature and field
+cdef extern from "sweep.hpp" namespace "hmc":
+    struct SweepPoint:
+        double beta
+        double H
+    cdef cppclass SweepOptions:
+        int warmup
+        int burn_in
+        bint cartesian
+        bint hysteresis
+        bint traces
+    cdef cppclass SweepResult:
+        vector[SweepPoint] points
+        vector[ModelResult] results
+        vector[dvarray] sample_energy
+        vector[dvarray] sample_magnetisation
+    SweepResult heisenberg_sweep(
+        const vector[int] dims,
+        const double J,
+        const vector[SweepPoint] &points,
+        const double leapfrog_eps,
+        const int nsamples,
+        const SweepOptions sweep,
+        const int initial_state_seed ) nogil except +
+
+# declare the multi-chain Heisenberg driver
+cdef extern from "chains.hpp" namespace "hmc":
+    void heisenberg_chains(
+        vector[dvarray] &energy,
+        vector[dvarray] &magnetisation,
+        const vector[int] dims,
+        const HamiltonianOptions options,
+        const double beta,
+        const double leapfrog_eps,
+        const int nsamples,
+        const int nchains,
+        const int nthreads,
+        const int seed ) nogil except +
+
+# declare the replica exchange driver
+cdef extern from "tempering.hpp" namespace "hmc":
+    cdef cppclass TemperingOptions:
+        int swap_interval
+        int adapt_rounds
+        double adapt_rate
+    cdef cppclass TemperingResult:
+        dvarray betas
+        vector[dvarray] sample_energy
+        vector[dvarray] sample_magnetisation
+        dvarray swap_attempts
+        dvarray swap_accepts
+    TemperingResult heisenberg_tempering(
+        const vector[int] dims,
+        const HamiltonianOptions options,
+        const vector[double] &betas,
+        const double leapfrog_eps,
+        const int nsamples,
+        const TemperingOptions temper,
+        const int nthreads,
+        const int seed ) nogil except+
+
+# The averages as a dict
+cdef observables_dict( Observables obs ):
+    return {
+        'samples': obs.samples,
+        'energy': obs.energy,
+        'energy_error': obs.energy_error,
+        'energy2': obs.energy2,
+        'energy2_error': obs.energy2_error,
+        'abs_magnetisation': obs.abs_magnetisation,
+        'abs_magnetisation_error': obs.abs_magnetisation_error,
+        'magnetisation2': obs.magnetisation2,
+        'magnetisation2_error': obs.magnetisation2_error,
+        'magnetisation4': obs.magnetisation4,
+        'magnetisation4_error': obs.magnetisation4_error,
+        'specific_heat': obs.specific_heat,
+        'specific_heat_error': obs.specific_heat_error,
+        'susceptibility': obs.susceptibility,
+        'susceptibility_error': obs.susceptibility_error,
+        'binder': obs.binder,
+        'binder_error': obs.binder_error,
+        'energy_time': obs.energy_time,
+        'energy_ess': obs.energy_ess,
+        'magnetisation_time': obs.magnetisation_time,
+        'magnetisation_ess': obs.magnetisation_ess
+    }
 
-# Wrap function
+# Wrap function. J and H are those of the lattice, sampled at
+# beta = 1 / (KB T), and the energies returned are those of the lattice.
 cpdef simulate(
     double J, double H, double KB, double T,
     long [:] dimensions,
-    int nsamples, double lf_eps, int init_seed=1001):
+    int nsamples, double lf_eps, int init_seed=1001, bint cartesian=False,
+    int warmup=0, checkpoint=None, int checkpoint_interval=0,
+    bint traces=True):
 
-    cdef dvarray c_energy = dvarray(nsamples)
-    cdef dvarray c_magnetisation = dvarray(nsamples)
+    # Without traces only the averages are kept, in fixed memory
+    cdef int ntrace = nsamples if traces else 0
+    cdef dvarray c_energy = dvarray(ntrace)
+    cdef dvarray c_magnetisation = dvarray(ntrace)
 
     cdef vector[int] c_dims
     for dim in dimensions:
@@ -50,14 +193,159 @@ cpdef simulate(
     cdef double c_eps = lf_eps
     cdef int c_samp = nsamples
     cdef int c_seed = init_seed
+    cdef ModelResult res
+
+    # A chain given a checkpoint file resumes from it if it exists
+    cdef CheckpointOptions c_checkpoint
+    if checkpoint is not None:
+        c_checkpoint.path = checkpoint.encode()
+        c_checkpoint.interval = checkpoint_interval
 
-    heisenberg_model( c_energy, c_magnetisation, c_dims, options, beta,
-                      c_eps, c_samp, c_seed )
+    # Cartesian spins avoid the trig functions and the poles. With warmup
+    # the step size starts from lf_eps and is adapted.
+    if cartesian:
+        res = heisenberg_model_cartesian( c_energy, c_magnetisation, c_dims,
+                                          options, beta, c_eps, c_samp,
+                                          c_seed, warmup, c_checkpoint )
+    else:
+        res = heisenberg_model( c_energy, c_magnetisation, c_dims, options,
+                                beta, c_eps, c_samp, c_seed, warmup,
+                                c_checkpoint )
 
-    energy = np.array([c_energy[i] for i in range(nsamples)])
-    magnetisation = np.array([c_magnetisation[i] for i in range(nsamples)])
+    energy = np.array([c_energy[i] for i in range(ntrace)])
+    magnetisation = np.array([c_magnetisation[i] for i in range(ntrace)])
+
+    return {
+        'energy': energy,
+        'magnetisation': magnetisation,
+        'eps': res.eps,
+        'warmup_acceptance': np.array([res.acceptance[i]
+                                       for i in range(warmup)]),
+        'observables': observables_dict( res.observables ),
+        'seconds': res.seconds
+    }
+
+# Wrap the sweep. Each point samples what simulate does at the same
+# J, H, KB and T.
+cpdef simulate_sweep(
+    double J, double KB, double [:] temperatures, double [:] fields,
+    long [:] dimensions,
+    int nsamples, double lf_eps, int init_seed=1001, bint cartesian=False,
+    int warmup=0, int burn_in=0, bint hysteresis=False, bint traces=True):
+
+    cdef vector[int] c_dims
+    for dim in dimensions:
+        c_dims.push_back( dim )
+
+    # One point for each temperature and field pair
+    cdef vector[SweepPoint] c_points
+    cdef SweepPoint point
+    for T, H in zip(temperatures, fields):
+        point.beta = 1.0 / (KB * T)
+        point.H = H
+        c_points.push_back( point )
+
+    cdef SweepOptions sweep
+    sweep.warmup = warmup
+    sweep.burn_in = burn_in
+    sweep.cartesian = cartesian
+    sweep.hysteresis = hysteresis
+    sweep.traces = traces
+
+    cdef SweepResult res
+    with nogil:
+        res = heisenberg_sweep( c_dims, J, c_points, lf_eps, nsamples, sweep,
+                                init_seed )
+
+    npoints = res.points.size()
+    ntrace = nsamples if traces else 0
+    return {
+        'beta': np.array([res.points[k].beta for k in range(npoints)]),
+        'H': np.array([res.points[k].H for k in range(npoints)]),
+        'energy': np.array([[res.sample_energy[k][i] for i in range(ntrace)]
+                            for k in range(res.sample_energy.size())]),
+        'magnetisation': np.array([[res.sample_magnetisation[k][i]
+                                    for i in range(ntrace)]
+                                   for k in range(res.sample_magnetisation.size())]),
+        'eps': np.array([res.results[k].eps for k in range(npoints)]),
+        'seconds': np.array([res.results[k].seconds for k in range(npoints)]),
+        'observables': [observables_dict( res.results[k].observables )
+                        for k in range(npoints)]
+    }
+
+# Wrap multi-chain function
+cpdef simulate_chains(
+    double J, double H, double KB, double T,
+    long [:] dimensions,
+    int nsamples, double lf_eps, int nchains,
+    int nthreads=0, int seed=1001):
+
+    cdef vector[dvarray] c_energy
+    cdef vector[dvarray] c_magnetisation
+
+    cdef vector[int] c_dims
+    for dim in dimensions:
+        c_dims.push_back( dim )
+
+    cdef HamiltonianOptions options
+    options.J = J
+    options.H = H
+    cdef double beta = 1.0 / (KB * T)
+
+    with nogil:
+        heisenberg_chains( c_energy, c_magnetisation, c_dims, options, beta,
+                           lf_eps, nsamples, nchains, nthreads, seed )
+
+    energy = np.array([[c_energy[c][i] for i in range(nsamples)]
+                       for c in range(nchains)])
+    magnetisation = np.array([[c_magnetisation[c][i] for i in range(nsamples)]
+                              for c in range(nchains)])
 
     return {
         'energy': energy,
         'magnetisation': magnetisation
     }
+
+# Wrap replica exchange
+cpdef simulate_tempering(
+    double J, double H, double KB, double [:] temperatures,
+    long [:] dimensions,
+    int nsamples, double lf_eps, int swap_interval=10,
+    int adapt_rounds=0, double adapt_rate=0.5,
+    int nthreads=0, int seed=1001):
+
+    cdef vector[int] c_dims
+    for dim in dimensions:
+        c_dims.push_back( dim )
+
+    cdef vector[double] c_betas
+    for T in temperatures:
+        c_betas.push_back( 1.0 / (KB * T) )
+
+    cdef HamiltonianOptions options
+    options.J = J
+    options.H = H
+
+    cdef TemperingOptions temper
+    temper.swap_interval = swap_interval
+    temper.adapt_rounds = adapt_rounds
+    temper.adapt_rate = adapt_rate
+
+    cdef TemperingResult res
+    with nogil:
+        res = heisenberg_tempering( c_dims, options, c_betas, lf_eps,
+                                    nsamples, temper, nthreads, seed )
+
+    nbeta = c_betas.size()
+    return {
+        'beta': np.array([res.betas[k] for k in range(nbeta)]),
+        'energy': np.array([[res.sample_energy[k][i] for i in range(nsamples)]
+                            for k in range(nbeta)]),
+        'magnetisation': np.array([[res.sample_magnetisation[k][i]
+                                    for i in range(nsamples)]
+                                   for k in range(nbeta)]),
+        'swap_attempts': np.array([res.swap_attempts[k]
+                                   for k in range(nbeta-1)]),
+        'swap_accepts': np.array([res.swap_accepts[k]
+                                  for k in range(nbeta-1)])
+    }
@@ -0,0 +1,219 @@
+#ifndef ADAPT_TEST
+#define ADAPT_TEST
+
+#include "../include/adapt.hpp"
+#include "../include/hmc.hpp"
+#include "../include/metric.hpp"
+#include "../include/rng.hpp"
+#include <functional>
+#include <cmath>
+#include <stdexcept>
+#include <valarray>
+
+TEST( adapt, dual_averaging_direction )
+{
+    hmc::AdaptOptions options;
+    options.target_accept = 0.8;
+
+    // Accepting everything means the step can grow
+    hmc::DualAveraging grow( 0.1, options );
+    for( int i=0; i<50; i++ )
+        grow.update( 1.0 );
+    EXPECT_GT( grow.adapted(), 0.1 );
+
+    // Rejecting everything, or failing, means it must shrink
+    hmc::DualAveraging shrink( 0.1, options );
+    for( int i=0; i<50; i++ )
+        shrink.update( i%2 ? 0.0 : NAN );
+    EXPECT_LT( shrink.adapted(), 0.1 );
+}
+
+TEST( adapt, nuts_warmup_reaches_target )
+{
+    // A narrow Gaussian with a step size far too small
+    std::valarray<double> sd = {0.1, 1.0, 3.0};
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)>
+        f = [sd]( std::valarray<double>& grad, const std::valarray<double>& x )
+        {
+            grad = x/(sd*sd);
+            return 0.5*(x*grad).sum();
+        };
+
+    hmc::AdaptOptions adapt;
+    adapt.warmup = 2000;
+    std::valarray<double> state = {0.1, -0.5, 1.0};
+    hmc::ChainRNG rng( 1001, 0 );
+    hmc::WarmupResult res = hmc::nuts_warmup( state, 1e-4, f, rng, adapt );
+
+    ASSERT_EQ( 2000u, res.acceptance.size() );
+    ASSERT_EQ( 2000u, res.step_size.size() );
+    EXPECT_DOUBLE_EQ( 1e-4, res.step_size[0] );
+
+    // Stable at the end of warmup, and stable for the narrow direction
+    EXPECT_GT( res.eps, 0.01 );
+    EXPECT_LT( res.eps, 0.2 );
+    std::valarray<double> last = res.acceptance[std::slice( 1000, 1000, 1 )];
+    EXPECT_NEAR( adapt.target_accept, last.sum()/last.size(), 0.05 );
+}
+
+TEST( adapt, hmc_warmup_reaches_target )
+{
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)>
+        f = []( std::valarray<double>& grad, const std::valarray<double>& x )
+        {
+            grad = x;
+            return 0.5*(x*x).sum();
+        };
+
+    hmc::AdaptOptions adapt;
+    adapt.warmup = 2000;
+    adapt.target_accept = 0.65;
+    std::valarray<double> state( 0.5, 20 );
+    hmc::ChainRNG rng( 1001, 1 );
+    hmc::WarmupResult res = hmc::hmc_warmup( state, 2.0, 10, f, rng, adapt );
+
+    // Too large a step at first, so it has to come down
+    EXPECT_LT( res.eps, 2.0 );
+    std::valarray<double> last = res.acceptance[std::slice( 1000, 1000, 1 )];
+    EXPECT_NEAR( adapt.target_accept, last.sum()/last.size(), 0.05 );
+}
+
+TEST( adapt, metric_inverse )
+{
+    // A diagonal metric with one correlated direction
+    hmc::Metric metric( std::valarray<double>( {0.5, 2.0, 1.0} ) );
+    metric.directions.push_back( std::valarray<double>( {1.0, 1.0, 0.0} )
+                                 / std::sqrt( 2.0 ) );
+    metric.values = {1.8};
+
+    // Momenta have covariance M, so p.(M^-1 p) averages to the dimension
+    // and p_i (M^-1 p)_j to the identity
+    hmc::NormalRNG rng( 0, 1, 10000, 7 );
+    std::valarray<double> p( 3 ), v( 3 ), state( 3 );
+    std::valarray<double> cross( 0.0, 9 );
+    int N = 200000;
+    for( int n=0; n<N; n++ )
+    {
+        metric.refresh( p, state, rng );
+        metric.velocity( v, p );
+        EXPECT_NEAR( 0.5*(p*v).sum(), metric.kinetic_energy( p ), 1e-12 );
+        for( int i=0; i<3; i++ )
+            for( int j=0; j<3; j++ )
+                cross[3*i+j] += p[i]*v[j] / N;
+    }
+    for( int i=0; i<3; i++ )
+        for( int j=0; j<3; j++ )
+            EXPECT_NEAR( i==j ? 1.0 : 0.0, cross[3*i+j], 0.02 );
+
+    // No scales is the identity
+    hmc::Metric identity;
+    identity.velocity( v, p );
+    for( int i=0; i<3; i++ )
+        EXPECT_DOUBLE_EQ( p[i], v[i] );
+}
+
+TEST( adapt, metric_estimator )
+{
+    // Two correlated coordinates and two independent ones
+    hmc::NormalRNG rng( 0, 1, 10000, 11 );
+    hmc::MetricEstimator estimator( 4, 2 );
+    std::valarray<double> x( 4 );
+    for( int n=0; n<20000; n++ )
+    {
+        double a = rng.gen(), b = rng.gen();
+        x[0] = 3.0 * a;
+        x[1] = 0.1 * ( 0.9*a + std::sqrt( 1 - 0.81 )*b );
+        x[2] = 2.0 * rng.gen();
+        x[3] = 1.0 + 0.5 * rng.gen();
+        estimator.add_sample( x );
+    }
+    hmc::Metric metric;
+    estimator.estimate( metric );
+    EXPECT_NEAR( 3.0, metric.scale[0], 0.05 );
+    EXPECT_NEAR( 0.1, metric.scale[1], 0.005 );
+    EXPECT_NEAR( 2.0, metric.scale[2], 0.05 );
+    EXPECT_NEAR( 0.5, metric.scale[3], 0.01 );
+
+    // The correlated pair is the strongest direction
+    ASSERT_GE( metric.directions.size(), 1u );
+    EXPECT_NEAR( 1.9, metric.values[0], 0.05 );
+    EXPECT_NEAR( 1/std::sqrt( 2.0 ), std::abs( metric.directions[0][0] ), 0.02 );
+    EXPECT_NEAR( 1/std::sqrt( 2.0 ), std::abs( metric.directions[0][1] ), 0.02 );
+    EXPECT_NEAR( 0, metric.directions[0][2], 0.05 );
+
+    estimator.restart();
+    EXPECT_EQ( 0, estimator.count() );
+}
+
+TEST( adapt, nuts_warmup_metric )
+{
+    // Scales four orders of magnitude apart
+    std::valarray<double> sd = {0.01, 1.0, 100.0};
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)>
+        f = [sd]( std::valarray<double>& grad, const std::valarray<double>& x )
+        {
+            grad = x/(sd*sd);
+            return 0.5*(x*grad).sum();
+        };
+
+    hmc::AdaptOptions adapt;
+    adapt.warmup = 1000;
+    std::valarray<double> start = {0.0, 0.0, 0.0};
+
+    // The identity metric has to step at the smallest scale
+    std::valarray<double> state( start );
+    hmc::ChainRNG rng( 1001, 0 );
+    hmc::WarmupResult plain = hmc::nuts_warmup( state, 0.01, f, rng, adapt );
+    EXPECT_LT( plain.eps, 0.03 );
+
+    // Metric adaptation needs the Metric geometry
+    adapt.metric = hmc::MetricAdaptation::diagonal;
+    EXPECT_THROW( hmc::nuts_warmup( state, 0.01, f, rng, adapt ),
+                  std::invalid_argument );
+
+    state = start;
+    hmc::WarmupResult res = hmc::nuts_warmup( state, 0.01, f, rng, adapt,
+                                              hmc::Metric() );
+    ASSERT_EQ( 3u, res.metric.scale.size() );
+    for( int i=0; i<3; i++ )
+        EXPECT_NEAR( 1.0, res.metric.scale[i]/sd[i], 0.5 );
+    EXPECT_GT( res.eps, 0.3 );
+
+    // Sampling with the metric recovers the widest scale
+    size_t N = 5000;
+    std::valarray<double> energy( N );
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = [](const std::valarray<double>&x)
+        { return std::valarray<double>( x ); };
+    auto trace = hmc::nuts( energy, state, res.eps, N, f, reduce, rng,
+                            res.metric );
+    double squares = 0;
+    for( size_t i=0; i<N; i++ )
+        squares += trace[i][2]*trace[i][2] / N;
+    EXPECT_NEAR( 100.0, std::sqrt( squares ), 10.0 );
+}
+
+TEST( adapt, heisenberg_model_warmup )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    int N = 20;
+    std::valarray<double> e( N ), m( N );
+
+    // Without warmup the step size is kept
+    hmc::WarmupResult none = hmc::heisenberg_model_cartesian(
+        e, m, {4, 4}, options, 2.0, 0.2, N, 3 );
+    EXPECT_DOUBLE_EQ( 0.2, none.eps );
+    EXPECT_EQ( 0u, none.acceptance.size() );
+
+    // Warmup draws are not returned
+    hmc::WarmupResult res = hmc::heisenberg_model_cartesian(
+        e, m, {4, 4}, options, 2.0, 0.01, N, 3, 300 );
+    EXPECT_EQ( 300u, res.acceptance.size() );
+    EXPECT_GT( res.eps, 0.01 );
+    for( int i=0; i<N; i++ )
+        EXPECT_GE( e[i], -( 2*16 + 0.5*16 ) - 1e-9 );
+}
+
+#endif
@@ -18,9 +18,9 @@ TEST(Hamiltonian_Gen, Zeeman)
     test_spins[6] = 5.2;
     test_spins[7] = 3.4;
 
-    hmc::set_slices(size*2, 2);
-    hmc::calc_trig(test_spins);
-    EXPECT_FLOAT_EQ(hmc::zeeman_energy(H), -0.5827041377);
+    hmc::HeisenbergSystem system(size*2, 2);
+    system.calc_trig(test_spins);
+    EXPECT_FLOAT_EQ(system.zeeman_energy(H), -0.5827041377);
 }
 
 TEST(Hamiltonian_Gen, Zeeman_Grad)
@@ -40,10 +40,10 @@ TEST(Hamiltonian_Gen, Zeeman_Grad)
 
     std::valarray<double> grad(size*2);
     grad = 0;
-    hmc::set_slices(size*2, 2);
-    hmc::calc_trig(test_spins);
+    hmc::HeisenbergSystem system(size*2, 2);
+    system.calc_trig(test_spins);
 
-    hmc::zeeman_grad(grad, H);
+    system.zeeman_grad(grad, H);
     for (int i = 4; i < 8; i++)
     {
         EXPECT_EQ(grad[i], 0);
@@ -54,4 +54,125 @@ TEST(Hamiltonian_Gen, Zeeman_Grad)
     EXPECT_FLOAT_EQ(grad[3], H*0.8632093666);
 }
 
+TEST(Hamiltonian_Gen, Energy_Grad_Fused)
+{
+    std::valarray<double> spins_1d = {2.3, 0.1, 1.1, 0.3, 1.6, 5.2};
+    std::valarray<double> spins_2d = {2.3, 0.1, 1.1, 2.1, 0.3, 1.6, 5.2, 3.4};
+
+    struct hmc::HamiltonianOptions options;
+    options.J = 1.0;
+    options.H = 2.1;
+
+    std::vector<std::valarray<double> > all_spins = {spins_1d, spins_2d};
+    for (int d = 1; d <= 2; d++)
+    {
+        std::valarray<double> &spins = all_spins[d-1];
+        int size = spins.size();
+        auto E = hmc::gen_total_energy( options, d, size );
+        auto G = hmc::gen_total_grad( options, d, size );
+        auto EG = hmc::gen_total_energy_grad( options, d, size );
+
+        std::valarray<double> grad(size), grad_fused(size);
+        G(grad, spins);
+        double energy = EG(grad_fused, spins);
+        EXPECT_NEAR(E(spins), energy, std::abs(energy)*1e-12);
+        for (int i = 0; i < size; i++)
+            EXPECT_NEAR(grad[i], grad_fused[i], 1e-12);
+
+        // Every component is the central difference of the energy
+        const double h = 1e-5;
+        for (int i = 0; i < size; i++)
+        {
+            std::valarray<double> up(spins), down(spins);
+            up[i] += h;
+            down[i] -= h;
+            EXPECT_NEAR((E(up) - E(down)) / (2*h), grad_fused[i], 1e-8);
+        }
+    }
+
+    // Exchange energy from the full field matches the forward bond sum
+    hmc::HeisenbergSystem system(8, 2);
+    std::valarray<double> grad(8);
+    grad = 0;
+    system.calc_trig(spins_2d);
+    EXPECT_NEAR(system.exchange_energy_grad(grad, 1), 3.4939748074272869,
+                3.4939748074272869*1e-12);
+    const double h = 1e-5;
+    for (int i = 0; i < 8; i++)
+    {
+        std::valarray<double> up(spins_2d), down(spins_2d);
+        up[i] += h;
+        down[i] -= h;
+        system.calc_trig(up);
+        double e_up = system.exchange_energy(1);
+        system.calc_trig(down);
+        double e_down = system.exchange_energy(1);
+        EXPECT_NEAR((e_up - e_down) / (2*h), grad[i], 1e-8);
+    }
+}
+
+TEST(Hamiltonian_Gen, Periodic_Neighbours)
+{
+    // Compare against a direct sum over the bonds of L^d lattices
+    int sides[3] = {7, 5, 4};
+    for (int d = 1; d <= 3; d++)
+    {
+        int L = sides[d-1];
+        int n = std::pow(L, d);
+        std::valarray<double> spins(2*n);
+        for (int i = 0; i < 2*n; i++)
+            spins[i] = std::fmod(1.3*i*i + 0.2*i, 2*pi);
+
+        double expected = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int stride = 1;
+            for (int a = 0; a < d; a++)
+            {
+                int coord = (i / stride) % L;
+                int j = i + ((coord + 1) % L - coord) * stride;
+                expected -= std::sin(spins[i])*std::sin(spins[j])
+                    * std::cos(spins[n+i] - spins[n+j])
+                    + std::cos(spins[i])*std::cos(spins[j]);
+                stride *= L;
+            }
+        }
+
+        hmc::HeisenbergSystem system(2*n, d);
+        system.calc_trig(spins);
+        std::valarray<double> grad(0.0, 2*n);
+        EXPECT_NEAR(system.exchange_energy(1), expected, 1e-10);
+        EXPECT_NEAR(system.exchange_energy_grad(grad, 1), expected, 1e-10);
+    }
+}
+
+TEST(Hamiltonian_Gen, Independent_Systems)
+{
+    std::valarray<double> spins_1d = {2.3, 0.1, 1.1, 0.3, 1.6, 5.2};
+    std::valarray<double> spins_2d = {2.3, 0.1, 1.1, 2.1, 0.3, 1.6, 5.2, 3.4};
+
+    struct hmc::HamiltonianOptions options;
+    options.J = 1.0;
+    options.H = 0.0;
+
+    // Two lattices of different size and dimension alive at once
+    auto E_1d = hmc::gen_total_energy( options, 1, 6 );
+    auto E_2d = hmc::gen_total_energy( options, 2, 8 );
+    for (int i = 0; i < 2; i++)
+    {
+        EXPECT_NEAR(E_2d(spins_2d), 3.4939748074272869, 3.4939748074272869*1e-9);
+        EXPECT_NEAR(E_1d(spins_1d), 0.44975793200288505, 0.44975793200288505*1e-9);
+    }
+
+    // Energy and gradient can share a single system
+    std::shared_ptr<hmc::HeisenbergSystem> system(new hmc::HeisenbergSystem(6, 1));
+    auto E_shared = hmc::gen_total_energy( options, system );
+    auto G_shared = hmc::gen_total_grad( options, system );
+    std::valarray<double> grad(6);
+    G_shared(grad, spins_1d);
+    EXPECT_NEAR(E_shared(spins_1d), 0.44975793200288505, 0.44975793200288505*1e-9);
+    EXPECT_NEAR(grad[0], 1.2087711, 1.2087711*1e-7);
+    EXPECT_NEAR(grad[5], -0.69228842, 0.69228842*1e-7);
+}
+
 #endif
@@ -0,0 +1,98 @@
+#ifndef CHAINS_TEST
+#define CHAINS_TEST
+
+#include "../include/chains.hpp"
+#include <gtest/gtest.h>
+#include <functional>
+#include <stdexcept>
+#include <cmath>
+#include <valarray>
+#include <vector>
+
+TEST( chains, run_parallel_all_tasks )
+{
+    std::vector<int> count( 50, 0 );
+    hmc::run_parallel( 50, 4, [&count]( const int i ) { count[i]++; } );
+    for( auto c : count )
+        EXPECT_EQ( 1, c );
+
+    EXPECT_THROW( hmc::run_parallel( 5, 2, []( const int i )
+        { if( i == 3 ) throw std::runtime_error( "fail" ); } ),
+        std::runtime_error );
+}
+
+TEST( chains, independent_streams )
+{
+    hmc::ChainRNG a( 1, 0 ), b( 1, 1 ), c( 1, 0 );
+    bool differ = false;
+    for( int i=0; i<100; i++ )
+    {
+        double x = a.normal_rng.gen();
+        differ |= ( x != b.normal_rng.gen() );
+        EXPECT_EQ( x, c.normal_rng.gen() );
+    }
+    EXPECT_TRUE( differ );
+    EXPECT_THROW( hmc::ChainRNG( 1, hmc::ChainRNG::max_chains ), std::out_of_range );
+}
+
+TEST( chains, multi_chain_nuts_normal )
+{
+    double mu = 1.0;
+    double std = 0.8;
+    std::function<hmc::ChainFunctions(const int)> model = [mu, std]( const int )
+    {
+        hmc::ChainFunctions f;
+        f.energy = [mu,std]( const std::valarray<double>&x)
+            { return (x[0]-mu)*(x[0]-mu)/(2*std*std); };
+        f.energy_grad = [mu,std](std::valarray<double>&grad, const std::valarray<double>&x )
+            { grad[0] = (x[0]-mu)/(std*std); };
+        f.reduce = [](const std::valarray<double>&x)
+            { return std::valarray<double>( x ); };
+        return f;
+    };
+
+    size_t N = 20000;
+    int nchains = 6;
+    std::vector<std::valarray<double> > init( nchains, std::valarray<double>( {1.0} ) );
+    auto res = hmc::multi_chain_nuts( init, 0.25, N, model, 3, 42 );
+    auto res_serial = hmc::multi_chain_nuts( init, 0.25, N, model, 1, 42 );
+
+    ASSERT_EQ( nchains, res.size() );
+    double mean = 0;
+    for( int c=0; c<nchains; c++ )
+    {
+        ASSERT_EQ( N, res[c].trace.size() );
+        ASSERT_EQ( N, res[c].energy.size() );
+        for( size_t i=0; i<N; i++ )
+        {
+            mean += res[c].trace[i][0] / ( N*nchains );
+            // Independent of the thread count
+            ASSERT_EQ( res[c].trace[i][0], res_serial[c].trace[i][0] );
+        }
+        EXPECT_EQ( res[c].trace[N-1][0], res[c].final_state[0] );
+    }
+    EXPECT_NEAR( mu, mean, 0.02 );
+
+    // Chains do not repeat each other
+    EXPECT_NE( res[0].trace[N-1][0], res[1].trace[N-1][0] );
+}
+
+TEST( chains, heisenberg_chains )
+{
+    std::vector<std::valarray<double> > E, M;
+    hmc::HamiltonianOptions opt;
+    opt.J = 1.0;
+    opt.H = 0.5;
+    hmc::heisenberg_chains( E, M, {2, 2}, opt, 1.0, 0.25, 20, 3, 3, 7 );
+    ASSERT_EQ( 3, E.size() );
+    ASSERT_EQ( 3, M.size() );
+    for( int c=0; c<3; c++ )
+    {
+        ASSERT_EQ( 20, E[c].size() );
+        ASSERT_EQ( 20, M[c].size() );
+        EXPECT_LE( M[c].max(), 4.0 );
+    }
+    EXPECT_NE( E[0][19], E[1][19] );
+}
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef CHECKPOINT_TEST
+#define CHECKPOINT_TEST
+
+#include "../include/hmc.hpp"
+#include "../include/checkpoint.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+TEST( checkpoint, rng_continues_exactly )
+{
+    hmc::ChainRNG a( 7, 1 );
+    for( int i=0; i<123; i++ )
+    {
+        a.uniform_rng.gen();
+        a.normal_rng.gen();
+    }
+    std::stringstream buffer;
+    a.save( buffer );
+
+    hmc::ChainRNG b( 7, 1 );
+    b.load( buffer );
+    // Past the end of the buffer and into the next fill
+    for( int i=0; i<200000; i++ )
+    {
+        ASSERT_EQ( a.uniform_rng.gen(), b.uniform_rng.gen() );
+        ASSERT_EQ( a.normal_rng.gen(), b.normal_rng.gen() );
+        ASSERT_EQ( a.int_rng.gen(), b.int_rng.gen() );
+    }
+
+    std::stringstream other;
+    a.save( other );
+    hmc::UniformRNG small( 10, 1 );
+    EXPECT_THROW( small.read_state( other ), std::runtime_error );
+}
+
+TEST( checkpoint, nuts_chain_resumes_bit_exact )
+{
+    std::valarray<double> scale = { 1, 2, 3 };
+    long calls = 0, stop_at = -1;
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+        f = [&]( std::valarray<double> &grad, const std::valarray<double> &x )
+        {
+            // Stands in for the job being stopped
+            if( ++calls == stop_at )
+                throw std::runtime_error( "preempted" );
+            grad = x / ( scale*scale );
+            return 0.5 * ( x*grad ).sum();
+        };
+    hmc::ReduceInto reduce = []( std::valarray<double> &out,
+                                 const std::valarray<double> &x )
+    {
+        out = x;
+    };
+
+    hmc::AdaptOptions adapt;
+    adapt.warmup = 150;
+    adapt.metric = hmc::MetricAdaptation::diagonal;
+    const size_t draws = 100;
+
+    // The chain run without stopping
+    hmc::TraceMatrix reference( draws, 3 );
+    std::valarray<double> reference_state( 1.0, 3 );
+    hmc::ChainRNG reference_rng( 2, 0 );
+    hmc::WarmupResult expected = hmc::nuts_chain(
+        reference, reference_state, 0.5, draws, f, reduce, reference_rng,
+        adapt, hmc::CheckpointOptions(), hmc::Metric() );
+    const long total_calls = calls;
+    const double next_uniform = reference_rng.uniform_rng.gen();
+
+    // Stopped during the warmup and during the draws
+    hmc::CheckpointOptions checkpoint;
+    checkpoint.path = "tests/test_files/chain_test.cp";
+    checkpoint.interval = 20;
+    for( double fraction : { 0.3, 0.8 } )
+    {
+        std::remove( checkpoint.path.c_str() );
+        calls = 0;
+        stop_at = fraction * total_calls;
+        {
+            hmc::TraceMatrix sink( draws, 3 );
+            std::valarray<double> state( 1.0, 3 );
+            hmc::ChainRNG rng( 2, 0 );
+            EXPECT_THROW( hmc::nuts_chain( sink, state, 0.5, draws, f, reduce,
+                                           rng, adapt, checkpoint,
+                                           hmc::Metric() ),
+                          std::runtime_error );
+        }
+
+        // A new job set up the same way
+        stop_at = -1;
+        hmc::TraceMatrix sink( draws, 3 );
+        std::valarray<double> state( 1.0, 3 );
+        hmc::ChainRNG rng( 2, 0 );
+        hmc::WarmupResult res = hmc::nuts_chain(
+            sink, state, 0.5, draws, f, reduce, rng, adapt, checkpoint,
+            hmc::Metric() );
+
+        EXPECT_EQ( expected.eps, res.eps );
+        ASSERT_EQ( expected.metric.scale.size(), res.metric.scale.size() );
+        for( size_t i=0; i<3; i++ )
+        {
+            EXPECT_EQ( expected.metric.scale[i], res.metric.scale[i] );
+            EXPECT_EQ( reference_state[i], state[i] );
+        }
+        ASSERT_EQ( draws, sink.size() );
+        for( size_t n=0; n<draws; n++ )
+        {
+            EXPECT_EQ( reference.energy()[n], sink.energy()[n] );
+            EXPECT_EQ( reference( n, 0 ), sink( n, 0 ) );
+        }
+        EXPECT_EQ( next_uniform, rng.uniform_rng.gen() );
+    }
+    std::remove( checkpoint.path.c_str() );
+}
+
+TEST( checkpoint, binary_sink_continues_file )
+{
+    const char *path = "tests/test_files/chain_test.bin";
+    std::stringstream saved;
+    {
+        hmc::BinaryFileSink sink( path, 1 );
+        for( int i=0; i<5; i++ )
+            sink.write( i, std::valarray<double>{ 10.0*i } );
+        sink.save( saved );
+        // Written after the checkpoint and then lost
+        sink.write( -1, std::valarray<double>{ -1 } );
+    }
+    {
+        hmc::BinaryFileSink sink( path, 1 );
+        sink.load( saved );
+        for( int i=5; i<8; i++ )
+            sink.write( i, std::valarray<double>{ 10.0*i } );
+    }
+
+    std::ifstream in( path, std::ios::binary );
+    std::vector<double> data( 16 );
+    in.read( reinterpret_cast<char*>( data.data() ), 16*sizeof( double ) );
+    for( int i=0; i<8; i++ )
+    {
+        EXPECT_EQ( i, data[2*i] );
+        EXPECT_EQ( 10.0*i, data[2*i+1] );
+    }
+    in.close();
+    std::remove( path );
+}
+
+#endif
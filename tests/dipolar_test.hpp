@@ -0,0 +1,160 @@
+#ifndef DIPOLAR_TEST
+#define DIPOLAR_TEST
+
+#include "../include/dipolar.hpp"
+#include "../include/fft.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/lattice.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+namespace
+{
+    // The dipolar field of every spin by the direct sum over pairs
+    std::valarray<double> direct_dipolar_field( const std::vector<double> &r,
+                                                const std::valarray<double> &s )
+    {
+        const int n = r.size() / 3;
+        std::valarray<double> h( 0.0, 3*n );
+        for( int i=0; i<n; i++ )
+            for( int j=0; j<n; j++ )
+            {
+                if( i == j )
+                    continue;
+                double d[3], r2 = 0, sd = 0;
+                for( int a=0; a<3; a++ )
+                {
+                    d[a] = r[3*i + a] - r[3*j + a];
+                    r2 += d[a]*d[a];
+                    sd += s[a*n + j]*d[a];
+                }
+                const double r3 = r2*std::sqrt( r2 );
+                for( int a=0; a<3; a++ )
+                    h[a*n + i] += ( s[a*n + j] - 3*sd*d[a]/r2 ) / r3;
+            }
+        return h;
+    }
+}
+
+TEST( dipolar, fft_matches_dft )
+{
+    hmc::FFTGrid grid( {8, 4, 2} );
+    EXPECT_EQ( 64u, grid.size() );
+    std::vector<std::complex<double> > x( 64 ), y;
+    for( int i=0; i<64; i++ )
+        x[i] = std::complex<double>( std::sin( 1.3*i ), std::cos( 0.7*i*i ) );
+    y = x;
+    grid.forward( &y[0] );
+    for( int k=0; k<64; k++ )
+    {
+        std::complex<double> sum = 0;
+        for( int i=0; i<64; i++ )
+        {
+            // The first axis is fastest
+            const double phase = -2*M_PI*( ( i%8 )*( k%8 ) / 8.0
+                                           + ( i/8%4 )*( k/8%4 ) / 4.0
+                                           + ( i/32 )*( k/32 ) / 2.0 );
+            sum += x[i] * std::polar( 1.0, phase );
+        }
+        EXPECT_NEAR( 0, std::abs( sum - y[k] ), 1e-12 );
+    }
+    grid.inverse( &y[0] );
+    for( int i=0; i<64; i++ )
+        EXPECT_NEAR( 0, std::abs( x[i] - y[i] ), 1e-14 );
+
+    EXPECT_THROW( hmc::FFTGrid( {6} ), std::invalid_argument );
+}
+
+TEST( dipolar, matches_direct_sum )
+{
+    // A stencil lattice and a film of half unit sites
+    std::vector<std::shared_ptr<hmc::HeisenbergSystem> > systems = {
+        std::make_shared<hmc::HeisenbergSystem>( std::vector<int>{ 5, 4, 3 } ),
+        std::make_shared<hmc::HeisenbergSystem>(
+            std::make_shared<const hmc::Lattice>(
+                hmc::bcc_lattice( {3, 2, 2}, {true, true, false} ) ) ) };
+    for( const auto &system : systems )
+    {
+        const int n = system->spins();
+        std::valarray<double> angles( 2*n );
+        for( int i=0; i<2*n; i++ )
+            angles[i] = std::fmod( 0.7*i*i + 0.3, 3.0 );
+        std::valarray<double> spins = hmc::spin_vectors( angles );
+
+        const std::vector<double> r = system->positions();
+        hmc::DipolarField dipoles( r );
+        std::valarray<double> h( 3*n );
+        dipoles.field( &spins[0], &spins[n], &spins[2*n], &h[0], &h[n], &h[2*n] );
+        std::valarray<double> expected = direct_dipolar_field( r, spins );
+        for( int i=0; i<3*n; i++ )
+            EXPECT_NEAR( expected[i], h[i], 1e-12 );
+
+        // The energy counts each pair once
+        std::valarray<double> grad( 0.0, 3*n );
+        EXPECT_NEAR( 0.5*0.3*( spins*expected ).sum(),
+                     system->vector_dipolar_energy_grad( grad, spins, 0.3 ),
+                     1e-12 );
+        for( int i=0; i<3*n; i++ )
+            EXPECT_NEAR( 0.3*expected[i], grad[i], 1e-12 );
+    }
+
+    EXPECT_THROW( hmc::DipolarField( {0, 0, 0, 0.3, 0, 0} ),
+                  std::invalid_argument );
+    EXPECT_THROW( hmc::DipolarField( {0, 0, 0, 0, 0, 0} ),
+                  std::invalid_argument );
+}
+
+TEST( dipolar, angle_gradient_and_shape )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 0;
+    options.H = 0.2;
+    options.D = 0.5;
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem( std::vector<int>{ 4, 3, 2 } ) );
+    const int n = system->spins();
+    auto energy = hmc::gen_total_energy( options, system );
+    auto energy_grad = hmc::gen_total_energy_grad( options, system );
+    auto grad = hmc::gen_total_grad( options, system );
+
+    std::valarray<double> angles( 2*n ), g( 2*n ), g2( 2*n );
+    for( int i=0; i<2*n; i++ )
+        angles[i] = std::fmod( 0.3*i*i + 0.1, 3.0 );
+    const double e = energy_grad( g, angles );
+    EXPECT_NEAR( energy( angles ), e, 1e-12 );
+    grad( g2, angles );
+    for( int i=0; i<2*n; i++ )
+    {
+        EXPECT_NEAR( g[i], g2[i], 1e-12 );
+        std::valarray<double> moved( angles );
+        moved[i] += 1e-6;
+        EXPECT_NEAR( g[i], ( energy( moved ) - e ) / 1e-6, 1e-4 );
+    }
+
+    // A thin film prefers to be magnetised in its plane
+    std::shared_ptr<hmc::HeisenbergSystem> film(
+        new hmc::HeisenbergSystem( std::vector<int>{ 8, 8, 2 } ) );
+    const int m = film->spins();
+    std::valarray<double> in_plane( 0.0, 3*m ), out_of_plane( 0.0, 3*m );
+    in_plane[std::slice( 0, m, 1 )] = 1;
+    out_of_plane[std::slice( 2*m, m, 1 )] = 1;
+    std::valarray<double> work( 3*m );
+    EXPECT_LT( film->vector_dipolar_energy_grad( work, in_plane, 1 ),
+               film->vector_dipolar_energy_grad( work, out_of_plane, 1 ) );
+
+    // The cartesian model takes the term as well
+    options.J = 1;
+    const int N = 10;
+    std::valarray<double> energies( N ), magnetisations( N );
+    hmc::heisenberg_model_cartesian( energies, magnetisations, film, options,
+                                     1.0, 0.1, N, 3 );
+    for( int i=0; i<N; i++ )
+        EXPECT_TRUE( std::isfinite( energies[i] ) );
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef HAMILTONIAN_TEST
+#define HAMILTONIAN_TEST
+
+#include "../include/hamiltonian.hpp"
+#include "../include/leapfrog.hpp"
+
+TEST(Hamiltonian_Composed, Matches_Runtime)
+{
+    struct hmc::HamiltonianOptions options;
+    options.J = 1.3;
+    options.H = 2.1;
+
+    // 1d, 2d and 3d lattices
+    int sizes[3] = {6, 16, 27};
+    for(int d = 1; d <= 3; d++)
+    {
+        int size = 2*sizes[d-1];
+        std::valarray<double> spins(size);
+        for(int i = 0; i < size; i++)
+            spins[i] = std::fmod(0.7*i*i + 0.3, 2*pi);
+
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem(size, d));
+        hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ham(
+            system, hmc::Exchange(options.J), hmc::Zeeman(options.H));
+        auto runtime = hmc::gen_total_energy_grad(options, d, size);
+
+        std::valarray<double> grad(size), grad_runtime(size);
+        double energy = ham(grad, spins);
+        double energy_runtime = runtime(grad_runtime, spins);
+        EXPECT_NEAR(energy, energy_runtime, std::abs(energy_runtime)*1e-12);
+        EXPECT_NEAR(ham.energy(spins), energy_runtime,
+                    std::abs(energy_runtime)*1e-12);
+        for(int i = 0; i < size; i++)
+            EXPECT_NEAR(grad[i], grad_runtime[i], 1e-12);
+    }
+}
+
+TEST(Hamiltonian_Composed, Single_Terms)
+{
+    std::valarray<double> spins = {2.3, 0.1, 1.1, 2.1, 0.3, 1.6, 5.2, 3.4};
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem(8, 2));
+
+    hmc::Hamiltonian<hmc::Zeeman> zeeman(system, hmc::Zeeman(2.1));
+    EXPECT_FLOAT_EQ(zeeman.energy(spins), -0.5827041377);
+
+    hmc::Hamiltonian<hmc::Exchange> exchange(system, hmc::Exchange(1));
+    EXPECT_FLOAT_EQ(exchange.energy(spins), 3.4939748074272869);
+
+    hmc::Hamiltonian<> empty(system);
+    std::valarray<double> grad(1.0, 8);
+    EXPECT_EQ(empty(grad, spins), 0);
+    for(int i = 0; i < 8; i++)
+        EXPECT_EQ(grad[i], 0);
+}
+
+TEST(Hamiltonian_Composed, Leapfrog)
+{
+    std::valarray<double> spins = {2.3, 0.1, 1.1, 2.1, 0.3, 1.6, 5.2, 3.4};
+    std::valarray<double> vels = {0.1, -0.2, 0.3, 0.4, -0.5, 0.6, 0.7, -0.8};
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem(8, 2));
+    hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ham(
+        system, hmc::Exchange(1), hmc::Zeeman(0.5));
+    struct hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    auto runtime = hmc::gen_total_grad(options, 2, 8);
+
+    std::valarray<double> x(8), v(8), work(8), x_rt(8), v_rt(8);
+    leapfrog::lfs(x, v, work, spins, vels, ham, 0.1);
+    leapfrog::lfs(x_rt, v_rt, work, spins, vels, runtime, 0.1);
+    for(int i = 0; i < 8; i++)
+    {
+        EXPECT_NEAR(x[i], x_rt[i], 1e-12);
+        EXPECT_NEAR(v[i], v_rt[i], 1e-12);
+    }
+}
+
+TEST(Hamiltonian_Composed, Cartesian)
+{
+    std::valarray<double> angles = {2.3, 0.1, 1.1, 2.1, 0.3, 1.6, 5.2, 3.4};
+    std::valarray<double> spins = hmc::spin_vectors(angles);
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem(8, 2));
+    hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ham(
+        system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+    hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> cart(
+        system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+
+    // Same energy as the angle form
+    std::valarray<double> grad(12);
+    double energy = cart(grad, spins);
+    EXPECT_NEAR(energy, ham.energy(angles), 1e-12);
+    EXPECT_NEAR(cart.energy(spins), energy, 1e-12);
+
+    // Gradient against central differences
+    for(int i = 0; i < 12; i++)
+    {
+        std::valarray<double> up(spins), down(spins);
+        up[i] += 1e-6;
+        down[i] -= 1e-6;
+        EXPECT_NEAR(grad[i], (cart.energy(up) - cart.energy(down))/2e-6, 1e-6);
+    }
+    EXPECT_NEAR(hmc::vector_magnetisation(spins),
+                hmc::magnetisation(angles), 1e-12);
+}
+
+TEST(Hamiltonian_Composed, Finite_Differences)
+{
+    // Every component of the gradient, in double and single precision, is
+    // the central difference of the energy
+    int sizes[3] = {6, 16, 27};
+    const double h = 1e-5;
+    for(int d = 1; d <= 3; d++)
+    {
+        int n = sizes[d-1];
+        std::valarray<double> angles(2*n);
+        for(int i = 0; i < 2*n; i++)
+            angles[i] = std::fmod(0.7*i*i + 0.3, 2*pi);
+
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem(2*n, d));
+        hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ham(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        hmc::MixedHamiltonian<hmc::Exchange, hmc::Zeeman> mixed(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        std::valarray<double> grad(2*n), grad_mixed(2*n);
+        ham(grad, angles);
+        mixed(grad_mixed, angles);
+        for(int i = 0; i < 2*n; i++)
+        {
+            std::valarray<double> up(angles), down(angles);
+            up[i] += h;
+            down[i] -= h;
+            double slope = (ham.energy(up) - ham.energy(down)) / (2*h);
+            EXPECT_NEAR(grad[i], slope, 1e-7);
+            EXPECT_NEAR(grad_mixed[i], slope, 1e-4);
+        }
+    }
+}
+
+TEST(Hamiltonian_Composed, Mixed_Precision)
+{
+    // 1d, 2d and 3d lattices, as Matches_Runtime
+    int sizes[3] = {6, 16, 27};
+    for(int d = 1; d <= 3; d++)
+    {
+        int n = sizes[d-1];
+        std::valarray<double> angles(2*n);
+        for(int i = 0; i < 2*n; i++)
+            angles[i] = std::fmod(0.7*i*i + 0.3, 2*pi);
+        std::valarray<double> spins = hmc::spin_vectors(angles);
+
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem(2*n, d));
+        hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> ham(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        hmc::MixedHamiltonian<hmc::Exchange, hmc::Zeeman> mixed(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        std::valarray<double> grad(2*n), grad_mixed(2*n);
+        double energy = ham(grad, angles);
+        EXPECT_NEAR(mixed(grad_mixed, angles), energy, n*1e-6);
+        EXPECT_NEAR(mixed.energy(angles), energy, n*1e-6);
+        for(int i = 0; i < 2*n; i++)
+            EXPECT_NEAR(grad_mixed[i], grad[i], 1e-5);
+
+        hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> cart(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        hmc::MixedCartesianHamiltonian<hmc::Exchange, hmc::Zeeman> mixed_cart(
+            system, hmc::Exchange(1.3), hmc::Zeeman(2.1));
+        std::valarray<double> vgrad(3*n), vgrad_mixed(3*n);
+        energy = cart(vgrad, spins);
+        EXPECT_NEAR(mixed_cart(vgrad_mixed, spins), energy, n*1e-6);
+        for(int i = 0; i < 3*n; i++)
+            EXPECT_NEAR(vgrad_mixed[i], vgrad[i], 1e-5);
+    }
+
+    // The sampler is unchanged, so the chain stays close to the double one
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    const int N = 200;
+    std::valarray<double> e(N), m(N), e_mixed(N), m_mixed(N);
+    hmc::heisenberg_model_cartesian(e, m, {4, 4}, options, 1.0, 0.2, N, 7);
+    hmc::ModelResult res = hmc::heisenberg_model_cartesian(
+        e_mixed, m_mixed, {4, 4}, options, 1.0, 0.2, N, 7, 0,
+        hmc::CheckpointOptions(), hmc::Precision::mixed);
+    EXPECT_EQ(N, res.observables.samples);
+    EXPECT_NEAR(e[0], e_mixed[0], 1e-4);
+}
+
+#endif
@@ -2,7 +2,7 @@
 #define HMC_TEST
 
 #include "../include/hmc.hpp"
-#include "../include/mklrand.hpp"
+#include "../include/rng.hpp"
 #include "test_funcs.hpp"
 #include <functional>
 #include <cmath>
@@ -19,7 +19,7 @@ TEST( hmc, acceptance_always )
 {
     // Create rng
     int seed = 1001;
-    mklrand::mkl_drand rng( 1, seed );
+    hmc::UniformRNG rng( 1, seed );
 
     // Always accept when the new energy is lower
     double before = 0.2;
@@ -41,7 +41,7 @@ TEST( hmc, accept_probability )
 {
     // Create rng
     int seed = 1001;
-    mklrand::mkl_drand rng( 1000, seed );
+    hmc::UniformRNG rng( 1000, seed );
 
     // Accept with prob exp(-(after-before))
     double before = 2;
@@ -142,7 +142,7 @@ TEST( hmc, hmc_sampling_normal_distribution )
 
     int N_bins = 100;
     std::vector<int> bins(N_bins, 0);
-    for(int i = 0; i < N; i++)
+    for(size_t i = 0; i < N; i++)
     {
         double g = trace[i][0];
         if (g >= 3 || g < -1) {continue;}
@@ -215,12 +215,26 @@ TEST( hmc, nuts_sampling_normal_distribution )
     double sample_variance = expected_squares - sample_mean*sample_mean;
     double sample_std = std::sqrt( sample_variance );
 
-    EXPECT_NEAR( mu, sample_mean, 0.001 );
-    EXPECT_NEAR( std, sample_std, 0.0015 );
-
+    // The tolerances are four standard errors of the chain, found by batch
+    // means, so they hold for the stream of any backend
+    std::vector<double> x( N ), deviations( N );
+    for( unsigned int i=0; i<N; i++ )
+    {
+        x[i] = trace[i][0];
+        deviations[i] = ( x[i] - sample_mean ) * ( x[i] - sample_mean );
+    }
+    const double mean_error = batch_means_error( x, 100 );
+    const double std_error = batch_means_error( deviations, 100 ) / ( 2*sample_std );
+    EXPECT_NEAR( mu, sample_mean, 4*mean_error );
+    EXPECT_NEAR( std, sample_std, 4*std_error );
+
+    // Every tenth sample is binned, as they are close to independent, and
+    // the chi squared per degree of freedom is held to four of its
+    // standard deviations
     int N_bins = 100;
+    int thin = 10;
     std::vector<int> bins(N_bins, 0);
-    for(int i = 0; i < N; i++)
+    for(size_t i = 0; i < N; i += thin)
     {
         double g = trace[i][0];
         if (g > 3 || g < -1) {continue;}
@@ -233,17 +247,140 @@ TEST( hmc, nuts_sampling_normal_distribution )
         double lower = (i)*4.0/float(N_bins) - 1;
         double higher = (i+1)*4.0/float(N_bins) - 1;
         double temp = erf((higher - sample_mean)/(sample_std*pow(2, 0.5))) - erf((lower - sample_mean)/(sample_std*pow(2, 0.5)));
-        expect[i] = N*0.5*temp;
+        expect[i] = (N/thin)*0.5*temp;
     }
     double chi2_test = chi2(bins, expect);
-    EXPECT_GT(chi2_test, 0.9);
-    EXPECT_LT(chi2_test, 1.3);
+    double chi2_std = std::sqrt(2.0 / (N_bins - 1));
+    EXPECT_GT(chi2_test, 1 - 4*chi2_std);
+    EXPECT_LT(chi2_test, 1 + 4*chi2_std);
+}
+
+TEST( hmc, nuts_fused_energy_grad )
+{
+    double mu = 1.0;
+    double std = 0.8;
+    int grad_calls = 0;
+    int energy_calls = 0;
+
+    std::function<double(const std::valarray<double>&)>
+        energy = [mu,std,&energy_calls]( const std::valarray<double>&x)
+        { energy_calls++; return (x[0]-mu)*(x[0]-mu)/(2*std*std); };
+    std::function<void(std::valarray<double>&,const std::valarray<double>&)>
+        energy_grad = [mu,std,&grad_calls](std::valarray<double>&grad, const std::valarray<double>&x )
+        { grad_calls++; grad[0] = (x[0]-mu)/(std*std); };
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = [](const std::valarray<double>&x)
+        { return std::valarray<double>( x ); };
+
+    size_t N = 1000;
+    std::valarray<double> x_init = {1.0};
+    std::valarray<double> e_sep( N ), e_fused( N );
+    auto trace_sep = hmc::nuts( e_sep, x_init, 0.25, N, energy, energy_grad, reduce );
+
+    // One energy and one gradient per leapfrog step, plus the start
+    EXPECT_EQ( grad_calls, energy_calls );
+
+    std::valarray<double> state( x_init );
+    hmc::ChainRNG rng;
+    auto trace_fused = hmc::nuts( e_fused, state, 0.25, N,
+                                  hmc::fuse_energy_grad( energy, energy_grad ),
+                                  reduce, rng );
+    for( size_t i=0; i<N; i++ )
+    {
+        ASSERT_EQ( trace_sep[i][0], trace_fused[i][0] );
+        ASSERT_EQ( e_sep[i], e_fused[i] );
+    }
+    EXPECT_EQ( trace_fused[N-1][0], state[0] );
+}
+
+TEST( hmc, nuts_max_depth )
+{
+    int calls = 0;
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)>
+        f = [&calls]( std::valarray<double>& grad, const std::valarray<double>& x )
+        { calls++; grad = x; return 0.5*(x*x).sum(); };
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = [](const std::valarray<double>&x)
+        { return std::valarray<double>( x ); };
+
+    // A tiny step never turns, so every tree reaches the limit
+    size_t N = 20;
+    hmc::NutsOptions options;
+    options.max_depth = 3;
+    std::valarray<double> state = {1.0, -0.5};
+    std::valarray<double> energy( N );
+    hmc::ChainRNG rng;
+    hmc::nuts( energy, state, 1e-4, N, f, reduce, rng, hmc::Euclidean(), options );
+    EXPECT_EQ( 1 + N*(1+2+4), calls );
+
+    // Levels are only allocated as the tree reaches them
+    hmc::NutsTree tree( 2 );
+    tree.reserve( 3 );
+    EXPECT_EQ( 4u, tree.candidate.size() );
+    tree.reserve( 1 );
+    EXPECT_EQ( 4u, tree.candidate.size() );
+}
+
+TEST( hmc, nuts_multinomial_normal_distribution )
+{
+    // Two independent normals of different width
+    std::valarray<double> mu = {1.0, -2.0};
+    std::valarray<double> std = {0.8, 2.0};
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)>
+        f = [mu,std]( std::valarray<double>& grad, const std::valarray<double>& x )
+        {
+            grad = (x-mu)/(std*std);
+            return 0.5*((x-mu)*grad).sum();
+        };
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = [](const std::valarray<double>&x)
+        { return std::valarray<double>( x ); };
+
+    size_t N = 200000;
+    hmc::NutsOptions options;
+    options.variant = hmc::NutsVariant::multinomial;
+    std::valarray<double> state = {1.0, -2.0};
+    std::valarray<double> energy( N );
+    hmc::ChainRNG rng( 1001, 0 );
+    auto trace = hmc::nuts( energy, state, 0.3, N, f, reduce, rng,
+                            hmc::Euclidean(), options );
+    ASSERT_EQ( N, trace.size() );
+
+    for( int d=0; d<2; d++ )
+    {
+        double mean = 0, squares = 0;
+        for( size_t i=0; i<N; i++ )
+        {
+            mean += trace[i][d];
+            squares += trace[i][d] * trace[i][d];
+        }
+        mean /= N;
+        squares /= N;
+        EXPECT_NEAR( mu[d], mean, 0.01*std[d] );
+        EXPECT_NEAR( std[d], std::sqrt( squares - mean*mean ), 0.01*std[d] );
+    }
+}
+
+TEST( hmc, heisenberg_model_cartesian )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    int N = 50;
+    std::valarray<double> e( N ), m( N );
+    hmc::heisenberg_model_cartesian( e, m, {4, 4}, options, 2.0, 0.2, N, 3 );
+
+    // Energy is bounded by all spins aligned with the field
+    for( int i=0; i<N; i++ )
+    {
+        EXPECT_GE( e[i], -( 2*16 + 0.5*16 ) - 1e-9 );
+        EXPECT_LE( m[i], 16 + 1e-9 );
+    }
 }
 
 TEST( hmc, magnetisaton )
 {
     std::valarray<double> state = { 0.2, 0.2, 1.1, 1.1 };
-    hmc::set_slices(4, 1);
     EXPECT_DOUBLE_EQ( 2.0, hmc::magnetisation( state ) );
 }
 #endif
@@ -0,0 +1,235 @@
+#ifndef LATTICE_TEST
+#define LATTICE_TEST
+
+#include "../include/lattice.hpp"
+#include "../include/hamiltonian.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+namespace
+{
+    // Unit spins at fixed but scattered directions, every x first
+    std::valarray<double> scattered_spins( const int n )
+    {
+        std::valarray<double> angles( 2*n );
+        for( int i=0; i<2*n; i++ )
+            angles[i] = std::fmod( 0.7*i*i + 0.3, 3.0 );
+        return hmc::spin_vectors( angles );
+    }
+}
+
+TEST( lattice, crystal_neighbours )
+{
+    hmc::Lattice square = hmc::rectangular_lattice( {5, 3} );
+    EXPECT_EQ( 15, square.size() );
+    EXPECT_EQ( 4, square.degree() );
+    EXPECT_EQ( 30, square.bonds() );
+    // Site (1, 1) and its neighbours, sorted
+    const int *row = square.neighbours( 6 );
+    std::vector<int> expected = { 1, 5, 7, 11 };
+    for( int k=0; k<4; k++ )
+        EXPECT_EQ( expected[k], row[k] );
+
+    hmc::Lattice bcc = hmc::bcc_lattice( {3, 3, 3} );
+    EXPECT_EQ( 54, bcc.size() );
+    EXPECT_EQ( 8, bcc.degree() );
+
+    hmc::Lattice fcc = hmc::fcc_lattice( {3, 3, 3} );
+    EXPECT_EQ( 108, fcc.size() );
+    EXPECT_EQ( 12, fcc.degree() );
+    // Neighbours are half a face diagonal away
+    for( int i=0; i<fcc.size(); i++ )
+    {
+        for( int k=0; k<12; k++ )
+        {
+            const double *a = fcc.position( i );
+            const double *b = fcc.position( fcc.neighbours( i )[k] );
+            double r2 = 0;
+            for( int d=0; d<3; d++ )
+            {
+                double delta = std::abs( a[d] - b[d] );
+                delta = std::min( delta, 3 - delta );
+                r2 += delta*delta;
+            }
+            EXPECT_NEAR( 0.5, r2, 1e-12 );
+        }
+    }
+
+    hmc::Lattice triangle = hmc::triangular_lattice( {4, 4} );
+    EXPECT_EQ( 6, triangle.degree() );
+    EXPECT_EQ( 48, triangle.bonds() );
+
+    EXPECT_THROW( hmc::bcc_lattice( {3, 3} ), std::invalid_argument );
+    EXPECT_THROW( hmc::rectangular_lattice( {3, 0} ), std::invalid_argument );
+}
+
+TEST( lattice, thin_film )
+{
+    // Open in z, so the two surfaces have one neighbour fewer
+    hmc::Lattice film = hmc::rectangular_lattice( {4, 4, 3},
+                                                  {true, true, false} );
+    EXPECT_EQ( 0, film.degree() );
+    for( int i=0; i<film.size(); i++ )
+        EXPECT_EQ( ( i/16 == 1 ) ? 6 : 5, film.degree( i ) );
+    EXPECT_EQ( 3*16*2 + 2*16, film.bonds() );
+
+    // All aligned, every bond counts -J
+    std::shared_ptr<hmc::HeisenbergSystem> system( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( film ) ) );
+    hmc::CartesianHamiltonian<hmc::Exchange> exchange( system, hmc::Exchange( 1 ) );
+    std::valarray<double> up( 0.0, 3*48 );
+    up[std::slice( 96, 48, 1 )] = 1;
+    EXPECT_DOUBLE_EQ( -film.bonds(), exchange.energy( up ) );
+
+    // One layer on its own, rather than a padded cube
+    hmc::Lattice layer = hmc::rectangular_lattice( {4, 4, 1},
+                                                   {true, true, false} );
+    EXPECT_EQ( 4, layer.degree() );
+}
+
+TEST( lattice, table_matches_stencil )
+{
+    // Unequal sides go through the stencils as well
+    std::vector<int> sides = { 6, 4, 2 };
+    std::shared_ptr<hmc::HeisenbergSystem> stencil(
+        new hmc::HeisenbergSystem( sides ) );
+    std::shared_ptr<hmc::HeisenbergSystem> table( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( hmc::rectangular_lattice( sides ) ) ) );
+    EXPECT_EQ( 48, stencil->spins() );
+
+    std::valarray<double> spins = scattered_spins( 48 );
+    hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> a(
+        stencil, hmc::Exchange( 1.3 ), hmc::Zeeman( 0.4 ) );
+    hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> b(
+        table, hmc::Exchange( 1.3 ), hmc::Zeeman( 0.4 ) );
+    std::valarray<double> grad_a( spins.size() ), grad_b( spins.size() );
+    EXPECT_NEAR( a( grad_a, spins ), b( grad_b, spins ), 1e-12 );
+    for( size_t i=0; i<spins.size(); i++ )
+        EXPECT_NEAR( grad_a[i], grad_b[i], 1e-12 );
+
+    // The angle form counts each bond once from the previous site
+    std::valarray<double> angles( 96 );
+    for( int i=0; i<96; i++ )
+        angles[i] = std::fmod( 0.3*i*i + 0.1, 3.0 );
+    stencil->calc_trig( angles );
+    table->calc_trig( angles );
+    EXPECT_NEAR( stencil->exchange_energy( 1 ), table->exchange_energy( 1 ),
+                 1e-12 );
+
+    EXPECT_THROW( hmc::HeisenbergSystem( std::vector<int>{ 4, 1 } ),
+                  std::invalid_argument );
+}
+
+TEST( lattice, gradient_and_order )
+{
+    hmc::Lattice bcc = hmc::bcc_lattice( {2, 3, 2}, {true, true, false} );
+    std::shared_ptr<hmc::HeisenbergSystem> system( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( bcc ) ) );
+    hmc::CartesianHamiltonian<hmc::Exchange> exchange( system, hmc::Exchange( 0.8 ) );
+
+    const int n = bcc.size();
+    std::valarray<double> spins = scattered_spins( n );
+    std::valarray<double> grad( 3*n );
+    const double energy = exchange( grad, spins );
+    for( int i=0; i<3*n; i+=7 )
+    {
+        std::valarray<double> moved( spins );
+        moved[i] += 1e-6;
+        EXPECT_NEAR( grad[i], ( exchange.energy( moved ) - energy ) / 1e-6, 1e-4 );
+    }
+
+    // Renumbering the sites and the spins with them leaves the energy
+    std::vector<int> order( n );
+    for( int i=0; i<n; i++ )
+        order[i] = ( 5*i + 3 ) % n;
+    hmc::Lattice shuffled = bcc.permuted( order );
+    for( int i=0; i<n; i++ )
+        EXPECT_EQ( bcc.position( order[i] )[0], shuffled.position( i )[0] );
+    std::shared_ptr<hmc::HeisenbergSystem> other( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( shuffled ) ) );
+    hmc::CartesianHamiltonian<hmc::Exchange> reordered( other, hmc::Exchange( 0.8 ) );
+    std::valarray<double> moved( 3*n );
+    for( int i=0; i<n; i++ )
+        for( int c=0; c<3; c++ )
+            moved[c*n + i] = spins[c*n + order[i]];
+    EXPECT_NEAR( energy, reordered.energy( moved ), 1e-12 );
+
+    order[0] = order[1];
+    EXPECT_THROW( bcc.permuted( order ), std::invalid_argument );
+}
+
+TEST( lattice, space_filling_order )
+{
+    hmc::Lattice cube = hmc::rectangular_lattice( {8, 8, 8} );
+    const int n = cube.size();
+    std::vector<int> hilbert = hmc::hilbert_order( cube );
+    std::vector<int> morton = hmc::morton_order( cube );
+    std::vector<int> sorted( hilbert );
+    std::sort( sorted.begin(), sorted.end() );
+    for( int i=0; i<n; i++ )
+        EXPECT_EQ( i, sorted[i] );
+
+    // Consecutive sites of the Hilbert curve are neighbours
+    hmc::Lattice curve = cube.permuted( hilbert );
+    for( int i=1; i<n; i++ )
+    {
+        const int *row = curve.neighbours( i );
+        EXPECT_NE( row + 6, std::find( row, row+6, i-1 ) );
+    }
+    // The Morton curve fills each 2x2x2 block before the next
+    for( int i=0; i<8; i++ )
+        for( int d=0; d<3; d++ )
+            EXPECT_GT( 2, cube.position( morton[i] )[d] );
+
+    // Renumbering twice still refers to the lattice as built
+    hmc::Lattice twice = curve.permuted( hmc::morton_order( curve ) );
+    for( int i=0; i<n; i++ )
+        EXPECT_EQ( cube.position( twice.built_order()[i] )[2],
+                   twice.position( i )[2] );
+
+    // States are moved in and out of the stored order for each component
+    std::valarray<double> spins = scattered_spins( n );
+    std::valarray<double> stored = twice.from_built( spins );
+    std::valarray<double> back = twice.to_built( stored );
+    for( int i=0; i<3*n; i++ )
+        EXPECT_EQ( spins[i], back[i] );
+    std::shared_ptr<hmc::HeisenbergSystem> natural( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( cube ) ) );
+    std::shared_ptr<hmc::HeisenbergSystem> local( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( twice ) ) );
+    hmc::CartesianHamiltonian<hmc::Exchange> a( natural, hmc::Exchange( 1 ) );
+    hmc::CartesianHamiltonian<hmc::Exchange> b( local, hmc::Exchange( 1 ) );
+    EXPECT_NEAR( a.energy( spins ), b.energy( local->from_built( spins ) ), 1e-10 );
+
+    // A bcc lattice has sites at half units
+    hmc::Lattice bcc = hmc::bcc_lattice( {4, 4, 4} );
+    hmc::Lattice ordered = bcc.permuted( hmc::hilbert_order( bcc ) );
+    EXPECT_EQ( 8, ordered.degree() );
+}
+
+TEST( lattice, model_on_lattice )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    std::shared_ptr<hmc::HeisenbergSystem> system( new hmc::HeisenbergSystem(
+        std::make_shared<const hmc::Lattice>( hmc::triangular_lattice( {4, 3} ) ) ) );
+    const int N = 30;
+    std::valarray<double> e( N ), m( N );
+    hmc::ModelResult res = hmc::heisenberg_model_cartesian(
+        e, m, system, options, 1.0, 0.2, N, 3 );
+    EXPECT_EQ( N, res.observables.samples );
+    // Bounded by every spin aligned with the field
+    for( int i=0; i<N; i++ )
+    {
+        EXPECT_GE( e[i], -( 36 + 0.5*12 ) - 1e-9 );
+        EXPECT_LE( m[i], 12 + 1e-9 );
+    }
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef LEAPFROG_TEST
 #define LEAPFROG_TEST
 #include "../include/leapfrog.hpp"
+#include "../include/hmc.hpp"
 #include "./googletest/googletest/include/gtest/gtest.h"
 #include <cmath>
 #include <valarray>
@@ -73,4 +74,108 @@ TEST( leapfrog, lfs )
     ASSERT_DOUBLE_EQ( 0.15738604333738995, vnew[1] );
 }
 
+TEST( leapfrog, lfs_cached )
+{
+    // Initial state and velocity
+    std::valarray<double> x = {2, 5};
+    std::valarray<double> v = {0.12, 0.27};
+    double eps=0.2;
+
+    // U = 4x ** 2 + x * sin(y), counting the calls
+    int calls = 0;
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)> f =
+        [&calls](std::valarray<double>& out, const std::valarray<double>& in)
+        {
+            calls++;
+            out[0] = 8*in[0] + std::sin( in[1] );
+            out[1] = in[0] * std::cos( in[1] );
+            return 4*in[0]*in[0] + in[0]*std::sin( in[1] );
+        };
+
+    // Gradient at the starting state is supplied by the caller
+    std::valarray<double> xnew( 2 ), vnew( 2 ), work( 2 );
+    f( work, x );
+    calls = 0;
+    double U = leapfrog::lfs_cached( xnew, vnew, work, x, v, f, eps );
+
+    EXPECT_EQ( 1, calls );
+    ASSERT_DOUBLE_EQ( 1.7231784854932628, xnew[0] );
+    ASSERT_DOUBLE_EQ( 5.0426535125814711, xnew[1] );
+    ASSERT_DOUBLE_EQ( -2.668054701866847, vnew[0] );
+    ASSERT_DOUBLE_EQ( 0.15738604333738995, vnew[1] );
+    ASSERT_DOUBLE_EQ( 4*xnew[0]*xnew[0] + xnew[0]*std::sin( xnew[1] ), U );
+
+    // work now holds the gradient at the new state
+    ASSERT_DOUBLE_EQ( 8*xnew[0] + std::sin( xnew[1] ), work[0] );
+    ASSERT_DOUBLE_EQ( xnew[0] * std::cos( xnew[1] ), work[1] );
+}
+
+TEST( leapfrog, rattle_sphere )
+{
+    // Two spins coupled by a field along z and along each other
+    std::valarray<double> angles = {0.4, 2.0, 1.0, 4.0};
+    std::valarray<double> x = hmc::spin_vectors( angles );
+    std::function<double(std::valarray<double>&,const std::valarray<double>&)> f =
+        [](std::valarray<double>& g, const std::valarray<double>& s)
+        {
+            g[0] = -s[1]; g[1] = -s[0];
+            g[2] = -s[3]; g[3] = -s[2];
+            g[4] = -s[5] - 0.5; g[5] = -s[4] - 0.5;
+            return -( s[0]*s[1] + s[2]*s[3] + s[4]*s[5] ) - 0.5*( s[4] + s[5] );
+        };
+
+    // Tangent velocity
+    std::valarray<double> v = {0.3, -0.2, 0.1, 0.5, -0.4, 0.2};
+    for( int i=0; i<2; i++ )
+    {
+        double vs = v[i]*x[i] + v[i+2]*x[i+2] + v[i+4]*x[i+4];
+        for( int c=0; c<3; c++ )
+            v[i+2*c] -= vs*x[i+2*c];
+    }
+
+    std::valarray<double> x1( 6 ), v1( 6 ), work( 6 );
+    f( work, x );
+    double e0 = f( work, x ) + hmc::kinetic_energy( v );
+    std::valarray<double> xs( x ), vs( v );
+    for( int n=0; n<20; n++ )
+    {
+        leapfrog::rattle_sphere( x1, v1, work, xs, vs, f, 0.05 );
+        std::swap( xs, x1 );
+        std::swap( vs, v1 );
+    }
+
+    // Spins stay unit length and velocities tangent
+    for( int i=0; i<2; i++ )
+    {
+        double norm = xs[i]*xs[i] + xs[i+2]*xs[i+2] + xs[i+4]*xs[i+4];
+        double dot = vs[i]*xs[i] + vs[i+2]*xs[i+2] + vs[i+4]*xs[i+4];
+        EXPECT_NEAR( norm, 1, 1e-12 );
+        EXPECT_NEAR( dot, 0, 1e-12 );
+    }
+    double e1 = f( work, xs ) + hmc::kinetic_energy( vs );
+    EXPECT_NEAR( e0, e1, 1e-3 );
+
+    // Reversing the velocity retraces the path
+    vs = -vs;
+    f( work, xs );
+    for( int n=0; n<20; n++ )
+    {
+        leapfrog::rattle_sphere( x1, v1, work, xs, vs, f, 0.05 );
+        std::swap( xs, x1 );
+        std::swap( vs, v1 );
+    }
+    for( int i=0; i<6; i++ )
+    {
+        EXPECT_NEAR( xs[i], x[i], 1e-10 );
+        EXPECT_NEAR( vs[i], -v[i], 1e-10 );
+    }
+
+    // Too large a step fails without moving
+    f( work, x );
+    double e = leapfrog::rattle_sphere( x1, v1, work, x, v, f, 10.0 );
+    EXPECT_TRUE( std::isinf( e ) );
+    for( int i=0; i<6; i++ )
+        EXPECT_EQ( x1[i], x[i] );
+}
+
 #endif
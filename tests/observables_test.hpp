@@ -0,0 +1,242 @@
+#ifndef OBSERVABLES_TEST
+#define OBSERVABLES_TEST
+
+#include "../include/hmc.hpp"
+#include "../include/observables.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <valarray>
+
+TEST( observables, welford )
+{
+    hmc::Welford w;
+    for( double x : { 1.0, 2.0, 3.0, 4.0 } )
+        w.add( x );
+    EXPECT_EQ( 4, w.n );
+    EXPECT_DOUBLE_EQ( 2.5, w.mean );
+    EXPECT_DOUBLE_EQ( 5.0/3, w.variance() );
+
+    // No cancellation far from zero
+    hmc::Welford far;
+    for( double x : { 1.0, 2.0, 3.0, 4.0 } )
+        far.add( 1e9 + x );
+    EXPECT_NEAR( 5.0/3, far.variance(), 1e-6 );
+}
+
+TEST( observables, binning_independent )
+{
+    std::mt19937 gen( 11 );
+    std::normal_distribution<double> normal( 0, 2 );
+    hmc::Binning binning;
+    const long n = 1 << 16;
+    for( long i=0; i<n; i++ )
+        binning.add( normal( gen ) );
+
+    EXPECT_EQ( n, binning.count() );
+    EXPECT_EQ( n/2, binning.blocks( 1 ) );
+    EXPECT_NEAR( 4, binning.variance(), 0.1 );
+    EXPECT_NEAR( 2 / std::sqrt( n ), binning.error( 0 ), 1e-4 );
+
+    // Blocking independent values does not change the error
+    EXPECT_NEAR( binning.error( 0 ), binning.binned_error(),
+                 0.3*binning.error( 0 ) );
+
+    std::stringstream saved;
+    binning.save( saved );
+    hmc::Binning copy;
+    copy.load( saved );
+    EXPECT_EQ( binning.mean(), copy.mean() );
+    EXPECT_EQ( binning.binned_error(), copy.binned_error() );
+}
+
+TEST( observables, binning_correlated )
+{
+    // AR(1) with correlation a has an integrated autocorrelation time of
+    // ( 1 + a ) / ( 1 - a ), here 19
+    const double a = 0.9;
+    std::mt19937 gen( 5 );
+    std::normal_distribution<double> normal( 0, 1 );
+    hmc::Binning binning;
+    double x = 0;
+    for( long i=0; i<( 1 << 17 ); i++ )
+    {
+        x = a*x + normal( gen );
+        binning.add( x );
+    }
+
+    const double ratio = binning.binned_error() / binning.error( 0 );
+    EXPECT_GT( ratio, std::sqrt( 19.0 ) * 0.8 );
+    EXPECT_LT( ratio, std::sqrt( 19.0 ) * 1.2 );
+}
+
+TEST( observables, autocorrelation )
+{
+    // AR(1) has autocorrelation a^k and time ( 1 + a ) / ( 1 - a )
+    const double a = 0.8;
+    std::mt19937 gen( 3 );
+    std::normal_distribution<double> normal( 0, 1 );
+    hmc::Autocorrelation correlated( 64 );
+    double x = 100;
+    for( long i=0; i<( 1 << 16 ); i++ )
+    {
+        x = a*( x - 100 ) + 100 + normal( gen );
+        correlated.add( x );
+    }
+    std::valarray<double> rho = correlated.function();
+    ASSERT_EQ( 64u, rho.size() );
+    EXPECT_DOUBLE_EQ( 1, rho[0] );
+    EXPECT_NEAR( a, rho[1], 0.02 );
+    EXPECT_NEAR( a*a*a, rho[3], 0.03 );
+    EXPECT_TRUE( correlated.resolved() );
+    EXPECT_NEAR( 9, correlated.time(), 1 );
+    EXPECT_NEAR( ( 1 << 16 ) / 9.0, correlated.ess(), ( 1 << 16 ) / 80.0 );
+
+    // Too correlated for the lags kept, so taken from batch means
+    hmc::Autocorrelation short_lags( 4 );
+    x = 0;
+    for( long i=0; i<( 1 << 16 ); i++ )
+    {
+        x = a*x + normal( gen );
+        short_lags.add( x );
+    }
+    EXPECT_FALSE( short_lags.resolved() );
+    EXPECT_NEAR( 9, short_lags.time(), 2 );
+
+    hmc::Autocorrelation independent;
+    for( long i=0; i<10000; i++ )
+        independent.add( normal( gen ) );
+    EXPECT_NEAR( 1, independent.time(), 0.15 );
+
+    std::stringstream saved;
+    correlated.save( saved );
+    hmc::Autocorrelation copy( 64 );
+    copy.load( saved );
+    for( int i=0; i<100; i++ )
+    {
+        correlated.add( i );
+        copy.add( i );
+    }
+    EXPECT_EQ( correlated.time(), copy.time() );
+    std::stringstream again;
+    copy.save( again );
+    hmc::Autocorrelation other( 32 );
+    EXPECT_THROW( other.load( again ), std::runtime_error );
+}
+
+TEST( observables, thermo_accumulator )
+{
+    const double beta = 0.5;
+    const size_t spins = 4;
+    std::valarray<double> e = { -3, -1, -2, -4, 0, -2, -3, -1 };
+    std::valarray<double> m = { 1, 3, 2, 4, 0.5, 2, 3, 1 };
+    const size_t n = e.size();
+
+    hmc::ThermoAccumulator acc( beta, spins );
+    for( size_t i=0; i<n; i++ )
+        acc.write( beta*e[i], std::valarray<double>{ m[i] } );
+    hmc::Observables res = acc.result();
+
+    const double me = e.sum() / n, me2 = ( e*e ).sum() / n;
+    const double mm = m.sum() / n, mm2 = ( m*m ).sum() / n;
+    const double mm4 = ( m*m*m*m ).sum() / n;
+    EXPECT_EQ( long( n ), res.samples );
+    EXPECT_DOUBLE_EQ( me, res.energy );
+    EXPECT_DOUBLE_EQ( me2, res.energy2 );
+    EXPECT_DOUBLE_EQ( mm, res.abs_magnetisation );
+    EXPECT_DOUBLE_EQ( mm2, res.magnetisation2 );
+    EXPECT_DOUBLE_EQ( mm4, res.magnetisation4 );
+    EXPECT_DOUBLE_EQ( beta*beta*( me2 - me*me ) / spins, res.specific_heat );
+    EXPECT_DOUBLE_EQ( beta*( mm2 - mm*mm ) / spins, res.susceptibility );
+    EXPECT_DOUBLE_EQ( 1 - mm4 / ( 3*mm2*mm2 ), res.binder );
+
+    // Each sample is a bin of its own, so the jackknife has six bins
+    hmc::ThermoAccumulator single( 1, 1 );
+    std::valarray<double> x = { 1, 4, 2, 8, 5, 7 };
+    for( double v : x )
+        single.write( 0, std::valarray<double>{ v } );
+    hmc::Observables mean_only = single.result();
+    EXPECT_GT( mean_only.susceptibility_error, 0 );
+    EXPECT_EQ( 0, mean_only.specific_heat );
+
+    // Continues from a checkpoint as if never stopped
+    std::stringstream saved;
+    acc.save( saved );
+    hmc::ThermoAccumulator resumed( beta, spins );
+    resumed.load( saved );
+    for( int k=0; k<200; k++ )
+    {
+        acc.write( beta*e[k%n], std::valarray<double>{ m[k%n] } );
+        resumed.write( beta*e[k%n], std::valarray<double>{ m[k%n] } );
+    }
+    EXPECT_EQ( acc.result().specific_heat, resumed.result().specific_heat );
+    EXPECT_EQ( acc.result().binder_error, resumed.result().binder_error );
+    EXPECT_GT( acc.result().binder_error, 0 );
+}
+
+TEST( observables, tee_sink )
+{
+    hmc::TraceMatrix trace( 3, 1 );
+    hmc::ThermoAccumulator acc( 1, 1 );
+    hmc::TeeSink both( trace, acc );
+    for( int i=0; i<3; i++ )
+        both.write( i, std::valarray<double>{ double( i ) } );
+    EXPECT_EQ( 3, trace.size() );
+    EXPECT_EQ( 3, acc.result().samples );
+    EXPECT_DOUBLE_EQ( 1, acc.result().energy );
+
+    hmc::RingBuffer wide( 2, 2 );
+    EXPECT_THROW( hmc::TeeSink( trace, wide ), std::invalid_argument );
+}
+
+TEST( observables, heisenberg_model )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    const int N = 200;
+    std::valarray<double> e( N ), m( N );
+    hmc::ModelResult res = hmc::heisenberg_model_cartesian(
+        e, m, {4, 4}, options, 2.0, 0.2, N, 3 );
+
+    const hmc::Observables &obs = res.observables;
+    EXPECT_EQ( N, obs.samples );
+    EXPECT_NEAR( e.sum() / N, obs.energy, 1e-9 );
+    EXPECT_NEAR( m.sum() / N, obs.abs_magnetisation, 1e-9 );
+    EXPECT_GT( obs.energy_error, 0 );
+    EXPECT_GT( obs.specific_heat, 0 );
+    EXPECT_GT( obs.energy_time, 0 );
+    EXPECT_NEAR( N / obs.energy_time, obs.energy_ess, 1e-9 );
+    EXPECT_GT( obs.magnetisation_ess, 0 );
+    EXPECT_GT( res.seconds, 0 );
+
+    // The same chain without its trace
+    std::valarray<double> none;
+    hmc::ModelResult averages = hmc::heisenberg_model_cartesian(
+        none, none, {4, 4}, options, 2.0, 0.2, N, 3 );
+    EXPECT_EQ( 0u, none.size() );
+    EXPECT_EQ( obs.energy, averages.observables.energy );
+    EXPECT_EQ( obs.binder, averages.observables.binder );
+}
+
+TEST( observables, heisenberg_model_temperature )
+{
+    // The lattice orders as it is cooled, towards the ground state of all
+    // spins along the field, of energy -40
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    const int N = 200;
+    std::valarray<double> none;
+    hmc::Observables hot = hmc::heisenberg_model_cartesian(
+        none, none, {4, 4}, options, 0.1, 0.2, N, 3 ).observables;
+    hmc::Observables cold = hmc::heisenberg_model_cartesian(
+        none, none, {4, 4}, options, 3.0, 0.2, N, 3 ).observables;
+    EXPECT_GT( hot.energy, -20 );
+    EXPECT_LT( cold.energy, -30 );
+    EXPECT_LT( hot.abs_magnetisation, 10 );
+    EXPECT_GT( cold.abs_magnetisation, 13 );
+}
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef PARALLEL_TEST
+#define PARALLEL_TEST
+
+#include "../include/parallel.hpp"
+#include "../include/hamiltonian.hpp"
+#include "../include/lattice.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+TEST( parallel, pool_sums )
+{
+    hmc::SlabPool one( 1 ), four( 4 );
+    EXPECT_EQ( 4, four.threads() );
+
+    // Every element is visited once, in slabs along block boundaries
+    const size_t n = 5*hmc::SlabPool::block_size + 17;
+    std::vector<int> visits( n, 0 );
+    four.run( n, [&]( const size_t begin, const size_t end )
+    {
+        EXPECT_EQ( 0u, begin % hmc::SlabPool::block_size );
+        for( size_t i=begin; i<end; i++ )
+            visits[i]++;
+    } );
+    for( size_t i=0; i<n; i++ )
+        EXPECT_EQ( 1, visits[i] );
+
+    // Sums are the same on any number of threads
+    std::vector<double> x( n );
+    for( size_t i=0; i<n; i++ )
+        x[i] = std::sin( 0.37*i ) * 1e3;
+    auto partial = [&]( const size_t begin, const size_t end )
+    {
+        double sum = 0;
+        for( size_t i=begin; i<end; i++ )
+            sum += x[i];
+        return sum;
+    };
+    EXPECT_EQ( one.sum( n, partial ), four.sum( n, partial ) );
+    EXPECT_EQ( 0, four.sum( 0, partial ) );
+
+    EXPECT_THROW( four.run( n, []( const size_t begin, const size_t )
+    {
+        if( begin > 0 )
+            throw std::runtime_error( "slab" );
+    } ), std::runtime_error );
+    // The pool is still usable after an exception
+    EXPECT_EQ( one.sum( n, partial ), four.sum( n, partial ) );
+}
+
+TEST( parallel, kernels_match_serial )
+{
+    std::shared_ptr<hmc::SlabPool> pool( new hmc::SlabPool( 3 ) );
+    std::vector<std::shared_ptr<const hmc::Lattice> > tables = {
+        nullptr,
+        std::make_shared<const hmc::Lattice>( hmc::bcc_lattice( {12, 12, 12} ) ) };
+    for( const auto &table : tables )
+    {
+        auto make = [&]()
+        {
+            return std::shared_ptr<hmc::HeisenbergSystem>( table
+                ? new hmc::HeisenbergSystem( table )
+                : new hmc::HeisenbergSystem( std::vector<int>{ 20, 18, 10 } ) );
+        };
+        std::shared_ptr<hmc::HeisenbergSystem> serial = make(), shared = make();
+        shared->set_pool( pool );
+        const int n = serial->spins();
+
+        std::valarray<double> angles( 2*n );
+        for( int i=0; i<2*n; i++ )
+            angles[i] = std::fmod( 0.7*i*i + 0.3, 3.0 );
+        std::valarray<double> spins = hmc::spin_vectors( angles );
+
+        // Each element is found the same way, only the sums are regrouped
+        hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> a(
+            serial, hmc::Exchange( 1.1 ), hmc::Zeeman( 0.3 ) );
+        hmc::CartesianHamiltonian<hmc::Exchange, hmc::Zeeman> b(
+            shared, hmc::Exchange( 1.1 ), hmc::Zeeman( 0.3 ) );
+        std::valarray<double> grad_a( 3*n ), grad_b( 3*n );
+        const double energy = a( grad_a, spins );
+        EXPECT_NEAR( energy, b( grad_b, spins ), 1e-12*n );
+        EXPECT_NEAR( energy, b.energy( spins ), 1e-12*n );
+        for( int i=0; i<3*n; i++ )
+            EXPECT_EQ( grad_a[i], grad_b[i] );
+
+        hmc::Hamiltonian<hmc::Exchange, hmc::Zeeman> c(
+            serial, hmc::Exchange( 1.1 ), hmc::Zeeman( 0.3 ) );
+        hmc::MixedHamiltonian<hmc::Exchange, hmc::Zeeman> d(
+            shared, hmc::Exchange( 1.1 ), hmc::Zeeman( 0.3 ) );
+        std::valarray<double> grad_c( 2*n ), grad_d( 2*n );
+        EXPECT_NEAR( c( grad_c, angles ), d( grad_d, angles ), 1e-5*n );
+        for( int i=0; i<2*n; i++ )
+            EXPECT_NEAR( grad_c[i], grad_d[i], 1e-5 );
+
+        // The angle kernels of the system itself
+        serial->calc_trig( angles );
+        shared->calc_trig( angles );
+        EXPECT_NEAR( serial->exchange_energy( 1 ), shared->exchange_energy( 1 ),
+                     1e-12*n );
+        std::valarray<double> grad_e( 0.0, 2*n ), grad_f( 0.0, 2*n );
+        EXPECT_NEAR( serial->exchange_energy_grad( grad_e, 1 )
+                     + serial->zeeman_energy_grad( grad_e, 0.3 ),
+                     shared->exchange_energy_grad( grad_f, 1 )
+                     + shared->zeeman_energy_grad( grad_f, 0.3 ), 1e-12*n );
+        for( int i=0; i<2*n; i++ )
+            EXPECT_EQ( grad_e[i], grad_f[i] );
+    }
+}
+
+TEST( parallel, chain_independent_of_threads )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.2;
+    const int N = 5;
+    std::valarray<double> e[2], m[2];
+    const int threads[2] = { 1, 4 };
+    for( int k=0; k<2; k++ )
+    {
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem( std::vector<int>{ 16, 16, 16 } ) );
+        system->set_pool( std::make_shared<hmc::SlabPool>( threads[k] ) );
+        e[k].resize( N );
+        m[k].resize( N );
+        hmc::heisenberg_model_cartesian( e[k], m[k], system, options, 1.0,
+                                         0.1, N, 7 );
+    }
+    for( int i=0; i<N; i++ )
+    {
+        EXPECT_EQ( e[0][i], e[1][i] );
+        EXPECT_EQ( m[0][i], m[1][i] );
+    }
+}
+
+TEST( parallel, angle_chain_independent_of_threads )
+{
+    // The warmup adapts a diagonal metric, which then shares the threads
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.2;
+    const int N = 5;
+    std::valarray<double> e[2], m[2];
+    const int threads[2] = { 1, 4 };
+    for( int k=0; k<2; k++ )
+    {
+        std::shared_ptr<hmc::HeisenbergSystem> system(
+            new hmc::HeisenbergSystem( std::vector<int>{ 16, 16, 16 } ) );
+        system->set_pool( std::make_shared<hmc::SlabPool>( threads[k] ) );
+        e[k].resize( N );
+        m[k].resize( N );
+        hmc::ModelResult res = hmc::heisenberg_model(
+            e[k], m[k], system, options, 1.0, 0.05, N, 7, 10 );
+        EXPECT_EQ( system->pool(), res.metric.pool );
+        EXPECT_GT( res.metric.scale.size(), 0u );
+    }
+    for( int i=0; i<N; i++ )
+    {
+        EXPECT_EQ( e[0][i], e[1][i] );
+        EXPECT_EQ( m[0][i], m[1][i] );
+    }
+
+    // A low rank metric gives the same velocities on any number of threads
+    const size_t n = 3*hmc::SlabPool::block_size + 5;
+    hmc::Metric a( std::make_shared<hmc::SlabPool>( 1 ) );
+    hmc::Metric b( std::make_shared<hmc::SlabPool>( 3 ) );
+    std::valarray<double> scale( n ), u( n ), p( n );
+    for( size_t i=0; i<n; i++ )
+    {
+        scale[i] = 1 + 0.5*std::sin( 0.1*i );
+        u[i] = std::cos( 0.3*i );
+        p[i] = std::sin( 0.7*i );
+    }
+    u /= std::sqrt( ( u*u ).sum() );
+    a.scale = b.scale = scale;
+    a.directions = b.directions = { u };
+    a.values = b.values = std::valarray<double>( 4.0, 1 );
+    std::valarray<double> va( n ), vb( n );
+    a.velocity( va, p );
+    b.velocity( vb, p );
+    for( size_t i=0; i<n; i++ )
+        EXPECT_EQ( va[i], vb[i] );
+    EXPECT_EQ( a.kinetic_energy( p ), b.kinetic_energy( p ) );
+}
+
+#endif
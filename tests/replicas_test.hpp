@@ -0,0 +1,150 @@
+#ifndef REPLICAS_TEST
+#define REPLICAS_TEST
+
+#include "../include/replicas.hpp"
+#include "../include/all_hamils.hpp"
+#include "../include/lattice.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+namespace
+{
+    // Replicas with different couplings and fields
+    std::vector<hmc::HamiltonianOptions> replica_options( const int replicas )
+    {
+        std::vector<hmc::HamiltonianOptions> options( replicas );
+        for( int k=0; k<replicas; k++ )
+        {
+            options[k].J = 0.5 + 0.3*k;
+            options[k].H = 0.4 - 0.2*k;
+        }
+        return options;
+    }
+
+    // Fixed but scattered angles, different in each replica
+    std::vector<std::valarray<double> > replica_states( const int replicas,
+                                                        const int n )
+    {
+        std::vector<std::valarray<double> > states(
+            replicas, std::valarray<double>( 2*n ) );
+        for( int k=0; k<replicas; k++ )
+            for( int i=0; i<2*n; i++ )
+                states[k][i] = std::fmod( 0.7*i*i + 0.3 + 0.9*k, 3.0 );
+        return states;
+    }
+}
+
+TEST( replicas, energy_and_gradient )
+{
+    std::vector<std::shared_ptr<hmc::HeisenbergSystem> > systems = {
+        std::make_shared<hmc::HeisenbergSystem>( std::vector<int>{ 4, 3, 2 } ),
+        std::make_shared<hmc::HeisenbergSystem>(
+            std::make_shared<const hmc::Lattice>(
+                hmc::bcc_lattice( {2, 2, 2}, {true, true, false} ) ) ) };
+    const int K = 5;
+    for( const auto &system : systems )
+    {
+        const int n = system->spins();
+        std::vector<hmc::HamiltonianOptions> options = replica_options( K );
+        hmc::ReplicaHamiltonian hamiltonian( system, options );
+        EXPECT_EQ( K, hamiltonian.replicas() );
+
+        std::vector<std::valarray<double> > states = replica_states( K, n );
+        std::valarray<double> state = hamiltonian.pack( states );
+        for( int k=0; k<K; k++ )
+            for( int i=0; i<2*n; i++ )
+                EXPECT_EQ( states[k][i], hamiltonian.unpack( state, k )[i] );
+
+        // Each replica has the energy of the scalar angle Hamiltonian
+        std::valarray<double> grad( state.size() ), energy( K ), moved_energy( K );
+        hamiltonian( grad, state, &energy[0] );
+        for( int k=0; k<K; k++ )
+        {
+            auto scalar = hmc::gen_total_energy( options[k], system );
+            EXPECT_NEAR( scalar( states[k] ), energy[k], 1e-12 );
+        }
+
+        // The gradient is that of the energy
+        std::valarray<double> work( state.size() );
+        for( size_t a=0; a<state.size(); a++ )
+        {
+            std::valarray<double> moved( state );
+            moved[a] += 1e-6;
+            hamiltonian( work, moved, &moved_energy[0] );
+            const int k = a % K;
+            EXPECT_NEAR( grad[a], ( moved_energy[k] - energy[k] ) / 1e-6, 1e-4 );
+        }
+    }
+
+    std::shared_ptr<hmc::HeisenbergSystem> system = systems[0];
+    hmc::ReplicaHamiltonian hamiltonian( system, replica_options( 2 ) );
+    EXPECT_THROW( hamiltonian.pack( replica_states( 3, system->spins() ) ),
+                  std::invalid_argument );
+    std::vector<hmc::HamiltonianOptions> dipolar( 1 );
+    dipolar[0].D = 1;
+    EXPECT_THROW( hmc::ReplicaHamiltonian( system, dipolar ),
+                  std::invalid_argument );
+}
+
+TEST( replicas, lanes_follow_single_chains )
+{
+    std::shared_ptr<hmc::HeisenbergSystem> system(
+        new hmc::HeisenbergSystem( std::vector<int>{ 3, 3, 3 } ) );
+    const int n = system->spins();
+    const int K = 4, N = 20, seed = 11;
+    std::vector<hmc::HamiltonianOptions> options = replica_options( K );
+    std::vector<std::valarray<double> > states = replica_states( K, n );
+    auto reduce = [system]( const std::valarray<double>& state )
+        {
+            std::valarray<double> res = { system->magnetisation( state ) };
+            return res;
+        };
+
+    hmc::ReplicaHamiltonian hamiltonian( system, options );
+    std::vector<hmc::ChainResult> results = hmc::replica_hmc(
+        states, 0.05, 5, N, hamiltonian, reduce, seed );
+    ASSERT_EQ( static_cast<size_t>( K ), results.size() );
+
+    // Replica k runs the chain of ChainRNG( seed, k ) on its own
+    for( int k=0; k<K; k++ )
+    {
+        hmc::ReplicaHamiltonian single( system, { options[k] } );
+        std::function<double(std::valarray<double>&, const std::valarray<double>&)> f =
+            [&single]( std::valarray<double> &grad, const std::valarray<double> &state )
+            {
+                double energy;
+                single( grad, state, &energy );
+                return energy;
+            };
+        hmc::ChainRNG rng( seed, k );
+        std::valarray<double> energy( N ), state( states[k] );
+        auto trace = hmc::hmc( energy, state, 0.05, 5, N, f, reduce, rng );
+        for( int i=0; i<N; i++ )
+        {
+            EXPECT_NEAR( energy[i], results[k].energy[i], 1e-10 );
+            EXPECT_NEAR( trace[i][0], results[k].trace[i][0], 1e-10 );
+        }
+        for( int i=0; i<2*n; i++ )
+            EXPECT_NEAR( state[i], results[k].final_state[i], 1e-10 );
+    }
+
+    // Ordered by a strong coupling, pulled along the field by a weak one
+    std::vector<hmc::HamiltonianOptions> phases( 2 );
+    phases[0].J = 3;
+    phases[1].J = 0.05;
+    phases[1].H = 2;
+    std::vector<std::valarray<double> > e, m;
+    hmc::heisenberg_replicas( e, m, {3, 3, 3}, phases, 1.0, 0.05, 10, 200, 5 );
+    ASSERT_EQ( 2u, e.size() );
+    std::valarray<double> ordered = m[0][std::slice( 100, 100, 1 )];
+    std::valarray<double> pulled = e[1][std::slice( 100, 100, 1 )];
+    EXPECT_GT( ordered.sum() / 100, 0.5*n );
+    EXPECT_LT( pulled.sum() / 100, -n );
+}
+
+#endif
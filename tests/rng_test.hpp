@@ -0,0 +1,206 @@
+#ifndef RNG_TEST
+#define RNG_TEST
+
+#include "../include/rng.hpp"
+#include "../include/philox.hpp"
+#include "../include/stdrand.hpp"
+#include "../include/hmc.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <vector>
+
+TEST( rng, philox_known_answers )
+{
+    // The test vectors of Random123 for Philox4x32-10
+    const uint32_t counters[3][4] = {
+        { 0, 0, 0, 0 },
+        { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff },
+        { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } };
+    const uint32_t keys[3][2] = {
+        { 0, 0 },
+        { 0xffffffff, 0xffffffff },
+        { 0xa4093822, 0x299f31d0 } };
+    const uint32_t expected[3][4] = {
+        { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 },
+        { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd },
+        { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } };
+    for( int t=0; t<3; t++ )
+    {
+        uint32_t out[4];
+        philox::philox4x32( counters[t], keys[t], out );
+        for( int i=0; i<4; i++ )
+            EXPECT_EQ( expected[t][i], out[i] );
+    }
+}
+
+TEST( rng, philox_streams_and_seek )
+{
+    // Any position is reached without drawing the numbers before it,
+    // across buffer boundaries and for every kind of generator
+    philox::philox_drand a( 10, 3, 5 );
+    std::vector<double> drawn( 1000 );
+    for( double &x : drawn )
+        x = a.gen();
+    EXPECT_EQ( 1000u, a.position() );
+    philox::philox_drand b( 7, 3, 5 );
+    for( uint64_t i : { 999, 537, 0, 11, 12 } )
+    {
+        b.seek( i );
+        EXPECT_EQ( drawn[i], b.gen() );
+    }
+
+    philox::philox_nrand n( 0, 1, 6, 3, 5 ), m( 0, 1, 100, 3, 5 );
+    philox::philox_irand k( 5, 3, 5 ), l( 100, 3, 5 );
+    std::vector<double> normals( 300 );
+    std::vector<int> ints( 300 );
+    for( int i=0; i<300; i++ )
+    {
+        normals[i] = n.gen();
+        ints[i] = k.gen();
+    }
+    m.seek( 123 );
+    l.seek( 123 );
+    for( int i=123; i<300; i++ )
+    {
+        EXPECT_EQ( normals[i], m.gen() );
+        EXPECT_EQ( ints[i], l.gen() );
+    }
+
+    // Streams and seeds give different numbers
+    philox::philox_drand other_stream( 10, 3, 6 ), other_seed( 10, 4, 5 );
+    EXPECT_NE( drawn[0], other_stream.gen() );
+    EXPECT_NE( drawn[0], other_seed.gen() );
+    other_seed.change_seed( 3 );
+    EXPECT_EQ( drawn[0], other_seed.gen() );
+}
+
+TEST( rng, philox_distributions )
+{
+    philox::philox_drand u( 1000, 1 );
+    philox::philox_irand k( 1000, 1 );
+    philox::philox_nrand n( 2, 3, 1000, 1 );
+    const int N = 1000000;
+    double u_sum = 0, u2_sum = 0, k_sum = 0, n_sum = 0, n2_sum = 0, n4_sum = 0;
+    for( int i=0; i<N; i++ )
+    {
+        double x = u.gen();
+        ASSERT_GE( x, 0 );
+        ASSERT_LT( x, 1 );
+        u_sum += x;
+        u2_sum += x*x;
+        int b = k.gen();
+        ASSERT_TRUE( b == 0 || b == 1 );
+        k_sum += b;
+        double z = ( n.gen() - 2 ) / 3;
+        n_sum += z;
+        n2_sum += z*z;
+        n4_sum += z*z*z*z;
+    }
+    EXPECT_NEAR( 0.5, u_sum / N, 2e-3 );
+    EXPECT_NEAR( 1.0/3, u2_sum / N, 2e-3 );
+    EXPECT_NEAR( 0.5, k_sum / N, 3e-3 );
+    EXPECT_NEAR( 0, n_sum / N, 5e-3 );
+    EXPECT_NEAR( 1, n2_sum / N, 5e-3 );
+    EXPECT_NEAR( 3, n4_sum / N, 3e-2 );
+}
+
+TEST( rng, backends_save_state )
+{
+    // Each backend continues exactly from a saved state
+    std::stringstream buffer;
+    philox::philox_nrand a( 0, 1, 64, 9, 2 );
+    stdrand::std_normrand b( 0, 1, 64, 9, 2 );
+    stdrand::std_irand c( 64, 9, 2 );
+    for( int i=0; i<101; i++ )
+    {
+        a.gen();
+        b.gen();
+        c.gen();
+    }
+    a.write_state( buffer );
+    b.write_state( buffer );
+    c.write_state( buffer );
+
+    philox::philox_nrand a2( 0, 1, 64, 1 );
+    stdrand::std_normrand b2( 0, 1, 64, 1 );
+    stdrand::std_irand c2( 64, 1 );
+    a2.read_state( buffer );
+    b2.read_state( buffer );
+    c2.read_state( buffer );
+    for( int i=0; i<500; i++ )
+    {
+        ASSERT_EQ( a.gen(), a2.gen() );
+        ASSERT_EQ( b.gen(), b2.gen() );
+        ASSERT_EQ( c.gen(), c2.gen() );
+    }
+
+    // A state of another kind of generator is refused
+    std::stringstream other;
+    a.write_state( other );
+    b.write_state( other );
+    philox::philox_drand d( 64, 1 );
+    EXPECT_THROW( d.read_state( other ), std::runtime_error );
+    stdrand::std_d_unirand e( 64, 1 );
+    EXPECT_THROW( e.read_state( other ), std::runtime_error );
+
+    // The std streams of one seed differ
+    stdrand::std_d_unirand f( 64, 9, 2 ), g( 64, 9, 3 );
+    EXPECT_NE( f.gen(), g.gen() );
+}
+
+namespace
+{
+    // Draws from a by fill in pieces crossing its buffer, and the same
+    // numbers from b by gen
+    template <class RNG, class T>
+    void expect_fill_matches_gen( RNG &a, RNG &b, T )
+    {
+        std::vector<T> filled( 60 );
+        size_t done = 0;
+        for( size_t n : { 3, 20, 7, 1, 0, 29 } )
+        {
+            a.fill( filled.data() + done, n );
+            done += n;
+        }
+        for( size_t i=0; i<filled.size(); i++ )
+            ASSERT_EQ( b.gen(), filled[i] );
+        for( int i=0; i<10; i++ )
+            ASSERT_EQ( b.gen(), a.gen() );
+    }
+}
+
+TEST( rng, fill_matches_gen )
+{
+    hmc::NormalRNG n1( 0, 1, 7, 3, hmc::rng_stream( 1 ) );
+    hmc::NormalRNG n2( 0, 1, 7, 3, hmc::rng_stream( 1 ) );
+    expect_fill_matches_gen( n1, n2, 0.0 );
+    hmc::UniformRNG u1( 8, 3, hmc::rng_stream( 1 ) ), u2( 8, 3, hmc::rng_stream( 1 ) );
+    expect_fill_matches_gen( u1, u2, 0.0 );
+    hmc::IntRNG k1( 7, 3, hmc::rng_stream( 1 ) ), k2( 7, 3, hmc::rng_stream( 1 ) );
+    expect_fill_matches_gen( k1, k2, 0 );
+
+    philox::philox_nrand pn1( 2, 3, 6, 3, 5 ), pn2( 2, 3, 6, 3, 5 );
+    expect_fill_matches_gen( pn1, pn2, 0.0 );
+    philox::philox_irand pk1( 8, 3, 5 ), pk2( 8, 3, 5 );
+    expect_fill_matches_gen( pk1, pk2, 0 );
+    stdrand::std_normrand sn1( 0, 1, 7, 3, 5 ), sn2( 0, 1, 7, 3, 5 );
+    expect_fill_matches_gen( sn1, sn2, 0.0 );
+    stdrand::std_irand sk1( 7, 3, 5 ), sk2( 7, 3, 5 );
+    expect_fill_matches_gen( sk1, sk2, 0 );
+}
+
+TEST( rng, chains_use_backend_streams )
+{
+    // Chains of the same seed draw different numbers
+    hmc::ChainRNG a( 5, 0 ), b( 5, 1 );
+    EXPECT_NE( a.uniform_rng.gen(), b.uniform_rng.gen() );
+    EXPECT_NE( a.normal_rng.gen(), b.normal_rng.gen() );
+    EXPECT_THROW( hmc::ChainRNG( 5, hmc::ChainRNG::max_chains ), std::out_of_range );
+    EXPECT_NE( std::string(), hmc::rng_backend() );
+}
+
+#endif
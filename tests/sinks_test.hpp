@@ -0,0 +1,137 @@
+#ifndef SINKS_TEST
+#define SINKS_TEST
+
+#include "../include/hmc.hpp"
+#include "../include/sinks.hpp"
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+TEST( sinks, options_keep )
+{
+    hmc::SinkOptions options;
+    options.burn_in = 3;
+    options.thin = 2;
+    EXPECT_FALSE( options.keeps( 2 ) );
+    EXPECT_TRUE( options.keeps( 3 ) );
+    EXPECT_FALSE( options.keeps( 4 ) );
+    EXPECT_TRUE( options.keeps( 5 ) );
+    EXPECT_EQ( 0, options.kept( 3 ) );
+    EXPECT_EQ( 1, options.kept( 4 ) );
+    EXPECT_EQ( 4, options.kept( 10 ) );
+
+    options.thin = 0;
+    EXPECT_THROW( hmc::TraceMatrix( 1, 1, options ), std::invalid_argument );
+}
+
+TEST( sinks, trace_matrix )
+{
+    hmc::TraceMatrix trace( 2, 2 );
+    trace.write( 1.0, std::valarray<double>{ 1, 2 } );
+    trace.write( 2.0, std::valarray<double>{ 3, 4 } );
+    EXPECT_EQ( 2, trace.size() );
+    EXPECT_EQ( 3, trace( 1, 0 ) );
+    EXPECT_EQ( 2.0, trace.energy()[1] );
+    std::valarray<double> col = trace.column( 1 );
+    ASSERT_EQ( 2, col.size() );
+    EXPECT_EQ( 2, col[0] );
+    EXPECT_EQ( 4, col[1] );
+    EXPECT_THROW( trace.write( 3.0, std::valarray<double>{ 5, 6 } ),
+                  std::length_error );
+}
+
+TEST( sinks, ring_buffer )
+{
+    hmc::RingBuffer ring( 3, 1 );
+    for( int i=0; i<2; i++ )
+        ring.write( i, std::valarray<double>{ 10.0*i } );
+    EXPECT_EQ( 2, ring.size() );
+    EXPECT_EQ( 0, ring.energy( 0 ) );
+
+    for( int i=2; i<7; i++ )
+        ring.write( i, std::valarray<double>{ 10.0*i } );
+    EXPECT_EQ( 3, ring.size() );
+    EXPECT_EQ( 7, ring.written() );
+    for( int i=0; i<3; i++ )
+    {
+        EXPECT_EQ( 4+i, ring.energy( i ) );
+        EXPECT_EQ( 10.0*( 4+i ), ring( i, 0 ) );
+    }
+}
+
+TEST( sinks, binary_file )
+{
+    const char *path = "tests/test_files/sink_test.bin";
+    {
+        hmc::BinaryFileSink sink( path, 2, hmc::SinkOptions(), 2 );
+        for( int i=0; i<5; i++ )
+            sink.write( i, std::valarray<double>{ 2.0*i, 3.0*i } );
+    }
+
+    std::ifstream in( path, std::ios::binary );
+    std::vector<double> data( 15 );
+    in.read( reinterpret_cast<char*>( data.data() ), 15*sizeof( double ) );
+    EXPECT_EQ( 15*sizeof( double ), size_t( in.gcount() ) );
+    for( int i=0; i<5; i++ )
+    {
+        EXPECT_EQ( i, data[3*i] );
+        EXPECT_EQ( 2.0*i, data[3*i+1] );
+        EXPECT_EQ( 3.0*i, data[3*i+2] );
+    }
+    in.close();
+    std::remove( path );
+
+    EXPECT_THROW( hmc::BinaryFileSink( "no_such_dir/sink.bin", 1 ),
+                  std::runtime_error );
+}
+
+TEST( sinks, nuts_matches_trace )
+{
+    std::function<double(std::valarray<double>&, const std::valarray<double>&)>
+        f = []( std::valarray<double> &grad, const std::valarray<double> &x )
+        {
+            grad = x;
+            return 0.5 * ( x*x ).sum();
+        };
+    std::function<std::valarray<double>(const std::valarray<double>&)>
+        reduce = []( const std::valarray<double> &x ) { return x; };
+    int calls = 0;
+    hmc::ReduceInto reduce_into = [&calls]( std::valarray<double> &out,
+                                            const std::valarray<double> &x )
+    {
+        calls++;
+        out = x;
+    };
+
+    const size_t draws = 50;
+    std::valarray<double> energy( draws );
+    std::valarray<double> state( 0.5, 2 );
+    hmc::ChainRNG rng_a( 3, 0 );
+    auto trace = hmc::nuts( energy, state, 0.3, draws, f, reduce, rng_a );
+
+    // Every fifth draw after the first ten
+    hmc::SinkOptions options;
+    options.burn_in = 10;
+    options.thin = 5;
+    hmc::TraceMatrix sink( options.kept( draws ), 2, options );
+    std::valarray<double> sink_state( 0.5, 2 );
+    hmc::ChainRNG rng_b( 3, 0 );
+    hmc::nuts( sink, sink_state, 0.3, draws, f, reduce_into, rng_b );
+
+    EXPECT_EQ( 8, calls );
+    ASSERT_EQ( 8, sink.size() );
+    for( size_t i=0; i<sink.size(); i++ )
+    {
+        size_t draw = 10 + 5*i;
+        EXPECT_EQ( energy[draw], sink.energy()[i] );
+        EXPECT_EQ( trace[draw][0], sink( i, 0 ) );
+        EXPECT_EQ( trace[draw][1], sink( i, 1 ) );
+    }
+    EXPECT_EQ( state[0], sink_state[0] );
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef SWEEP_TEST
+#define SWEEP_TEST
+
+#include "../include/sweep.hpp"
+#include <gtest/gtest.h>
+#include <valarray>
+#include <vector>
+
+TEST( sweep, first_point_matches_model )
+{
+    hmc::HamiltonianOptions options;
+    options.J = 1;
+    options.H = 0.5;
+    const int N = 40;
+    std::valarray<double> e( N ), m( N );
+    hmc::heisenberg_model_cartesian( e, m, {4, 4}, options, 2.0, 0.2, N, 3 );
+
+    // Both scale the terms by beta, so sample the same chain
+    std::vector<hmc::SweepPoint> points = { {2.0, 0.5}, {1.0, 0.5} };
+    hmc::SweepOptions sweep;
+    sweep.cartesian = true;
+    hmc::SweepResult res = hmc::heisenberg_sweep( {4, 4}, 1, points, 0.2, N,
+                                                  sweep, 3 );
+    ASSERT_EQ( 2u, res.results.size() );
+    ASSERT_EQ( 2u, res.sample_energy.size() );
+    for( int i=0; i<N; i++ )
+    {
+        EXPECT_EQ( e[i], res.sample_energy[0][i] );
+        EXPECT_EQ( m[i], res.sample_magnetisation[0][i] );
+    }
+
+    // The second point carries on from the first, at its own beta
+    EXPECT_EQ( N, res.results[1].observables.samples );
+    EXPECT_EQ( 1.0, res.points[1].beta );
+    for( int i=0; i<N; i++ )
+        EXPECT_GE( res.sample_energy[1][i], -( 2*16 + 0.5*16 ) - 1e-9 );
+
+    // And with angles
+    const int n = 3;
+    std::valarray<double> angle_e( n ), angle_m( n );
+    hmc::heisenberg_model( angle_e, angle_m, {3, 3}, options, 2.0, 0.2, n, 3 );
+    sweep.cartesian = false;
+    hmc::SweepResult angles = hmc::heisenberg_sweep( {3, 3}, 1, { points[0] },
+                                                     0.2, n, sweep, 3 );
+    for( int i=0; i<n; i++ )
+    {
+        EXPECT_EQ( angle_e[i], angles.sample_energy[0][i] );
+        EXPECT_EQ( angle_m[i], angles.sample_magnetisation[0][i] );
+    }
+}
+
+TEST( sweep, hysteresis_walks_back )
+{
+    std::vector<hmc::SweepPoint> points = { {1.0, -1}, {1.0, 0}, {1.0, 1} };
+    hmc::SweepOptions sweep;
+    sweep.hysteresis = true;
+    sweep.burn_in = 10;
+    const int N = 30;
+    sweep.cartesian = true;
+    hmc::SweepResult res = hmc::heisenberg_sweep( {3, 3}, 1, points, 0.2, N,
+                                                  sweep, 5 );
+    ASSERT_EQ( 6u, res.points.size() );
+    ASSERT_EQ( 6u, res.results.size() );
+    for( size_t k=0; k<3; k++ )
+    {
+        EXPECT_EQ( points[k].H, res.points[k].H );
+        EXPECT_EQ( points[k].H, res.points[5-k].H );
+    }
+    for( size_t k=0; k<6; k++ )
+    {
+        EXPECT_EQ( N, res.results[k].observables.samples );
+        EXPECT_EQ( size_t( N ), res.sample_energy[k].size() );
+        EXPECT_DOUBLE_EQ( 0.2, res.results[k].eps );
+    }
+}
+
+TEST( sweep, averages_without_traces )
+{
+    std::vector<hmc::SweepPoint> points = { {0.5, 0.2}, {1.5, 0.2} };
+    hmc::SweepOptions sweep;
+    sweep.cartesian = true;
+    sweep.warmup = 100;
+    hmc::SweepResult kept = hmc::heisenberg_sweep( {4, 4}, 1, points, 0.1,
+                                                   50, sweep, 7 );
+    sweep.traces = false;
+    hmc::SweepResult averages = hmc::heisenberg_sweep( {4, 4}, 1, points, 0.1,
+                                                       50, sweep, 7 );
+    EXPECT_EQ( 0u, averages.sample_energy.size() );
+    ASSERT_EQ( 2u, averages.results.size() );
+    for( size_t k=0; k<2; k++ )
+    {
+        EXPECT_EQ( 100u, averages.results[k].acceptance.size() );
+        EXPECT_EQ( kept.results[k].eps, averages.results[k].eps );
+        EXPECT_EQ( kept.results[k].observables.energy,
+                   averages.results[k].observables.energy );
+    }
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef TEMPERING_TEST
+#define TEMPERING_TEST
+
+#include "../include/tempering.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <valarray>
+#include <vector>
+
+TEST( tempering, adapt_ladder )
+{
+    std::valarray<double> betas = { 0.1, 0.2, 0.3, 0.4, 0.5 };
+    std::valarray<double> acc = { 0.9, 0.5, 0.5, 0.1 };
+    hmc::adapt_ladder( betas, acc, 1.0 );
+
+    // End points fixed and order kept
+    EXPECT_DOUBLE_EQ( 0.1, betas[0] );
+    EXPECT_DOUBLE_EQ( 0.5, betas[4] );
+    for( int i=1; i<5; i++ )
+        EXPECT_GT( betas[i], betas[i-1] );
+
+    // High acceptance widens a gap, low acceptance narrows it
+    EXPECT_GT( betas[1] - betas[0], 0.1 );
+    EXPECT_LT( betas[4] - betas[3], 0.1 );
+
+    // Equal acceptance leaves the ladder alone
+    std::valarray<double> flat = { 0.1, 0.2, 0.3, 0.4, 0.5 };
+    std::valarray<double> same = { 0.4, 0.4, 0.4, 0.4 };
+    hmc::adapt_ladder( flat, same, 1.0 );
+    EXPECT_NEAR( 0.3, flat[2], 1e-15 );
+}
+
+TEST( tempering, heisenberg_tempering )
+{
+    hmc::HamiltonianOptions opt;
+    opt.J = 1.0;
+    opt.H = 1.0;
+    std::vector<double> betas = { 1.0, 2.0, 3.0, 4.0 };
+
+    hmc::TemperingOptions temper;
+    temper.swap_interval = 5;
+    temper.adapt_rounds = 4;
+
+    auto res = hmc::heisenberg_tempering( {2, 2}, opt, betas, 0.2, 20,
+                                          temper, 4, 11 );
+
+    ASSERT_EQ( 4, res.betas.size() );
+    EXPECT_DOUBLE_EQ( 1.0, res.betas[0] );
+    EXPECT_DOUBLE_EQ( 4.0, res.betas[3] );
+    ASSERT_EQ( 4, res.sample_energy.size() );
+    ASSERT_EQ( 3, res.swap_attempts.size() );
+    for( int k=0; k<4; k++ )
+    {
+        ASSERT_EQ( 20, res.sample_energy[k].size() );
+        ASSERT_EQ( 20, res.sample_magnetisation[k].size() );
+        EXPECT_LE( res.sample_magnetisation[k].max(), 4.0 );
+        // Eight bonds and four spins in the field
+        EXPECT_GE( res.sample_energy[k].min(), -12.0 - 1e-9 );
+    }
+    // Three swap rounds alternating between the two even pairs and the
+    // single odd pair
+    EXPECT_EQ( 5, res.swap_attempts.sum() );
+    for( int k=0; k<3; k++ )
+        EXPECT_LE( res.swap_accepts[k], res.swap_attempts[k] );
+
+    EXPECT_THROW( hmc::heisenberg_tempering( {2, 2}, opt, {0.5, 0.5}, 0.2, 10,
+                                             temper, 1, 1 ),
+                  std::invalid_argument );
+    EXPECT_THROW( hmc::heisenberg_tempering( {2, 2}, opt, {0.0, 0.5}, 0.2, 10,
+                                             temper, 1, 1 ),
+                  std::invalid_argument );
+    EXPECT_THROW( hmc::heisenberg_tempering( {2, 2}, opt, { -1.0 }, 0.2, 10,
+                                             temper, 1, 1 ),
+                  std::invalid_argument );
+    hmc::TemperingOptions never = temper;
+    never.swap_interval = 0;
+    EXPECT_THROW( hmc::heisenberg_tempering( {2, 2}, opt, {0.5, 1.0}, 0.2, 10,
+                                             never, 1, 1 ),
+                  std::invalid_argument );
+
+    // A single beta is one chain, with nothing to swap or adapt
+    auto single = hmc::heisenberg_tempering( {2, 2}, opt, { 2.0 }, 0.2, 10,
+                                             temper, 1, 11 );
+    ASSERT_EQ( 1, single.betas.size() );
+    EXPECT_DOUBLE_EQ( 2.0, single.betas[0] );
+    EXPECT_EQ( 0u, single.swap_attempts.size() );
+    EXPECT_EQ( 10, single.sample_energy[0].size() );
+}
+
+#endif
@@ -1,12 +1,28 @@
 const double pi = 3.141592653589793;
 
+#ifdef USEMKL
 #include "mklrand_test.hpp"
+#endif
+#include "rng_test.hpp"
 #include "1d_hamil_tests.hpp"
 #include "2d_hamil_tests.hpp"
 #include "3d_hamil_tests.hpp"
 #include "all_hamils_tests.hpp"
+#include "hamiltonian_test.hpp"
+#include "trig_test.hpp"
 #include "leapfrog_test.hpp"
 #include "hmc_test.hpp"
+#include "adapt_test.hpp"
+#include "sinks_test.hpp"
+#include "checkpoint_test.hpp"
+#include "observables_test.hpp"
+#include "sweep_test.hpp"
+#include "lattice_test.hpp"
+#include "chains_test.hpp"
+#include "tempering_test.hpp"
+#include "parallel_test.hpp"
+#include "dipolar_test.hpp"
+#include "replicas_test.hpp"
 #include "gtest/gtest.h"
 
 // Run all tests
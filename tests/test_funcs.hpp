@@ -12,7 +12,7 @@ double chi2(std::vector<int>& count, std::vector<double>& expect)
 {
     double ans = 0;
     int skip = 0;
-    for(int i=0; i < count.size(); i++)
+    for(size_t i=0; i < count.size(); i++)
     {
         if(count[i] == 0)
         {
@@ -24,6 +24,27 @@ double chi2(std::vector<int>& count, std::vector<double>& expect)
     return ans / (count.size() - 1 - skip);
 }
 
+// The standard error of the mean of the samples x of a chain, from the
+// spread of the means of the given number of consecutive batches, so the
+// autocorrelation of the chain is allowed for
+double batch_means_error(const std::vector<double>& x, size_t batches)
+{
+    const size_t length = x.size() / batches;
+    double mean = 0, squares = 0;
+    for(size_t b = 0; b < batches; b++)
+    {
+        double batch = 0;
+        for(size_t i = b*length; i < (b+1)*length; i++)
+            batch += x[i];
+        batch /= length;
+        mean += batch;
+        squares += batch * batch;
+    }
+    mean /= batches;
+    squares /= batches;
+    return std::sqrt((squares - mean*mean) / (batches - 1));
+}
+
 double beta(int a, int b)
 {
     return tgamma(a)*tgamma(b)/(tgamma(a+b));
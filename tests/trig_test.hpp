@@ -0,0 +1,51 @@
+#ifndef TRIG_TEST
+#define TRIG_TEST
+
+#include "../include/trig.hpp"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+TEST( trig, matches_library )
+{
+    // Every quadrant, both signs, and lengths that leave a vector tail
+    std::vector<double> x;
+    for( int i=-2000; i<2001; i++ )
+        x.push_back( 0.0137*i );
+    x.push_back( 0.0 );
+    x.push_back( -0.0 );
+    x.push_back( M_PI/4 );
+    x.push_back( 3*M_PI/4 );
+    x.push_back( 99999.9 );
+    const size_t n = x.size();
+    std::vector<double> s( n ), c( n );
+    hmc::sincos_array( x.data(), s.data(), c.data(), n );
+    for( size_t i=0; i<n; i++ )
+    {
+        EXPECT_NEAR( std::sin( x[i] ), s[i], 4e-16 ) << x[i];
+        EXPECT_NEAR( std::cos( x[i] ), c[i], 4e-16 ) << x[i];
+    }
+
+    const std::string isa = hmc::sincos_isa();
+    EXPECT_TRUE( isa == "avx512" || isa == "avx2" || isa == "sse2"
+                 || isa == "generic" );
+}
+
+TEST( trig, outside_the_kernel )
+{
+    // Beyond the reduction and non-finite angles go to the library
+    double x[3] = { 3e7, -1e300, std::numeric_limits<double>::quiet_NaN() };
+    double s[3], c[3];
+    hmc::sincos_array( x, s, c, 3 );
+    for( int i=0; i<2; i++ )
+    {
+        EXPECT_EQ( std::sin( x[i] ), s[i] );
+        EXPECT_EQ( std::cos( x[i] ), c[i] );
+    }
+    EXPECT_TRUE( std::isnan( s[2] ) );
+    EXPECT_TRUE( std::isnan( c[2] ) );
+}
+
+#endif